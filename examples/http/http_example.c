@@ -88,6 +88,7 @@ static int http_upload_test()
 
     IOT_HTTP_Disconnect(handle);
     IOT_HTTP_DeInit(&handle);
+    IOT_HTTP_FlushConnections();
     IOT_DumpMemoryStats(IOT_LOG_DEBUG);
     IOT_CloseLog();
     return 0;
@@ -112,6 +112,21 @@ DLL_IOT_API int     IOT_HTTP_DeviceNameAuth(void *handle);
  */
 DLL_IOT_API int     IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param);
 
+/**
+ * @brief   Send several messages to server over one connection.
+ *        With keep_alive, up to IOTX_HTTP_PIPELINE_DEPTH requests are written before their responses are read.
+ *        Client must authentication with server before send message.
+ *
+ * @param [in] handle: Pointer of contex, specify the HTTP client.
+ * @param [in] msg_params: Array of message, each with its own topic path and payload configuration.
+ * @param [in] count: Number of messages in msg_params.
+ *
+ * @retval >= 0 : Number of leading messages in msg_params accepted by server.
+ * @retval -1 : Failed.
+ * @see iotx_err_t.
+ */
+DLL_IOT_API int     IOT_HTTP_SendMessages(void *handle, iotx_http_message_param_t *msg_params, int count);
+
 /**
  * @brief   close tcp connection from client to server.
  *
@@ -121,6 +136,15 @@ DLL_IOT_API int     IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t
  */
 DLL_IOT_API void     IOT_HTTP_Disconnect(void *handle);
 
+/**
+ * @brief   close idle connections kept alive by IOT_HTTP_DeInit().
+ *        Call it when no more request goes to server soon, to release sockets and TLS contexts.
+ *
+ * @return None.
+ * @see None.
+ */
+DLL_IOT_API void     IOT_HTTP_FlushConnections(void);
+
 /** @} */ /* end of api_http */
 /** @} */ /* end of api */
 
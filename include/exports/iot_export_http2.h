@@ -56,6 +56,12 @@ typedef struct http2_header_struct {
     int  valuelen;  /* the length of value */
 } http2_header;
 
+/* body of a request pulled while sending, embed it in the real source and recover that with container_of */
+typedef struct http2_data_source {
+    /* fill buf with at most len bytes, return bytes filled or < 0 on error, set *eof when no more data follows */
+    int (*read)(struct http2_data_source *source, char *buf, int len, int *eof);
+} http2_data_source_t;
+
 typedef struct http2_data_struct {
     http2_header *header;  /* header data. */
     int header_count;      /* the count of header data. */
@@ -81,6 +87,30 @@ http2_connection_t *iotx_http2_client_connect_with_cb(void *pclient, char *url,
 */
 extern int iotx_http2_client_send(http2_connection_t *conn, http2_data *h2_data);
 /**
+* @brief          the http2 client submit a request whose body is read from source as flow control allows,
+*                 the source must stay valid until the stream is closed.
+* @param[in]      handler: http2 client connection handler.
+* @param[in]      h2_data: request headers, stream_id of the new stream is returned in it.
+* @param[in]      source: request body.
+* @param[in]      weight: priority weight of the stream, 1~256, 0 for default.
+* @return         The result. 0 is ok.
+*/
+int iotx_http2_client_send_source(http2_connection_t *conn, http2_data *h2_data, http2_data_source_t *source,
+                                  int weight);
+/**
+* @brief          the http2 client reset a stream, nghttp2 stops reading its data source.
+* @param[in]      handler: http2 client connection handler.
+* @param[in]      stream_id: stream to reset.
+* @return         The result. 0 is ok.
+*/
+int iotx_http2_reset_stream(http2_connection_t *conn, int stream_id);
+/**
+* @brief          the http2 client get max concurrent streams allowed by server.
+* @param[in]      handler: http2 client connection handler.
+* @return         The stream count.
+*/
+int iotx_http2_get_max_concurrent_streams(http2_connection_t *conn);
+/**
 * @brief          the http2 client receive data.
 * @param[in]      handler: http2 client connection handler.
 * @param[in]      data: receive data buffer.
@@ -14,6 +14,15 @@ extern "C" {
 #define IOT_HTTP2_RES_OVERTIME_MS                 (10000)
 #define IOT_HTTP2_KEEP_ALIVE_CNT                  (2)
 #define IOT_HTTP2_KEEP_ALIVE_TIME                 (30*1000) /* in seconds */
+#ifndef IOT_HTTP2_UPLOAD_MAX_CONCURRENT
+    #define IOT_HTTP2_UPLOAD_MAX_CONCURRENT       (4)       /* files uploaded at the same time, also capped by server */
+#endif
+#ifndef IOT_HTTP2_UPLOAD_WEIGHT
+    #define IOT_HTTP2_UPLOAD_WEIGHT               (8)       /* priority weight of upload streams, default of others is 16 */
+#endif
+#ifndef IOT_HTTP2_IO_IDLE_WAIT_MS
+    #define IOT_HTTP2_IO_IDLE_WAIT_MS             (1000)    /* io thread sleeps at most this long when no stream is open */
+#endif
 
 #define MAKE_HEADER(NAME, VALUE)                                             \
     {                                                                        \
@@ -181,6 +181,14 @@ DLL_IOT_API int MAL_MQTT_Subscribe_Sync(void *handle,
 DLL_IOT_API int MAL_MQTT_Unsubscribe(void *handle, const char *topic_filter);
 DLL_IOT_API int MAL_MQTT_Publish(void *handle, const char *topic_name, iotx_mqtt_topic_info_pt topic_msg);
 DLL_IOT_API int MAL_MQTT_Publish_Simple(void *handle, const char *topic_name, int qos, void *data, int len);
+
+/* called with above_high 1 when buffered received data reaches high watermark, e.g. to pause modem, */
+/* and with 0 when it drains to low watermark */
+typedef void (*iotx_mal_recv_watermark_fpt)(void *pcontext, int above_high);
+
+DLL_IOT_API int MAL_MQTT_SetRecvWatermark(void *handle, uint32_t high, uint32_t low,
+                                          iotx_mal_recv_watermark_fpt watermark_cb, void *pcontext);
+DLL_IOT_API int MAL_MQTT_GetRecvDropped(void *handle, uint32_t *dropped_full, uint32_t *dropped_oversize);
 #else /* MAL_ENABLED */
 /** @defgroup group_api api
  *  @{
@@ -25,6 +25,7 @@ typedef enum {
     IOT_OTAE_FETCH_FAILED = -5,
     IOT_OTAE_NOMEM = -6,
     IOT_OTAE_OSC_FAILED = -7,
+    IOT_OTAE_BURN_FAILED = -8,
     IOT_OTAE_NONE = 0,
 
 } IOT_OTA_Err_t;
@@ -85,7 +86,8 @@ typedef enum {
     IOT_OTAG_VERSION,          /* version in string format */
     IOT_OTAG_CHECK_FIRMWARE,    /* Check firmware is valid or not */
     IOT_OTAG_CHECK_CONFIG,      /* Check config file is valid or not */
-    IOT_OTAG_RESET_FETCHED_SIZE /* reset the size_fetched parameter to be 0 */
+    IOT_OTAG_RESET_FETCHED_SIZE, /* reset the size_fetched parameter to be 0 */
+    IOT_OTAG_PERSIST_ON_FETCH   /* write fetched data by HAL_Firmware_Persistence_Write() in IOT_OTA_FetchYield() */
 } IOT_OTA_CmdType_t;
 
 /** @defgroup group_api api
@@ -210,6 +212,9 @@ DLL_IOT_API int IOT_OTA_FetchYield(void *handle, char *buf, uint32_t buf_len, ui
       4) When type is IOT_OTAG_VERSION, 'buf' should be a buffer, and 'buf_len' should be OTA_VERSION_LEN_MAX.
       5) When type is IOT_OTAG_CHECK_FIRMWARE, 'buf' should be pointer of uint32_t, and 'buf_len' should be 4.
          0, firmware is invalid; 1, firmware is valid.
+      6) When type is IOT_OTAG_PERSIST_ON_FETCH, 'buf' should be pointer of uint32_t, and 'buf_len' should be 4.
+         1, IOT_OTA_FetchYield() hashes and saves data in one pass, and returns IOT_OTAE_BURN_FAILED
+         if saving failed; 0, caller saves the returned data itself.
   @endverbatim
  *
  * @retval   0 : Successful.
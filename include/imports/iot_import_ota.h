@@ -17,7 +17,7 @@
  * @param None
  * @return None.
  * @see None.
- * @note None.
+ * @note May be called again during an upgrade, data saved before is dropped and the image restarts from 0.
  */
 DLL_HAL_API void HAL_Firmware_Persistence_Start(void);
 
@@ -34,6 +34,29 @@ DLL_HAL_API void HAL_Firmware_Persistence_Start(void);
 DLL_HAL_API int HAL_Firmware_Persistence_Write(_IN_ char *buffer, _IN_ uint32_t length);
 
 
+/**
+ * @brief make data saved by HAL_Firmware_Persistence_Write() survive a power loss.
+ *
+ * @param None.
+ * @return 0, Sync success; -1, Sync failure, no checkpoint is saved for the data.
+ * @see None.
+ * @note Only required when OTA_FETCH_CHECKPOINT is defined, called before a download checkpoint is saved.
+ */
+DLL_HAL_API int HAL_Firmware_Persistence_Sync(void);
+
+
+/**
+ * @brief continue an interrupted firmware upgrade, following writes are appended after 'offset' bytes.
+ *
+ * @param[in] offset: @n The length, in bytes, of the data already saved and kept.
+ * @return 0, Resume success; -1, Resume failure, caller restarts with HAL_Firmware_Persistence_Start().
+ * @see None.
+ * @note Only required when OTA_FETCH_CHECKPOINT is defined.
+ *       The first 'offset' bytes must be durable, return -1 if fewer bytes than that are in storage.
+ */
+DLL_HAL_API int HAL_Firmware_Persistence_Resume(_IN_ uint32_t offset);
+
+
 /**
  * @brief indicate firmware upgrade data complete, and trigger data integrity checking,
      and then reboot the system.
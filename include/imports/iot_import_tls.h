@@ -42,6 +42,42 @@ DLL_HAL_API uintptr_t HAL_SSL_Establish(
             _IN_ const char *ca_crt,
             _IN_ size_t ca_crt_len);
 
+/* returned by HAL_SSL_Establish_Step() while the connection is in progress */
+#define HAL_SSL_WANT_READ       (1)
+#define HAL_SSL_WANT_WRITE      (2)
+
+/**
+ * @brief Start establishing a SSL connection without blocking in the TCP connect and handshake.
+ *        Drive it with HAL_SSL_Establish_Step() until it returns 0.
+ *
+ * @param [in] host: @n Specify the hostname(IP) of the SSL server
+ * @param [in] port: @n Specify the SSL port of SSL server
+ * @param [in] ca_crt @n Specify the root certificate which is PEM format.
+ * @param [in] ca_crt_len @n Length of root certificate, in bytes.
+ * @return SSL handle, NULL on failure.
+ * @see HAL_SSL_Establish_Step().
+ * @note Resolving the hostname may still block.
+ */
+DLL_HAL_API uintptr_t HAL_SSL_Establish_Async(
+            _IN_ const char *host,
+            _IN_ uint16_t port,
+            _IN_ const char *ca_crt,
+            _IN_ size_t ca_crt_len);
+
+/**
+ * @brief Advance a SSL connection started by HAL_SSL_Establish_Async() as far as it can go without blocking.
+ *
+ * @param [in] handle: @n Handle of the connection.
+ * @param [out] fd: @n Socket of the connection, to wait on for HAL_SSL_WANT_READ/HAL_SSL_WANT_WRITE. May be NULL.
+ *
+ * @retval HAL_SSL_WANT_READ  : Call again when fd is readable.
+ * @retval HAL_SSL_WANT_WRITE : Call again when fd is writable.
+ * @retval                  0 : Established, HAL_SSL_Read()/HAL_SSL_Write() can be used.
+ * @retval                < 0 : Fail, release the handle with HAL_SSL_Destroy().
+ * @note The caller owns the timeout, call HAL_SSL_Destroy() to give up.
+ */
+DLL_HAL_API int HAL_SSL_Establish_Step(_IN_ uintptr_t handle, _OU_ int *fd);
+
 /**
  * @brief Destroy the specific SSL connection.
  *
@@ -117,6 +117,10 @@ void        LITE_replace_substr(char orig[], char key[], char swap[]);
 void        LITE_dump_malloc_free_stats(int level);
 void        LITE_track_malloc_callstack(int state);
 
+#define LITE_MEM_REPORT_TEXT        (0)
+#define LITE_MEM_REPORT_JSON        (1)
+int         LITE_mem_stats_report(char *buf, int buf_len, int format);
+
 char           *LITE_json_value_of(char *key, char *src, ...);
 list_head_t    *LITE_json_keys_of(char *src, char *prefix, ...);
 
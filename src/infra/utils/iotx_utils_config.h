@@ -21,6 +21,16 @@
     #define WITH_MEM_STATS_PER_MODULE       0
 #endif
 
+/* call sites tracked by WITH_MEM_STATS, later ones are counted together */
+#ifndef WITH_MEM_STATS_SITES
+    #define WITH_MEM_STATS_SITES            256
+#endif
+
+/* 1 in N allocations records its call stack, 0 to disable */
+#ifndef WITH_MEM_STATS_SAMPLE
+    #define WITH_MEM_STATS_SAMPLE           64
+#endif
+
 #ifndef WITH_JSON_KEYS_OF
     #define WITH_JSON_KEYS_OF               0
 #endif
@@ -5,127 +5,184 @@
 #include "iotx_utils_internal.h"
 #include "mem_stats.h"
 
-LIST_HEAD(mem_recs);
-
-#if WITH_MEM_STATS_PER_MODULE
-LIST_HEAD(mem_module_statis);
-
-typedef struct {
-    char *func_name;
-    int line;
-    list_head_t func_head;
-} calling_stack_t;
-
-typedef struct {
-    char module_name[32];
-    calling_stack_t calling_stack;
-    int bytes_total_allocated;
-    int bytes_total_freed;
-    int bytes_total_in_use;
-    int bytes_max_allocated;
-    int bytes_max_in_use;
-    int iterations_allocated;
-    int iterations_freed;
-    int iterations_in_use;
-    int iterations_max_in_use;
-} mem_statis_t;
-
-typedef struct {
-    mem_statis_t    mem_statis;
-    list_head_t     list;
-} module_mem_t;
-
 #if WITH_MEM_STATS
-/* sort module used */
-static int _mem_cmp_max_used(list_head_t *a, list_head_t *b)
+/*
+ * Allocations are counted per call site in a fixed open addressing table,
+ * with atomic counters so that LITE_malloc()/LITE_free() never lock and
+ * never walk a list. LITE_free() finds the site in the record prepended to
+ * the buffer.
+ */
+#define MEM_STATS_MAGIC             (0x4D454D53)
+#define MEM_SITE_BUSY               ((const char *)1)
+
+#define MEM_STATS_GET(p)            __atomic_load_n((p), __ATOMIC_RELAXED)
+#define MEM_STATS_ADD(p, v)         __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+
+static void *mutex_mem_stats = NULL;
+static int bytes_total_allocated;
+static int bytes_total_freed;
+static int bytes_total_in_use;
+static int bytes_max_allocated;
+static int bytes_max_in_use;
+static int iterations_allocated;
+static int iterations_freed;
+static int iterations_in_use;
+static int iterations_max_in_use;
+
+/* the last one counts the sites which find the table full */
+static mem_site_t mem_sites[WITH_MEM_STATS_SITES + 1];
+
+static void _mem_stats_max(int *max, int value)
 {
-    if (a == NULL || b == NULL) {
-        return 0;
-    }
+    int cur = MEM_STATS_GET(max);
 
-    module_mem_t *temp_a = list_entry(a, module_mem_t, list);
-    module_mem_t *temp_b = list_entry(b, module_mem_t, list);
-
-    /* return true to swap if a < b */
-    return (temp_a->mem_statis.bytes_max_in_use < temp_b->mem_statis.bytes_max_in_use);
+    while (cur < value &&
+           !__atomic_compare_exchange_n(max, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 }
 
-static void _mem_swap_module_pos(list_head_t *a, list_head_t *b)
+static uint32_t _mem_site_hash(const char *f, int l)
 {
-    list_head_t temp = {NULL, NULL};
-
-    if (a == NULL || a == NULL) {
-        return;
-    }
+    uint32_t h = (uint32_t)(uintptr_t)f ^ ((uint32_t)l * 2654435761u);
 
-    list_add(&temp, b);
-    list_del(b);
-    list_add(b, a);
-    list_del(a);
-    list_add(a, &temp);
-    list_del(&temp);
+    h ^= h >> 15;
+    return h % WITH_MEM_STATS_SITES;
 }
 
-static void _mem_sort_module_pos(list_head_t *head)
+/* find or add the site of f:l, lock free since sites are never removed */
+static mem_site_t *_mem_site_get(const char *f, int l, const char *module)
 {
-    list_head_t *start = NULL;
-    list_head_t *end = NULL;
-
-    if (head == NULL) {
-        return;
+    uint32_t idx = _mem_site_hash(f, l);
+    mem_site_t *site;
+    const char *key;
+    int probe;
+
+    for (probe = 0; probe < WITH_MEM_STATS_SITES; probe++) {
+        site = &mem_sites[idx];
+
+        key = __atomic_load_n(&site->func, __ATOMIC_ACQUIRE);
+        if (key == NULL) {
+            if (__atomic_compare_exchange_n(&site->func, &key, MEM_SITE_BUSY, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+                site->line = l;
+                site->module = module;
+                __atomic_store_n(&site->func, f, __ATOMIC_RELEASE);
+                return site;
+            }
+        }
+        /* another thread is filling this slot in */
+        while (key == MEM_SITE_BUSY) {
+            key = __atomic_load_n(&site->func, __ATOMIC_ACQUIRE);
+        }
+        if (key == f && site->line == l) {
+            return site;
+        }
+        idx = (idx + 1) % WITH_MEM_STATS_SITES;
     }
 
-    for (end = head->prev; end != head; end = end->prev) {  /* list_for_each_prev */
-        list_for_each(start, head) {
-            if (start == end) {
-                break;
-            }
+    return &mem_sites[WITH_MEM_STATS_SITES];
+}
 
-            if (_mem_cmp_max_used(start, start->next)) {
-                _mem_swap_module_pos(start, start->next);
+static const char *_mem_site_name(mem_site_t *site)
+{
+    const char *func;
 
-                start = start->prev;
-                if (start == end) {
-                    end = end->next;
-                }
-            }
-        }
+    if (site == &mem_sites[WITH_MEM_STATS_SITES]) {
+        return (MEM_STATS_GET(&site->iterations_allocated) > 0) ? "(others)" : NULL;
     }
+    func = __atomic_load_n(&site->func, __ATOMIC_ACQUIRE);
+    return (func == MEM_SITE_BUSY) ? NULL : func;
 }
-#endif /* WITH_MEM_STATS */
-#endif /* WITH_MEM_STATS_PER_MODULE */
 
-#if WITH_MEM_STATS
-    static void *mutex_mem_stats = NULL;
-    static int bytes_total_allocated;
-    static int bytes_total_freed;
-    static int bytes_total_in_use;
-    static int bytes_max_allocated;
-    static int bytes_max_in_use;
-    static int iterations_allocated;
-    static int iterations_freed;
-    static int iterations_in_use;
-    static int iterations_max_in_use;
-#endif
+static void _mem_count_malloc(mem_site_t *site, int size)
+{
+    int in_use;
+
+    MEM_STATS_ADD(&iterations_allocated, 1);
+    MEM_STATS_ADD(&bytes_total_allocated, size);
+    in_use = MEM_STATS_ADD(&bytes_total_in_use, size);
+    _mem_stats_max(&bytes_max_in_use, in_use);
+    _mem_stats_max(&bytes_max_allocated, size);
+    in_use = MEM_STATS_ADD(&iterations_in_use, 1);
+    _mem_stats_max(&iterations_max_in_use, in_use);
+
+    MEM_STATS_ADD(&site->iterations_allocated, 1);
+    MEM_STATS_ADD(&site->bytes_total_allocated, size);
+    in_use = MEM_STATS_ADD(&site->bytes_in_use, size);
+    _mem_stats_max(&site->bytes_max_in_use, in_use);
+    _mem_stats_max(&site->bytes_max_allocated, size);
+}
+
+static void _mem_count_free(mem_site_t *site, int size)
+{
+    MEM_STATS_ADD(&iterations_freed, 1);
+    MEM_STATS_ADD(&iterations_in_use, -1);
+    MEM_STATS_ADD(&bytes_total_freed, size);
+    MEM_STATS_ADD(&bytes_total_in_use, -size);
+
+    MEM_STATS_ADD(&site->iterations_freed, 1);
+    MEM_STATS_ADD(&site->bytes_total_freed, size);
+    MEM_STATS_ADD(&site->bytes_in_use, -size);
+}
+#endif  /* WITH_MEM_STATS */
 
 #if defined(__UBUNTU_SDK_DEMO__) && (WITH_MEM_STATS)
 
 static int tracking_malloc_callstack = 1;
+#if WITH_MEM_STATS_SAMPLE > 0
+static uint32_t mem_sample_tick;
+#endif
 
-static int record_backtrace(int *level, char *** trace)
+/* keep the call stack of the first and then 1 in WITH_MEM_STATS_SAMPLE allocations */
+static void _mem_sample_backtrace(mem_site_t *site)
 {
-#define MAX_BT_LEVEL    8
+#if WITH_MEM_STATS_SAMPLE > 0
+    int busy = 0;
 
-    void       *buffer[MAX_BT_LEVEL];
+    if (!tracking_malloc_callstack) {
+        return;
+    }
+    if (site->bt_level > 0 &&
+        MEM_STATS_ADD(&mem_sample_tick, 1) % WITH_MEM_STATS_SAMPLE != 0) {
+        return;
+    }
+    if (!__atomic_compare_exchange_n(&site->bt_busy, &busy, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    site->bt_level = backtrace(site->bt, MEM_STATS_BT_LEVEL);
+    __atomic_store_n(&site->bt_busy, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+static void _mem_print_backtrace(void **bt, int level)
+{
+    char      **symbols;
+    int         k;
+
+    if (level <= 0) {
+        return;
+    }
 
-    *level = backtrace(buffer, MAX_BT_LEVEL);
-    *trace = backtrace_symbols(buffer, *level);
-    if (*trace == NULL) {
+    symbols = backtrace_symbols(bt, level);
+    if (symbols == NULL) {
         utils_err("backtrace_symbols returns NULL!");
-        return -1;
+        return;
     }
 
-    return 0;
+    for (k = 0; k < level; ++k) {
+        int             m;
+        const char     *p = strchr(symbols[k], '(');
+
+        if (p == NULL || p[1] == ')') {
+            continue;
+        }
+        LITE_printf("    ");
+        for (m = 0; m < k; ++m) {
+            LITE_printf("  ");
+        }
+
+        LITE_printf("%s\r\n", p);
+    }
+    UTILS_free(symbols);
 }
 
 void LITE_track_malloc_callstack(int state)
@@ -148,6 +205,7 @@ void *LITE_realloc_internal(const char *f, const int l, void *ptr, int size, ...
     void               *temp = NULL;
     int                 magic = 0;
     char               *module_name = NULL;
+    OS_malloc_record   *rec;
 
     if (size <= 0) {
         return NULL;
@@ -172,7 +230,12 @@ void *LITE_realloc_internal(const char *f, const int l, void *ptr, int size, ...
     }
 
     if (ptr) {
-        memcpy(temp, ptr, size);
+        rec = (OS_malloc_record *)ptr - 1;
+        if (rec->magic == MEM_STATS_MAGIC) {
+            memcpy(temp, ptr, LITE_MINIMUM(size, rec->buflen));
+        } else {
+            memcpy(temp, ptr, size);
+        }
 
         LITE_free(ptr);
 
@@ -185,249 +248,71 @@ void *LITE_realloc_internal(const char *f, const int l, void *ptr, int size, ...
 #endif
 }
 
-#if WITH_MEM_STATS_PER_MODULE
-void *_create_mem_table(char *module_name, struct list_head *list_head)
-{
-    module_mem_t *pos = NULL;
-    int len = 0;
-
-    if (!module_name || !list_head) {
-        return NULL;
-    }
-
-    pos = UTILS_malloc(sizeof(module_mem_t));
-    if (!pos) {
-        return NULL;
-    }
-    memset(pos, 0, sizeof(module_mem_t));
-    len = strlen(module_name);
-    memcpy(pos->mem_statis.module_name, module_name,
-           (len >= sizeof(pos->mem_statis.module_name)) ? (sizeof(pos->mem_statis.module_name) - 1) : len);
-
-    INIT_LIST_HEAD(&pos->mem_statis.calling_stack.func_head);
-
-    list_add_tail(&pos->list, list_head);
-    return (void *)pos;
-}
-
-void *_find_mem_table(char *module_name, struct list_head *list_head)
+void *LITE_malloc_internal(const char *f, const int l, int size, ...)
 {
+    void                   *ptr = NULL;
+#if WITH_MEM_STATS
+    OS_malloc_record       *rec;
+    mem_site_t             *site;
+    char                   *module_name = NULL;
 
-    module_mem_t *pos = NULL, *tmp = NULL;
-
-    if (!module_name || !list_head) {
+    if (size <= 0) {
         return NULL;
     }
 
-    list_for_each_entry_safe(pos, tmp, list_head, list, module_mem_t) {
-        if (!strcmp(module_name, pos->mem_statis.module_name)) {
-            return (void *)pos;
-        }
-    }
-
-    return NULL;
-}
-
-int _del_mem_table(char *module_name, struct list_head *list_head)
-{
-    int ret = -1;
-
-    calling_stack_t *calling_stack_pos = NULL, *tmp = NULL;
-    module_mem_t *table_pos = (module_mem_t *)_find_mem_table(module_name, list_head);
-    if (table_pos) {
-        list_for_each_entry_safe(calling_stack_pos, tmp, \
-                                 &table_pos->mem_statis.calling_stack.func_head, func_head, calling_stack_t) {
-            if (calling_stack_pos) {
-                list_del(&calling_stack_pos->func_head);
-                if (calling_stack_pos->func_name) {
-                    UTILS_free(calling_stack_pos->func_name);
-                    calling_stack_pos->func_name = NULL;
-                }
-                UTILS_free(calling_stack_pos);
-                calling_stack_pos = NULL;
-            }
-        }
-
-        list_del(&table_pos->list);
-        UTILS_free(table_pos);
-        table_pos = NULL;
-        ret = 0;
-    }
-    return ret;
-}
-
-int _count_malloc_internal(const char *f, const int l, OS_malloc_record *os_malloc_pos, va_list ap)
-{
-    int ret = -1;
-
-    int magic = 0;
-    char is_repeat = 0;
-    char *module_name = NULL;
-    module_mem_t *pos = NULL;
-    calling_stack_t    *call_pos, *call_tmp;
-    calling_stack_t    *entry = NULL;
+#if WITH_MEM_STATS_PER_MODULE
+    int                     magic;
+    va_list                 ap;
 
+    va_start(ap, size);
     magic = va_arg(ap, int);
     if (MEM_MAGIC == magic) {
         module_name = va_arg(ap, char *);
-    } else {
-        module_name = "unknown";
-    }
-
-    pos = (module_mem_t *)_find_mem_table(module_name, &mem_module_statis);
-    if (!pos) {
-        if (NULL == (pos = (module_mem_t *)_create_mem_table(module_name, &mem_module_statis))) {
-            utils_err("create_mem_table:[%s] failed!", module_name);
-            return ret;
-        }
-    }
-    os_malloc_pos->mem_table = (void *)pos;
-
-    if (!strcmp(pos->mem_statis.module_name, "unknown")) {
-        list_for_each_entry_safe(call_pos, call_tmp, &pos->mem_statis.calling_stack.func_head, func_head, calling_stack_t) {
-            if (!strcmp(call_pos->func_name, f) && (call_pos->line == l)) {
-                is_repeat = 1;
-                break;
-            }
-        }
-        if (!is_repeat) {
-            entry = UTILS_malloc(sizeof(calling_stack_t));
-            if (!entry) {
-                return ret;
-            }
-
-            memset(entry, 0, sizeof(calling_stack_t));
-            entry->func_name = UTILS_malloc(strlen(f) + 1);
-            memset(entry->func_name, 0, strlen(f) + 1);
-            strncpy(entry->func_name, f, strlen(f));
-            entry->line = l;
-            list_add(&entry->func_head, &pos->mem_statis.calling_stack.func_head);
-        }
     }
-
-    pos->mem_statis.iterations_allocated += 1;
-    pos->mem_statis.bytes_total_allocated += os_malloc_pos->buflen;
-    pos->mem_statis.bytes_total_in_use += os_malloc_pos->buflen;
-    pos->mem_statis.bytes_max_in_use = (pos->mem_statis.bytes_max_in_use > pos->mem_statis.bytes_total_in_use) ?
-                                       pos->mem_statis.bytes_max_in_use : pos->mem_statis.bytes_total_in_use;
-    pos->mem_statis.bytes_max_allocated = (pos->mem_statis.bytes_max_allocated >= os_malloc_pos->buflen) ?
-                                          pos->mem_statis.bytes_max_allocated : os_malloc_pos->buflen;
-
-    pos->mem_statis.iterations_in_use += 1;
-    pos->mem_statis.iterations_max_in_use = (pos->mem_statis.iterations_in_use > pos->mem_statis.iterations_max_in_use) ?
-                                            pos->mem_statis.iterations_in_use : pos->mem_statis.iterations_max_in_use;
-    ret = 0;
-
-    return ret;
-}
-
-void _count_free_internal(void *ptr, OS_malloc_record *os_malloc_pos)
-{
-
-    module_mem_t *pos = NULL;
-
-    pos = (module_mem_t *)(os_malloc_pos->mem_table);
-    if (!pos) {
-        utils_err("find mem_table faild");
-        return;
+    va_end(ap);
+    if (module_name == NULL) {
+        module_name = "unknown";
     }
-
-    pos->mem_statis.iterations_freed += 1;
-    pos->mem_statis.iterations_in_use -= 1;
-
-    pos->mem_statis.bytes_total_freed += os_malloc_pos->buflen;
-    pos->mem_statis.bytes_total_in_use -= os_malloc_pos->buflen;
-}
-
 #endif
 
-void *LITE_malloc_internal(const char *f, const int l, int size, ...)
-{
-    void                   *ptr = NULL;
-#if WITH_MEM_STATS
-    OS_malloc_record       *pos;
-
-    if (size <= 0) {
+    rec = UTILS_malloc(sizeof(OS_malloc_record) + size);
+    if (NULL == rec) {
         return NULL;
     }
+    ptr = rec + 1;
 
-    ptr = UTILS_malloc(size);
-    if (!ptr) {
-        return NULL;
-    }
-
-    HAL_MutexLock(mutex_mem_stats);
+    site = _mem_site_get((f == NULL) ? "" : f, (int)l, module_name);
+    rec->magic = MEM_STATS_MAGIC;
+    rec->site = (uint32_t)(site - mem_sites);
+    rec->buflen = size;
+    rec->reserved = 0;
 
-    iterations_allocated += 1;
-    bytes_total_allocated += size;
-    bytes_total_in_use += size;
-    bytes_max_in_use = (bytes_max_in_use > bytes_total_in_use) ? bytes_max_in_use : bytes_total_in_use;
-    bytes_max_allocated = (bytes_max_allocated >= size) ? bytes_max_allocated : size;
+    _mem_count_malloc(site, size);
+#if defined(__UBUNTU_SDK_DEMO__)
+    _mem_sample_backtrace(site);
+#endif
 
 #if defined(WITH_TOTAL_COST_WARNING)
-    if (bytes_total_in_use > WITH_TOTAL_COST_WARNING) {
+    if (MEM_STATS_GET(&bytes_total_in_use) > WITH_TOTAL_COST_WARNING) {
         utils_debug(" ");
-        utils_debug("==== PRETTY HIGH TOTAL IN USE: %d BYTES ====", bytes_total_in_use);
+        utils_debug("==== PRETTY HIGH TOTAL IN USE: %d BYTES ====", MEM_STATS_GET(&bytes_total_in_use));
         LITE_dump_malloc_free_stats(LOG_DEBUG_LEVEL);
     }
 #endif
 
-    iterations_in_use += 1;
-    iterations_max_in_use = (iterations_in_use > iterations_max_in_use) ? iterations_in_use : iterations_max_in_use;
-
-    pos = UTILS_malloc(sizeof(OS_malloc_record));
-    if (NULL == pos) {
-        UTILS_free(ptr);
-        HAL_MutexUnlock(mutex_mem_stats);
-        return NULL;
-    }
-    memset(pos, 0, sizeof(OS_malloc_record));
-
-    pos->buf = ptr;
-    pos->buflen = size;
-    pos->func = (char *)f;
-    pos->line = (int)l;
-#if defined(__UBUNTU_SDK_DEMO__)
-    if (tracking_malloc_callstack) {
-        record_backtrace(&pos->bt_level, &pos->bt_symbols);
-    }
-#endif
-
-    list_add_tail(&pos->list, &mem_recs);
-
-#if WITH_MEM_STATS_PER_MODULE
-    va_list                 ap;
-    va_start(ap, size);
-    _count_malloc_internal(f, l, pos, ap);
-    va_end(ap);
-#endif
-
 #if defined(WITH_ALLOC_WARNING_THRESHOLD)
     if (size > WITH_ALLOC_WARNING_THRESHOLD) {
-        int             k;
-
         log_warning("utils", "large allocating @ %s(%d) for %04d bytes!", f, l, size);
         LITE_printf("\r\n");
 #if defined(__UBUNTU_SDK_DEMO__)
-        for (k = 0; k < pos->bt_level; ++k) {
-            int             m;
-            const char     *p = strchr(pos->bt_symbols[k], '(');
-
-            if (p[1] == ')') {
-                continue;
-            }
-            for (m = 0; m < k; ++m) {
-                LITE_printf("  ");
-            }
+        void           *bt[MEM_STATS_BT_LEVEL];
 
-            LITE_printf("%s\r\n", p);
-        }
+        _mem_print_backtrace(bt, backtrace(bt, MEM_STATS_BT_LEVEL));
 #endif
         LITE_printf("\r\n");
     }
 #endif
     memset(ptr, 0, size);
-    HAL_MutexUnlock(mutex_mem_stats);
     return ptr;
 #else
     ptr = UTILS_malloc(size);
@@ -442,63 +327,29 @@ void *LITE_malloc_internal(const char *f, const int l, int size, ...)
 void LITE_free_internal(void *ptr)
 {
 #if WITH_MEM_STATS
-    OS_malloc_record       *pos;
-    OS_malloc_record       *next;
-    int                     found = 0;
+    OS_malloc_record       *rec;
 
     if (!ptr) {
         return;
     }
 
-    HAL_MutexLock(mutex_mem_stats);
-
-    pos = NULL;
-    list_for_each_entry_safe(pos, next, &mem_recs, list, OS_malloc_record) {
-        if (pos->buf == ptr) {
-            found = 1;
-            break;
-        }
-    }
-
-    if (!found) {
-        pos = NULL;
-    }
-
-    if (NULL == pos) {
+    rec = (OS_malloc_record *)ptr - 1;
+    if (rec->magic != MEM_STATS_MAGIC || rec->site > WITH_MEM_STATS_SITES) {
         log_warning("utils", "Cannot find %p allocated! Skip stat ...", ptr);
-
-        HAL_MutexUnlock(mutex_mem_stats);
+        UTILS_free(ptr);
         return;
-    } else {
-        iterations_freed += 1;
-        iterations_in_use -= 1;
-
-        bytes_total_freed += pos->buflen;
-        bytes_total_in_use -= pos->buflen;
-
-#if WITH_MEM_STATS_PER_MODULE
-        _count_free_internal(ptr, pos);
-#endif
+    }
 
-        if (pos->buf && pos->buflen > 0) {
-            memset(pos->buf, 0xEE, pos->buflen);
-        }
-        pos->buf = 0;
-        pos->buflen = 0;
-        pos->func = "";
-        pos->line = 0;
-#if defined(__UBUNTU_SDK_DEMO__)
-        pos->bt_level = 0;
-        UTILS_free(pos->bt_symbols);
-        pos->bt_symbols = 0;
-#endif
+    _mem_count_free(&mem_sites[rec->site], rec->buflen);
 
-        list_del(&pos->list);
-        UTILS_free(pos);
+    if (rec->buflen > 0) {
+        memset(ptr, 0xEE, rec->buflen);
     }
-    HAL_MutexUnlock(mutex_mem_stats);
-#endif
+    rec->magic = 0;
+    UTILS_free(rec);
+#else
     UTILS_free(ptr);
+#endif
 }
 
 void *LITE_malloc_routine(int size, ...)
@@ -544,145 +395,125 @@ void LITE_free_routine(void *ptr)
     LITE_free(ptr);
 }
 
-void LITE_dump_malloc_free_stats(int level)
+#if WITH_MEM_STATS_PER_MODULE && WITH_MEM_STATS
+/* modules are summed up from their sites, max_in_use is the sum of site peaks */
+static void _mem_dump_modules(void)
 {
-#if WITH_MEM_STATS
-    OS_malloc_record       *pos;
-
-    if (level > LITE_get_loglevel()) {
-        return;
-    }
-
-    utils_debug("");
-    utils_debug("---------------------------------------------------");
-    utils_debug(". bytes_total_allocated:    %d", bytes_total_allocated);
-    utils_debug(". bytes_total_freed:        %d", bytes_total_freed);
-    utils_debug(". bytes_total_in_use:       %d", bytes_total_in_use);
-    utils_warning(". bytes_max_allocated:      %d", bytes_max_allocated);
-    utils_info(". bytes_max_in_use:         %d", bytes_max_in_use);
-    utils_debug(". iterations_allocated:     %d", iterations_allocated);
-    utils_debug(". iterations_freed:         %d", iterations_freed);
-    utils_debug(". iterations_in_use:        %d", iterations_in_use);
-    utils_debug(". iterations_max_in_use:    %d", iterations_max_in_use);
-    utils_debug("---------------------------------------------------");
-    utils_debug("");
-
-#if WITH_MEM_STATS_PER_MODULE
-    _mem_sort_module_pos(&mem_module_statis);
-
-    module_mem_t *module_pos, *tmp;
-    module_mem_t *unknown_mod = NULL;
+    unsigned char       done[WITH_MEM_STATS_SITES + 1] = {0};
+    int                 i, j;
+    int                 unknown = 0;
 
     LITE_printf("\r\n");
     LITE_printf("|               |  max_in_use          |  max_allocated   |  total_allocated      |  total_free\r\n");
     LITE_printf("|---------------|----------------------|------------------|-----------------------|----------------------\r\n");
-    list_for_each_entry_safe(module_pos, tmp, &mem_module_statis, list, module_mem_t) {
-        if (module_pos) {
-
-            LITE_printf("| %-13s | %6d bytes / %-5d |    %6d bytes  | %6d bytes / %-5d  | %6d bytes / %-5d     \r\n",
-                        module_pos->mem_statis.module_name,
-                        module_pos->mem_statis.bytes_max_in_use,
-                        module_pos->mem_statis.iterations_max_in_use,
-                        module_pos->mem_statis.bytes_max_allocated,
-                        module_pos->mem_statis.bytes_total_allocated,
-                        module_pos->mem_statis.iterations_allocated,
-                        module_pos->mem_statis.bytes_total_freed,
-                        module_pos->mem_statis.iterations_freed
-                       );
-            /*
-                        LITE_printf("\x1B[1;32mMODULE_NAME: [%s]\x1B[0m\r\n", module_pos->mem_statis.module_name);
-                        LITE_printf("---------------------------------------------------\r\n");
-                        LITE_printf(". bytes_total_allocated:    %d\r\n", module_pos->mem_statis.bytes_total_allocated);
-                        LITE_printf(". bytes_total_freed:        %d\r\n", module_pos->mem_statis.bytes_total_freed);
-                        LITE_printf(". bytes_total_in_use:       %d\r\n", module_pos->mem_statis.bytes_total_in_use);
-                        LITE_printf(". bytes_max_allocated:      %d\r\n", module_pos->mem_statis.bytes_max_allocated);
-                        LITE_printf(". bytes_max_in_use:         %d\r\n", module_pos->mem_statis.bytes_max_in_use);
-                        LITE_printf(". iterations_allocated:     %d\r\n", module_pos->mem_statis.iterations_allocated);
-                        LITE_printf(". iterations_freed:         %d\r\n", module_pos->mem_statis.iterations_freed);
-                        LITE_printf(". iterations_in_use:        %d\r\n", module_pos->mem_statis.iterations_in_use);
-                        LITE_printf(". iterations_max_in_use:    %d\r\n", module_pos->mem_statis.iterations_max_in_use);
-                        LITE_printf("---------------------------------------------------\r\n");
-            */
-            if (!strcmp(module_pos->mem_statis.module_name, "unknown")) {
-                unknown_mod = module_pos;
-            } else {
-                UTILS_free(module_pos->mem_statis.calling_stack.func_name);
+    for (i = 0; i <= WITH_MEM_STATS_SITES; i++) {
+        const char *module;
+        int max_in_use = 0, max_allocated = 0, total_allocated = 0, total_freed = 0;
+        int allocs = 0, frees = 0, in_use = 0;
+
+        if (done[i] || _mem_site_name(&mem_sites[i]) == NULL) {
+            continue;
+        }
+        module = mem_sites[i].module ? mem_sites[i].module : "unknown";
+
+        for (j = i; j <= WITH_MEM_STATS_SITES; j++) {
+            mem_site_t *site = &mem_sites[j];
+
+            if (done[j] || _mem_site_name(site) == NULL ||
+                strcmp(module, site->module ? site->module : "unknown")) {
+                continue;
             }
+            done[j] = 1;
+            max_in_use += MEM_STATS_GET(&site->bytes_max_in_use);
+            max_allocated = LITE_MAXIMUM(max_allocated, MEM_STATS_GET(&site->bytes_max_allocated));
+            total_allocated += MEM_STATS_GET(&site->bytes_total_allocated);
+            total_freed += MEM_STATS_GET(&site->bytes_total_freed);
+            allocs += MEM_STATS_GET(&site->iterations_allocated);
+            frees += MEM_STATS_GET(&site->iterations_freed);
+        }
+        in_use = allocs - frees;
+
+        LITE_printf("| %-13s | %6d bytes / %-5d |    %6d bytes  | %6d bytes / %-5d  | %6d bytes / %-5d     \r\n",
+                    module, max_in_use, in_use, max_allocated,
+                    total_allocated, allocs, total_freed, frees);
+        if (!strcmp(module, "unknown")) {
+            unknown = 1;
         }
     }
 
-    if (unknown_mod) {
-        calling_stack_t *call_pos, *tmp;
+    if (unknown) {
         LITE_printf("\r\n");
         LITE_printf("\x1B[1;33mMissing module-name references:\x1B[0m\r\n");
         LITE_printf("---------------------------------------------------\r\n");
 
-        list_for_each_entry_safe(call_pos, tmp, &unknown_mod->mem_statis.calling_stack.func_head, func_head, calling_stack_t) {
-            if (call_pos->func_name) {
-                LITE_printf(". \x1B[1;31m%s \x1B[0m Ln:%d\r\n", call_pos->func_name, call_pos->line);
+        for (i = 0; i < WITH_MEM_STATS_SITES; i++) {
+            const char *func = _mem_site_name(&mem_sites[i]);
 
-                // free memery of func_name and calling_stack
-                UTILS_free(call_pos->func_name);
-                list_del(&call_pos->func_head);
-                UTILS_free(call_pos);
+            if (func != NULL && (mem_sites[i].module == NULL || !strcmp(mem_sites[i].module, "unknown"))) {
+                LITE_printf(". \x1B[1;31m%s \x1B[0m Ln:%d\r\n", func, mem_sites[i].line);
             }
         }
         LITE_printf("\r\n");
     }
 
-    list_for_each_entry_safe(module_pos, tmp, &mem_module_statis, list, module_mem_t) {
-        list_del(&module_pos->list);
-        UTILS_free(module_pos);
+    LITE_printf("\r\n");
+}
+#endif
+
+void LITE_dump_malloc_free_stats(int level)
+{
+#if WITH_MEM_STATS
+    int                     i;
+    int                     cnt = 0;
+
+    if (level > LITE_get_loglevel()) {
+        return;
     }
 
-    LITE_printf("\r\n");
+    utils_debug("");
+    utils_debug("---------------------------------------------------");
+    utils_debug(". bytes_total_allocated:    %d", MEM_STATS_GET(&bytes_total_allocated));
+    utils_debug(". bytes_total_freed:        %d", MEM_STATS_GET(&bytes_total_freed));
+    utils_debug(". bytes_total_in_use:       %d", MEM_STATS_GET(&bytes_total_in_use));
+    utils_warning(". bytes_max_allocated:      %d", MEM_STATS_GET(&bytes_max_allocated));
+    utils_info(". bytes_max_in_use:         %d", MEM_STATS_GET(&bytes_max_in_use));
+    utils_debug(". iterations_allocated:     %d", MEM_STATS_GET(&iterations_allocated));
+    utils_debug(". iterations_freed:         %d", MEM_STATS_GET(&iterations_freed));
+    utils_debug(". iterations_in_use:        %d", MEM_STATS_GET(&iterations_in_use));
+    utils_debug(". iterations_max_in_use:    %d", MEM_STATS_GET(&iterations_max_in_use));
+    utils_debug("---------------------------------------------------");
+    utils_debug("");
 
+#if WITH_MEM_STATS_PER_MODULE
+    _mem_dump_modules();
 #endif
-    if (LITE_get_loglevel() == level) {
-        int         j;
-        int         cnt = 0;
-
-        list_for_each_entry(pos, &mem_recs, list, OS_malloc_record) {
-            if (pos->buf) {
-                LITE_printf("%4d. %-24s Ln:%-5d @ %p: %4d bytes [",
-                            ++cnt,
-                            pos->func,
-                            pos->line,
-                            pos->buf,
-                            pos->buflen);
-                for (j = 0; j < 32 && j < pos->buflen; ++j) {
-                    char        c;
-
-                    c = *(char *)(pos->buf + j);
-                    if (c < ' ' || c > '~') {
-                        c = '.';
-                    }
-                    LITE_printf("%c", c);
-                }
-                LITE_printf("]\r\n");
 
+    if (LITE_get_loglevel() != level) {
+        return;
+    }
+
+    /* sites still holding memory, with the call stack last sampled there */
+    for (i = 0; i <= WITH_MEM_STATS_SITES; ++i) {
+        mem_site_t     *site = &mem_sites[i];
+        const char     *func = _mem_site_name(site);
+        int             in_use;
+
+        if (func == NULL || (in_use = MEM_STATS_GET(&site->bytes_in_use)) <= 0) {
+            continue;
+        }
+        LITE_printf("%4d. %-24s Ln:%-5d: %6d bytes in %d blocks\r\n",
+                    ++cnt,
+                    func,
+                    site->line,
+                    in_use,
+                    MEM_STATS_GET(&site->iterations_allocated) - MEM_STATS_GET(&site->iterations_freed));
 #if defined(__UBUNTU_SDK_DEMO__)
-                int             k;
-
-                LITE_printf("\r\n");
-                for (k = 0; k < pos->bt_level; ++k) {
-                    int             m;
-                    const char     *p = strchr(pos->bt_symbols[k], '(');
-
-                    if (p[1] == ')') {
-                        continue;
-                    }
-                    LITE_printf("    ");
-                    for (m = 0; m < k; ++m) {
-                        LITE_printf("  ");
-                    }
-
-                    LITE_printf("%s\r\n", p);
-                }
-#endif
-                LITE_printf("\r\n");
-            }
+        if (!__atomic_load_n(&site->bt_busy, __ATOMIC_ACQUIRE)) {
+            LITE_printf("\r\n");
+            _mem_print_backtrace(site->bt, site->bt_level);
         }
+#endif
+        LITE_printf("\r\n");
     }
 #else
     utils_info("WITH_MEM_STATS = %d", WITH_MEM_STATS);
@@ -691,10 +522,102 @@ void LITE_dump_malloc_free_stats(int level)
 }
 
 #if WITH_MEM_STATS
-void **LITE_get_mem_mutex(void)
+static int _mem_report_printf(char *buf, int buf_len, int len, const char *fmt, ...)
 {
-    return &mutex_mem_stats;
+    va_list             ap;
+    int                 ret;
+
+    if (len >= buf_len - 1) {
+        return len;
+    }
+
+    va_start(ap, fmt);
+    ret = UTILS_vsnprintf(buf + len, buf_len - len, fmt, ap);
+    va_end(ap);
+    if (ret < 0) {
+        return len;
+    }
+
+    len += ret;
+    return (len >= buf_len) ? (buf_len - 1) : len;
 }
 #endif
 
+/* write counters of all call sites into buf as text lines or a JSON object, return its length */
+int LITE_mem_stats_report(char *buf, int buf_len, int format)
+{
+#if WITH_MEM_STATS
+    int                 i;
+    int                 len = 0;
+    int                 first = 1;
+
+    if (buf == NULL || buf_len <= 0) {
+        return -1;
+    }
+    buf[0] = '\0';
+
+    if (LITE_MEM_REPORT_JSON == format) {
+        len = _mem_report_printf(buf, buf_len, len,
+                                 "{\"bytes_total_allocated\":%d,\"bytes_total_freed\":%d,\"bytes_in_use\":%d,"
+                                 "\"bytes_max_in_use\":%d,\"bytes_max_allocated\":%d,"
+                                 "\"iterations_allocated\":%d,\"iterations_in_use\":%d,\"sites\":[",
+                                 MEM_STATS_GET(&bytes_total_allocated), MEM_STATS_GET(&bytes_total_freed),
+                                 MEM_STATS_GET(&bytes_total_in_use), MEM_STATS_GET(&bytes_max_in_use),
+                                 MEM_STATS_GET(&bytes_max_allocated), MEM_STATS_GET(&iterations_allocated),
+                                 MEM_STATS_GET(&iterations_in_use));
+    } else {
+        len = _mem_report_printf(buf, buf_len, len,
+                                 "total %d freed %d in_use %d max_in_use %d max_allocated %d allocs %d blocks %d\n",
+                                 MEM_STATS_GET(&bytes_total_allocated), MEM_STATS_GET(&bytes_total_freed),
+                                 MEM_STATS_GET(&bytes_total_in_use), MEM_STATS_GET(&bytes_max_in_use),
+                                 MEM_STATS_GET(&bytes_max_allocated), MEM_STATS_GET(&iterations_allocated),
+                                 MEM_STATS_GET(&iterations_in_use));
+    }
 
+    for (i = 0; i <= WITH_MEM_STATS_SITES; i++) {
+        mem_site_t     *site = &mem_sites[i];
+        const char     *func = _mem_site_name(site);
+        const char     *module = site->module ? site->module : "unknown";
+
+        if (func == NULL) {
+            continue;
+        }
+
+        if (LITE_MEM_REPORT_JSON == format) {
+            len = _mem_report_printf(buf, buf_len, len,
+                                     "%s{\"func\":\"%s\",\"line\":%d,\"module\":\"%s\",\"allocs\":%d,\"frees\":%d,"
+                                     "\"bytes_total\":%d,\"bytes_in_use\":%d,\"bytes_max_in_use\":%d,\"bytes_max_allocated\":%d}",
+                                     first ? "" : ",", func, site->line, module,
+                                     MEM_STATS_GET(&site->iterations_allocated), MEM_STATS_GET(&site->iterations_freed),
+                                     MEM_STATS_GET(&site->bytes_total_allocated), MEM_STATS_GET(&site->bytes_in_use),
+                                     MEM_STATS_GET(&site->bytes_max_in_use), MEM_STATS_GET(&site->bytes_max_allocated));
+        } else {
+            len = _mem_report_printf(buf, buf_len, len,
+                                     "%s:%d %s allocs %d frees %d total %d in_use %d max_in_use %d max_allocated %d\n",
+                                     func, site->line, module,
+                                     MEM_STATS_GET(&site->iterations_allocated), MEM_STATS_GET(&site->iterations_freed),
+                                     MEM_STATS_GET(&site->bytes_total_allocated), MEM_STATS_GET(&site->bytes_in_use),
+                                     MEM_STATS_GET(&site->bytes_max_in_use), MEM_STATS_GET(&site->bytes_max_allocated));
+        }
+        first = 0;
+    }
+
+    if (LITE_MEM_REPORT_JSON == format) {
+        len = _mem_report_printf(buf, buf_len, len, "]}");
+    }
+
+    return len;
+#else
+    if (buf != NULL && buf_len > 0) {
+        buf[0] = '\0';
+    }
+    return -1;
+#endif
+}
+
+#if WITH_MEM_STATS
+void **LITE_get_mem_mutex(void)
+{
+    return &mutex_mem_stats;
+}
+#endif
@@ -14,20 +14,34 @@
     #include <execinfo.h>
 #endif
 
+#define MEM_STATS_BT_LEVEL      8
+
+/* counters of one LITE_malloc() call site, func/line is the key */
 typedef struct {
-    void               *buf;
-    int                 buflen;
-    char               *func;
+    const char         *func;
     int                 line;
+    const char         *module;
+    int                 iterations_allocated;
+    int                 iterations_freed;
+    int                 bytes_total_allocated;
+    int                 bytes_total_freed;
+    int                 bytes_in_use;
+    int                 bytes_max_in_use;
+    int                 bytes_max_allocated;
 #if defined(__UBUNTU_SDK_DEMO__)
-    char              **bt_symbols;
+    /* last sampled call stack of this site */
+    int                 bt_busy;
     int                 bt_level;
+    void               *bt[MEM_STATS_BT_LEVEL];
 #endif
-    list_head_t         list;
+} mem_site_t;
 
-#if WITH_MEM_STATS_PER_MODULE
-    void               *mem_table;
-#endif
+/* prepended to each allocation, keeps the buffer behind it aligned */
+typedef struct {
+    uint32_t            magic;
+    uint32_t            site;
+    int                 buflen;
+    uint32_t            reserved;
 } OS_malloc_record;
 
 #endif  /* __MEM_STATS_H__ */
@@ -7,8 +7,34 @@
 #include "utils_epoch_time.h"
 #include "iotx_utils_internal.h"
 
-#define ALIYUN_NTP_SERVER       "ntp%d.aliyun.com"
-#define ALIYUN_NTP_PORT         (123)
+#ifndef ALIYUN_NTP_SERVER
+    #define ALIYUN_NTP_SERVER       "ntp%d.aliyun.com"
+#endif
+#ifndef ALIYUN_NTP_PORT
+    #define ALIYUN_NTP_PORT         (123)
+#endif
+/* ntp1 to ntpN are all asked at once */
+#ifndef ALIYUN_NTP_SERVER_NUM
+    #define ALIYUN_NTP_SERVER_NUM   (7)
+#endif
+
+#define NTP_PACKET_LEN          (48)
+#define NTP_SEND_TIMEOUT_MS     (200)
+#define NTP_WAIT_TIMEOUT_MS     (3000)
+
+/* HAL_UDP_sendto() blocks to resolve a name, servers without a known address are skipped once this is spent */
+#ifndef NTP_RESOLVE_BUDGET_MS
+    #define NTP_RESOLVE_BUDGET_MS   (1000)
+#endif
+
+/* a larger correction steps the clock, a smaller one is slewed in, as ntpd does */
+#define NTP_STEP_THRESHOLD_MS   (128)
+#define NTP_SLEW_PPM            (500)
+
+/* utils_get_epoch_time_from_ntp() asks the servers again once the clock is this old */
+#ifndef NTP_RESYNC_INTERVAL_MS
+    #define NTP_RESYNC_INTERVAL_MS  (3600 * 1000)
+#endif
 
 #define LI                      0
 #define VN                      3
@@ -39,11 +65,6 @@
  */
 #define sec2u(x)                ((x) * 15.2587890625)
 
-struct timeval_t {
-    uint32_t tv_sec;
-    uint32_t tv_usec;
-};
-
 struct ntptime_t {
     uint32_t coarse;
     uint32_t fine;
@@ -61,6 +82,31 @@ struct ntp_packet_t {
     int refid;
 };
 
+/* a request of one round, its reply echoes nonce/index as the originate timestamp */
+typedef struct {
+    uint32_t    nonce;
+    uint64_t    sent;       /* HAL_UptimeMs() after the request left */
+    int         pending;
+} ntp_query_t;
+
+typedef struct {
+    int64_t     offset;     /* epoch time minus HAL_UptimeMs(), in ms */
+    int64_t     delay;      /* round trip less the server time, in ms */
+} ntp_sample_t;
+
+/*
+ * The epoch clock is HAL_UptimeMs() plus an offset. After a sync the offset
+ * moves from base towards target at NTP_SLEW_PPM, so the clock never goes back.
+ */
+static struct {
+    void       *mutex;
+    int         synced;
+    uint64_t    sync_time;
+    int64_t     base;
+    int64_t     target;
+    char        server_ip[ALIYUN_NTP_SERVER_NUM][NETWORK_ADDR_LEN];    /* learnt from replies, "" to resolve by name */
+} g_ntp_clock;
+
 /**
  * implement of htonl and ntohl
  */
@@ -91,42 +137,66 @@ static uint32_t _ntohl(uint32_t n)
     return _check_endian() ? n : BigLittleSwap(n);
 }
 
-static int _get_packet(unsigned char *packet, int *len)
+static int _get_packet(unsigned char *packet, int *len, uint32_t nonce, uint32_t index)
 {
     uint32_t data[12];
-    struct timeval_t now = {0, 0};
 
-    if (*len < 48) {
+    if (*len < NTP_PACKET_LEN) {
         utils_err("packet buf too short!\n");
         return -1;
     }
 
     memset(packet, 0, *len);
+    memset(data, 0, sizeof(data));
 
     data[0] = _htonl((LI << 30) | (VN << 27) | (MODE << 24) |
                      (STRATUM << 16) | (POLL << 8) | (PREC & 0xff));
     data[1] = _htonl(1 << 16);  /* Root Delay (seconds) */
     data[2] = _htonl(1 << 16);  /* Root Dispersion (seconds) */
-    data[10] = _htonl(now.tv_sec + JAN_1970); /* Transmit Timestamp coarse */
-    data[11] = _htonl(NTPFRAC(now.tv_usec));  /* Transmit Timestamp fine */
+    /* not a time, SNTP servers just copy it into the originate timestamp */
+    data[10] = _htonl(nonce);   /* Transmit Timestamp coarse */
+    data[11] = _htonl(index);   /* Transmit Timestamp fine */
 
-    memcpy(packet, data, 48);
-    *len = 48;
+    memcpy(packet, data, NTP_PACKET_LEN);
+    *len = NTP_PACKET_LEN;
 
     return 0;
 }
 
-static void _rfc1305_parse_timeval(unsigned char *read_buf, struct timeval_t *tv)
+/* NTP era 0 ends in 2036, seconds below JAN_1970 are taken from era 1 */
+static int64_t _ntptime_to_epoch_ms(struct ntptime_t *t)
+{
+    int64_t sec = (int64_t)t->coarse - JAN_1970;
+
+    if (t->coarse < JAN_1970) {
+        sec += (int64_t)1 << 32;
+    }
+    return sec * 1000 + (int64_t)(((uint64_t)t->fine * 1000) >> 32);
+}
+
+/*
+ * Check a reply against the pending queries and work out offset and delay
+ * from the four timestamps, T1/T4 read from HAL_UptimeMs() and T2/T3 from
+ * the server. Returns the index of the query answered, -1 for a bad reply.
+ */
+static int _rfc1305_parse_sample(uint32_t *read_buf, int len, ntp_query_t *query,
+                                 uint64_t t4, ntp_sample_t *sample)
 {
     /* straight out of RFC-1305 Appendix A */
     struct ntp_packet_t ntp_packet;
-    struct ntptime_t xmttime;
+    struct ntptime_t orgtime, rectime, xmttime;
 #ifdef NTP_DEBUG
-    struct ntptime_t reftime, orgtime, rectime;
+    struct ntptime_t reftime;
 #endif
+    uint32_t index;
+    int64_t t1, t2, t3;
+
+    if (len < NTP_PACKET_LEN) {
+        return -1;
+    }
     memset(&ntp_packet, 0, sizeof(struct ntp_packet_t));
 
-#define Data(i) _ntohl(((unsigned int *)read_buf)[i])
+#define Data(i) _ntohl(read_buf[i])
     ntp_packet.li      = Data(0) >> 30 & 0x03;
     ntp_packet.vn      = Data(0) >> 27 & 0x07;
     ntp_packet.mode    = Data(0) >> 24 & 0x07;
@@ -143,11 +213,11 @@ static void _rfc1305_parse_timeval(unsigned char *read_buf, struct timeval_t *tv
 #ifdef NTP_DEBUG
     reftime.coarse = Data(4);
     reftime.fine   = Data(5);
+#endif
     orgtime.coarse = Data(6);
     orgtime.fine   = Data(7);
     rectime.coarse = Data(8);
     rectime.fine   = Data(9);
-#endif
     xmttime.coarse = Data(10);
     xmttime.fine   = Data(11);
 #undef Data
@@ -161,69 +231,250 @@ static void _rfc1305_parse_timeval(unsigned char *read_buf, struct timeval_t *tv
                 ntp_packet.refid >> 24 & 0xff, ntp_packet.refid >> 16 & 0xff,
                 ntp_packet.refid >> 8 & 0xff, ntp_packet.refid & 0xff);
     utils_debug("Reference %u.%.6u\n", reftime.coarse - JAN_1970, USEC(reftime.fine));
-    utils_debug("Originate %u.%.6u\n", orgtime.coarse - JAN_1970, USEC(orgtime.fine));
     utils_debug("Receive   %u.%.6u\n", rectime.coarse - JAN_1970, USEC(rectime.fine));
     utils_debug("Transmit  %u.%.6u\n", xmttime.coarse - JAN_1970, USEC(xmttime.fine));
 #endif
 
-    tv->tv_sec = xmttime.coarse - JAN_1970;
-    tv->tv_usec = USEC(xmttime.fine);
+    /* mode 4 is a server reply, LI 3 an unsynchronized server, stratum 0 a kiss-o'-death */
+    if (4 != ntp_packet.mode || 3 == ntp_packet.li
+        || 0 == ntp_packet.stratum || 15 < ntp_packet.stratum) {
+        return -1;
+    }
+
+    index = orgtime.fine;
+    if (index >= ALIYUN_NTP_SERVER_NUM || !query[index].pending
+        || orgtime.coarse != query[index].nonce) {
+        return -1;
+    }
+
+    t1 = (int64_t)query[index].sent;
+    t2 = _ntptime_to_epoch_ms(&rectime);
+    t3 = _ntptime_to_epoch_ms(&xmttime);
+
+    sample->offset = ((t2 - t1) + (t3 - (int64_t)t4)) / 2;
+    sample->delay  = ((int64_t)t4 - t1) - (t3 - t2);
+    if (sample->delay < 0) {
+        sample->delay = 0;
+    }
+
+    return (int)index;
 }
 
-static uint64_t _get_timestamp_from_ntp(const char *host)
+static void _ntp_clock_lock(void)
 {
-    long fd;  /* socket */
-    int ret = -1;
-    uint64_t retval = 0;
-    struct timeval_t tv;
-    unsigned char write_buf[48] = {0};
-    int write_len = sizeof(write_buf);
-    unsigned char read_buf[1500] = {0};
+    if (NULL == g_ntp_clock.mutex) {
+        g_ntp_clock.mutex = HAL_MutexCreate();
+    }
+    if (NULL != g_ntp_clock.mutex) {
+        HAL_MutexLock(g_ntp_clock.mutex);
+    }
+}
+
+static void _ntp_clock_unlock(void)
+{
+    if (NULL != g_ntp_clock.mutex) {
+        HAL_MutexUnlock(g_ntp_clock.mutex);
+    }
+}
 
-    fd = (long)HAL_UDP_create((char *)host, ALIYUN_NTP_PORT);
+/* ask all servers on one socket and keep the reply with the shortest round trip */
+static int _ntp_query_servers(ntp_sample_t *best)
+{
+    intptr_t fd;
+    int i = 0;
+    int ret = -1;
+    int pending = 0;
+    int found = 0;
+    uint64_t now = 0;
+    uint64_t deadline = 0;
+    uint64_t until = 0;
+    uint64_t start = 0;
+    NetworkAddr remote;
+    ntp_sample_t sample;
+    ntp_query_t query[ALIYUN_NTP_SERVER_NUM];
+    char server_ip[ALIYUN_NTP_SERVER_NUM][NETWORK_ADDR_LEN];
+    uint32_t read_buf[32];
+    int write_len = 0;
+    unsigned char write_buf[NTP_PACKET_LEN] = {0};
+
+    fd = HAL_UDP_create_without_connect(NULL, 0);
     if (fd < 0) {
         utils_err("udp create error!");
-        return 0;
+        return -1;
+    }
+
+    _ntp_clock_lock();
+    memcpy(server_ip, g_ntp_clock.server_ip, sizeof(server_ip));
+    _ntp_clock_unlock();
+
+    memset(query, 0, sizeof(query));
+    start = HAL_UptimeMs();
+    for (i = 0; i < ALIYUN_NTP_SERVER_NUM; i++) {
+        memset(&remote, 0, sizeof(NetworkAddr));
+        if ('\0' != server_ip[i][0]) {
+            memcpy(remote.addr, server_ip[i], NETWORK_ADDR_LEN);
+        } else if (HAL_UptimeMs() - start < NTP_RESOLVE_BUDGET_MS) {
+            HAL_Snprintf((char *)remote.addr, NETWORK_ADDR_LEN, ALIYUN_NTP_SERVER, i + 1);
+        } else {
+            utils_debug("resolve budget spent, skip ntp%d", i + 1);
+            continue;
+        }
+        remote.port = ALIYUN_NTP_PORT;
+
+        query[i].nonce = HAL_Random(0xffffffff);
+        write_len = sizeof(write_buf);
+        _get_packet(write_buf, &write_len, query[i].nonce, i);
+
+        /* HAL_UDP_sendto() may resolve the name first, so T1 is read after it */
+        ret = HAL_UDP_sendto(fd, &remote, write_buf, write_len, NTP_SEND_TIMEOUT_MS);
+        query[i].sent = HAL_UptimeMs();
+        if (ret != write_len) {
+            utils_debug("udp sendto %s error!", remote.addr);
+            server_ip[i][0] = '\0';
+            continue;
+        }
+        query[i].pending = 1;
+        pending++;
+    }
+
+    deadline = HAL_UptimeMs() + NTP_WAIT_TIMEOUT_MS;
+    while (pending > 0) {
+        now = HAL_UptimeMs();
+        if (now >= deadline) {
+            break;
+        }
+
+        ret = HAL_UDP_recvfrom(fd, &remote, (unsigned char *)read_buf, sizeof(read_buf),
+                               (unsigned int)(deadline - now));
+        now = HAL_UptimeMs();
+        if (0 == ret) {
+            break;
+        } else if (ret < 0) {
+            continue;
+        }
+
+        i = _rfc1305_parse_sample(read_buf, ret, query, now, &sample);
+        if (i < 0) {
+            utils_debug("drop bad ntp reply from %s", remote.addr);
+            continue;
+        }
+        query[i].pending = 0;
+        pending--;
+        memcpy(server_ip[i], remote.addr, NETWORK_ADDR_LEN);
+        server_ip[i][NETWORK_ADDR_LEN - 1] = '\0';
+        utils_debug("ntp%d: offset %d ms, delay %d ms", i + 1, (int)sample.offset, (int)sample.delay);
+
+        if (!found || sample.delay < best->delay) {
+            *best = sample;
+            found = 1;
+        }
+
+        /* a server still pending can only do better by answering within the best delay */
+        until = 0;
+        for (i = 0; i < ALIYUN_NTP_SERVER_NUM; i++) {
+            if (query[i].pending && query[i].sent + best->delay + 1 > until) {
+                until = query[i].sent + best->delay + 1;
+            }
+        }
+        if (until < deadline) {
+            deadline = until;
+        }
+    }
+
+    HAL_UDP_close_without_connect(fd);
+
+    /* a server which kept silent is looked up by name again next time, its address may have changed */
+    for (i = 0; i < ALIYUN_NTP_SERVER_NUM; i++) {
+        if (query[i].pending) {
+            server_ip[i][0] = '\0';
+        }
     }
+    _ntp_clock_lock();
+    memcpy(g_ntp_clock.server_ip, server_ip, sizeof(server_ip));
+    _ntp_clock_unlock();
 
-    ret = _get_packet(write_buf, &write_len);
-    if (ret < 0) {
-        utils_err("get_packet error!");
-        goto do_exit;
+    return found ? 0 : -1;
+}
+
+/* the offset in use at uptime now, with the lock held */
+static int64_t _ntp_clock_offset(uint64_t now)
+{
+    int64_t slew = (int64_t)(now - g_ntp_clock.sync_time) * NTP_SLEW_PPM / 1000000;
+
+    if (g_ntp_clock.target > g_ntp_clock.base) {
+        return (g_ntp_clock.base + slew < g_ntp_clock.target) ? g_ntp_clock.base + slew : g_ntp_clock.target;
+    }
+    return (g_ntp_clock.base - slew > g_ntp_clock.target) ? g_ntp_clock.base - slew : g_ntp_clock.target;
+}
+
+int utils_epoch_time_sync(void)
+{
+    int step = 1;
+    int first = 0;
+    uint64_t now = 0;
+    int64_t offset = 0;
+    ntp_sample_t sample;
+
+    if (0 != _ntp_query_servers(&sample)) {
+        utils_err("no ntp server answered!");
+        return -1;
     }
 
-    ret = HAL_UDP_write((intptr_t)fd, write_buf, write_len);
-    if (ret < 0) {
-        utils_err("udp write error!");
-        goto do_exit;
+    _ntp_clock_lock();
+    now = HAL_UptimeMs();
+    first = !g_ntp_clock.synced;
+    if (!first) {
+        offset = _ntp_clock_offset(now);
+        step = (sample.offset - offset > NTP_STEP_THRESHOLD_MS
+                || offset - sample.offset > NTP_STEP_THRESHOLD_MS);
+    }
+    g_ntp_clock.base      = step ? sample.offset : offset;
+    g_ntp_clock.target    = sample.offset;
+    g_ntp_clock.sync_time = now;
+    g_ntp_clock.synced    = 1;
+    _ntp_clock_unlock();
+
+    if (first) {
+        utils_info("epoch time synced, delay %d ms", (int)sample.delay);
+    } else {
+        utils_info("epoch time %s by %d ms, delay %d ms", step ? "stepped" : "slewed",
+                   (int)(sample.offset - offset), (int)sample.delay);
     }
+    return 0;
+}
+
+uint64_t utils_epoch_time_now(void)
+{
+    uint64_t now = 0;
+    uint64_t epoch = 0;
 
-    ret = HAL_UDP_readTimeout((intptr_t)fd, read_buf, sizeof(read_buf), 3000);
-    if (ret < 0) {
-        utils_err("udp read error!");
-        goto do_exit;
+    _ntp_clock_lock();
+    if (g_ntp_clock.synced) {
+        now = HAL_UptimeMs();
+        epoch = now + _ntp_clock_offset(now);
     }
-    _rfc1305_parse_timeval(read_buf, &tv);
-    retval = ((uint64_t)tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+    _ntp_clock_unlock();
 
-do_exit:
-    HAL_UDP_close((intptr_t)fd);
-    return retval;
+    return epoch;
 }
 
 uint64_t utils_get_epoch_time_from_ntp(char copy[], int len)
 {
-    char ntp_server[20] = {0};
-    int ntp_server_index = 1;
+    int expired = 0;
     uint64_t time_in_ms = 0;
 
-    for (ntp_server_index = 1; ntp_server_index <= 7; ntp_server_index ++) {
-        HAL_Snprintf(ntp_server, 20, ALIYUN_NTP_SERVER, ntp_server_index);
-        time_in_ms = _get_timestamp_from_ntp(ntp_server);
-        if (time_in_ms > 0) {
-            HAL_Snprintf(copy, len, "%lu", time_in_ms);
-            break;
-        }
+    _ntp_clock_lock();
+    expired = !g_ntp_clock.synced || HAL_UptimeMs() - g_ntp_clock.sync_time > NTP_RESYNC_INTERVAL_MS;
+    _ntp_clock_unlock();
+
+    /* on a failed resync the clock keeps running on the last offset */
+    if (expired) {
+        utils_epoch_time_sync();
+    }
+
+    time_in_ms = utils_epoch_time_now();
+    if (time_in_ms > 0) {
+        HAL_Snprintf(copy, len, "%lu", time_in_ms);
     }
 
     return time_in_ms;
@@ -23,7 +23,27 @@ extern "C" {
  */
 uint64_t utils_get_epoch_time_from_ntp(char copy[], int len);
 
+/**
+ * @brief Ask all the Aliyun NTP servers at once and correct the epoch clock
+ *        with the reply of the shortest round trip.
+ *
+ * @param none
+ *
+ * @return 0, success; -1, no server answered, the clock is left as it was
+ */
+int utils_epoch_time_sync(void);
+
+/**
+ * @brief Get epoch time in millisecond from the clock kept by
+ *        utils_epoch_time_sync(), without any network access.
+ *
+ * @param none
+ *
+ * @return 0, not synced yet; OTHERS, the actual value of epoch time
+ */
+uint64_t utils_epoch_time_now(void);
+
 #ifdef __cplusplus
-extern "C" {
+}
 #endif
 #endif /* _ALIOT_EPOCH_TIME_H_ */
@@ -25,6 +25,13 @@
 
 #define HTTP_RETRIEVE_MORE_DATA   (1)            /**< More data needs to be retrieved. */
 
+#ifndef HTTPCLIENT_POOL_SIZE
+    #define HTTPCLIENT_POOL_SIZE      (2)           /* idle keep-alive connections kept */
+#endif
+#ifndef HTTPCLIENT_POOL_IDLE_MS
+    #define HTTPCLIENT_POOL_IDLE_MS   (30 * 1000)   /* idle connection older than this is closed */
+#endif
+
 #if defined(MBEDTLS_DEBUG_C)
     #define DEBUG_LEVEL 2
 #endif
@@ -38,10 +45,165 @@ static int httpclient_parse_url(const char *url, char *scheme, uint32_t max_sche
 static int httpclient_conn(httpclient_t *client);
 static int httpclient_recv(httpclient_t *client, char *buf, int min_len, int max_len, int *p_read_len,
                            uint32_t timeout);
-static int httpclient_retrieve_content(httpclient_t *client, char *data, int len, uint32_t timeout,
-                                       httpclient_data_t *client_data);
 static int httpclient_response_parse(httpclient_t *client, char *data, int len, uint32_t timeout,
-                                     httpclient_data_t *client_data);
+                                     httpclient_data_t *client_data, httpclient_body_cb_t sink, void *sink_ctx);
+
+typedef struct {
+    char                host[HTTPCLIENT_MAX_HOST_LEN];
+    int                 port;
+    const char         *ca_crt;
+    utils_network_t     net;
+    uint64_t            idle_since;
+} httpclient_pool_entry_t;
+
+static httpclient_pool_entry_t g_httpc_pool[HTTPCLIENT_POOL_SIZE];
+static void *g_httpc_pool_mutex = NULL;
+
+static void httpclient_pool_lock(void)
+{
+    if (NULL == g_httpc_pool_mutex) {
+        g_httpc_pool_mutex = HAL_MutexCreate();
+    }
+    if (NULL != g_httpc_pool_mutex) {
+        HAL_MutexLock(g_httpc_pool_mutex);
+    }
+}
+
+static void httpclient_pool_unlock(void)
+{
+    if (NULL != g_httpc_pool_mutex) {
+        HAL_MutexUnlock(g_httpc_pool_mutex);
+    }
+}
+
+static void httpclient_pool_drop(httpclient_pool_entry_t *entry)
+{
+    if (0 != entry->net.handle) {
+        entry->net.disconnect(&entry->net);
+    }
+    memset(entry, 0, sizeof(httpclient_pool_entry_t));
+}
+
+/* close connections idle for too long, with the lock held */
+static void httpclient_pool_expire(uint64_t now)
+{
+    int i;
+
+    for (i = 0; i < HTTPCLIENT_POOL_SIZE; i++) {
+        if (0 != g_httpc_pool[i].net.handle && now - g_httpc_pool[i].idle_since > HTTPCLIENT_POOL_IDLE_MS) {
+            httpclient_pool_drop(&g_httpc_pool[i]);
+        }
+    }
+}
+
+int httpclient_pool_acquire(httpclient_t *client, const char *host, int port, const char *ca_crt)
+{
+    int i, ret = -1;
+    uint64_t now = HAL_UptimeMs();
+
+    httpclient_pool_lock();
+    httpclient_pool_expire(now);
+    for (i = 0; i < HTTPCLIENT_POOL_SIZE; i++) {
+        httpclient_pool_entry_t *entry = &g_httpc_pool[i];
+
+        if (0 == entry->net.handle) {
+            continue;
+        }
+        if (-1 == ret && entry->port == port && entry->ca_crt == ca_crt && 0 == strcmp(entry->host, host)) {
+            memcpy(&client->net, &entry->net, sizeof(utils_network_t));
+            client->net.pHostAddress = NULL;
+            memset(entry, 0, sizeof(httpclient_pool_entry_t));
+            ret = 0;
+        }
+    }
+    httpclient_pool_unlock();
+
+    if (0 == ret) {
+        utils_debug("reuse keep-alive connection to %s:%d", host, port);
+    }
+    return ret;
+}
+
+void httpclient_pool_release(httpclient_t *client, const char *host, int port, const char *ca_crt)
+{
+    int i;
+    httpclient_pool_entry_t *slot = NULL;
+
+    if (0 == client->net.handle) {
+        return;
+    }
+    if (strlen(host) >= HTTPCLIENT_MAX_HOST_LEN || client->rx_pending_len > 0) {
+        /* unsolicited bytes left on connection, it can not carry another request */
+        httpclient_close(client);
+        return;
+    }
+
+    httpclient_pool_lock();
+    httpclient_pool_expire(HAL_UptimeMs());
+    for (i = 0; i < HTTPCLIENT_POOL_SIZE; i++) {
+        if (0 == g_httpc_pool[i].net.handle) {
+            slot = &g_httpc_pool[i];
+            break;
+        }
+        if (NULL == slot || g_httpc_pool[i].idle_since < slot->idle_since) {
+            slot = &g_httpc_pool[i];
+        }
+    }
+    httpclient_pool_drop(slot);
+
+    strncpy(slot->host, host, HTTPCLIENT_MAX_HOST_LEN - 1);
+    slot->port = port;
+    slot->ca_crt = ca_crt;
+    memcpy(&slot->net, &client->net, sizeof(utils_network_t));
+    slot->net.pHostAddress = slot->host;
+    slot->idle_since = HAL_UptimeMs();
+    httpclient_pool_unlock();
+
+    client->net.handle = 0;
+    utils_debug("keep connection to %s:%d in pool", host, port);
+}
+
+void httpclient_pool_flush(void)
+{
+    int i;
+
+    httpclient_pool_lock();
+    for (i = 0; i < HTTPCLIENT_POOL_SIZE; i++) {
+        httpclient_pool_drop(&g_httpc_pool[i]);
+    }
+    httpclient_pool_unlock();
+}
+
+/* keep bytes read beyond current response, httpclient_recv() returns them first */
+static int httpclient_keep_pending(httpclient_t *client, const char *data, int len)
+{
+    if (len <= 0) {
+        return SUCCESS_RETURN;
+    }
+
+    if (NULL == client->rx_pending) {
+        client->rx_pending = httpc_malloc(HTTPCLIENT_CHUNK_SIZE);
+        if (NULL == client->rx_pending) {
+            return ERROR_NO_ENOUGH_MEM;
+        }
+        client->rx_pending_len = 0;
+    }
+
+    if (0 == client->rx_pending_len) {
+        client->rx_pending_off = HTTPCLIENT_CHUNK_SIZE;
+    }
+
+    /* bytes kept were read out of rx_pending last or it was empty, so there is room in front of what is pending */
+    if (len > client->rx_pending_off) {
+        utils_err("pending buffer overflow");
+        return ERROR_HTTP;
+    }
+
+    client->rx_pending_off -= len;
+    memcpy(client->rx_pending + client->rx_pending_off, data, len);
+    client->rx_pending_len += len;
+    return SUCCESS_RETURN;
+}
 
 static void httpclient_base64enc(char *out, const char *in)
 {
@@ -391,6 +553,16 @@ int httpclient_recv(httpclient_t *client, char *buf, int min_len, int max_len, i
 
     *p_read_len = 0;
 
+    if (client->rx_pending_len > 0) {
+        int pending_len = HTTPCLIENT_MIN(max_len, client->rx_pending_len);
+
+        memcpy(buf, client->rx_pending + client->rx_pending_off, pending_len);
+        client->rx_pending_off += pending_len;
+        client->rx_pending_len -= pending_len;
+        *p_read_len = pending_len;
+        return 0;
+    }
+
     ret = client->net.read(&client->net, buf, max_len, iotx_time_left(&timer));
     /* utils_debug("Recv: | %s", buf); */
 
@@ -438,226 +610,227 @@ int httpclient_recv(httpclient_t *client, char *buf, int min_len, int max_len, i
     /*    return 0; */
 }
 
-int httpclient_retrieve_content(httpclient_t *client, char *data, int len,
-                                uint32_t timeout_ms, httpclient_data_t *client_data)
+/* bytes of body in data[0, len) are handed to sink as slices of data, framing of chunked body is decoded in place */
+/* return length consumed, stops early when body finished or sink takes less than offered; < 0 on format error */
+static int httpclient_body_feed(httpclient_data_t *client_data, const char *data, int len,
+                                httpclient_body_cb_t sink, void *sink_ctx)
 {
-    int count = 0;
-    int templen = 0;
-    int crlf_pos;
+    int pos = 0;
+
+    while (pos < len && HTTPCLIENT_BODY_DONE != client_data->body_state) {
+        char c = data[pos];
+
+        switch (client_data->body_state) {
+            case HTTPCLIENT_BODY_DATA: {
+                int offer = HTTPCLIENT_MIN(len - pos, client_data->retrieve_len);
+                int taken = sink(sink_ctx, data + pos, offer);
+
+                if (taken < 0) {
+                    return taken;
+                }
+                pos += taken;
+                client_data->retrieve_len -= taken;
+                if (0 == client_data->retrieve_len) {
+                    client_data->body_state = client_data->is_chunked ? HTTPCLIENT_BODY_CHUNK_END : HTTPCLIENT_BODY_DONE;
+                }
+                if (taken < offer) {
+                    return pos;
+                }
+            }
+            break;
+            case HTTPCLIENT_BODY_CHUNK_SIZE: {
+                int digit = (c >= '0' && c <= '9') ? (c - '0') :
+                            (c >= 'a' && c <= 'f') ? (c - 'a' + 10) :
+                            (c >= 'A' && c <= 'F') ? (c - 'A' + 10) : -1;
+
+                if (digit >= 0) {
+                    if (client_data->chunk_len > (0x7FFFFFFF >> 4)) {
+                        utils_err("chunk length overflow");
+                        return ERROR_HTTP_PARSE;
+                    }
+                    client_data->chunk_len = (client_data->chunk_len << 4) + digit;
+                    pos++;
+                    break;
+                }
+                /* chunk extension or end of size line */
+                client_data->body_state = HTTPCLIENT_BODY_CHUNK_EXT;
+            }
+            /* fall through */
+            case HTTPCLIENT_BODY_CHUNK_EXT: {
+                pos++;
+                if ('\n' != c) {
+                    break;
+                }
+                client_data->retrieve_len = client_data->chunk_len;
+                client_data->response_content_len += client_data->chunk_len;
+                client_data->body_state = (0 == client_data->chunk_len) ? HTTPCLIENT_BODY_TRAILER : HTTPCLIENT_BODY_DATA;
+                client_data->chunk_len = 0;
+            }
+            break;
+            case HTTPCLIENT_BODY_CHUNK_END: {
+                pos++;
+                if ('\n' == c) {
+                    client_data->body_state = HTTPCLIENT_BODY_CHUNK_SIZE;
+                } else if ('\r' != c) {
+                    utils_err("Format error, 0x%02x after chunk", (unsigned char)c);
+                    return ERROR_HTTP_PARSE;
+                }
+            }
+            break;
+            case HTTPCLIENT_BODY_TRAILER: {
+                pos++;
+                if ('\n' == c) {
+                    utils_debug("no more (last chunk)");
+                    client_data->body_state = HTTPCLIENT_BODY_DONE;
+                } else if ('\r' != c) {
+                    client_data->body_state = HTTPCLIENT_BODY_TRAILER_LINE;
+                }
+            }
+            break;
+            case HTTPCLIENT_BODY_TRAILER_LINE: {
+                pos++;
+                if ('\n' == c) {
+                    client_data->body_state = HTTPCLIENT_BODY_TRAILER;
+                }
+            }
+            break;
+            default:
+                return ERROR_HTTP_PARSE;
+        }
+    }
+
+    return pos;
+}
+
+typedef struct {
+    httpclient_data_t  *client_data;
+    int                 count;
+} httpclient_buf_sink_t;
+
+/* default sink, fill client_data->response_buf and keep it NULL-terminated */
+static int httpclient_buf_sink(void *sink_ctx, const char *data, int len)
+{
+    httpclient_buf_sink_t *buf_sink = (httpclient_buf_sink_t *)sink_ctx;
+    httpclient_data_t *client_data = buf_sink->client_data;
+    int taken = HTTPCLIENT_MIN(len, client_data->response_buf_len - 1 - buf_sink->count);
+
+    memcpy(client_data->response_buf + buf_sink->count, data, taken);
+    buf_sink->count += taken;
+    client_data->response_buf[buf_sink->count] = '\0';
+    return taken;
+}
+
+/* stream body to sink, 'data' holds 'len' bytes already received after header, 'buf' is scratch of HTTPCLIENT_CHUNK_SIZE */
+static int httpclient_retrieve_body(httpclient_t *client, char *buf, char *data, int len, uint32_t timeout_ms,
+                                    httpclient_data_t *client_data, httpclient_body_cb_t sink, void *sink_ctx)
+{
+    int ret, consumed;
     iotx_time_t timer;
+    unsigned int deadLoopCount = 0;
+    unsigned int extendCount = 0;
+    const unsigned int MIN_TIMEOUT = 100;
+    const unsigned int MAX_RETRY_COUNT = 600;
 
     iotx_time_init(&timer);
     utils_time_countdown_ms(&timer, timeout_ms);
 
-    /* Receive data */
-    utils_debug("Current data: %s", data);
-
     client_data->is_more = IOT_TRUE;
 
-    /* the header is not received finished */
-    if (client_data->response_content_len == -1 && client_data->is_chunked == IOT_FALSE) {
-        /* can not enter this if */
-        while (1) {
-            int ret, max_len;
-            if (count + len < client_data->response_buf_len - 1) {
-                memcpy(client_data->response_buf + count, data, len);
-                count += len;
-                client_data->response_buf[count] = '\0';
-            } else {
-                memcpy(client_data->response_buf + count, data, client_data->response_buf_len - 1 - count);
-                client_data->response_buf[client_data->response_buf_len - 1] = '\0';
+    while (1) {
+        int max_len = HTTPCLIENT_CHUNK_SIZE - 1;
+        char *read_buf = buf;
+
+        if (len > 0) {
+            consumed = httpclient_body_feed(client_data, data, len, sink, sink_ctx);
+            if (consumed < 0) {
+                return consumed;
+            }
+            /* the rest belongs to next response, or is delivered by next call when sink is full */
+            if (SUCCESS_RETURN != httpclient_keep_pending(client, data + consumed, len - consumed)) {
+                return ERROR_HTTP;
+            }
+            if (consumed < len && HTTPCLIENT_BODY_DONE != client_data->body_state) {
                 return HTTP_RETRIEVE_MORE_DATA;
             }
+            len = 0;
+        }
 
-            /* try to read more header */
-            max_len = HTTPCLIENT_MIN(HTTPCLIENT_RAED_HEAD_SIZE, client_data->response_buf_len - 1 - count);
-            ret = httpclient_recv(client, data, 1, max_len, &len, iotx_time_left(&timer));
-
-            /* Receive data */
-            utils_debug("data len: %d %d", len, count);
+        if (HTTPCLIENT_BODY_DONE == client_data->body_state) {
+            utils_debug("no more data");
+            client_data->is_more = IOT_FALSE;
+            return SUCCESS_RETURN;
+        }
 
-            if (ret == ERROR_HTTP_CONN) {
-                utils_err("ret == ERROR_HTTP_CONN");
-                return ret;
-            }
+        if (HTTPCLIENT_BODY_DATA == client_data->body_state) {
+            /* never read beyond current content, next response may follow */
+            max_len = HTTPCLIENT_MIN(max_len, client_data->retrieve_len);
 
-            if (len == 0) {
-                /* read no more data */
-                utils_debug("no more len == 0");
-                client_data->is_more = IOT_FALSE;
-                return SUCCESS_RETURN;
-            }
-        }
-    }
+            if (sink == httpclient_buf_sink) {
+                httpclient_buf_sink_t *buf_sink = (httpclient_buf_sink_t *)sink_ctx;
+                int space = client_data->response_buf_len - 1 - buf_sink->count;
 
-    while (1) {
-        uint32_t readLen = 0;
-
-        if (client_data->is_chunked && client_data->retrieve_len <= 0) {
-            /* Read chunk header */
-            int foundCrlf;
-            int n;
-            do {
-                foundCrlf = IOT_FALSE;
-                crlf_pos = 0;
-                data[len] = 0;
-                if (len >= 2) {
-                    for (; crlf_pos < len - 2; crlf_pos++) {
-                        if (data[crlf_pos] == '\r' && data[crlf_pos + 1] == '\n') {
-                            foundCrlf = IOT_TRUE;
-                            break;
-                        }
-                    }
-                }
-                if (!foundCrlf) {
-                    /* Try to read more */
-                    if (len < HTTPCLIENT_CHUNK_SIZE) {
-                        int new_trf_len, ret;
-                        ret = httpclient_recv(client,
-                                              data + len,
-                                              0,
-                                              HTTPCLIENT_CHUNK_SIZE - len - 1,
-                                              &new_trf_len,
-                                              iotx_time_left(&timer));
-                        len += new_trf_len;
-                        if (ret == ERROR_HTTP_CONN) {
-                            return ret;
-                        } else {
-                            continue;
-                        }
-                    } else {
-                        return ERROR_HTTP;
-                    }
+                if (0 == space) {
+                    return HTTP_RETRIEVE_MORE_DATA;
                 }
-            } while (!foundCrlf);
-            data[crlf_pos] = '\0';
-
-            /* chunk length */
-            /* n = sscanf(data, "%x", &readLen); */
-
-            readLen = strtoul(data, NULL, 16);
-            n = (0 == readLen) ? 0 : 1;
-            client_data->retrieve_len = readLen;
-            client_data->response_content_len += client_data->retrieve_len;
-            if (readLen == 0) {
-                /* Last chunk */
-                client_data->is_more = IOT_FALSE;
-                utils_debug("no more (last chunk)");
+                /* receive body straight into response buffer */
+                read_buf = client_data->response_buf + buf_sink->count;
+                max_len = HTTPCLIENT_MIN(client_data->retrieve_len, space);
             }
+        }
 
-            if (n != 1) {
-                utils_err("Could not read chunk length");
-                return ERROR_HTTP_UNRESOLVED_DNS;
+        /* if timeout reduce to zero, it will be translated into NULL for select function in TLS lib */
+        /* it would lead to indenfinite behavior, so we avoid it */
+        if (iotx_time_left(&timer) < MIN_TIMEOUT) {
+            extendCount++;
+            utils_time_countdown_ms(&timer, MIN_TIMEOUT);
+            if (1 == extendCount % 100) {
+                utils_debug("extend countdown_ms to avoid NULL input to select, tired %d times", extendCount);
             }
-
-            memmove(data, &data[crlf_pos + 2], len - (crlf_pos + 2)); /* Not need to move NULL-terminating char any more */
-            len -= (crlf_pos + 2);
-        } else {
-            readLen = client_data->retrieve_len;
         }
 
-        utils_debug("Total-Payload: %d Bytes; Read: %d Bytes", readLen, len);
-        unsigned int deadLoopCount = 0;
-        unsigned int extendCount = 0;
-        const unsigned int MIN_TIMEOUT = 100;
-        const unsigned int MAX_RETRY_COUNT = 600;
-        do {
-            templen = HTTPCLIENT_MIN(len, readLen);
-            if (count + templen < client_data->response_buf_len - 1) {
-                memcpy(client_data->response_buf + count, data, templen);
-                count += templen;
-                client_data->response_buf[count] = '\0';
-                client_data->retrieve_len -= templen;
-            } else {
-                memcpy(client_data->response_buf + count, data, client_data->response_buf_len - 1 - count);
-                client_data->response_buf[client_data->response_buf_len - 1] = '\0';
-                client_data->retrieve_len -= (client_data->response_buf_len - 1 - count);
-                return HTTP_RETRIEVE_MORE_DATA;
-            }
+        data = buf;
+        ret = httpclient_recv(client, read_buf, 1, max_len, &len, iotx_time_left(&timer));
+        if (ret == ERROR_HTTP_CONN) {
+            return ret;
+        }
 
-            if (len > readLen) {
-                utils_debug("memmove %d %d %d\n", readLen, len, client_data->retrieve_len);
-                memmove(data, &data[readLen], len - readLen); /* chunk case, read between two chunks */
-                len -= readLen;
-                readLen = 0;
-                client_data->retrieve_len = 0;
-            } else {
-                readLen -= len;
+        /* if it falls into deadloop before reconnected to internet, we just quit*/
+        if ((0 == len) && (0 == iotx_time_left(&timer)) && (FAIL_RETURN == ret)) {
+            deadLoopCount++;
+            if (deadLoopCount > MAX_RETRY_COUNT) {
+                utils_err("deadloop detected, exit");
+                return ret;
             }
+        } else {
+            deadLoopCount = 0;
+        }
 
-            if (readLen) {
-                int ret;
-                int max_len = HTTPCLIENT_MIN(HTTPCLIENT_CHUNK_SIZE - 1, client_data->response_buf_len - 1 - count);
-                max_len = HTTPCLIENT_MIN(max_len, readLen);
-
-                /* if timeout reduce to zero, it will be translated into NULL for select function in TLS lib */
-                /* it would lead to indenfinite behavior, so we avoid it */
-                if (iotx_time_left(&timer) < MIN_TIMEOUT) {
-                    extendCount++;
-                    utils_time_countdown_ms(&timer, MIN_TIMEOUT);
-                    if (1 == extendCount % 100) {
-                        utils_debug("extend countdown_ms to avoid NULL input to select, tired %d times", extendCount);
-                    }
-                }
-
-                ret = httpclient_recv(client, data, 1, max_len, &len, iotx_time_left(&timer));
-                if (ret == ERROR_HTTP_CONN) {
-                    return ret;
-                }
-
-                /* if it falls into deadloop before reconnected to internet, we just quit*/
-                if ((0 == len) && (0 == iotx_time_left(&timer)) && (FAIL_RETURN == ret)) {
-                    deadLoopCount++;
-                    if (deadLoopCount > MAX_RETRY_COUNT) {
-                        utils_err("deadloop detected, exit");
-                        return ret;
-                    }
-                } else {
-                    deadLoopCount = 0;
-                }
+        /*if the internet connection is fixed during the loop, the download stream might be disconnected. we have to quit */
+        if ((0 == len) && (extendCount > 2 * MAX_RETRY_COUNT) && (FAIL_RETURN == ret)) {
+            utils_err("extend timer for too many times, exit");
+            return ERROR_HTTP_CONN;
+        }
 
-                /*if the internet connection is fixed during the loop, the download stream might be disconnected. we have to quit */
-                if ((0 == len) && (extendCount > 2 * MAX_RETRY_COUNT) && (FAIL_RETURN == ret)) {
-                    utils_err("extend timer for too many times, exit");
-                    return ERROR_HTTP_CONN;
-                }
+        if (read_buf != buf && len > 0) {
+            httpclient_buf_sink_t *buf_sink = (httpclient_buf_sink_t *)sink_ctx;
 
+            buf_sink->count += len;
+            client_data->response_buf[buf_sink->count] = '\0';
+            client_data->retrieve_len -= len;
+            if (0 == client_data->retrieve_len) {
+                client_data->body_state = client_data->is_chunked ? HTTPCLIENT_BODY_CHUNK_END : HTTPCLIENT_BODY_DONE;
             }
-        } while (readLen);
-
-        if (client_data->is_chunked) {
-            if (len < 2) {
-                int new_trf_len, ret;
-                /* Read missing chars to find end of chunk */
-                ret = httpclient_recv(client, data + len, 2 - len, HTTPCLIENT_CHUNK_SIZE - len - 1, &new_trf_len,
-                                      iotx_time_left(&timer));
-                if (ret == ERROR_HTTP_CONN) {
-                    return ret;
-                }
-                len += new_trf_len;
-            }
-            if ((data[0] != '\r') || (data[1] != '\n')) {
-                utils_err("Format error, %s", data); /* after memmove, the beginning of next chunk */
-                return ERROR_HTTP_UNRESOLVED_DNS;
-            }
-            memmove(data, &data[2], len - 2); /* remove the \r\n */
-            len -= 2;
-        } else {
-            utils_debug("no more (content-length)");
-            client_data->is_more = IOT_FALSE;
-            break;
+            len = 0;
         }
-
     }
-
-    return SUCCESS_RETURN;
 }
 
 int httpclient_response_parse(httpclient_t *client, char *data, int len, uint32_t timeout_ms,
-                              httpclient_data_t *client_data)
+                              httpclient_data_t *client_data, httpclient_body_cb_t sink, void *sink_ctx)
 {
     int crlf_pos;
     iotx_time_t timer;
+    char *buf = data;
     char *tmp_ptr, *ptr_body_end;
 
     int new_trf_len, ret;
@@ -702,8 +875,8 @@ int httpclient_response_parse(httpclient_t *client, char *data, int len, uint32_
 
     utils_debug("Reading headers: %s", data);
 
-    memmove(data, &data[crlf_pos + 2], len - (crlf_pos + 2) + 1); /* Be sure to move NULL-terminating char as well */
-    len -= (crlf_pos + 2);       /* remove status_line length */
+    data += crlf_pos + 2;        /* skip status_line */
+    len -= (crlf_pos + 2);
 
     client_data->is_chunked = IOT_FALSE;
 
@@ -711,7 +884,7 @@ int httpclient_response_parse(httpclient_t *client, char *data, int len, uint32_
     /* try to read more header again until find response head ending "\r\n\r\n" */
     while (NULL == (ptr_body_end = strstr(data, "\r\n\r\n"))) {
         /* try to read more header */
-        int max_remain_len = HTTPCLIENT_CHUNK_SIZE - len -1;
+        int max_remain_len = HTTPCLIENT_CHUNK_SIZE - (data - buf) - len - 1;
         if (max_remain_len <= 0) {
             utils_err("buffer exceeded max\n");
             return ERROR_HTTP_PARSE;
@@ -726,19 +899,33 @@ int httpclient_response_parse(httpclient_t *client, char *data, int len, uint32_
         data[len] = '\0';
     }
 
+    /* only search in headers */
+    *ptr_body_end = '\0';
+    client->conn_close = (NULL != strstr(data, "Connection: close") || NULL != strstr(data, "Connection: Close"));
+    client->range_start = -1;
+    if (NULL != (tmp_ptr = strstr(data, "Content-Range: bytes "))) {
+        client->range_start = atoi(tmp_ptr + strlen("Content-Range: bytes "));
+    }
+
     /* parse response_content_len */
+    client_data->chunk_len = 0;
     if (NULL != (tmp_ptr = strstr(data, "Content-Length"))) {
         client_data->response_content_len = atoi(tmp_ptr + strlen("Content-Length: "));
         client_data->retrieve_len = client_data->response_content_len;
+        client_data->body_state = (0 == client_data->retrieve_len) ? HTTPCLIENT_BODY_DONE : HTTPCLIENT_BODY_DATA;
     } else if (NULL != (tmp_ptr = strstr(data, "Transfer-Encoding"))) {
         int len_chunk = strlen("Chunked");
-        char *chunk_value = data + strlen("Transfer-Encoding: ");
+        char *chunk_value = tmp_ptr + strlen("Transfer-Encoding: ");
 
         if ((! memcmp(chunk_value, "Chunked", len_chunk))
             || (! memcmp(chunk_value, "chunked", len_chunk))) {
             client_data->is_chunked = IOT_TRUE;
             client_data->response_content_len = 0;
             client_data->retrieve_len = 0;
+            client_data->body_state = HTTPCLIENT_BODY_CHUNK_SIZE;
+        } else {
+            utils_err("Unsupported transfer encoding");
+            return ERROR_HTTP;
         }
     } else {
         utils_err("Could not parse header");
@@ -750,9 +937,9 @@ int httpclient_response_parse(httpclient_t *client, char *data, int len, uint32_
     /* if client_data->response_content_len != 0, it is know response length */
     /* the remain length is client_data->response_content_len - len */
     len = len - (ptr_body_end + 4 - data);
-    memmove(data, ptr_body_end + 4, len + 1);
     client_data->response_received_len += len;
-    return httpclient_retrieve_content(client, data, len, iotx_time_left(&timer), client_data);
+    return httpclient_retrieve_body(client, buf, ptr_body_end + 4, len, iotx_time_left(&timer), client_data, sink,
+                                    sink_ctx);
 }
 
 int httpclient_connect(httpclient_t *client)
@@ -793,7 +980,8 @@ int httpclient_send_request(httpclient_t *client, const char *url, HTTPCLIENT_RE
     return ret;
 }
 
-int httpclient_recv_response(httpclient_t *client, uint32_t timeout_ms, httpclient_data_t *client_data)
+static int httpclient_recv_response_internal(httpclient_t *client, uint32_t timeout_ms,
+        httpclient_data_t *client_data, httpclient_body_cb_t sink, void *sink_ctx)
 {
     int reclen = 0, ret = ERROR_HTTP_CONN;
     iotx_time_t timer;
@@ -814,8 +1002,7 @@ int httpclient_recv_response(httpclient_t *client, uint32_t timeout_ms, httpclie
     }
 
     if (client_data->is_more) {
-        client_data->response_buf[0] = '\0';
-        ret = httpclient_retrieve_content(client, buf, reclen, iotx_time_left(&timer), client_data);
+        ret = httpclient_retrieve_body(client, buf, buf, reclen, iotx_time_left(&timer), client_data, sink, sink_ctx);
     } else {
         client_data->is_more = 1;
         /* try to read header */
@@ -828,7 +1015,7 @@ int httpclient_recv_response(httpclient_t *client, uint32_t timeout_ms, httpclie
 
         if (reclen) {
             log_multi_line(LOG_DEBUG_LEVEL, "RESPONSE", "%s", buf, "<");
-            ret = httpclient_response_parse(client, buf, reclen, iotx_time_left(&timer), client_data);
+            ret = httpclient_response_parse(client, buf, reclen, iotx_time_left(&timer), client_data, sink, sink_ctx);
         }
     }
 
@@ -839,12 +1026,39 @@ err:
     return ret;
 }
 
+int httpclient_recv_response(httpclient_t *client, uint32_t timeout_ms, httpclient_data_t *client_data)
+{
+    httpclient_buf_sink_t buf_sink;
+
+    buf_sink.client_data = client_data;
+    buf_sink.count = 0;
+    client_data->response_buf[0] = '\0';
+
+    return httpclient_recv_response_internal(client, timeout_ms, client_data, httpclient_buf_sink, &buf_sink);
+}
+
+int httpclient_recv_response_stream(httpclient_t *client, uint32_t timeout_ms, httpclient_data_t *client_data,
+                                    httpclient_body_cb_t body_cb, void *user_data)
+{
+    if (NULL == body_cb) {
+        return ERROR_NULL_VALUE;
+    }
+
+    return httpclient_recv_response_internal(client, timeout_ms, client_data, body_cb, user_data);
+}
+
 void httpclient_close(httpclient_t *client)
 {
     if (client->net.handle > 0) {
         client->net.disconnect(&client->net);
     }
     client->net.handle = 0;
+    if (NULL != client->rx_pending) {
+        httpc_free(client->rx_pending);
+        client->rx_pending = NULL;
+    }
+    client->rx_pending_len = 0;
+    client->rx_pending_off = 0;
     utils_info("client disconnected");
 }
 
@@ -853,50 +1067,71 @@ int httpclient_common(httpclient_t *client, const char *url, int port, const cha
 {
     iotx_time_t timer;
     int ret = 0;
+    int reused = 0;
     char host[HTTPCLIENT_MAX_HOST_LEN] = { 0 };
 
     httpclient_parse_host(url, host, sizeof(host));
     utils_info("host: '%s', port: %d", host, port);
 
-    if (0 == client->net.handle) {
-        /* Establish connection if no. */
-        ret = iotx_net_init(&client->net, host, port, ca_crt);
-        if (0 != ret) {
-            return ret;
-        }
+    do {
+        if (0 == client->net.handle) {
+            reused = (client->keep_alive && 0 == httpclient_pool_acquire(client, host, port, ca_crt));
+            if (!reused) {
+                /* Establish connection if no. */
+                ret = iotx_net_init(&client->net, host, port, ca_crt);
+                if (0 != ret) {
+                    return ret;
+                }
 
-        ret = httpclient_connect(client);
-        if (0 != ret) {
-            utils_err("httpclient_connect is error, ret = %d", ret);
-            httpclient_close(client);
-            return ret;
-        }
+                ret = httpclient_connect(client);
+                if (0 != ret) {
+                    utils_err("httpclient_connect is error, ret = %d", ret);
+                    httpclient_close(client);
+                    return ret;
+                }
+            }
 
-        ret = httpclient_send_request(client, url, method, client_data);
-        if (0 != ret) {
-            utils_err("httpclient_send_request is error, ret = %d", ret);
-            httpclient_close(client);
-            return ret;
+            ret = httpclient_send_request(client, url, method, client_data);
+            if (0 != ret) {
+                utils_err("httpclient_send_request is error, ret = %d", ret);
+                httpclient_close(client);
+                if (reused) {
+                    /* server closed the idle connection, retry on a new one */
+                    reused = 0;
+                    continue;
+                }
+                return ret;
+            }
         }
-    }
-
-    iotx_time_init(&timer);
-    utils_time_countdown_ms(&timer, timeout_ms);
 
-    if ((NULL != client_data->response_buf)
-        && (0 != client_data->response_buf_len)) {
-        ret = httpclient_recv_response(client, iotx_time_left(&timer), client_data);
-        if (ret < 0) {
-            utils_err("httpclient_recv_response is error,ret = %d", ret);
-            httpclient_close(client);
-            return ret;
+        iotx_time_init(&timer);
+        utils_time_countdown_ms(&timer, timeout_ms);
+
+        if ((NULL != client_data->response_buf)
+            && (0 != client_data->response_buf_len)) {
+            ret = httpclient_recv_response(client, iotx_time_left(&timer), client_data);
+            if (ret < 0) {
+                utils_err("httpclient_recv_response is error,ret = %d", ret);
+                httpclient_close(client);
+                if (reused && ERROR_HTTP_CONN == ret) {
+                    reused = 0;
+                    client_data->is_more = IOT_FALSE;
+                    continue;
+                }
+                return ret;
+            }
         }
-    }
+        break;
+    } while (1);
 
     if (! client_data->is_more) {
-        /* Close the HTTP if no more data. */
-        utils_info("close http channel");
-        httpclient_close(client);
+        if (client->keep_alive && !client->conn_close) {
+            httpclient_pool_release(client, host, port, ca_crt);
+        } else {
+            /* Close the HTTP if no more data. */
+            utils_info("close http channel");
+            httpclient_close(client);
+        }
     }
 
     ret = 0;
@@ -916,32 +1151,44 @@ int iotx_post(httpclient_t *client,
 {
     /* return httpclient_common(client, url, port, ca_crt, HTTPCLIENT_POST, timeout_ms, client_data); */
     int ret = ERROR_HTTP;
+    int reused = 0;
     char host[HTTPCLIENT_MAX_HOST_LEN] = { 0 };
 
     httpclient_parse_host(url, host, sizeof(host));
     utils_info("host: '%s', port: %d", host, port);
 
-    if (0 == client->net.handle) {
-        /* Establish connection if no. */
-        ret = iotx_net_init(&client->net, host, port, ca_crt);
-        if (0 != ret) {
-            return ret;
+    do {
+        if (0 == client->net.handle) {
+            reused = (client->keep_alive && 0 == httpclient_pool_acquire(client, host, port, ca_crt));
+            if (!reused) {
+                /* Establish connection if no. */
+                ret = iotx_net_init(&client->net, host, port, ca_crt);
+                if (0 != ret) {
+                    return ret;
+                }
+
+                ret = httpclient_connect(client);
+                if (0 != ret) {
+                    utils_err("httpclient_connect is error, ret = %d", ret);
+                    httpclient_close(client);
+                    return ret;
+                }
+            }
         }
 
-        ret = httpclient_connect(client);
+        ret = httpclient_send_request(client, url, HTTPCLIENT_POST, client_data);
         if (0 != ret) {
-            utils_err("httpclient_connect is error, ret = %d", ret);
+            utils_err("httpclient_send_request is error, ret = %d", ret);
             httpclient_close(client);
+            if (reused) {
+                /* server closed the idle connection, retry on a new one */
+                reused = 0;
+                continue;
+            }
             return ret;
         }
-    }
-
-    ret = httpclient_send_request(client, url, HTTPCLIENT_POST, client_data);
-    if (0 != ret) {
-        utils_err("httpclient_send_request is error, ret = %d", ret);
-        httpclient_close(client);
-        return ret;
-    }
+        break;
+    } while (1);
 
     return ret;
 }
@@ -73,13 +73,32 @@ typedef struct {
     char               *header;         /**< Custom header. */
     char               *auth_user;      /**< Username for basic authentication. */
     char               *auth_password;  /**< Password for basic authentication. */
+    int                 keep_alive;     /**< Put connection into pool instead of closing it, when response finished. */
+    int                 conn_close;     /**< Server announced 'Connection: close' in the last response. */
+    int                 range_start;    /**< First byte position in 'Content-Range' of the last response, -1 if absent. */
+    char               *rx_pending;     /**< Bytes received beyond the last response, kept for the next one. */
+    int                 rx_pending_len; /**< Length of rx_pending. */
+    int                 rx_pending_off; /**< Offset of the first pending byte in rx_pending. */
 } httpclient_t;
 
+/** @brief   This enumeration defines the state of response body decoding.  */
+typedef enum {
+    HTTPCLIENT_BODY_DATA = 0,       /**< Inside content, or inside data of a chunk. */
+    HTTPCLIENT_BODY_CHUNK_SIZE,     /**< Reading hex size of a chunk. */
+    HTTPCLIENT_BODY_CHUNK_EXT,      /**< Skipping chunk extension until end of size line. */
+    HTTPCLIENT_BODY_CHUNK_END,      /**< Expecting CRLF after data of a chunk. */
+    HTTPCLIENT_BODY_TRAILER,        /**< After last chunk, at beginning of a trailer line. */
+    HTTPCLIENT_BODY_TRAILER_LINE,   /**< Skipping a trailer field line. */
+    HTTPCLIENT_BODY_DONE            /**< Whole body received. */
+} HTTPCLIENT_BODY_STATE;
+
 /** @brief   This structure defines the HTTP data structure.  */
 typedef struct {
     int     is_more;                /**< Indicates if more data needs to be retrieved. */
     int     is_chunked;             /**< Response data is encoded in portions/chunks.*/
     int     retrieve_len;           /**< Content length to be retrieved. */
+    int     body_state;             /**< Decoding state of response body, see HTTPCLIENT_BODY_STATE. */
+    int     chunk_len;              /**< Chunk size parsed so far. */
     int     response_content_len;   /**< Response content length. */
     int     response_received_len;  /**< Response have received length. */
     int     post_buf_len;           /**< Post data length. */
@@ -95,13 +114,51 @@ int iotx_post(httpclient_t *client,
               const char *ca_crt,
               httpclient_data_t *client_data);
 
+int httpclient_send_request(httpclient_t *client, const char *url, HTTPCLIENT_REQUEST_TYPE method,
+                            httpclient_data_t *client_data);
+
 int httpclient_recv_response(httpclient_t *client, uint32_t timeout_ms, httpclient_data_t *client_data);
 
+/**
+ * @brief Body callback of #httpclient_recv_response_stream().
+ *
+ * @return bytes taken, less than len to pause receiving; < 0 to abort.
+ */
+typedef int (*httpclient_body_cb_t)(void *user_data, const char *data, int len);
+
+/**
+ * @brief Same as #httpclient_recv_response(), but response body is handed to body_cb as it arrives
+ *        instead of being copied into client_data->response_buf. Chunked encoding is decoded already.
+ *
+ * @return 0, body finished; 1, body_cb paused receiving, call again for the rest; < 0, error.
+ */
+int httpclient_recv_response_stream(httpclient_t *client, uint32_t timeout_ms, httpclient_data_t *client_data,
+                                    httpclient_body_cb_t body_cb, void *user_data);
+
 int httpclient_common(httpclient_t *client, const char *url, int port, const char *ca_crt,
                       HTTPCLIENT_REQUEST_TYPE method, uint32_t timeout_ms, httpclient_data_t *client_data);
 
 void httpclient_close(httpclient_t *client);
 
+/**
+ * @brief Take an idle keep-alive connection to host:port out of the pool.
+ *
+ * @return 0, client->net is a connected network now; -1, no usable connection in pool.
+ */
+int httpclient_pool_acquire(httpclient_t *client, const char *host, int port, const char *ca_crt);
+
+/**
+ * @brief Put the connection of client into the pool, the oldest idle one is closed when pool is full.
+ *        Connections idle longer than HTTPCLIENT_POOL_IDLE_MS are closed on each acquire and release.
+ *        client->net is detached from the connection afterwards.
+ */
+void httpclient_pool_release(httpclient_t *client, const char *host, int port, const char *ca_crt);
+
+/**
+ * @brief Close all idle connections in the pool.
+ */
+void httpclient_pool_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
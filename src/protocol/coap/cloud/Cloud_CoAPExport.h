@@ -17,6 +17,19 @@
 #define COAP_MSG_MAX_PATH_LEN     32
 #define COAP_MSG_MAX_PDU_LEN      1280
 
+/* largest block of a block-wise transfer, 2^(SZX + 4) bytes */
+#ifndef COAP_MSG_BLOCK_SZX
+    #define COAP_MSG_BLOCK_SZX    6
+#endif
+
+/* largest payload sent or reassembled with block-wise transfer */
+#ifndef COAP_MSG_MAX_BODY_LEN
+    #define COAP_MSG_MAX_BODY_LEN (16 * 1024)
+#endif
+
+/* buckets of the message id and token index of the send list */
+#define COAP_SENDLIST_HASH_NUM    16
+
 /*CoAP Content Type*/
 #define COAP_CT_TEXT_PLAIN                 0   /* text/plain (UTF-8) */
 #define COAP_CT_APP_LINK_FORMAT           40   /* application/link-format */
@@ -136,18 +149,35 @@ typedef void (*Cloud_CoAPRespMsgHandler)(void *data, void *message);
 
 typedef void (*Cloud_CoAPEventNotifier)(unsigned int event, void *p_message);
 
+/* state of a block-wise (RFC 7959) request */
 typedef struct {
+    unsigned char           *request;       /* whole serialized request, payload not split */
+    unsigned short           reqlen;
+    unsigned int             block1;        /* num of the Block1 being sent */
+    unsigned char            szx1;
+    unsigned int             block2;        /* num of the Block2 asked for, 0 while uploading */
+    unsigned char            szx2;
+    unsigned char           *body;          /* Block2 payload received so far */
+    unsigned short           bodylen;
+} Cloud_CoAPBlockXfer;
+
+typedef struct _Cloud_CoAPSendNode {
     void                    *user;
     unsigned short           msgid;
     char                     acked;
+    char                     confirmable;
     unsigned char            tokenlen;
     unsigned char            token[8];
     unsigned char            retrans_count;
-    unsigned short           timeout;
-    unsigned short           timeout_val;
+    unsigned int             timeout;       /* current retransmit timeout, in ms */
+    uint64_t                 due;           /* HAL_UptimeMs() of the next retransmit or of giving up */
+    unsigned short           heap_index;
     unsigned char           *message;
     unsigned int             msglen;
+    Cloud_CoAPBlockXfer     *block;
     Cloud_CoAPRespMsgHandler       handler;
+    struct _Cloud_CoAPSendNode *msgid_next;
+    struct _Cloud_CoAPSendNode *token_next;
     struct list_head         sendlist;
 } Cloud_CoAPSendNode;
 
@@ -155,6 +185,9 @@ typedef struct {
     unsigned char            count;
     unsigned char            maxcount;
     struct list_head         sendlist;
+    Cloud_CoAPSendNode     **heap;          /* min-heap of the nodes by due time, maxcount slots */
+    Cloud_CoAPSendNode      *msgid_hash[COAP_SENDLIST_HASH_NUM];
+    Cloud_CoAPSendNode      *token_hash[COAP_SENDLIST_HASH_NUM];
 } Cloud_CoAPSendList;
 
 
@@ -18,6 +18,7 @@
 #define COAP_DEFAULT_SCHEME         "coap" /* the default scheme for CoAP URIs */
 #define COAP_DEFAULT_HOST_LEN       128
 #define COAP_DEFAULT_WAIT_TIME_MS   2000
+#define COAP_DEFAULT_MAX_COUNT      10
 
 unsigned int Cloud_CoAPUri_parse(char *p_uri, coap_endpoint_type *p_endpoint_type,
                            char host[COAP_DEFAULT_HOST_LEN], unsigned short *port)
@@ -161,7 +162,16 @@ Cloud_CoAPContext *Cloud_CoAPContext_create(Cloud_CoAPInitParam *param)
     /*CoAP message send list*/
     INIT_LIST_HEAD(&p_ctx->list.sendlist);
     p_ctx->list.count = 0;
-    p_ctx->list.maxcount = param->maxcount;
+    if (0 == param->maxcount) {
+        p_ctx->list.maxcount = COAP_DEFAULT_MAX_COUNT;
+    } else {
+        p_ctx->list.maxcount = param->maxcount;
+    }
+    p_ctx->list.heap = coap_malloc(p_ctx->list.maxcount * sizeof(Cloud_CoAPSendNode *));
+    if (NULL == p_ctx->list.heap) {
+        COAP_ERR("not enough memory");
+        goto err;
+    }
 
     /*set the endpoint type by uri schema*/
     if (NULL != param->url) {
@@ -207,6 +217,11 @@ err:
         p_ctx->sendbuf = NULL;
     }
 
+    if (NULL != p_ctx->list.heap) {
+        coap_free(p_ctx->list.heap);
+        p_ctx->list.heap = NULL;
+    }
+
     coap_free(p_ctx);
     p_ctx = NULL;
 
@@ -229,6 +244,16 @@ void Cloud_CoAPContext_free(Cloud_CoAPContext *p_ctx)
                 coap_free(cur->message);
                 cur->message = NULL;
             }
+            if (NULL != cur->block) {
+                if (NULL != cur->block->request) {
+                    coap_free(cur->block->request);
+                }
+                if (NULL != cur->block->body) {
+                    coap_free(cur->block->body);
+                }
+                coap_free(cur->block);
+                cur->block = NULL;
+            }
             coap_free(cur);
             cur = NULL;
         }
@@ -244,6 +269,10 @@ void Cloud_CoAPContext_free(Cloud_CoAPContext *p_ctx)
         p_ctx->sendbuf = NULL;
     }
 
+    if (NULL != p_ctx->list.heap) {
+        coap_free(p_ctx->list.heap);
+        p_ctx->list.heap = NULL;
+    }
 
     if (NULL != p_ctx) {
         coap_free(p_ctx);
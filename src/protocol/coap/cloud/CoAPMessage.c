@@ -37,12 +37,27 @@
 
 
 #define COAP_CUR_VERSION        1
-#define COAP_WAIT_TIME_MS       2000
 #define COAP_MAX_MESSAGE_ID     65535
 #define COAP_MAX_RETRY_COUNT    4
-#define COAP_ACK_TIMEOUT        2
-#define COAP_ACK_RANDOM_FACTOR  1
-#define COAP_MAX_TRANSMISSION_SPAN   10
+
+/* RFC 7252 4.8, the first timeout is ACK_TIMEOUT scaled by up to ACK_RANDOM_FACTOR 1.5 */
+#define COAP_ACK_TIMEOUT_MS         2000
+#define COAP_ACK_RANDOM_MS          (COAP_ACK_TIMEOUT_MS / 2)
+
+/* how long an acked request waits for its separate response */
+#define COAP_MAX_TRANSMIT_SPAN_MS   45000
+
+/* how long a NON request waits for its response */
+#ifndef COAP_NON_LIFETIME_MS
+    #define COAP_NON_LIFETIME_MS    20000
+#endif
+
+#define COAP_BLOCK_SIZE(szx)        (1 << ((szx) + 4))
+
+/* a Block option plus the growth of the delta of the option behind it */
+#define COAP_BLOCK_OPTION_MAX_LEN   6
+
+#define COAP_MSGID_HASH(msgid)      ((msgid) % COAP_SENDLIST_HASH_NUM)
 
 int Cloud_CoAPStrOption_add(Cloud_CoAPMessage *message, unsigned short optnum, unsigned char *data,
                             unsigned short datalen)
@@ -109,7 +124,10 @@ int Cloud_CoAPUintOption_add(Cloud_CoAPMessage *message, unsigned short  optnum,
 unsigned short Cloud_CoAPMessageId_gen(Cloud_CoAPContext *context)
 {
     unsigned short msg_id = 0;
-    msg_id = ((COAP_MAX_MESSAGE_ID == context->message_id)  ? 1 : context->message_id++);
+    if (COAP_MAX_MESSAGE_ID == context->message_id) {
+        context->message_id = 1;
+    }
+    msg_id = context->message_id++;
     return msg_id;
 }
 
@@ -228,58 +246,482 @@ int Cloud_CoAPMessage_destory(Cloud_CoAPMessage *message)
     return COAP_SUCCESS;
 }
 
-static int Cloud_CoAPMessageList_add(Cloud_CoAPContext *context, Cloud_CoAPMessage *message, int len)
+static unsigned int Cloud_CoAPToken_hash(unsigned char *token, unsigned char tokenlen)
+{
+    unsigned int hash = 0;
+
+    while (tokenlen--) {
+        hash = hash * 31 + *token++;
+    }
+    return hash % COAP_SENDLIST_HASH_NUM;
+}
+
+static void Cloud_CoAPMsgId_link(Cloud_CoAPSendList *list, Cloud_CoAPSendNode *node)
+{
+    Cloud_CoAPSendNode **bucket = &list->msgid_hash[COAP_MSGID_HASH(node->msgid)];
+
+    node->msgid_next = *bucket;
+    *bucket = node;
+}
+
+static void Cloud_CoAPMsgId_unlink(Cloud_CoAPSendList *list, Cloud_CoAPSendNode *node)
+{
+    Cloud_CoAPSendNode **pnode = &list->msgid_hash[COAP_MSGID_HASH(node->msgid)];
+
+    while (NULL != *pnode) {
+        if (*pnode == node) {
+            *pnode = node->msgid_next;
+            break;
+        }
+        pnode = &(*pnode)->msgid_next;
+    }
+    node->msgid_next = NULL;
+}
+
+static Cloud_CoAPSendNode *Cloud_CoAPMsgId_find(Cloud_CoAPSendList *list, unsigned short msgid)
+{
+    Cloud_CoAPSendNode *node = list->msgid_hash[COAP_MSGID_HASH(msgid)];
+
+    while (NULL != node && node->msgid != msgid) {
+        node = node->msgid_next;
+    }
+    return node;
+}
+
+static void Cloud_CoAPToken_link(Cloud_CoAPSendList *list, Cloud_CoAPSendNode *node)
+{
+    Cloud_CoAPSendNode **bucket = NULL;
+
+    if (0 == node->tokenlen) {
+        return;
+    }
+    bucket = &list->token_hash[Cloud_CoAPToken_hash(node->token, node->tokenlen)];
+    node->token_next = *bucket;
+    *bucket = node;
+}
+
+static void Cloud_CoAPToken_unlink(Cloud_CoAPSendList *list, Cloud_CoAPSendNode *node)
+{
+    Cloud_CoAPSendNode **pnode = NULL;
+
+    if (0 == node->tokenlen) {
+        return;
+    }
+    pnode = &list->token_hash[Cloud_CoAPToken_hash(node->token, node->tokenlen)];
+    while (NULL != *pnode) {
+        if (*pnode == node) {
+            *pnode = node->token_next;
+            break;
+        }
+        pnode = &(*pnode)->token_next;
+    }
+    node->token_next = NULL;
+}
+
+static Cloud_CoAPSendNode *Cloud_CoAPToken_find(Cloud_CoAPSendList *list, unsigned char *token,
+        unsigned char tokenlen)
+{
+    Cloud_CoAPSendNode *node = list->token_hash[Cloud_CoAPToken_hash(token, tokenlen)];
+
+    while (NULL != node) {
+        if (node->tokenlen == tokenlen && 0 == memcmp(node->token, token, tokenlen)) {
+            break;
+        }
+        node = node->token_next;
+    }
+    return node;
+}
+
+static void Cloud_CoAPSendHeap_swap(Cloud_CoAPSendList *list, int a, int b)
+{
+    Cloud_CoAPSendNode *node = list->heap[a];
+
+    list->heap[a] = list->heap[b];
+    list->heap[b] = node;
+    list->heap[a]->heap_index = a;
+    list->heap[b]->heap_index = b;
+}
+
+/* restore the heap order after the due time of the node at index changed */
+static void Cloud_CoAPSendHeap_fix(Cloud_CoAPSendList *list, int index)
+{
+    int child = 0;
+
+    while (0 < index && list->heap[index]->due < list->heap[(index - 1) / 2]->due) {
+        Cloud_CoAPSendHeap_swap(list, index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+
+    while (1) {
+        child = 2 * index + 1;
+        if (child >= list->count) {
+            break;
+        }
+        if (child + 1 < list->count && list->heap[child + 1]->due < list->heap[child]->due) {
+            child++;
+        }
+        if (list->heap[index]->due <= list->heap[child]->due) {
+            break;
+        }
+        Cloud_CoAPSendHeap_swap(list, index, child);
+        index = child;
+    }
+}
+
+/* start the retransmission timer of a message sent for the first time */
+static void Cloud_CoAPSendNode_arm(Cloud_CoAPSendNode *node)
+{
+    node->acked         = 0;
+    node->retrans_count = 0;
+    if (node->confirmable) {
+        node->timeout   = COAP_ACK_TIMEOUT_MS + HAL_Random(COAP_ACK_RANDOM_MS);
+    } else {
+        node->timeout   = COAP_NON_LIFETIME_MS;
+    }
+    node->due = HAL_UptimeMs() + node->timeout;
+}
+
+static void Cloud_CoAPBlockXfer_free(Cloud_CoAPBlockXfer *xfer)
+{
+    if (NULL != xfer->request) {
+        coap_free(xfer->request);
+    }
+    if (NULL != xfer->body) {
+        coap_free(xfer->body);
+    }
+    coap_free(xfer);
+}
+
+static Cloud_CoAPBlockXfer *Cloud_CoAPBlockXfer_create(unsigned short reqlen)
 {
+    Cloud_CoAPBlockXfer *xfer = NULL;
+
+    xfer = coap_malloc(sizeof(Cloud_CoAPBlockXfer));
+    if (NULL == xfer) {
+        return NULL;
+    }
+    memset(xfer, 0x00, sizeof(Cloud_CoAPBlockXfer));
+
+    xfer->request = coap_malloc(reqlen);
+    if (NULL == xfer->request) {
+        coap_free(xfer);
+        return NULL;
+    }
+    xfer->reqlen = reqlen;
+
+    return xfer;
+}
+
+static int Cloud_CoAPMessageList_add(Cloud_CoAPContext *context, Cloud_CoAPMessage *message, int len,
+                                     Cloud_CoAPBlockXfer *block)
+{
+    Cloud_CoAPSendList *list = &context->list;
     Cloud_CoAPSendNode *node = NULL;
+
     node = coap_malloc(sizeof(Cloud_CoAPSendNode));
+    if (NULL == node) {
+        return COAP_ERROR_NULL;
+    }
+    memset(node, 0x00, sizeof(Cloud_CoAPSendNode));
 
-    if (NULL != node) {
-        node->acked        = 0;
-        node->user         = message->user;
-        node->msgid        = message->header.msgid;
-        node->handler      = message->handler;
-        node->msglen       = len;
-        node->timeout_val   = COAP_ACK_TIMEOUT * COAP_ACK_RANDOM_FACTOR;
-
-        if (COAP_MESSAGE_TYPE_CON == message->header.type) {
-            node->timeout       = node->timeout_val;
-            node->retrans_count = 0;
-        } else {
-            node->timeout       = COAP_MAX_TRANSMISSION_SPAN;
-            node->retrans_count = COAP_MAX_RETRY_COUNT;
+    node->message = (unsigned char *)coap_malloc(len);
+    if (NULL == node->message) {
+        coap_free(node);
+        return COAP_ERROR_NULL;
+    }
+    memcpy(node->message, context->sendbuf, len);
+    node->msglen       = len;
+    node->user         = message->user;
+    node->msgid        = message->header.msgid;
+    node->handler      = message->handler;
+    node->confirmable  = (COAP_MESSAGE_TYPE_CON == message->header.type);
+    node->tokenlen     = message->header.tokenlen;
+    memcpy(node->token, message->token, message->header.tokenlen);
+    node->block        = block;
+    Cloud_CoAPSendNode_arm(node);
+
+    list_add_tail(&node->sendlist, &list->sendlist);
+    Cloud_CoAPMsgId_link(list, node);
+    Cloud_CoAPToken_link(list, node);
+    node->heap_index = list->count;
+    list->heap[list->count++] = node;
+    Cloud_CoAPSendHeap_fix(list, node->heap_index);
+
+    return COAP_SUCCESS;
+}
+
+static void Cloud_CoAPMessageList_del(Cloud_CoAPContext *context, Cloud_CoAPSendNode *node)
+{
+    Cloud_CoAPSendList *list = &context->list;
+    int index = node->heap_index;
+
+    list_del_init(&node->sendlist);
+    Cloud_CoAPMsgId_unlink(list, node);
+    Cloud_CoAPToken_unlink(list, node);
+    list->count--;
+    if (index != list->count) {
+        list->heap[index] = list->heap[list->count];
+        list->heap[index]->heap_index = index;
+        Cloud_CoAPSendHeap_fix(list, index);
+    }
+
+    if (NULL != node->message) {
+        coap_free(node->message);
+    }
+    if (NULL != node->block) {
+        Cloud_CoAPBlockXfer_free(node->block);
+    }
+    coap_free(node);
+}
+
+/* encode the num/M/SZX value of a Block1 or Block2 option, returns its length */
+static unsigned short Cloud_CoAPBlockOption_encode(unsigned int num, int more, unsigned char szx,
+        unsigned char value[3])
+{
+    unsigned int data = (num << 4) | (more ? 0x08 : 0x00) | (szx & 0x07);
+
+    if (0 == data) {
+        return 0;
+    } else if (0xFF >= data) {
+        value[0] = (unsigned char)data;
+        return 1;
+    } else if (0xFFFF >= data) {
+        value[0] = (unsigned char)(data >> 8);
+        value[1] = (unsigned char)data;
+        return 2;
+    }
+    value[0] = (unsigned char)(data >> 16);
+    value[1] = (unsigned char)(data >> 8);
+    value[2] = (unsigned char)data;
+    return 3;
+}
+
+/* find and decode the Block1 or Block2 option of a received message */
+static int Cloud_CoAPBlockOption_get(Cloud_CoAPMessage *message, unsigned short optnum,
+                                     unsigned int *num, int *more, unsigned char *szx)
+{
+    int i = 0;
+    int j = 0;
+    unsigned int data = 0;
+
+    for (i = 0; i < message->optnum; i++) {
+        if (optnum != message->options[i].num) {
+            continue;
+        }
+        if (3 < message->options[i].len) {
+            return COAP_ERROR_INVALID_LENGTH;
         }
-        node->tokenlen     = message->header.tokenlen;
-        memcpy(node->token, message->token, message->header.tokenlen);
-        node->message      = (unsigned char *)coap_malloc(len);
-        if (NULL != node->message) {
-            memcpy(node->message, context->sendbuf, len);
+        for (j = 0; j < message->options[i].len; j++) {
+            data = (data << 8) | message->options[i].val[j];
         }
+        /* SZX 7 is reserved for BERT over TCP */
+        if (0x07 == (data & 0x07)) {
+            return COAP_ERROR_INVALID_PARAM;
+        }
+        *num  = data >> 4;
+        *more = (data >> 3) & 0x01;
+        *szx  = data & 0x07;
+        return COAP_SUCCESS;
+    }
+
+    return COAP_ERROR_NOT_FOUND;
+}
+
+static int Cloud_CoAPOption_append(Cloud_CoAPMessage *message, Cloud_CoAPMsgOption *option)
+{
+    if (COAP_MSG_MAX_OPTION_NUM <= message->optnum) {
+        return COAP_ERROR_INVALID_PARAM;
+    }
 
-        if (&context->list.count >= &context->list.maxcount) {
-            coap_free(node);
+    message->options[message->optnum].num = option->num - message->optdelta;
+    message->options[message->optnum].len = option->len;
+    message->options[message->optnum].val = option->val;
+    message->optdelta = option->num;
+    message->optnum ++;
+
+    return COAP_SUCCESS;
+}
+
+/*
+ * Serialize the current block of a block-wise request into buf: a slice of the
+ * request payload with Block1 while uploading, or the request without payload
+ * and with Block2 when asking for the next block of the response.
+ */
+static int Cloud_CoAPBlock_build(Cloud_CoAPBlockXfer *xfer, unsigned short msgid, unsigned char *buf)
+{
+    int i = 0;
+    int more = 0;
+    int added = 0;
+    unsigned int offset = 0;
+    unsigned char value[3];
+    Cloud_CoAPMsgOption blockopt;
+    Cloud_CoAPMessage request;
+    Cloud_CoAPMessage block;
+
+    memset(&request, 0x00, sizeof(Cloud_CoAPMessage));
+    if (COAP_SUCCESS != Cloud_CoAPDeserialize_Message(&request, xfer->request, xfer->reqlen)) {
+        return -1;
+    }
+
+    /* option values point into xfer->request, so the block is never destoried */
+    Cloud_CoAPMessage_init(&block);
+    block.header = request.header;
+    block.header.msgid = msgid;
+    memcpy(block.token, request.token, request.header.tokenlen);
+
+    if (0 == xfer->block2) {
+        offset = xfer->block1 * COAP_BLOCK_SIZE(xfer->szx1);
+        if (offset >= request.payloadlen) {
             return -1;
-        } else {
-            list_add_tail(&node->sendlist, &context->list.sendlist);
-            context->list.count ++;
-            return 0;
         }
+        block.payload = request.payload + offset;
+        block.payloadlen = request.payloadlen - offset;
+        if (COAP_BLOCK_SIZE(xfer->szx1) < block.payloadlen) {
+            block.payloadlen = COAP_BLOCK_SIZE(xfer->szx1);
+            more = 1;
+        }
+        blockopt.num = COAP_OPTION_BLOCK1;
+        blockopt.len = Cloud_CoAPBlockOption_encode(xfer->block1, more, xfer->szx1, value);
     } else {
+        blockopt.num = COAP_OPTION_BLOCK2;
+        blockopt.len = Cloud_CoAPBlockOption_encode(xfer->block2, 0, xfer->szx2, value);
+    }
+    blockopt.val = value;
+
+    /* the deserializer gives absolute option numbers, the serializer wants deltas */
+    for (i = 0; i < request.optnum; i++) {
+        if (COAP_OPTION_BLOCK1 == request.options[i].num || COAP_OPTION_BLOCK2 == request.options[i].num) {
+            continue;
+        }
+        if (!added && request.options[i].num > blockopt.num) {
+            if (COAP_SUCCESS != Cloud_CoAPOption_append(&block, &blockopt)) {
+                return -1;
+            }
+            added = 1;
+        }
+        if (COAP_SUCCESS != Cloud_CoAPOption_append(&block, &request.options[i])) {
+            return -1;
+        }
+    }
+    if (!added && COAP_SUCCESS != Cloud_CoAPOption_append(&block, &blockopt)) {
         return -1;
     }
+
+    if (COAP_MSG_MAX_PDU_LEN < Cloud_CoAPSerialize_MessageLength(&block)) {
+        return -1;
+    }
+    return Cloud_CoAPSerialize_Message(&block, buf, COAP_MSG_MAX_PDU_LEN);
+}
+
+/* send the current block of the transfer of node, each block is a new message with the same token */
+static int Cloud_CoAPBlock_next(Cloud_CoAPContext *context, Cloud_CoAPSendNode *node)
+{
+    int len = 0;
+    unsigned char *message = NULL;
+
+    Cloud_CoAPMsgId_unlink(&context->list, node);
+    node->msgid = Cloud_CoAPMessageId_gen(context);
+    Cloud_CoAPMsgId_link(&context->list, node);
+
+    len = Cloud_CoAPBlock_build(node->block, node->msgid, context->sendbuf);
+    if (0 >= len) {
+        return COAP_ERROR_INVALID_LENGTH;
+    }
+    message = (unsigned char *)coap_malloc(len);
+    if (NULL == message) {
+        return COAP_ERROR_NULL;
+    }
+    memcpy(message, context->sendbuf, len);
+    coap_free(node->message);
+    node->message = message;
+    node->msglen  = len;
+
+    Cloud_CoAPSendNode_arm(node);
+    Cloud_CoAPSendHeap_fix(&context->list, node->heap_index);
+
+    COAP_DEBUG("Send block1 %d block2 %d, message id %d len %d",
+               node->block->block1, node->block->block2, node->msgid, len);
+    return Cloud_CoAPNetwork_write(&context->network, node->message, node->msglen);
+}
+
+/* send a request too large for one PDU with Block1, in the largest blocks that fit */
+static int Cloud_CoAPBlockMessage_send(Cloud_CoAPContext *context, Cloud_CoAPMessage *message,
+                                       unsigned short msglen)
+{
+    int ret = COAP_SUCCESS;
+    int len = 0;
+    unsigned short hdrlen = msglen - message->payloadlen;
+    Cloud_CoAPBlockXfer *xfer = NULL;
+
+    xfer = Cloud_CoAPBlockXfer_create(msglen);
+    if (NULL == xfer) {
+        return COAP_ERROR_NULL;
+    }
+    xfer->reqlen = Cloud_CoAPSerialize_Message(message, xfer->request, msglen);
+
+    xfer->szx1 = COAP_MSG_BLOCK_SZX;
+    while (0 < xfer->szx1
+           && COAP_MSG_MAX_PDU_LEN < hdrlen + COAP_BLOCK_OPTION_MAX_LEN + COAP_BLOCK_SIZE(xfer->szx1)) {
+        xfer->szx1--;
+    }
+    if (COAP_MSG_MAX_PDU_LEN < hdrlen + COAP_BLOCK_OPTION_MAX_LEN + COAP_BLOCK_SIZE(xfer->szx1)) {
+        COAP_INFO("The message header length %d is too loog", hdrlen);
+        ret = COAP_ERROR_DATA_SIZE;
+        goto err;
+    }
+
+    len = Cloud_CoAPBlock_build(xfer, message->header.msgid, context->sendbuf);
+    if (0 >= len) {
+        ret = COAP_ERROR_INVALID_LENGTH;
+        goto err;
+    }
+    COAP_DEBUG("Send the %d bytes payload in blocks of %d bytes", message->payloadlen,
+               COAP_BLOCK_SIZE(xfer->szx1));
+
+    ret = Cloud_CoAPNetwork_write(&context->network, context->sendbuf, (unsigned int)len);
+    if (COAP_SUCCESS != ret) {
+        COAP_ERR("CoAP transport write failed, return %d", ret);
+        goto err;
+    }
+
+    ret = Cloud_CoAPMessageList_add(context, message, len, xfer);
+    if (COAP_SUCCESS != ret) {
+        goto err;
+    }
+    return COAP_SUCCESS;
+
+err:
+    Cloud_CoAPBlockXfer_free(xfer);
+    return ret;
 }
 
 int Cloud_CoAPMessage_send(Cloud_CoAPContext *context, Cloud_CoAPMessage *message)
 {
     unsigned int   ret            = COAP_SUCCESS;
     unsigned short msglen         = 0;
+    int            tracked        = 0;
 
     if (NULL == message || NULL == context) {
         return (COAP_ERROR_INVALID_PARAM);
     }
 
-    /* TODO: get the message length */
+    if (COAP_MSG_MAX_BODY_LEN < message->payloadlen) {
+        COAP_INFO("The payload length %d is too loog", message->payloadlen);
+        return COAP_ERROR_DATA_SIZE;
+    }
+
+    tracked = Cloud_CoAPReqMsg(message->header) || Cloud_CoAPCONRespMsg(message->header);
+    if (tracked && context->list.count >= context->list.maxcount) {
+        COAP_INFO("The send list is full");
+        return COAP_ERROR_DATA_SIZE;
+    }
+
     msglen = Cloud_CoAPSerialize_MessageLength(message);
     if (COAP_MSG_MAX_PDU_LEN < msglen) {
+        /* the response is matched by token, so only a request with one can go block-wise */
+        if (Cloud_CoAPReqMsg(message->header) && 0 != message->header.tokenlen) {
+            return Cloud_CoAPBlockMessage_send(context, message, msglen);
+        }
         COAP_INFO("The message length %d is too loog", msglen);
         return COAP_ERROR_DATA_SIZE;
     }
@@ -291,10 +733,10 @@ int Cloud_CoAPMessage_send(Cloud_CoAPContext *context, Cloud_CoAPMessage *messag
 
     ret = Cloud_CoAPNetwork_write(&context->network, context->sendbuf, (unsigned int)msglen);
     if (COAP_SUCCESS == ret) {
-        if (Cloud_CoAPReqMsg(message->header) || Cloud_CoAPCONRespMsg(message->header)) {
+        if (tracked) {
             COAP_DEBUG("Add message id %d len %d to the list",
                        message->header.msgid, msglen);
-            Cloud_CoAPMessageList_add(context, message, msglen);
+            Cloud_CoAPMessageList_add(context, message, msglen, NULL);
         } else {
             COAP_DEBUG("The message doesn't need to be retransmitted");
         }
@@ -310,16 +752,31 @@ static int Cloud_CoAPAckMessage_handle(Cloud_CoAPContext *context, Cloud_CoAPMes
 {
     Cloud_CoAPSendNode *node = NULL;
 
-    list_for_each_entry(node, &context->list.sendlist, sendlist, Cloud_CoAPSendNode) {
-        if (node->msgid == message->header.msgid) {
-            node->acked = 1;
-            return COAP_SUCCESS;
-        }
+    node = Cloud_CoAPMsgId_find(&context->list, message->header.msgid);
+    if (NULL != node && node->confirmable && 0 == node->acked) {
+        /* stop retransmitting, the response comes separately */
+        node->acked = 1;
+        node->due   = HAL_UptimeMs() + COAP_MAX_TRANSMIT_SPAN_MS;
+        Cloud_CoAPSendHeap_fix(&context->list, node->heap_index);
     }
 
     return COAP_SUCCESS;
 }
 
+static int Cloud_CoAPRstMessage_handle(Cloud_CoAPContext *context, Cloud_CoAPMessage *message)
+{
+    Cloud_CoAPSendNode *node = NULL;
+
+    node = Cloud_CoAPMsgId_find(&context->list, message->header.msgid);
+    if (NULL == node) {
+        return COAP_ERROR_NOT_FOUND;
+    }
+
+    COAP_INFO("The message id %d is reset by peer", node->msgid);
+    Cloud_CoAPMessageList_del(context, node);
+    return COAP_SUCCESS;
+}
+
 static int Cloud_CoAPAckMessage_send(Cloud_CoAPContext *context, unsigned short msgid)
 {
     Cloud_CoAPMessage message;
@@ -328,46 +785,137 @@ static int Cloud_CoAPAckMessage_send(Cloud_CoAPContext *context, unsigned short
     return Cloud_CoAPMessage_send(context, &message);
 }
 
+/*
+ * Go on with the block-wise transfer of node on its response. Returns 1 when the
+ * transfer goes on, 0 when message is the final response to hand to the handler
+ * and a negative value when the transfer failed.
+ */
+static int Cloud_CoAPBlockResp_handle(Cloud_CoAPContext *context, Cloud_CoAPSendNode *node,
+                                      Cloud_CoAPMessage *message)
+{
+    int more = 0;
+    unsigned int num = 0;
+    unsigned int offset = 0;
+    unsigned char szx = 0;
+    unsigned char *body = NULL;
+    Cloud_CoAPBlockXfer *xfer = node->block;
+
+    if (NULL != xfer && 0 == xfer->block2 && COAP_MSG_CODE_231_CONTINUE == message->header.code) {
+        if (COAP_SUCCESS != Cloud_CoAPBlockOption_get(message, COAP_OPTION_BLOCK1, &num, &more, &szx)
+            || num != xfer->block1) {
+            COAP_DEBUG("Ignore the continue of block1 %d", num);
+            return 1;
+        }
+        /* the server may ask for smaller blocks, go on from the same offset */
+        offset = (xfer->block1 + 1) * COAP_BLOCK_SIZE(xfer->szx1);
+        if (szx < xfer->szx1) {
+            xfer->szx1 = szx;
+        }
+        xfer->block1 = offset / COAP_BLOCK_SIZE(xfer->szx1);
+        return (COAP_SUCCESS == Cloud_CoAPBlock_next(context, node)) ? 1 : -1;
+    }
+
+    if (COAP_SUCCESS != Cloud_CoAPBlockOption_get(message, COAP_OPTION_BLOCK2, &num, &more, &szx)) {
+        return 0;
+    }
+    if (NULL == xfer) {
+        if (0 == num && !more) {
+            return 0;
+        }
+        /* a response too large for one PDU to a plain request */
+        xfer = Cloud_CoAPBlockXfer_create(node->msglen);
+        if (NULL == xfer) {
+            return -1;
+        }
+        memcpy(xfer->request, node->message, node->msglen);
+        node->block = xfer;
+    }
+    if (num != xfer->block2) {
+        COAP_DEBUG("Ignore the block2 %d, waiting for %d", num, xfer->block2);
+        return 1;
+    }
+    if (0 == num && !more) {
+        return 0;
+    }
+
+    if (COAP_MSG_MAX_BODY_LEN < xfer->bodylen + message->payloadlen) {
+        COAP_ERR("The response body is longer than %d", COAP_MSG_MAX_BODY_LEN);
+        return -1;
+    }
+    body = (unsigned char *)coap_malloc(xfer->bodylen + message->payloadlen + 1);
+    if (NULL == body) {
+        return -1;
+    }
+    if (NULL != xfer->body) {
+        memcpy(body, xfer->body, xfer->bodylen);
+        coap_free(xfer->body);
+    }
+    memcpy(body + xfer->bodylen, message->payload, message->payloadlen);
+    xfer->body = body;
+    xfer->bodylen += message->payloadlen;
+    xfer->body[xfer->bodylen] = '\0';
+
+    if (more) {
+        xfer->block2 = num + 1;
+        xfer->szx2   = szx;
+        return (COAP_SUCCESS == Cloud_CoAPBlock_next(context, node)) ? 1 : -1;
+    }
+
+    message->payload    = xfer->body;
+    message->payloadlen = xfer->bodylen;
+    return 0;
+}
+
 static int Cloud_CoAPRespMessage_handle(Cloud_CoAPContext *context, Cloud_CoAPMessage *message)
 {
+    int ret = 0;
     Cloud_CoAPSendNode *node = NULL;
 
     if (COAP_MESSAGE_TYPE_CON == message->header.type) {
         Cloud_CoAPAckMessage_send(context, message->header.msgid);
     }
 
+    if (0 == message->header.tokenlen) {
+        return COAP_ERROR_NOT_FOUND;
+    }
+    node = Cloud_CoAPToken_find(&context->list, message->token, message->header.tokenlen);
+    if (NULL == node) {
+        return COAP_ERROR_NOT_FOUND;
+    }
+    COAP_DEBUG("Find the node by token");
 
-    list_for_each_entry(node, &context->list.sendlist, sendlist, Cloud_CoAPSendNode) {
-        if (0 != node->tokenlen && node->tokenlen == message->header.tokenlen
-            && 0 == memcmp(node->token, message->token, message->header.tokenlen)) {
+    /* a duplicated piggybacked response to an earlier block */
+    if (COAP_MESSAGE_TYPE_ACK == message->header.type && node->msgid != message->header.msgid) {
+        COAP_DEBUG("Ignore the response of message id %d", message->header.msgid);
+        return COAP_SUCCESS;
+    }
 
-            COAP_DEBUG("Find the node by token");
-            COAP_INFO("Downstream Payload:");
-            iotx_facility_json_print((const char *)message->payload, LOG_INFO_LEVEL, '<');
+    ret = Cloud_CoAPBlockResp_handle(context, node, message);
+    if (0 < ret) {
+        return COAP_SUCCESS;
+    } else if (0 > ret) {
+        COAP_ERR("Block-wise transfer failed, remove the message id %d", node->msgid);
+        Cloud_CoAPMessageList_del(context, node);
+        return COAP_ERROR_INTERNAL;
+    }
 
-            message->user  = node->user;
-            if (COAP_MSG_CODE_400_BAD_REQUEST <= message->header.code) {
-                /* TODO:i */
-                if (NULL != context->notifier) {
-                    //context->notifier(message->header.code, message);
-                }
-            }
+    COAP_INFO("Downstream Payload:");
+    iotx_facility_json_print((const char *)message->payload, LOG_INFO_LEVEL, '<');
 
-            if (NULL != node->handler) {
-                node->handler(node->user, message);
-            }
-            COAP_DEBUG("Remove the message id %d from list", node->msgid);
-            list_del_init(&node->sendlist);
-            context->list.count--;
-            if (NULL != node->message) {
-                coap_free(node->message);
-            }
-            coap_free(node);
-            node = NULL;
-            return COAP_SUCCESS;
+    message->user  = node->user;
+    if (COAP_MSG_CODE_400_BAD_REQUEST <= message->header.code) {
+        /* TODO:i */
+        if (NULL != context->notifier) {
+            //context->notifier(message->header.code, message);
         }
     }
-    return COAP_ERROR_NOT_FOUND;
+
+    if (NULL != node->handler) {
+        node->handler(node->user, message);
+    }
+    COAP_DEBUG("Remove the message id %d from list", node->msgid);
+    Cloud_CoAPMessageList_del(context, node);
+    return COAP_SUCCESS;
 }
 
 static void Cloud_CoAPMessage_handle(Cloud_CoAPContext *context,
@@ -405,6 +953,10 @@ static void Cloud_CoAPMessage_handle(Cloud_CoAPContext *context,
     } else if (Cloud_CoAPRespMsg(message.header)) {
         COAP_DEBUG("Receive CoAP Response Message,ID %d", message.header.msgid);
         Cloud_CoAPRespMessage_handle(context, &message);
+
+    } else if (Cloud_CoAPRstMsg(message.header)) {
+        COAP_DEBUG("Receive CoAP RST Message,ID %d", message.header.msgid);
+        Cloud_CoAPRstMessage_handle(context, &message);
     }
 }
 
@@ -435,45 +987,49 @@ int Cloud_CoAPMessage_recv(Cloud_CoAPContext *context, unsigned int timeout, int
 int Cloud_CoAPMessage_cycle(Cloud_CoAPContext *context)
 {
     unsigned int ret = 0;
-    Cloud_CoAPMessage_recv(context, context->waittime, 0);
-
-    Cloud_CoAPSendNode *node = NULL, *next = NULL;
-    list_for_each_entry_safe(node, next, &context->list.sendlist, sendlist, Cloud_CoAPSendNode) {
-        if (NULL != node) {
-            if (node->timeout == 0) {
-                if (node->retrans_count < COAP_MAX_RETRY_COUNT && (0 == node->acked)) {
-                    node->timeout     = node->timeout_val * 2;
-                    node->timeout_val = node->timeout;
-                    node->retrans_count++;
-                    COAP_DEBUG("Retansmit the message id %d len %d", node->msgid, node->msglen);
-                    ret = Cloud_CoAPNetwork_write(&context->network, node->message, node->msglen);
-                    if (ret != COAP_SUCCESS) {
-                        if (NULL != context->notifier) {
-                            /* TODO: */
-                            /* context->notifier(context, event); */
-                        }
-                    }
-                }
+    unsigned int waittime = context->waittime;
+    uint64_t now = 0;
+    Cloud_CoAPSendNode *node = NULL;
 
-                if ((node->timeout > COAP_MAX_TRANSMISSION_SPAN) ||
-                    (node->retrans_count >= COAP_MAX_RETRY_COUNT)) {
-                    if (NULL != context->notifier) {
-                        /* TODO: */
-                        /* context->notifier(context, event); */
-                    }
-
-                    /*Remove the node from the list*/
-                    list_del_init(&node->sendlist);
-                    context->list.count--;
-                    COAP_INFO("Retransmit timeout,remove the message id %d count %d",
-                              node->msgid, context->list.count);
-                    coap_free(node->message);
-                    coap_free(node);
+    /* do not sleep past the earliest retransmission, a read timeout of 0 waits forever */
+    if (0 < context->list.count) {
+        now = HAL_UptimeMs();
+        node = context->list.heap[0];
+        if (node->due <= now) {
+            waittime = 1;
+        } else if (node->due - now < waittime) {
+            waittime = (unsigned int)(node->due - now);
+        }
+    }
+    Cloud_CoAPMessage_recv(context, waittime, 0);
+
+    now = HAL_UptimeMs();
+    while (0 < context->list.count && context->list.heap[0]->due <= now) {
+        node = context->list.heap[0];
+        if (node->confirmable && 0 == node->acked && node->retrans_count < COAP_MAX_RETRY_COUNT) {
+            node->retrans_count++;
+            node->timeout *= 2;
+            node->due = now + node->timeout;
+            Cloud_CoAPSendHeap_fix(&context->list, 0);
+            COAP_DEBUG("Retansmit the message id %d len %d", node->msgid, node->msglen);
+            ret = Cloud_CoAPNetwork_write(&context->network, node->message, node->msglen);
+            if (ret != COAP_SUCCESS) {
+                if (NULL != context->notifier) {
+                    /* TODO: */
+                    /* context->notifier(context, event); */
                 }
-            } else {
-                node->timeout--;
             }
+            continue;
         }
+
+        if (NULL != context->notifier) {
+            /* TODO: */
+            /* context->notifier(context, event); */
+        }
+
+        COAP_INFO("Retransmit timeout,remove the message id %d count %d",
+                  node->msgid, context->list.count - 1);
+        Cloud_CoAPMessageList_del(context, node);
     }
     return COAP_SUCCESS;
 }
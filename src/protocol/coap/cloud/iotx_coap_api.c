@@ -625,7 +625,8 @@ int IOT_CoAP_SendMessage(iotx_coap_context_t *p_context, char *p_path, iotx_mess
         return IOTX_ERR_INVALID_PARAM;
     }
 
-    if (p_message->payload_len >= COAP_MSG_MAX_PDU_LEN) {
+    /* a payload over one PDU goes with block-wise transfer */
+    if (p_message->payload_len > COAP_MSG_MAX_BODY_LEN) {
         COAP_ERR("The payload length %d is too loog", p_message->payload_len);
         return IOTX_ERR_MSG_TOO_LOOG;
     }
@@ -668,11 +669,12 @@ int IOT_CoAP_SendMessage(iotx_coap_context_t *p_context, char *p_path, iotx_mess
             }
             HEXDUMP_DEBUG(seq, len);
 
-            payload = (unsigned char *)coap_malloc(COAP_MSG_MAX_PDU_LEN);
+            /* CBC pads the payload up to the next 16 bytes */
+            payload = (unsigned char *)coap_malloc(p_message->payload_len + 16);
             if (NULL == payload) {
                 return IOTX_ERR_NO_MEM;
             }
-            memset(payload, 0x00, COAP_MSG_MAX_PDU_LEN);
+            memset(payload, 0x00, p_message->payload_len + 16);
             len = iotx_aes_cbc_encrypt(p_message->p_payload, p_message->payload_len, p_iotx_coap->key, payload);
             if (0 == len) {
                 coap_free(payload);
@@ -722,11 +724,11 @@ int IOT_CoAP_GetMessagePayload(void *p_message, unsigned char **pp_payload, int
         && 0 < message->payloadlen) {
         int len = 0;
         unsigned char *payload = NULL;
-        payload = coap_malloc(COAP_MSG_MAX_PDU_LEN);
+        payload = coap_malloc(message->payloadlen + 1);
         if (NULL == payload) {
             return IOTX_ERR_NO_MEM;
         }
-        memset(payload, 0x00, COAP_MSG_MAX_PDU_LEN);
+        memset(payload, 0x00, message->payloadlen + 1);
 
         len = iotx_aes_cbc_decrypt(message->payload, message->payloadlen, p_iotx_coap->key, payload);
         HEXDUMP_DEBUG(message->payload, message->payloadlen);
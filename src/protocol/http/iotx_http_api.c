@@ -48,7 +48,8 @@
 #endif
 
 #define IOTX_HTTP_AUTH_STR              "auth"
-#define IOTX_HTTP_ONLINE_SERVER_URL     "https://iot-as-http.cn-shanghai.aliyuncs.com"
+#define IOTX_HTTP_ONLINE_SERVER_HOST    "iot-as-http.cn-shanghai.aliyuncs.com"
+#define IOTX_HTTP_ONLINE_SERVER_URL     "https://" IOTX_HTTP_ONLINE_SERVER_HOST
 #define IOTX_HTTP_ONLINE_SERVER_PORT    443
 #define IOTX_HTTP_CA_GET                iotx_ca_get()
 
@@ -66,6 +67,10 @@
 
 #define HTTP_AUTH_RESP_MAX_LEN      (256)
 
+#ifndef IOTX_HTTP_PIPELINE_DEPTH
+    #define IOTX_HTTP_PIPELINE_DEPTH    (4)     /* requests in flight by IOT_HTTP_SendMessages() */
+#endif
+
 static iotx_http_t *iotx_http_context_bak = NULL;
 
 
@@ -243,6 +248,7 @@ void *IOT_HTTP_Init(iotx_http_param_t *pInitParams)
         goto err;
     }
     memset(iotx_http_context->httpc, 0x00, sizeof(httpclient_t));
+    ((httpclient_t *)iotx_http_context->httpc)->keep_alive = iotx_http_context->keep_alive;
 
     iotx_http_context_bak = iotx_http_context;
 
@@ -263,6 +269,17 @@ err:
     return NULL;
 }
 
+/* hand a kept-alive connection over to the pool, next context to the same server starts on it */
+static void http_release_connection(iotx_http_t *iotx_http_context)
+{
+    httpclient_t *httpc = (httpclient_t *)iotx_http_context->httpc;
+
+    if (iotx_http_context->keep_alive && !httpc->conn_close) {
+        httpclient_pool_release(httpc, IOTX_HTTP_ONLINE_SERVER_HOST, IOTX_HTTP_ONLINE_SERVER_PORT, IOTX_HTTP_CA_GET);
+    }
+    httpclient_close(httpc);
+}
+
 void IOT_HTTP_DeInit(void **handle)
 {
     iotx_http_t *iotx_http_context;
@@ -281,6 +298,7 @@ void IOT_HTTP_DeInit(void **handle)
         HTTP_API_FREE(iotx_http_context->p_auth_token);
     }
     if (NULL != iotx_http_context->httpc) {
+        http_release_connection(iotx_http_context);
         HTTP_API_FREE(iotx_http_context->httpc);
     }
 
@@ -427,7 +445,7 @@ int IOT_HTTP_DeviceNameAuth(void *handle)
         httpclient_close(httpc);
         return ret;
     }
-    if (0 == iotx_http_context->keep_alive) {
+    if (0 == iotx_http_context->keep_alive || httpc->conn_close) {
         http_info("http not keepalive");
         httpclient_close(httpc);
     }
@@ -531,21 +549,33 @@ do_exit:
     return ret;
 }
 
-int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
+/* header of upstream request, carrying the auth token */
+static char *http_build_upstream_header(iotx_http_t *iotx_http_context)
+{
+    int     len;
+    char   *header;
+
+    len = strlen(IOTX_HTTP_HEADER_PASSWORD_STR) + strlen(iotx_http_context->p_auth_token) + strlen(
+                      IOTX_HTTP_HEADER_KEEPALIVE_STR) + strlen(IOTX_HTTP_HEADER_END_STR);
+    header = HTTP_API_MALLOC(len + 1);
+    if (NULL == header) {
+        http_err("Allocate memory for httpc->header failed");
+        return NULL;
+    }
+    LITE_snprintf(header, len + 1,
+                  IOTX_HTTP_UPSTREAM_HEADER_STR, iotx_http_context->p_auth_token);
+    http_info("httpc->header = %s", header);
+
+    return header;
+}
+
+/* send one upstream request, connection is established if not yet */
+static int http_send_upstream_request(iotx_http_t *iotx_http_context, iotx_http_message_param_t *msg_param,
+                                      httpclient_data_t *httpc_data)
 {
-    int                 ret = -1;
-    int                 response_code = 0;
-    char               *pvalue = NULL;
     char                http_url[IOTX_HTTP_URL_LEN_MAX] = {0};
-    httpclient_t       *httpc = NULL;
-    httpclient_data_t   httpc_data = {0};
-    char               *messageId = NULL;
-    char               *user_data = NULL;
-    char               *response_message = NULL;
-    int                 len = 0;
     uint32_t            payload_len = 0;
-    iotx_time_t         timer;
-    iotx_http_t        *iotx_http_context;
+
     /*
         POST /topic/${topic} HTTP/1.1
         Host: iot-as-http.cn-shanghai.aliyuncs.com
@@ -553,40 +583,19 @@ int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
         Content-Type: application/octet-stream
         body: ${your_data}
     */
-    if (NULL == (iotx_http_context = verify_iotx_http_context(handle))) {
-        goto do_exit;
-    }
-
-    if (NULL == msg_param) {
-        http_err("iotx_http_context or msg_param NULL pointer!");
-        goto do_exit;
-    }
-
-    httpc = (httpclient_t *)iotx_http_context->httpc;
-
-    if (NULL == httpc) {
-        http_err("httpc null pointer");
-        goto do_exit;
-    }
-
-    if (0 == iotx_http_context->is_authed) {
-        http_err("Device is not authed");
-        goto do_exit;
-    }
-
     if (NULL == msg_param->request_payload) {
         http_err("IOT_HTTP_SendMessage request_payload NULL!");
-        goto do_exit;
+        return -1;
     }
 
     if (NULL == msg_param->response_payload) {
         http_err("IOT_HTTP_SendMessage response_payload NULL!");
-        goto do_exit;
+        return -1;
     }
 
     if (NULL == msg_param->topic_path) {
         http_err("IOT_HTTP_SendMessage topic_path NULL!");
-        goto do_exit;
+        return -1;
     }
 
     payload_len = strlen(msg_param->request_payload) + 1;
@@ -596,46 +605,58 @@ int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
     /* Construct Auth Url */
     construct_full_http_upstream_url(http_url, msg_param->topic_path);
 
-    len = strlen(IOTX_HTTP_HEADER_PASSWORD_STR) + strlen(iotx_http_context->p_auth_token) + strlen(
-                      IOTX_HTTP_HEADER_KEEPALIVE_STR) + strlen(IOTX_HTTP_HEADER_END_STR);
-    httpc->header = HTTP_API_MALLOC(len + 1);
-    if (NULL == httpc->header) {
-        http_err("Allocate memory for httpc->header failed");
-        goto do_exit;
-    }
-    LITE_snprintf(httpc->header, len + 1,
-                  IOTX_HTTP_UPSTREAM_HEADER_STR, iotx_http_context->p_auth_token);
-    http_info("httpc->header = %s", httpc->header);
+    memset(httpc_data, 0, sizeof(httpclient_data_t));
+    httpc_data->post_content_type = "application/octet-stream";
+    httpc_data->post_buf = msg_param->request_payload;
+    httpc_data->post_buf_len = msg_param->request_payload_len;
+    httpc_data->response_buf = msg_param->response_payload;
+    httpc_data->response_buf_len = msg_param->response_payload_len;
 
-    httpc_data.post_content_type = "application/octet-stream";
-    httpc_data.post_buf = msg_param->request_payload;
-    httpc_data.post_buf_len = msg_param->request_payload_len;
-    httpc_data.response_buf = msg_param->response_payload;
-    httpc_data.response_buf_len = msg_param->response_payload_len;
+    http_info("request_payload: \r\n\r\n%s\r\n", httpc_data->post_buf);
 
-    http_info("request_payload: \r\n\r\n%s\r\n", httpc_data.post_buf);
+    return iotx_post((httpclient_t *)iotx_http_context->httpc,
+                     http_url,
+                     IOTX_HTTP_ONLINE_SERVER_PORT,
+                     IOTX_HTTP_CA_GET,
+                     httpc_data);
+}
+
+static int http_discard_body(void *user_data, const char *data, int len)
+{
+    return len;
+}
+
+/* receive the response of one upstream request, 0 when server accepted the message */
+static int http_recv_upstream_response(iotx_http_t *iotx_http_context, iotx_http_message_param_t *msg_param,
+                                       httpclient_data_t *httpc_data, int *response_code)
+{
+    int                 ret = -1;
+    char               *pvalue = NULL;
+    char               *messageId = NULL;
+    char               *user_data = NULL;
+    char               *response_message = NULL;
+    httpclient_t       *httpc = (httpclient_t *)iotx_http_context->httpc;
+    iotx_time_t         timer;
+
+    *response_code = -1;
 
-    /* Send Request and Get Response */
-    if (iotx_post(httpc,
-                  http_url,
-                  IOTX_HTTP_ONLINE_SERVER_PORT,
-                  IOTX_HTTP_CA_GET,
-                  &httpc_data)) {
-        goto do_exit_pre;
-    }
     iotx_time_init(&timer);
     utils_time_countdown_ms(&timer, msg_param->timeout_ms);
 
-    ret = httpclient_recv_response(httpc, iotx_time_left(&timer), &httpc_data);
+    ret = httpclient_recv_response(httpc, iotx_time_left(&timer), httpc_data);
+    if (ret > 0) {
+        /* body longer than response_payload, read the rest off the socket so the next response starts clean */
+        http_err("response truncated to %d bytes", msg_param->response_payload_len);
+        do {
+            ret = httpclient_recv_response_stream(httpc, iotx_time_left(&timer), httpc_data, http_discard_body, NULL);
+        } while (ret > 0);
+    }
     if (ret < 0) {
         http_err("httpclient_recv_response error, ret = %d", ret);
         httpclient_close(httpc);
-        goto do_exit_pre;
-    }
-
-    if (0 == iotx_http_context->keep_alive) {
-        httpclient_close(httpc);
+        return -1;
     }
+    ret = -1;
 
     /*
         body:
@@ -648,33 +669,31 @@ int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
           }
         }
     */
-    http_info("http response: \r\n\r\n%s\r\n", httpc_data.response_buf);
+    http_info("http response: \r\n\r\n%s\r\n", httpc_data->response_buf);
 
-    pvalue = HTTP_LITE_JSON_VALUE_OF("code", httpc_data.response_buf);
+    pvalue = HTTP_LITE_JSON_VALUE_OF("code", httpc_data->response_buf);
     if (!pvalue) {
-        goto do_exit_pre;
+        goto do_exit;
     }
 
-    response_code = atoi(pvalue);
+    *response_code = atoi(pvalue);
     HTTP_API_FREE(pvalue);
     pvalue = NULL;
-    http_info("response code: %d", response_code);
+    http_info("response code: %d", *response_code);
 
-    pvalue = HTTP_LITE_JSON_VALUE_OF("message", httpc_data.response_buf);
+    pvalue = HTTP_LITE_JSON_VALUE_OF("message", httpc_data->response_buf);
     if (NULL == pvalue) {
-        goto do_exit_pre;
+        goto do_exit;
     }
     response_message = HTTP_STRDUP(pvalue);
     http_info("response_message: %s", response_message);
     HTTP_API_FREE(pvalue);
     pvalue = NULL;
 
-    switch (response_code) {
+    switch (*response_code) {
         case IOTX_HTTP_SUCCESS:
             break;
         case IOTX_HTTP_TOKEN_EXPIRED_ERROR:
-            iotx_http_context->is_authed = IOT_FALSE;
-            IOT_HTTP_DeviceNameAuth((iotx_http_t *)iotx_http_context);
         case IOTX_HTTP_COMMON_ERROR:
         case IOTX_HTTP_PARAM_ERROR:
         case IOTX_HTTP_AUTH_CHECK_ERROR:
@@ -684,14 +703,14 @@ int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
         case IOTX_HTTP_PUBLISH_MESSAGE_ERROR:
         case IOTX_HTTP_REQUEST_TOO_MANY_ERROR:
         default:
-            goto do_exit_pre;
+            goto do_exit;
     }
 
     /* info.messageId */
-    pvalue = HTTP_LITE_JSON_VALUE_OF("info.messageId", httpc_data.response_buf);
+    pvalue = HTTP_LITE_JSON_VALUE_OF("info.messageId", httpc_data->response_buf);
     if (NULL == pvalue) {
         http_err("messageId: NULL");
-        goto do_exit_pre;
+        goto do_exit;
     }
     messageId = pvalue;
     http_info("messageId: %s", messageId);
@@ -700,7 +719,7 @@ int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
     pvalue = NULL;
 
     /* info.data */
-    pvalue = HTTP_LITE_JSON_VALUE_OF("info.data", httpc_data.response_buf);
+    pvalue = HTTP_LITE_JSON_VALUE_OF("info.data", httpc_data->response_buf);
     user_data = pvalue;
 
     /* Maybe NULL */
@@ -716,7 +735,7 @@ int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
 
     ret = 0;
 
-do_exit_pre:
+do_exit:
 
     if (pvalue) {
         HTTP_API_FREE(pvalue);
@@ -726,8 +745,57 @@ do_exit_pre:
         HTTP_API_FREE(response_message);
     }
 
-    if (httpc != NULL && httpc->header) {
-        HTTP_API_FREE(httpc->header);
+    return ret;
+}
+
+int IOT_HTTP_SendMessage(void *handle, iotx_http_message_param_t *msg_param)
+{
+    int                 ret = -1;
+    int                 response_code = 0;
+    httpclient_t       *httpc = NULL;
+    httpclient_data_t   httpc_data = {0};
+    iotx_http_t        *iotx_http_context;
+
+    if (NULL == (iotx_http_context = verify_iotx_http_context(handle))) {
+        goto do_exit;
+    }
+
+    if (NULL == msg_param) {
+        http_err("iotx_http_context or msg_param NULL pointer!");
+        goto do_exit;
+    }
+
+    httpc = (httpclient_t *)iotx_http_context->httpc;
+
+    if (NULL == httpc) {
+        http_err("httpc null pointer");
+        goto do_exit;
+    }
+
+    if (0 == iotx_http_context->is_authed) {
+        http_err("Device is not authed");
+        goto do_exit;
+    }
+
+    httpc->header = http_build_upstream_header(iotx_http_context);
+    if (NULL == httpc->header) {
+        goto do_exit;
+    }
+
+    /* Send Request and Get Response */
+    if (0 == http_send_upstream_request(iotx_http_context, msg_param, &httpc_data)) {
+        ret = http_recv_upstream_response(iotx_http_context, msg_param, &httpc_data, &response_code);
+        if (0 == iotx_http_context->keep_alive || httpc->conn_close) {
+            httpclient_close(httpc);
+        }
+    }
+
+    HTTP_API_FREE(httpc->header);
+    httpc->header = NULL;
+
+    if (IOTX_HTTP_TOKEN_EXPIRED_ERROR == response_code) {
+        iotx_http_context->is_authed = IOT_FALSE;
+        IOT_HTTP_DeviceNameAuth((iotx_http_t *)iotx_http_context);
     }
 
 do_exit:
@@ -735,6 +803,86 @@ do_exit:
     return ret;
 }
 
+int IOT_HTTP_SendMessages(void *handle, iotx_http_message_param_t *msg_params, int count)
+{
+    int                 acked = 0, sent, depth, i;
+    int                 response_code = 0;
+    httpclient_t       *httpc = NULL;
+    httpclient_data_t   httpc_data[IOTX_HTTP_PIPELINE_DEPTH];
+    iotx_http_t        *iotx_http_context;
+
+    if (NULL == (iotx_http_context = verify_iotx_http_context(handle))) {
+        return -1;
+    }
+
+    if (NULL == msg_params || count <= 0) {
+        http_err("msg_params NULL pointer or invalid count!");
+        return -1;
+    }
+
+    httpc = (httpclient_t *)iotx_http_context->httpc;
+
+    if (NULL == httpc) {
+        http_err("httpc null pointer");
+        return -1;
+    }
+
+    if (0 == iotx_http_context->keep_alive) {
+        /* connection is closed after each response, nothing to pipeline */
+        while (acked < count && 0 == IOT_HTTP_SendMessage(handle, &msg_params[acked])) {
+            acked++;
+        }
+        return acked;
+    }
+
+    if (0 == iotx_http_context->is_authed) {
+        http_err("Device is not authed");
+        return -1;
+    }
+
+    httpc->header = http_build_upstream_header(iotx_http_context);
+    if (NULL == httpc->header) {
+        return -1;
+    }
+
+    while (acked < count) {
+        depth = count - acked;
+        if (depth > IOTX_HTTP_PIPELINE_DEPTH) {
+            depth = IOTX_HTTP_PIPELINE_DEPTH;
+        }
+
+        /* write requests back to back, then collect responses in the same order */
+        for (sent = 0; sent < depth; sent++) {
+            if (0 != http_send_upstream_request(iotx_http_context, &msg_params[acked + sent], &httpc_data[sent])) {
+                break;
+            }
+        }
+
+        for (i = 0; i < sent; i++) {
+            if (0 != http_recv_upstream_response(iotx_http_context, &msg_params[acked], &httpc_data[i], &response_code)) {
+                break;
+            }
+            acked++;
+        }
+
+        if (i < sent || sent < depth) {
+            /* responses still in flight can not be matched any more */
+            httpclient_close(httpc);
+            break;
+        }
+    }
+
+    HTTP_API_FREE(httpc->header);
+    httpc->header = NULL;
+
+    if (IOTX_HTTP_TOKEN_EXPIRED_ERROR == response_code) {
+        iotx_http_context->is_authed = IOT_FALSE;
+        IOT_HTTP_DeviceNameAuth((iotx_http_t *)iotx_http_context);
+    }
+
+    return acked;
+}
+
 void IOT_HTTP_Disconnect(void *handle)
 {
     iotx_http_t *iotx_http_context;
@@ -743,3 +891,8 @@ void IOT_HTTP_Disconnect(void *handle)
     }
 }
 
+void IOT_HTTP_FlushConnections(void)
+{
+    httpclient_pool_flush();
+}
+
@@ -537,6 +537,89 @@ int iotx_http2_client_send(http2_connection_t *conn, http2_data *h2_data)
     return rv;
 }
 
+static ssize_t source_read_callback(nghttp2_session *session, int32_t stream_id,
+                                    uint8_t *buf, size_t length,
+                                    uint32_t *data_flags,
+                                    nghttp2_data_source *source,
+                                    void *user_data)
+{
+    int eof = 0;
+    int len;
+    http2_data_source_t *src = (http2_data_source_t *)source->ptr;
+
+    len = src->read(src, (char *)buf, (int)length, &eof);
+    if (len < 0) {
+        /* reset this stream only */
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    if (eof) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return len;
+}
+
+int iotx_http2_client_send_source(http2_connection_t *conn, http2_data *h2_data, http2_data_source_t *source,
+                                  int weight)
+{
+    int rv = 0;
+    nghttp2_data_provider data_prd;
+    nghttp2_priority_spec pri_spec;
+    nghttp2_nv *nva = NULL;
+    int nva_size = 0;
+
+    if (conn == NULL || source == NULL || h2_data->header == NULL || h2_data->header_count == 0) {
+        return -1;
+    }
+
+    nva = (nghttp2_nv *)HTTP2_API_MALLOC(sizeof(nghttp2_nv) * h2_data->header_count);
+    if (nva == NULL) {
+        return -1;
+    }
+    nva_size = http2_nv_copy_nghttp2_nv(nva, nva_size, h2_data->header, h2_data->header_count);
+
+    nghttp2_priority_spec_init(&pri_spec, 0, (weight > 0) ? weight : NGHTTP2_DEFAULT_WEIGHT, 0);
+    data_prd.source.ptr = source;
+    data_prd.read_callback = source_read_callback;
+    rv = nghttp2_submit_request(conn->session, &pri_spec, nva, nva_size, &data_prd, NULL);
+    HTTP2_API_FREE(nva);
+    if (rv < 0) {
+        return rv;
+    }
+    h2_data->stream_id = rv;
+
+    if (nghttp2_session_want_write(conn->session)) {
+        rv = nghttp2_session_send(conn->session);
+        NGHTTP2_DBG("nghttp2_session_send %d\r\n", rv);
+    }
+
+    return rv;
+}
+
+int iotx_http2_reset_stream(http2_connection_t *conn, int stream_id)
+{
+    int rv;
+
+    if (conn == NULL) {
+        return -1;
+    }
+    rv = nghttp2_submit_rst_stream(conn->session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+    if (rv < 0) {
+        return rv;
+    }
+    return nghttp2_session_send(conn->session);
+}
+
+int iotx_http2_get_max_concurrent_streams(http2_connection_t *conn)
+{
+    uint32_t num;
+
+    if (conn == NULL) {
+        return 0;
+    }
+    num = nghttp2_session_get_remote_settings(conn->session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+    return (num > 0x7FFFFFFF) ? 0x7FFFFFFF : (int)num;
+}
+
 int iotx_http2_client_recv(http2_connection_t *conn, char *data, int data_len, int *len, int timeout)
 {
     int rv = 0;
@@ -737,20 +820,23 @@ int iotx_http2_update_window_size(http2_connection_t *conn)
  */
 int iotx_http2_exec_io(http2_connection_t *connection)
 {
-    if (nghttp2_session_want_read(connection->session) /*||
-        nghttp2_session_want_write(connection->session)*/) {
+    int rv;
 
-        int rv;
+    if (nghttp2_session_want_read(connection->session)) {
         rv = nghttp2_session_recv(connection->session);
         if (rv < 0) {
             NGHTTP2_DBG("nghttp2_session_recv error");
             return -1;
         }
-        // rv = nghttp2_session_send(connection->session);
-        // if (rv < 0) {
-        //     NGHTTP2_DBG("nghttp2_session_send error");
-        //     return -1;
-        // }
+    }
+
+    /* flush frames queued by recv, such as SETTINGS ACK, PING ACK and WINDOW_UPDATE */
+    if (nghttp2_session_want_write(connection->session)) {
+        rv = nghttp2_session_send(connection->session);
+        if (rv < 0) {
+            NGHTTP2_DBG("nghttp2_session_send error");
+            return -1;
+        }
     }
     return 0;
 }
@@ -411,6 +411,10 @@ static FILE *fp;
 #define otafilename "/tmp/alinkota.bin"
 void HAL_Firmware_Persistence_Start(void)
 {
+    /* called again to restart the image from 0 */
+    if (fp != NULL) {
+        fclose(fp);
+    }
     fp = fopen(otafilename, "w");
     assert(fp);
     return;
@@ -427,10 +431,37 @@ int HAL_Firmware_Persistence_Write(_IN_ char *buffer, _IN_ uint32_t length)
     return 0;
 }
 
+int HAL_Firmware_Persistence_Sync(void)
+{
+    if (fp != NULL && (0 != fflush(fp) || 0 != fsync(fileno(fp)))) {
+        return -1;
+    }
+    return 0;
+}
+
+int HAL_Firmware_Persistence_Resume(_IN_ uint32_t offset)
+{
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    fp = fopen(otafilename, "r+");
+    if (fp == NULL) {
+        return -1;
+    }
+    /* a file shorter than offset lost data after the checkpoint was saved, seeking past its end leaves a hole */
+    if (0 != fseek(fp, 0, SEEK_END) || ftell(fp) < (long)offset || 0 != fseek(fp, offset, SEEK_SET)) {
+        fclose(fp);
+        fp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
 int HAL_Firmware_Persistence_Stop(void)
 {
     if (fp != NULL) {
         fclose(fp);
+        fp = NULL;
     }
 
     return 0;
@@ -228,6 +228,315 @@ void start_sniff(_IN_ awss_recv_80211_frame_cb_t cb)
     HAL_ThreadCreate(&g_sniff_thread, func_Sniffer, (void *)cb, &task_parms, &stack_used);
 }
 
+/*
+ * Offline replay of a radiotap capture (e.g. `tcpdump -i mon0 -w x.pcap`),
+ * used in place of the wireless card when AWSS_PCAP_FILE names a pcap file:
+ *     AWSS_PCAP_FILE=smartconfig.pcap ./linkkit-example-...
+ * frames are paced by their capture time and only those recorded on the
+ * channel set by HAL_Awss_Switch_Channel() are delivered, the capture is
+ * played again from the beginning when it ends. Set AWSS_PCAP_FAST=1 to
+ * deliver frames back to back, which turns the per pass statistics into a
+ * throughput figure of the awss frame handler.
+ */
+#define PCAP_MAGIC              0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_LINKTYPE_80211     105
+#define PCAP_LINKTYPE_RADIOTAP  127
+#define PCAP_MAX_GAP_MS         1000
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_hdr_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_rec_hdr_t;
+
+static FILE *s_replay_fp = NULL;
+static volatile int s_replay_running = 0;
+static volatile int s_replay_active = 0;    /* replay thread alive, it owns s_replay_fp until it clears this */
+static int s_replay_swap = 0;
+static int s_replay_nsec = 0;
+static uint32_t s_replay_linktype = 0;
+static volatile int s_replay_channel = 0;
+static uint64_t s_replay_open_ms = 0;
+
+static uint64_t replay_now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint32_t replay_u32(uint32_t v)
+{
+    return s_replay_swap ? __builtin_bswap32(v) : v;
+}
+
+static int replay_freq_to_channel(int freq)
+{
+    if (freq == 2484) {
+        return 14;
+    }
+    if (freq >= 2412 && freq < 2484) {
+        return (freq - 2407) / 5;
+    }
+    if (freq >= 5000 && freq < 5900) {
+        return (freq - 5000) / 5;
+    }
+    return 0;
+}
+
+/*
+ * walk the radiotap fields up to DBM_ANTSIGNAL, header is little endian
+ * return radiotap length, or -1 on malformed header
+ */
+static int replay_parse_radiotap(const uint8_t *buf, int len, int *channel,
+                                 int *with_fcs, signed char *rssi)
+{
+    uint32_t present;
+    int hdr_len, off, field;
+
+    if (len < 8) {
+        return -1;
+    }
+    hdr_len = buf[2] | (buf[3] << 8);
+    if (hdr_len < 8 || hdr_len > len) {
+        return -1;
+    }
+
+    present = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t)buf[7] << 24);
+    off = 8;
+    /* skip extended present bitmaps */
+    while ((buf[off - 1] & 0x80) && off + 4 <= hdr_len) {
+        off += 4;
+    }
+
+    for (field = IEEE80211_RADIOTAP_TSFT; field <= IEEE80211_RADIOTAP_DBM_ANTSIGNAL; field++) {
+        if (!(present & (1 << field))) {
+            continue;
+        }
+        switch (field) {
+            case IEEE80211_RADIOTAP_TSFT:
+                off = (off + 7) & ~7;
+                off += 8;
+                break;
+            case IEEE80211_RADIOTAP_FLAGS:
+                if (off + 1 > hdr_len) {
+                    return -1;
+                }
+                *with_fcs = (buf[off] & IEEE80211_RADIOTAP_F_FCS) ? 1 : 0;
+                off += 1;
+                break;
+            case IEEE80211_RADIOTAP_RATE:
+                off += 1;
+                break;
+            case IEEE80211_RADIOTAP_CHANNEL:
+                off = (off + 1) & ~1;
+                if (off + 4 > hdr_len) {
+                    return -1;
+                }
+                *channel = replay_freq_to_channel(buf[off] | (buf[off + 1] << 8));
+                off += 4;
+                break;
+            case IEEE80211_RADIOTAP_FHSS:
+                off += 2;
+                break;
+            case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+                if (off + 1 > hdr_len) {
+                    return -1;
+                }
+                *rssi = (signed char)buf[off];
+                off += 1;
+                break;
+        }
+    }
+
+    return hdr_len;
+}
+
+static int replay_open(const char *file)
+{
+    pcap_file_hdr_t hdr;
+
+    s_replay_fp = fopen(file, "rb");
+    if (s_replay_fp == NULL) {
+        printf("pcap %s open failed\n", file);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, s_replay_fp) != 1) {
+        goto do_exit;
+    }
+
+    s_replay_swap = (hdr.magic == __builtin_bswap32(PCAP_MAGIC) ||
+                     hdr.magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+    hdr.magic = replay_u32(hdr.magic);
+    if (hdr.magic != PCAP_MAGIC && hdr.magic != PCAP_MAGIC_NSEC) {
+        goto do_exit;
+    }
+    s_replay_nsec = (hdr.magic == PCAP_MAGIC_NSEC);
+    s_replay_linktype = replay_u32(hdr.linktype);
+    if (s_replay_linktype != PCAP_LINKTYPE_RADIOTAP && s_replay_linktype != PCAP_LINKTYPE_80211) {
+        printf("pcap %s linktype %u not supported\n", file, s_replay_linktype);
+        goto do_exit;
+    }
+
+    return 0;
+
+do_exit:
+    printf("pcap %s is not a valid capture\n", file);
+    fclose(s_replay_fp);
+    s_replay_fp = NULL;
+    return -1;
+}
+
+static void *func_Replay(void *cb)
+{
+    uint8_t *rev_buffer;
+    pcap_rec_hdr_t rec;
+    uint64_t first_ts_us, last_ts_us = 0, ts_us, play_us;
+    uint64_t cb_us, begin_us, now_us;
+    uint64_t total_cb_us = 0, total_delivered = 0;
+    uint32_t frames, delivered, len;
+    int fast = (getenv("AWSS_PCAP_FAST") != NULL);
+    int pass = 0;
+
+    rev_buffer = malloc(MAX_REV_BUFFER);
+    if (rev_buffer == NULL) {
+        fclose(s_replay_fp);
+        s_replay_fp = NULL;
+        s_replay_active = 0;
+        return NULL;
+    }
+
+    printf("Replay Thread Create\r\n");
+
+    while (s_replay_running) {
+        /* one pass over the capture */
+        fseek(s_replay_fp, sizeof(pcap_file_hdr_t), SEEK_SET);
+        frames = delivered = 0;
+        cb_us = 0;
+        first_ts_us = 0;
+        begin_us = replay_now_us();
+        play_us = begin_us;
+
+        while (s_replay_running && fread(&rec, sizeof(rec), 1, s_replay_fp) == 1) {
+            int skip_len = 0, channel = 0, with_fcs = 0;
+            signed char rssi = 0;
+
+            len = replay_u32(rec.incl_len);
+            if (len > MAX_REV_BUFFER) {
+                fseek(s_replay_fp, len, SEEK_CUR);
+                continue;
+            }
+            if (fread(rev_buffer, len, 1, s_replay_fp) != 1) {
+                break;
+            }
+            frames++;
+
+            ts_us = (uint64_t)replay_u32(rec.ts_sec) * 1000000 +
+                    (s_replay_nsec ? replay_u32(rec.ts_frac) / 1000 : replay_u32(rec.ts_frac));
+            if (!fast) {
+                if (first_ts_us == 0) {
+                    first_ts_us = last_ts_us = ts_us;
+                }
+                /* keep capture pace, but do not wait over long idle gaps */
+                if (ts_us > last_ts_us) {
+                    uint64_t gap_us = ts_us - last_ts_us;
+                    play_us += gap_us > PCAP_MAX_GAP_MS * 1000 ? PCAP_MAX_GAP_MS * 1000 : gap_us;
+                }
+                last_ts_us = ts_us;
+                now_us = replay_now_us();
+                if (play_us > now_us) {
+                    usleep(play_us - now_us);
+                }
+            }
+
+            if (s_replay_linktype == PCAP_LINKTYPE_RADIOTAP) {
+                skip_len = replay_parse_radiotap(rev_buffer, len, &channel, &with_fcs, &rssi);
+                if (skip_len < 0) {
+                    continue;
+                }
+            }
+            if ((int)len <= skip_len) {
+                continue;
+            }
+            /* the card only hears the channel it is on */
+            if (channel && s_replay_channel && channel != s_replay_channel) {
+                continue;
+            }
+
+            now_us = replay_now_us();
+            ((awss_recv_80211_frame_cb_t)cb)((char *)rev_buffer + skip_len, len - skip_len,
+                                             AWSS_LINK_TYPE_NONE, with_fcs, rssi);
+            cb_us += replay_now_us() - now_us;
+            delivered++;
+        }
+
+        now_us = replay_now_us();
+        pass++;
+        total_cb_us += cb_us;
+        total_delivered += delivered;
+        if (!fast) {
+            printf("replay pass %d: %u frames, %u delivered in %u ms\r\n",
+                   pass, frames, delivered, (uint32_t)((now_us - begin_us) / 1000));
+        }
+        if (frames == 0) {
+            break;
+        }
+    }
+
+    printf("replay %d passes, %llu frames delivered, handler %llu us, %llu frames/s\r\n",
+           pass, (unsigned long long)total_delivered, (unsigned long long)total_cb_us,
+           total_cb_us ? (unsigned long long)(total_delivered * 1000000 / total_cb_us) : 0ULL);
+
+    free(rev_buffer);
+    fclose(s_replay_fp);
+    s_replay_fp = NULL;
+    printf("Replay Proc Finish\r\n");
+    s_replay_active = 0;
+    return (void *)0;
+}
+
+static int start_replay(_IN_ awss_recv_80211_frame_cb_t cb, const char *file)
+{
+    static void *g_replay_thread = NULL;
+    int stack_used;
+    hal_os_thread_param_t task_parms = {0};
+
+    /* threads are detached, so stop the previous replay and wait for it to let go of s_replay_fp */
+    s_replay_running = 0;
+    while (s_replay_active) {
+        usleep(10 * 1000);
+    }
+
+    if (replay_open(file) < 0) {
+        return -1;
+    }
+    s_replay_channel = 0;
+    s_replay_running = 1;
+    s_replay_active = 1;
+    s_replay_open_ms = replay_now_us() / 1000;
+    if (HAL_ThreadCreate(&g_replay_thread, func_Replay, (void *)cb, &task_parms, &stack_used) != 0) {
+        s_replay_running = 0;
+        s_replay_active = 0;
+        fclose(s_replay_fp);
+        s_replay_fp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
 void HAL_Awss_Open_Monitor(_IN_ awss_recv_80211_frame_cb_t cb)
 {
     extern void start_sniff(_IN_ awss_recv_80211_frame_cb_t cb);
@@ -235,6 +544,13 @@ void HAL_Awss_Open_Monitor(_IN_ awss_recv_80211_frame_cb_t cb)
 
     char buffer[256] = {0};
     int ret = 0;
+    char *pcap_file = getenv("AWSS_PCAP_FILE");
+
+    if (pcap_file != NULL) {
+        start_replay(cb, pcap_file);
+        return;
+    }
+
     memset(buffer, 0, 256);
     snprintf(buffer, 256, "ifconfig %s down", ifname);
     ret = system(buffer);
@@ -263,6 +579,15 @@ void HAL_Awss_Close_Monitor(void)
     int ret = -1;
     char buffer[256] = {0};
     char *ifname = g_ifname;
+
+    if (s_replay_running) {
+        /* after credentials are got or awss timed out */
+        s_replay_running = 0;
+        printf("replay monitor closed after %u ms\r\n",
+               (uint32_t)(replay_now_us() / 1000 - s_replay_open_ms));
+        return;
+    }
+
     stop_sniff();
     memset(buffer, 0, 256);
     snprintf(buffer, 256, "ifconfig %s down", ifname);
@@ -293,7 +618,14 @@ void HAL_Awss_Switch_Channel(
 {
     char cmd[255] = {0};
     int ret = -1;
-    snprintf(cmd, 255, "iwconfig %s channel %d", g_ifname, primary_channel);
+
+    if (s_replay_running) {
+        s_replay_channel = (uint8_t)primary_channel;
+        return;
+    }
+
+    /* 5G channels above 127 are passed through char */
+    snprintf(cmd, 255, "iwconfig %s channel %d", g_ifname, (uint8_t)primary_channel);
     printf("switch:%s\n", cmd);
     ret = system(cmd);
     assert(0 == ret);
@@ -459,6 +459,10 @@ static FILE *fp;
 void HAL_Firmware_Persistence_Start(void)
 {
 #ifdef __DEMO__
+    /* called again to restart the image from 0 */
+    if (fp != NULL) {
+        fclose(fp);
+    }
     fp = fopen(otafilename, "w");
     //    assert(fp);
 #endif
@@ -478,11 +482,42 @@ int HAL_Firmware_Persistence_Write(_IN_ char *buffer, _IN_ uint32_t length)
     return 0;
 }
 
+int HAL_Firmware_Persistence_Sync(void)
+{
+#ifdef __DEMO__
+    if (fp != NULL && (0 != fflush(fp) || 0 != fsync(fileno(fp)))) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+int HAL_Firmware_Persistence_Resume(_IN_ uint32_t offset)
+{
+#ifdef __DEMO__
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    fp = fopen(otafilename, "r+");
+    if (fp == NULL) {
+        return -1;
+    }
+    /* a file shorter than offset lost data after the checkpoint was saved, seeking past its end leaves a hole */
+    if (0 != fseek(fp, 0, SEEK_END) || ftell(fp) < (long)offset || 0 != fseek(fp, offset, SEEK_SET)) {
+        fclose(fp);
+        fp = NULL;
+        return -1;
+    }
+#endif
+    return 0;
+}
+
 int HAL_Firmware_Persistence_Stop(void)
 {
 #ifdef __DEMO__
     if (fp != NULL) {
         fclose(fp);
+        fp = NULL;
     }
 #endif
 
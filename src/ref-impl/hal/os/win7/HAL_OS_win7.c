@@ -11,6 +11,7 @@
 #include "iot_export.h"
 
 #include <process.h>
+#include <io.h>
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -375,6 +376,10 @@ void HAL_ThreadDelete(_IN_ void *thread_handle)
 void HAL_Firmware_Persistence_Start(void)
 {
 #ifdef __DEMO__
+    /* called again to restart the image from 0 */
+    if (fp != NULL) {
+        fclose(fp);
+    }
     fp = fopen(otafilename, "w");
     //    assert(fp);
 #endif
@@ -394,11 +399,42 @@ int HAL_Firmware_Persistence_Write(_IN_ char *buffer, _IN_ uint32_t length)
     return 0;
 }
 
+int HAL_Firmware_Persistence_Sync(void)
+{
+#ifdef __DEMO__
+    if (fp != NULL && (0 != fflush(fp) || 0 != _commit(_fileno(fp)))) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+int HAL_Firmware_Persistence_Resume(_IN_ uint32_t offset)
+{
+#ifdef __DEMO__
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    fp = fopen(otafilename, "r+");
+    if (fp == NULL) {
+        return -1;
+    }
+    /* a file shorter than offset lost data after the checkpoint was saved, seeking past its end leaves a hole */
+    if (0 != fseek(fp, 0, SEEK_END) || ftell(fp) < (long)offset || 0 != fseek(fp, offset, SEEK_SET)) {
+        fclose(fp);
+        fp = NULL;
+        return -1;
+    }
+#endif
+    return 0;
+}
+
 int HAL_Firmware_Persistence_Stop(void)
 {
 #ifdef __DEMO__
     if (fp != NULL) {
         fclose(fp);
+        fp = NULL;
     }
 #endif
 
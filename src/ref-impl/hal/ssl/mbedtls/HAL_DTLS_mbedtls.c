@@ -30,7 +30,27 @@
 
 
 #ifdef DTLS_SESSION_SAVE
-    mbedtls_ssl_session *saved_session = NULL;
+/* sessions of different servers are kept apart, keyed by host:port */
+#ifndef DTLS_SESSION_CACHE_NUM
+    #define DTLS_SESSION_CACHE_NUM      (2)
+#endif
+#ifndef DTLS_SESSION_LIFETIME_MS
+    #define DTLS_SESSION_LIFETIME_MS    (24 * 3600 * 1000)
+#endif
+#define DTLS_SESSION_KEY_LEN            (64)
+
+typedef struct {
+    char                key[DTLS_SESSION_KEY_LEN];  /* host:port, empty if unused */
+    uint64_t            saved_time;
+    uint32_t            last_used;
+    mbedtls_ssl_session session;
+} dtls_saved_session_t;
+
+static dtls_saved_session_t saved_sessions[DTLS_SESSION_CACHE_NUM];
+static uint32_t saved_session_clock = 0;
+static void *saved_session_mutex = NULL;
+static uint32_t dtls_full_handshakes = 0;
+static uint32_t dtls_resumed_handshakes = 0;
 #endif
 
 typedef struct {
@@ -135,49 +155,146 @@ static  void _DTLSFree_wrapper(void *ptr)
 #endif
 
 #ifdef DTLS_SESSION_SAVE
-static int _DTLSSession_save(const mbedtls_ssl_session *session,
-                             unsigned char *buf, size_t buf_len,
-                             size_t *olen)
+/* deep copy without peer_cert, which is not needed for resumption */
+static int _DTLSSession_copy(mbedtls_ssl_session *dst, const mbedtls_ssl_session *src)
 {
-    unsigned char *p = buf;
-    size_t left = buf_len;
+    memcpy(dst, src, sizeof(mbedtls_ssl_session));
 #if defined(MBEDTLS_X509_CRT_PARSE_C)
-    size_t cert_len;
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
+    dst->peer_cert = NULL;
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    dst->ticket = NULL;
+    if (src->ticket_len > 0) {
+        dst->ticket = mbedtls_calloc(1, src->ticket_len);
+        if (NULL == dst->ticket) {
+            dst->ticket_len = 0;
+            return MBEDTLS_ERR_SSL_ALLOC_FAILED;
+        }
+        memcpy(dst->ticket, src->ticket, src->ticket_len);
+    }
+#endif
+    return 0;
+}
+
+static void _DTLSSession_drop(dtls_saved_session_t *saved)
+{
+    mbedtls_ssl_session_free(&saved->session);
+    memset(saved, 0, sizeof(dtls_saved_session_t));
+}
 
-    if (left < sizeof(mbedtls_ssl_session)) {
-        return (MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL);
+/* find the saved session of key, or the slot to save it in when found is 0 */
+static dtls_saved_session_t *_DTLSSession_find(const char *key, int *found)
+{
+    int i;
+    dtls_saved_session_t *victim = &saved_sessions[0];
+
+    *found = 0;
+    for (i = 0; i < DTLS_SESSION_CACHE_NUM; i++) {
+        if (!strcmp(saved_sessions[i].key, key)) {
+            *found = 1;
+            return &saved_sessions[i];
+        }
+        if (victim->key[0] != '\0' &&
+            (saved_sessions[i].key[0] == '\0' || saved_sessions[i].last_used < victim->last_used)) {
+            victim = &saved_sessions[i];
+        }
     }
 
-    memcpy(p, session, sizeof(mbedtls_ssl_session));
-    p += sizeof(mbedtls_ssl_session);
-    left -= sizeof(mbedtls_ssl_session);
+    return victim;
+}
 
-#if defined(MBEDTLS_X509_CRT_PARSE_C)
-    if (session->peer_cert == NULL) {
-        cert_len = 0;
-    } else {
-        cert_len = session->peer_cert->raw.len;
+static int _DTLSSession_lock(void)
+{
+    if (NULL == saved_session_mutex) {
+        saved_session_mutex = HAL_MutexCreate();
+        if (NULL == saved_session_mutex) {
+            return -1;
+        }
     }
+    HAL_MutexLock(saved_session_mutex);
+    return 0;
+}
+
+/* copy the saved session of key to session, return 0 if there is one */
+static int _DTLSSession_load(const char *key, mbedtls_ssl_session *session)
+{
+    int found, ret = -1;
+    dtls_saved_session_t *saved;
 
-    if (left < 3 + cert_len) {
-        return (MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL);
+    if (0 != _DTLSSession_lock()) {
+        return -1;
     }
 
-    *p++ = (unsigned char)(cert_len >> 16 & 0xFF);
-    *p++ = (unsigned char)(cert_len >>  8 & 0xFF);
-    *p++ = (unsigned char)(cert_len       & 0xFF);
+    saved = _DTLSSession_find(key, &found);
+    if (found) {
+        if (HAL_UptimeMs() - saved->saved_time >= DTLS_SESSION_LIFETIME_MS) {
+            DTLS_INFO("saved session of %s expired\r\n", key);
+            _DTLSSession_drop(saved);
+        } else {
+            saved->last_used = ++saved_session_clock;
+            ret = _DTLSSession_copy(session, &saved->session);
+            if (0 != ret) {
+                mbedtls_ssl_session_free(session);
+            }
+        }
+    }
+
+    HAL_MutexUnlock(saved_session_mutex);
+    return ret;
+}
+
+static void _DTLSSession_save(const char *key, const mbedtls_ssl_session *session)
+{
+    int found;
+    dtls_saved_session_t *saved;
+
+    if (0 != _DTLSSession_lock()) {
+        return;
+    }
 
-    if (session->peer_cert != NULL) {
-        memcpy(p, session->peer_cert->raw.p, cert_len);
+    saved = _DTLSSession_find(key, &found);
+    /* a resumed session keeps the time it was first saved */
+    if (!found || saved->session.id_len != session->id_len ||
+        memcmp(saved->session.id, session->id, session->id_len) ||
+        memcmp(saved->session.master, session->master, sizeof(session->master))) {
+        _DTLSSession_drop(saved);
+        if (0 == _DTLSSession_copy(&saved->session, session)) {
+            strncpy(saved->key, key, DTLS_SESSION_KEY_LEN - 1);
+            saved->saved_time = HAL_UptimeMs();
+        } else {
+            _DTLSSession_drop(saved);
+        }
+    }
+    if (saved->key[0] != '\0') {
+        saved->last_used = ++saved_session_clock;
     }
 
-    p += cert_len;
-#endif /* MBEDTLS_X509_CRT_PARSE_C */
+    HAL_MutexUnlock(saved_session_mutex);
+}
+
+/* errors the server gives for a session it won't resume, a timeout or lost datagram says nothing about it */
+static int _DTLSSession_rejected(int result)
+{
+    return (MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE == result ||
+            MBEDTLS_ERR_SSL_BAD_HS_SERVER_HELLO == result ||
+            MBEDTLS_ERR_SSL_BAD_HS_FINISHED == result);
+}
+
+static void _DTLSSession_forget(const char *key)
+{
+    int found;
+    dtls_saved_session_t *saved;
 
-    *olen = p - buf;
+    if (0 != _DTLSSession_lock()) {
+        return;
+    }
+
+    saved = _DTLSSession_find(key, &found);
+    if (found) {
+        _DTLSSession_drop(saved);
+    }
 
-    return (0);
+    HAL_MutexUnlock(saved_session_mutex);
 }
 #endif
 
@@ -224,6 +341,11 @@ static void _DTLSLog_wrapper(void        *p_ctx, int level,
 static unsigned int _DTLSContext_setup(dtls_session_t *p_dtls_session, coap_dtls_options_t *p_options)
 {
     int   result = 0;
+#ifdef DTLS_SESSION_SAVE
+    char session_key[DTLS_SESSION_KEY_LEN] = {0};
+    mbedtls_ssl_session saved_session;
+    int has_saved_session = 0;
+#endif
 
     mbedtls_ssl_init(&p_dtls_session->context);
 
@@ -249,9 +371,21 @@ static unsigned int _DTLSContext_setup(dtls_session_t *p_dtls_session, coap_dtls
                             mbedtls_net_recv_timeout);
         DTLS_TRC("mbedtls_ssl_set_bio result 0x%04x\r\n", result);
 
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+        /*
+         * zero length own CID: ask the server for a CID and put it in the records we send,
+         * so the session survives a NAT rebinding or address change of this side
+         */
+        result = mbedtls_ssl_set_cid(&p_dtls_session->context, MBEDTLS_SSL_CID_ENABLED, NULL, 0);
+        DTLS_TRC("mbedtls_ssl_set_cid result 0x%04x\r\n", result);
+#endif
+
 #ifdef DTLS_SESSION_SAVE
-        if (NULL != saved_session) {
-            result = mbedtls_ssl_set_session(&p_dtls_session->context, saved_session);
+        HAL_Snprintf(session_key, sizeof(session_key), "%s:%u", p_options->p_host, p_options->port);
+        memset(&saved_session, 0x00, sizeof(mbedtls_ssl_session));
+        if (0 == _DTLSSession_load(session_key, &saved_session)) {
+            has_saved_session = 1;
+            result = mbedtls_ssl_set_session(&p_dtls_session->context, &saved_session);
             DTLS_TRC("mbedtls_ssl_set_session return 0x%04x\r\n", result);
         }
 #endif
@@ -266,16 +400,42 @@ static unsigned int _DTLSContext_setup(dtls_session_t *p_dtls_session, coap_dtls
                  mbedtls_mem_used, mbedtls_max_mem_used);
 #endif
 
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+        if (0 == result) {
+            int cid_enabled = MBEDTLS_SSL_CID_DISABLED;
+            unsigned char peer_cid[MBEDTLS_SSL_CID_OUT_LEN_MAX];
+            size_t peer_cid_len = 0;
+
+            mbedtls_ssl_get_peer_cid(&p_dtls_session->context, &cid_enabled, peer_cid, &peer_cid_len);
+            DTLS_INFO("connection id %s, peer cid len %d\r\n",
+                      cid_enabled == MBEDTLS_SSL_CID_ENABLED ? "enabled" : "not supported by server",
+                      (int)peer_cid_len);
+        }
+#endif
+
 #ifdef DTLS_SESSION_SAVE
         if (0 == result) {
-            if (NULL == saved_session) {
-                saved_session = HAL_Malloc(sizeof(mbedtls_ssl_session));
-            }
-            if (NULL != saved_session) {
-                memset(saved_session, 0x00, sizeof(mbedtls_ssl_session));
-                result = mbedtls_ssl_get_session(&p_dtls_session->context, saved_session);
-                DTLS_TRC("mbedtls_ssl_get_session return 0x%04x\r\n", result);
+            mbedtls_ssl_session new_session;
+
+            memset(&new_session, 0x00, sizeof(mbedtls_ssl_session));
+            if (0 == mbedtls_ssl_get_session(&p_dtls_session->context, &new_session)) {
+                /* an abbreviated handshake keeps the master secret of the saved session */
+                if (has_saved_session && !memcmp(new_session.master, saved_session.master, sizeof(new_session.master))) {
+                    dtls_resumed_handshakes++;
+                } else {
+                    dtls_full_handshakes++;
+                }
+                DTLS_INFO("handshake with %s, full %u, resumed %u\r\n", session_key,
+                          dtls_full_handshakes, dtls_resumed_handshakes);
+                _DTLSSession_save(session_key, &new_session);
             }
+            mbedtls_ssl_session_free(&new_session);
+        } else if (has_saved_session && _DTLSSession_rejected(result)) {
+            /* don't offer it again if it is what the server refused */
+            _DTLSSession_forget(session_key);
+        }
+        if (has_saved_session) {
+            mbedtls_ssl_session_free(&saved_session);
         }
 #endif
     }
@@ -377,6 +537,13 @@ DTLSContext *HAL_DTLSSession_create(coap_dtls_options_t *p_options)
         }
         mbedtls_ssl_conf_rng(&p_dtls_session->conf, mbedtls_ctr_drbg_random, &p_dtls_session->ctr_drbg);
         mbedtls_ssl_conf_dbg(&p_dtls_session->conf, _DTLSLog_wrapper, NULL);
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+        result = mbedtls_ssl_conf_cid(&p_dtls_session->conf, 0, MBEDTLS_SSL_UNEXPECTED_CID_IGNORE);
+        if (0 != result) {
+            DTLS_ERR("mbedtls_ssl_conf_cid result 0x%04x\r\n", result);
+            goto error;
+        }
+#endif
 
         result = mbedtls_ssl_cookie_setup(&p_dtls_session->cookie_ctx,
                                           mbedtls_ctr_drbg_random, &p_dtls_session->ctr_drbg);
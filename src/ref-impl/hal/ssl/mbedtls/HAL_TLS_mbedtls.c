@@ -29,6 +29,7 @@
 #include "mbedtls/pk.h"
 #include "mbedtls/debug.h"
 #include "mbedtls/platform.h"
+#include "mbedtls/sha256.h"
 
 #include "utils_hmac.h"
 #include "iot_import.h"
@@ -39,14 +40,19 @@
 #define GUIDER_ONLINE_HOSTNAME              ("iot-auth.cn-shanghai.aliyuncs.com")
 #define GUIDER_PRE_ADDRESS                  ("100.67.80.107")
 
-typedef struct _TLSDataParams {
-    mbedtls_ssl_context ssl;          /**< mbed TLS control context. */
-    mbedtls_net_context fd;           /**< mbed TLS network context. */
+/*
+ * Parsed certificates and the ssl config built from them, shared by all the
+ * connections made with the same CA/client cert/key.
+ */
+typedef struct _TLSSharedConf {
+    struct _TLSSharedConf *next;
+    int ref;                          /**< connections using it, kept when it drops to 0. */
+    unsigned char hash[32];           /**< sha256 of what the config is built from. */
     mbedtls_ssl_config conf;          /**< mbed TLS configuration context. */
     mbedtls_x509_crt cacertl;         /**< mbed TLS CA certification. */
     mbedtls_x509_crt clicert;         /**< mbed TLS Client certification. */
     mbedtls_pk_context pkey;          /**< mbed TLS Client key. */
-} TLSDataParams_t, *TLSDataParams_pt;
+} TLSSharedConf_t;
 
 static unsigned int mbedtls_mem_used = 0;
 static unsigned int mbedtls_max_mem_used = 0;
@@ -68,86 +74,430 @@ typedef struct {
     #define TLS_AUTH_MODE           TLS_AUTH_MODE_CA
 #endif
 
+/* max number of shared configs kept when no connection uses them */
+#ifndef TLS_SHARED_CONF_NUM
+    #define TLS_SHARED_CONF_NUM     (2)
+#endif
+
+static TLSSharedConf_t *g_tls_shared_confs = NULL;
+static void *g_tls_shared_conf_mutex = NULL;
+
 /* define TLS_SAVE_TICKET to enable support for RFC 5077 session tickets in SSL */
 #if defined(TLS_SAVE_TICKET)
 
-#define KEY_MAX_LEN          64
-#define TLS_MAX_SESSION_BUF  384
-#define KV_SESSION_KEY_FMT   "TLS_%s"
+/*
+ * Sessions are cached per host:port, so MQTT, HTTPS OTA and HTTP2 connections
+ * do not evict each other, and each one is kept in KV as "TLS_<host>:<port>"
+ * in a field by field format which doesn't depend on mbedtls_ssl_session layout.
+ */
+#ifndef TLS_SESSION_CACHE_NUM
+    #define TLS_SESSION_CACHE_NUM       (4)
+#endif
+/* used when server gives no ticket lifetime hint, and as the upper bound */
+#ifndef TLS_SESSION_MAX_LIFETIME_S
+    #define TLS_SESSION_MAX_LIFETIME_S  (24 * 3600)
+#endif
+
+#define KEY_MAX_LEN                 64
+#define TLS_MAX_SESSION_BUF         384
+#define KV_SESSION_KEY_FMT          "TLS_%s"
+#define TLS_SESSION_FORMAT_VERSION  1
 
 extern int HAL_Kv_Set(const char *key, const void *val, int len, int sync);
 
 extern int HAL_Kv_Get(const char *key, void *val, int *buffer_len);
 
-static mbedtls_ssl_session *saved_session = NULL;
+extern int HAL_Kv_Del(const char *key);
+
+typedef struct {
+    char                key[KEY_MAX_LEN];       /* host:port, empty if unused */
+    long long           expire_ms;              /* HAL_UTC_Get() based */
+    uint32_t            last_used;
+    mbedtls_ssl_session session;
+} tls_session_entry_t;
+
+static tls_session_entry_t g_tls_sessions[TLS_SESSION_CACHE_NUM];
+static uint32_t g_tls_session_clock = 0;
+static void *g_tls_session_mutex = NULL;
+
+/* handshake statistic, reported after each handshake */
+static uint32_t g_tls_full_handshakes = 0;
+static uint32_t g_tls_resumed_handshakes = 0;
 
-static int ssl_serialize_session(const mbedtls_ssl_session *session,
+static int ssl_serialize_session(const mbedtls_ssl_session *session, long long expire_ms,
                                  unsigned char *buf, size_t buf_len,
                                  size_t *olen)
 {
     unsigned char *p = buf;
-    size_t left = buf_len;
+    size_t ticket_len = 0;
+    uint32_t lifetime = 0;
+    unsigned char mfl_code = 0, trunc_hmac = 0, etm = 0;
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    ticket_len = session->ticket_len;
+    lifetime = session->ticket_lifetime;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    mfl_code = session->mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    trunc_hmac = (unsigned char)session->trunc_hmac;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    etm = (unsigned char)session->encrypt_then_mac;
+#endif
 
-    if (left < sizeof(mbedtls_ssl_session)) {
+    if (session->id_len > sizeof(session->id) || ticket_len > 0xFFFF ||
+        buf_len < 1 + 2 + 1 + 1 + session->id_len + 48 + 4 + 8 + 4 + 2 + ticket_len + 3) {
         return (MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL);
     }
 
-    memcpy(p, session, sizeof(mbedtls_ssl_session));
-    p += sizeof(mbedtls_ssl_session);
-    left -= sizeof(mbedtls_ssl_session);
+    *p++ = TLS_SESSION_FORMAT_VERSION;
+    *p++ = (unsigned char)(session->ciphersuite >> 8);
+    *p++ = (unsigned char)(session->ciphersuite);
+    *p++ = (unsigned char)(session->compression);
+    *p++ = (unsigned char)(session->id_len);
+    memcpy(p, session->id, session->id_len);
+    p += session->id_len;
+    memcpy(p, session->master, 48);
+    p += 48;
+    *p++ = (unsigned char)(session->verify_result >> 24);
+    *p++ = (unsigned char)(session->verify_result >> 16);
+    *p++ = (unsigned char)(session->verify_result >> 8);
+    *p++ = (unsigned char)(session->verify_result);
+    *p++ = (unsigned char)((unsigned long long)expire_ms >> 56);
+    *p++ = (unsigned char)((unsigned long long)expire_ms >> 48);
+    *p++ = (unsigned char)((unsigned long long)expire_ms >> 40);
+    *p++ = (unsigned char)((unsigned long long)expire_ms >> 32);
+    *p++ = (unsigned char)((unsigned long long)expire_ms >> 24);
+    *p++ = (unsigned char)((unsigned long long)expire_ms >> 16);
+    *p++ = (unsigned char)((unsigned long long)expire_ms >> 8);
+    *p++ = (unsigned char)((unsigned long long)expire_ms);
+    *p++ = (unsigned char)(lifetime >> 24);
+    *p++ = (unsigned char)(lifetime >> 16);
+    *p++ = (unsigned char)(lifetime >> 8);
+    *p++ = (unsigned char)(lifetime);
+    *p++ = (unsigned char)(ticket_len >> 8);
+    *p++ = (unsigned char)(ticket_len);
 #if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
-    if (left < sizeof(mbedtls_ssl_session)) {
-        return (MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL);
+    if (ticket_len > 0) {
+        memcpy(p, session->ticket, ticket_len);
+        p += ticket_len;
     }
-    memcpy(p, session->ticket, session->ticket_len);
-    p += session->ticket_len;
-    left -= session->ticket_len;
 #endif
+    *p++ = mfl_code;
+    *p++ = trunc_hmac;
+    *p++ = etm;
 
     *olen = p - buf;
 
     return (0);
 }
 
-static int ssl_deserialize_session(mbedtls_ssl_session *session,
+static int ssl_deserialize_session(mbedtls_ssl_session *session, long long *expire_ms,
                                    const unsigned char *buf, size_t len)
 {
     const unsigned char *p = buf;
     const unsigned char *const end = buf + len;
+    size_t ticket_len;
+    uint32_t lifetime;
+    unsigned long long expire = 0;
+    int i;
+
+    memset(session, 0, sizeof(mbedtls_ssl_session));
 
-    if (sizeof(mbedtls_ssl_session) > (size_t)(end - p)) {
+    if (len < 5 || p[0] != TLS_SESSION_FORMAT_VERSION) {
+        return (MBEDTLS_ERR_SSL_BAD_INPUT_DATA);
+    }
+    p++;
+    session->ciphersuite = (p[0] << 8) | p[1];
+    p += 2;
+    session->compression = *p++;
+    session->id_len = *p++;
+    if (session->id_len > sizeof(session->id) ||
+        (size_t)(end - p) < session->id_len + 48 + 4 + 8 + 4 + 2) {
+        return (MBEDTLS_ERR_SSL_BAD_INPUT_DATA);
+    }
+    memcpy(session->id, p, session->id_len);
+    p += session->id_len;
+    memcpy(session->master, p, 48);
+    p += 48;
+    session->verify_result = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    p += 4;
+    for (i = 0; i < 8; i++) {
+        expire = (expire << 8) | *p++;
+    }
+    *expire_ms = (long long)expire;
+    lifetime = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    p += 4;
+    ticket_len = (p[0] << 8) | p[1];
+    p += 2;
+    if ((size_t)(end - p) != ticket_len + 3) {
         return (MBEDTLS_ERR_SSL_BAD_INPUT_DATA);
     }
 
-    memcpy(session, p, sizeof(mbedtls_ssl_session));
-    p += sizeof(mbedtls_ssl_session);
-#if (TLS_AUTH_MODE == TLS_AUTH_MODE_CA)
-    session->peer_cert = NULL;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    session->ticket_lifetime = lifetime;
+    if (ticket_len > 0) {
+        session->ticket = mbedtls_calloc(1, ticket_len);
+        if (session->ticket == NULL) {
+            return (MBEDTLS_ERR_SSL_ALLOC_FAILED);
+        }
+        memcpy(session->ticket, p, ticket_len);
+        session->ticket_len = ticket_len;
+    }
+#else
+    /* ticket can't be used by this build, resume by session id only */
+    (void)lifetime;
+#endif
+    p += ticket_len;
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    session->mfl_code = p[0];
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    session->trunc_hmac = p[1];
 #endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    session->encrypt_then_mac = p[2];
+#endif
+
+    return (0);
+}
 
+/* deep copy without peer_cert, which is not needed for resumption */
+static int ssl_session_dup(mbedtls_ssl_session *dst, const mbedtls_ssl_session *src)
+{
+    memcpy(dst, src, sizeof(mbedtls_ssl_session));
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    dst->peer_cert = NULL;
+#endif
 #if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
-    if (session->ticket_len > 0) {
-        if (session->ticket_len > (size_t)(end - p)) {
-            return (MBEDTLS_ERR_SSL_BAD_INPUT_DATA);
-        }
-        session->ticket = HAL_Malloc(session->ticket_len);
-        if (session->ticket == NULL) {
+    dst->ticket = NULL;
+    if (src->ticket_len > 0) {
+        dst->ticket = mbedtls_calloc(1, src->ticket_len);
+        if (dst->ticket == NULL) {
+            dst->ticket_len = 0;
             return (MBEDTLS_ERR_SSL_ALLOC_FAILED);
         }
-        memcpy(session->ticket, p, session->ticket_len);
-        p += session->ticket_len;
-        printf("saved ticket len = %d \r\n", (int)session->ticket_len);
+        memcpy(dst->ticket, src->ticket, src->ticket_len);
     }
 #endif
+    return (0);
+}
 
-    if (p != end) {
-        return (MBEDTLS_ERR_SSL_BAD_INPUT_DATA);
+static long long ssl_session_expire_ms(const mbedtls_ssl_session *session)
+{
+    uint32_t lifetime = TLS_SESSION_MAX_LIFETIME_S;
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    if (session->ticket_lifetime != 0 && session->ticket_lifetime < lifetime) {
+        lifetime = session->ticket_lifetime;
     }
+#endif
+    return HAL_UTC_Get() + (long long)lifetime * 1000;
+}
 
-    return (0);
+static void ssl_session_entry_free(tls_session_entry_t *entry)
+{
+    mbedtls_ssl_session_free(&entry->session);
+    memset(entry, 0, sizeof(tls_session_entry_t));
+}
+
+static int ssl_session_cache_lock(void)
+{
+    if (g_tls_session_mutex == NULL) {
+        g_tls_session_mutex = HAL_MutexCreate();
+        if (g_tls_session_mutex == NULL) {
+            return -1;
+        }
+    }
+    HAL_MutexLock(g_tls_session_mutex);
+    return 0;
+}
+
+/* find the entry of key, or the one to (re)use for it: a free or the least recently used one */
+static tls_session_entry_t *ssl_session_cache_slot(const char *key, int *found)
+{
+    int i;
+    tls_session_entry_t *victim = &g_tls_sessions[0];
+
+    *found = 0;
+    for (i = 0; i < TLS_SESSION_CACHE_NUM; i++) {
+        if (!strcmp(g_tls_sessions[i].key, key)) {
+            *found = 1;
+            return &g_tls_sessions[i];
+        }
+        if (victim->key[0] != '\0' &&
+            (g_tls_sessions[i].key[0] == '\0' || g_tls_sessions[i].last_used < victim->last_used)) {
+            victim = &g_tls_sessions[i];
+        }
+    }
+
+    return victim;
+}
+
+/*
+ * copy the session cached for key to session, loading it from KV if it is not in memory
+ * @return 0 on hit, -1 if there is no usable one
+ */
+static int ssl_session_cache_get(const char *key, mbedtls_ssl_session *session)
+{
+    int found, ret = -1;
+    tls_session_entry_t *entry;
+
+    if (ssl_session_cache_lock() != 0) {
+        return -1;
+    }
+
+    entry = ssl_session_cache_slot(key, &found);
+    if (!found) {
+        int len = TLS_MAX_SESSION_BUF;
+        char key_buf[KEY_MAX_LEN + 8] = {0};
+        unsigned char *save_buf = HAL_Malloc(TLS_MAX_SESSION_BUF);
+
+        if (save_buf == NULL) {
+            goto do_exit;
+        }
+        HAL_Snprintf(key_buf, sizeof(key_buf) - 1, KV_SESSION_KEY_FMT, key);
+        if (HAL_Kv_Get(key_buf, save_buf, &len) != 0 || len <= 0) {
+            HAL_Free(save_buf);
+            goto do_exit;
+        }
+
+        ssl_session_entry_free(entry);
+        if (ssl_deserialize_session(&entry->session, &entry->expire_ms, save_buf, len) != 0) {
+            hal_err("saved session of %s is invalid, drop it", key);
+            ssl_session_entry_free(entry);
+            HAL_Kv_Del(key_buf);
+            HAL_Free(save_buf);
+            goto do_exit;
+        }
+        HAL_Free(save_buf);
+        strncpy(entry->key, key, KEY_MAX_LEN - 1);
+    }
+
+    if (HAL_UTC_Get() >= entry->expire_ms) {
+        char key_buf[KEY_MAX_LEN + 8] = {0};
+
+        hal_info("saved session of %s expired", key);
+        HAL_Snprintf(key_buf, sizeof(key_buf) - 1, KV_SESSION_KEY_FMT, key);
+        HAL_Kv_Del(key_buf);
+        ssl_session_entry_free(entry);
+        goto do_exit;
+    }
+
+    entry->last_used = ++g_tls_session_clock;
+    ret = ssl_session_dup(session, &entry->session);
+    if (ret != 0) {
+        mbedtls_ssl_session_free(session);
+    }
+
+do_exit:
+    HAL_MutexUnlock(g_tls_session_mutex);
+    return ret;
+}
+
+/* cache the session of a finished handshake, and save it to KV if it changed */
+static void ssl_session_cache_put(const char *key, const mbedtls_ssl_session *session)
+{
+    int found, ret;
+    size_t len = 0;
+    tls_session_entry_t *entry;
+    unsigned char *save_buf;
+    char key_buf[KEY_MAX_LEN + 8] = {0};
+
+    if (ssl_session_cache_lock() != 0) {
+        return;
+    }
+
+    entry = ssl_session_cache_slot(key, &found);
+    if (found && entry->session.id_len == session->id_len &&
+        !memcmp(entry->session.id, session->id, session->id_len) &&
+        !memcmp(entry->session.master, session->master, 48)
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+        && entry->session.ticket_len == session->ticket_len &&
+        (session->ticket_len == 0 || !memcmp(entry->session.ticket, session->ticket, session->ticket_len))
+#endif
+       ) {
+        /* resumed with the same ticket, nothing new to save */
+        entry->last_used = ++g_tls_session_clock;
+        HAL_MutexUnlock(g_tls_session_mutex);
+        return;
+    }
+
+    ssl_session_entry_free(entry);
+    if (ssl_session_dup(&entry->session, session) != 0) {
+        ssl_session_entry_free(entry);
+        HAL_MutexUnlock(g_tls_session_mutex);
+        return;
+    }
+    strncpy(entry->key, key, KEY_MAX_LEN - 1);
+    entry->expire_ms = ssl_session_expire_ms(session);
+    entry->last_used = ++g_tls_session_clock;
+
+    save_buf = HAL_Malloc(TLS_MAX_SESSION_BUF);
+    if (save_buf != NULL) {
+        ret = ssl_serialize_session(&entry->session, entry->expire_ms, save_buf, TLS_MAX_SESSION_BUF, &len);
+        if (ret == 0) {
+            HAL_Snprintf(key_buf, sizeof(key_buf) - 1, KV_SESSION_KEY_FMT, key);
+            ret = HAL_Kv_Set(key_buf, (void *)save_buf, len, 1);
+            if (ret < 0) {
+                hal_err("save ticket to kv failed ret =%d ,len = %d", ret, (int)len);
+            }
+        } else {
+            /* still cached in memory for this boot */
+            hal_err("session of %s is too large to save", key);
+        }
+        HAL_Free(save_buf);
+    }
+
+    HAL_MutexUnlock(g_tls_session_mutex);
+}
+
+/* forget the session of key, e.g. after it was rejected in a handshake */
+static void ssl_session_cache_del(const char *key)
+{
+    int found;
+    tls_session_entry_t *entry;
+    char key_buf[KEY_MAX_LEN + 8] = {0};
+
+    if (ssl_session_cache_lock() != 0) {
+        return;
+    }
+
+    entry = ssl_session_cache_slot(key, &found);
+    if (found) {
+        ssl_session_entry_free(entry);
+    }
+    HAL_Snprintf(key_buf, sizeof(key_buf) - 1, KV_SESSION_KEY_FMT, key);
+    HAL_Kv_Del(key_buf);
+
+    HAL_MutexUnlock(g_tls_session_mutex);
 }
 #endif /* #if defined(TLS_SAVE_TICKET) */
 
+/* progress of a connection made by HAL_SSL_Establish_Async() */
+enum {
+    TLS_ASYNC_NONE = 0,               /* established, or made by HAL_SSL_Establish() */
+    TLS_ASYNC_CONNECTING,
+    TLS_ASYNC_HANDSHAKE,
+    TLS_ASYNC_FAILED
+};
+
+typedef struct _TLSDataParams {
+    mbedtls_ssl_context ssl;          /**< mbed TLS control context. */
+    mbedtls_net_context fd;           /**< mbed TLS network context. */
+    mbedtls_ssl_config conf;          /**< shallow copy of shared->conf, owns nothing. */
+    TLSSharedConf_t *shared;          /**< shared certificates and config. */
+    int async_state;                  /**< TLS_ASYNC_XXX. */
+#if defined(TLS_SAVE_TICKET)
+    char session_key[KEY_MAX_LEN];    /**< host:port, key of the session cache. */
+    mbedtls_ssl_session saved_session;/**< session offered in the handshake. */
+    int has_saved_session;
+    uint64_t handshake_start;
+#endif
+} TLSDataParams_t, *TLSDataParams_pt;
+
 
 static unsigned int _avRandom()
 {
@@ -208,26 +558,21 @@ static int _real_confirm(int verify_result)
     return 0;
 }
 
-static int _ssl_client_init(mbedtls_ssl_context *ssl,
-                            mbedtls_net_context *tcp_fd,
-                            mbedtls_ssl_config *conf,
-                            mbedtls_x509_crt *crt509_ca, const char *ca_crt, size_t ca_len,
-                            mbedtls_x509_crt *crt509_cli, const char *cli_crt, size_t cli_len,
-                            mbedtls_pk_context *pk_cli, const char *cli_key, size_t key_len,  const char *cli_pwd, size_t pwd_len
-                           )
+static int _ssl_shared_conf_build(TLSSharedConf_t *shared,
+                                  const char *ca_crt, size_t ca_crt_len,
+                                  const char *client_crt, size_t client_crt_len,
+                                  const char *client_key, size_t client_key_len,
+                                  const char *client_pwd, size_t client_pwd_len)
 {
     int ret = -1;
 
-    /*
-     * 0. Initialize the RNG and the session data
-     */
 #if defined(MBEDTLS_DEBUG_C)
     mbedtls_debug_set_threshold((int)CONFIG_MBEDTLS_DEBUG_LEVEL);
 #endif
-    mbedtls_net_init(tcp_fd);
-    mbedtls_ssl_init(ssl);
-    mbedtls_ssl_config_init(conf);
-    mbedtls_x509_crt_init(crt509_ca);
+    mbedtls_ssl_config_init(&(shared->conf));
+    mbedtls_x509_crt_init(&(shared->cacertl));
+    mbedtls_x509_crt_init(&(shared->clicert));
+    mbedtls_pk_init(&(shared->pkey));
 
     /*verify_source->trusted_ca_crt==NULL
      * 0. Initialize certificates
@@ -235,7 +580,7 @@ static int _ssl_client_init(mbedtls_ssl_context *ssl,
 
     hal_info("Loading the CA root certificate ...");
     if (NULL != ca_crt) {
-        if (0 != (ret = mbedtls_x509_crt_parse(crt509_ca, (const unsigned char *)ca_crt, ca_len))) {
+        if (0 != (ret = mbedtls_x509_crt_parse(&(shared->cacertl), (const unsigned char *)ca_crt, ca_crt_len))) {
             hal_err(" failed ! x509parse_crt returned -0x%04x", -ret);
             return ret;
         }
@@ -245,14 +590,10 @@ static int _ssl_client_init(mbedtls_ssl_context *ssl,
 
     /* Setup Client Cert/Key */
 #if (TLS_AUTH_MODE == TLS_AUTH_MODE_CA)
-#if defined(MBEDTLS_CERTS_C)
-    mbedtls_x509_crt_init(crt509_cli);
-    mbedtls_pk_init(pk_cli);
-#endif
-    if (cli_crt != NULL && cli_key != NULL) {
+    if (client_crt != NULL && client_key != NULL) {
 #if defined(MBEDTLS_CERTS_C)
         hal_info("start prepare client cert .");
-        ret = mbedtls_x509_crt_parse(crt509_cli, (const unsigned char *) cli_crt, cli_len);
+        ret = mbedtls_x509_crt_parse(&(shared->clicert), (const unsigned char *) client_crt, client_crt_len);
 #else
         {
             ret = 1;
@@ -265,8 +606,8 @@ static int _ssl_client_init(mbedtls_ssl_context *ssl,
         }
 
 #if defined(MBEDTLS_CERTS_C)
-        hal_info("start mbedtls_pk_parse_key[%s]", cli_pwd);
-        ret = mbedtls_pk_parse_key(pk_cli, (const unsigned char *) cli_key, key_len, (const unsigned char *) cli_pwd, pwd_len);
+        hal_info("start mbedtls_pk_parse_key[%s]", client_pwd);
+        ret = mbedtls_pk_parse_key(&(shared->pkey), (const unsigned char *) client_key, client_key_len, (const unsigned char *) client_pwd, client_pwd_len);
 #else
         {
             ret = 1;
@@ -281,9 +622,235 @@ static int _ssl_client_init(mbedtls_ssl_context *ssl,
     }
 #endif /* #if (TLS_AUTH_MODE == TLS_AUTH_MODE_CA) */
 
+    if ((ret = mbedtls_ssl_config_defaults(&(shared->conf), MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+        hal_err(" failed! mbedtls_ssl_config_defaults returned %d", ret);
+        return ret;
+    }
+
+    mbedtls_ssl_conf_max_version(&(shared->conf), MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+    mbedtls_ssl_conf_min_version(&(shared->conf), MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+
+    hal_info(" ok");
+
+    /* OPTIONAL is not optimal for security, but makes interop easier in this simplified example */
+    if (ca_crt != NULL) {
+#if defined(FORCE_SSL_VERIFY)
+        mbedtls_ssl_conf_authmode(&(shared->conf), MBEDTLS_SSL_VERIFY_REQUIRED);
+#else
+        mbedtls_ssl_conf_authmode(&(shared->conf), MBEDTLS_SSL_VERIFY_OPTIONAL);
+#endif
+    } else {
+        mbedtls_ssl_conf_authmode(&(shared->conf), MBEDTLS_SSL_VERIFY_NONE);
+    }
+
+#if (TLS_AUTH_MODE == TLS_AUTH_MODE_CA)
+    mbedtls_ssl_conf_ca_chain(&(shared->conf), &(shared->cacertl), NULL);
+
+    if ((ret = mbedtls_ssl_conf_own_cert(&(shared->conf), &(shared->clicert), &(shared->pkey))) != 0) {
+        hal_err(" failed\n  ! mbedtls_ssl_conf_own_cert returned %d\n", ret);
+        return ret;
+    }
+#elif (TLS_AUTH_MODE == TLS_AUTH_MODE_PSK)
+    {
+        static const int ciphersuites[1] = {MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA};
+        char product_key[IOTX_PRODUCT_KEY_LEN + 1] = {0};
+        char device_name[IOTX_DEVICE_NAME_LEN + 1] = {0};
+        char device_secret[IOTX_DEVICE_SECRET_LEN + 1] = {0};
+        char *auth_type = "devicename";
+        char *sign_method = "hmacsha256";
+        char *timestamp = "2524608000000";
+        char *psk_identity = NULL, string_to_sign[IOTX_PRODUCT_KEY_LEN + IOTX_DEVICE_NAME_LEN + 33] = {0};
+        uint32_t psk_identity_len = 0;
+        uint8_t sign_hex[32] = {0};
+        char sign_string[65] = {0};
+        int i = 0;
+
+        HAL_GetProductKey(product_key);
+        HAL_GetDeviceName(device_name);
+        HAL_GetDeviceSecret(device_secret);
+
+        /* psk identity length */
+        psk_identity_len = strlen(auth_type) + strlen(sign_method) + strlen(product_key) + strlen(device_name) + strlen(
+                                       timestamp) + 5;
+        psk_identity = HAL_Malloc(psk_identity_len);
+        if (psk_identity == NULL) {
+            printf("psk_identity malloc failed\n");
+            return -1;
+        }
+        memset(psk_identity, 0, psk_identity_len);
+        memcpy(psk_identity, auth_type, strlen(auth_type));
+        memcpy(psk_identity + strlen(psk_identity), "|", strlen("|"));
+        memcpy(psk_identity + strlen(psk_identity), sign_method, strlen(sign_method));
+        memcpy(psk_identity + strlen(psk_identity), "|", strlen("|"));
+        memcpy(psk_identity + strlen(psk_identity), product_key, strlen(product_key));
+        memcpy(psk_identity + strlen(psk_identity), "&", strlen("&"));
+        memcpy(psk_identity + strlen(psk_identity), device_name, strlen(device_name));
+        memcpy(psk_identity + strlen(psk_identity), "|", strlen("|"));
+        memcpy(psk_identity + strlen(psk_identity), timestamp, strlen(timestamp));
+
+        /* string to sign */
+        memcpy(string_to_sign, "id", strlen("id"));
+        memcpy(string_to_sign + strlen(string_to_sign), product_key, strlen(product_key));
+        memcpy(string_to_sign + strlen(string_to_sign), "&", strlen("&"));
+        memcpy(string_to_sign + strlen(string_to_sign), device_name, strlen(device_name));
+        memcpy(string_to_sign + strlen(string_to_sign), "timestamp", strlen("timestamp"));
+        memcpy(string_to_sign + strlen(string_to_sign), timestamp, strlen(timestamp));
+
+        utils_hmac_sha256(string_to_sign, strlen(string_to_sign), sign_string, device_secret, strlen(device_secret));
+
+        for (i = 0; i < strlen(sign_string); i++) {
+            if (sign_string[i] >= 'a' && sign_string[i] <= 'z') {
+                sign_string[i] -= 'a' - 'A';
+            }
+        }
+        /* printf("psk_identity: %s\n",psk_identity);
+        printf("psk         : %s\n",sign_string); */
+
+        mbedtls_ssl_conf_psk(&(shared->conf), (const unsigned char *)sign_string, strlen(sign_string),
+                             (uint8_t *)psk_identity, strlen(psk_identity));
+        mbedtls_ssl_conf_ciphersuites(&(shared->conf), ciphersuites);
+
+        HAL_Free(psk_identity);
+
+        printf("mbedtls psk config finished\n");
+    }
+#endif /* #elif (TLS_AUTH_MODE == TLS_AUTH_MODE_PSK) */
+
+    mbedtls_ssl_conf_rng(&(shared->conf), _ssl_random, NULL);
+    mbedtls_ssl_conf_dbg(&(shared->conf), _ssl_debug, NULL);
+    mbedtls_ssl_conf_dbg(&(shared->conf), _ssl_debug, stdout);
+
     return 0;
 }
 
+static void _ssl_shared_conf_free(TLSSharedConf_t *shared)
+{
+    mbedtls_x509_crt_free(&(shared->cacertl));
+    mbedtls_x509_crt_free(&(shared->clicert));
+    mbedtls_pk_free(&(shared->pkey));
+    mbedtls_ssl_config_free(&(shared->conf));
+    HAL_Free(shared);
+}
+
+static void _ssl_shared_conf_hash_update(mbedtls_sha256_context *ctx, const char *data, size_t len)
+{
+    unsigned char len_buf[4];
+
+    /* length first, so that different splits of the same bytes don't collide */
+    len_buf[0] = (unsigned char)(len >> 24);
+    len_buf[1] = (unsigned char)(len >> 16);
+    len_buf[2] = (unsigned char)(len >> 8);
+    len_buf[3] = (unsigned char)(len);
+    mbedtls_sha256_update(ctx, len_buf, sizeof(len_buf));
+    if (data != NULL && len > 0) {
+        mbedtls_sha256_update(ctx, (const unsigned char *)data, len);
+    }
+}
+
+/*
+ * get the shared config of this CA/client cert/key, parse and build it only if
+ * there is not one yet. Release it with _ssl_shared_conf_put().
+ */
+static TLSSharedConf_t *_ssl_shared_conf_get(const char *ca_crt, size_t ca_crt_len,
+        const char *client_crt, size_t client_crt_len,
+        const char *client_key, size_t client_key_len,
+        const char *client_pwd, size_t client_pwd_len,
+        int *ret)
+{
+    unsigned char hash[32];
+    mbedtls_sha256_context sha_ctx;
+    TLSSharedConf_t *shared, *prev;
+    int idle_num = 0;
+#if (TLS_AUTH_MODE == TLS_AUTH_MODE_PSK)
+    char product_key[IOTX_PRODUCT_KEY_LEN + 1] = {0};
+    char device_name[IOTX_DEVICE_NAME_LEN + 1] = {0};
+    char device_secret[IOTX_DEVICE_SECRET_LEN + 1] = {0};
+#endif
+
+    *ret = -1;
+    /* hashing costs little next to parsing the PEMs */
+    mbedtls_sha256_init(&sha_ctx);
+    mbedtls_sha256_starts(&sha_ctx, 0);
+    _ssl_shared_conf_hash_update(&sha_ctx, ca_crt, ca_crt_len);
+    _ssl_shared_conf_hash_update(&sha_ctx, client_crt, client_crt_len);
+    _ssl_shared_conf_hash_update(&sha_ctx, client_key, client_key_len);
+    _ssl_shared_conf_hash_update(&sha_ctx, client_pwd, client_pwd_len);
+#if (TLS_AUTH_MODE == TLS_AUTH_MODE_PSK)
+    /* psk is derived from the device identity, which can be changed at runtime */
+    HAL_GetProductKey(product_key);
+    HAL_GetDeviceName(device_name);
+    HAL_GetDeviceSecret(device_secret);
+    _ssl_shared_conf_hash_update(&sha_ctx, product_key, strlen(product_key));
+    _ssl_shared_conf_hash_update(&sha_ctx, device_name, strlen(device_name));
+    _ssl_shared_conf_hash_update(&sha_ctx, device_secret, strlen(device_secret));
+#endif
+    mbedtls_sha256_finish(&sha_ctx, hash);
+    mbedtls_sha256_free(&sha_ctx);
+
+    if (g_tls_shared_conf_mutex == NULL) {
+        g_tls_shared_conf_mutex = HAL_MutexCreate();
+        if (g_tls_shared_conf_mutex == NULL) {
+            hal_err("create shared conf mutex failed");
+            return NULL;
+        }
+    }
+
+    HAL_MutexLock(g_tls_shared_conf_mutex);
+    for (shared = g_tls_shared_confs; shared != NULL; shared = shared->next) {
+        if (!memcmp(shared->hash, hash, sizeof(hash))) {
+            shared->ref++;
+            HAL_MutexUnlock(g_tls_shared_conf_mutex);
+            hal_info("reuse shared ssl config, ref = %d", shared->ref);
+            *ret = 0;
+            return shared;
+        }
+    }
+
+    /* built while locked, so concurrent connections parse the certificates only once */
+    shared = HAL_Malloc(sizeof(TLSSharedConf_t));
+    if (shared == NULL) {
+        HAL_MutexUnlock(g_tls_shared_conf_mutex);
+        hal_err("malloc shared conf failed");
+        return NULL;
+    }
+    memset(shared, 0, sizeof(TLSSharedConf_t));
+    *ret = _ssl_shared_conf_build(shared, ca_crt, ca_crt_len, client_crt, client_crt_len,
+                                  client_key, client_key_len, client_pwd, client_pwd_len);
+    if (*ret != 0) {
+        HAL_MutexUnlock(g_tls_shared_conf_mutex);
+        _ssl_shared_conf_free(shared);
+        return NULL;
+    }
+    memcpy(shared->hash, hash, sizeof(hash));
+    shared->ref = 1;
+    shared->next = g_tls_shared_confs;
+    g_tls_shared_confs = shared;
+
+    /* drop the oldest idle ones beyond TLS_SHARED_CONF_NUM */
+    prev = shared;
+    while (prev->next != NULL) {
+        TLSSharedConf_t *cur = prev->next;
+
+        if (cur->ref == 0 && ++idle_num > TLS_SHARED_CONF_NUM) {
+            prev->next = cur->next;
+            _ssl_shared_conf_free(cur);
+        } else {
+            prev = cur;
+        }
+    }
+    HAL_MutexUnlock(g_tls_shared_conf_mutex);
+
+    return shared;
+}
+
+static void _ssl_shared_conf_put(TLSSharedConf_t *shared)
+{
+    HAL_MutexLock(g_tls_shared_conf_mutex);
+    shared->ref--;
+    HAL_MutexUnlock(g_tls_shared_conf_mutex);
+}
+
 #if defined(_PLATFORM_IS_LINUX_)
 static int net_prepare(void)
 {
@@ -537,7 +1104,153 @@ void _SSLFree_wrapper(void *ptr)
     g_ssl_hooks.free(mem_info);
 }
 
-/**
+static int _ssl_conn_init(TLSDataParams_t *pTlsData,
+                          const char *ca_crt, size_t ca_crt_len,
+                          const char *client_crt,   size_t client_crt_len,
+                          const char *client_key,   size_t client_key_len,
+                          const char *client_pwd, size_t client_pwd_len)
+{
+    int ret = -1;
+
+    mbedtls_net_init(&(pTlsData->fd));
+    mbedtls_ssl_init(&(pTlsData->ssl));
+    pTlsData->shared = _ssl_shared_conf_get(ca_crt, ca_crt_len, client_crt, client_crt_len,
+                                            client_key, client_key_len, client_pwd, client_pwd_len, &ret);
+    if (pTlsData->shared == NULL) {
+        hal_err(" failed ! ssl_shared_conf_get returned -0x%04x", -ret);
+        return ret;
+    }
+    /* own copy, so that the read timeout set on it stays per connection */
+    memcpy(&(pTlsData->conf), &(pTlsData->shared->conf), sizeof(mbedtls_ssl_config));
+
+    return 0;
+}
+
+/* set up the ssl context on a connected socket, nonblock means no blocking read in the handshake */
+static int _ssl_conn_setup(TLSDataParams_t *pTlsData, const char *addr, const char *port, int nonblock)
+{
+    int ret = -1;
+#if defined(_PLATFORM_IS_LINUX_)
+    struct in_addr in;
+#endif /* #if defined(_PLATFORM_IS_LINUX_) */
+
+    hal_info("  . Setting up the SSL/TLS structure...");
+
+    if ((ret = mbedtls_ssl_setup(&(pTlsData->ssl), &(pTlsData->conf))) != 0) {
+        hal_err("failed! mbedtls_ssl_setup returned %d", ret);
+        return ret;
+    }
+#if (defined(ON_PRE) || defined(ON_DAILY))
+    hal_err("SKIPPING mbedtls_ssl_set_hostname() when ON_PRE or ON_DAILY defined!");
+#else
+#if defined(_PLATFORM_IS_LINUX_)
+    /* only set hostname when addr isn't ip string and hostname isn't preauth_shanghai */
+    if (inet_aton(addr, &in) == 0 && strcmp("iot-auth-pre.cn-shanghai.aliyuncs.com", addr)) {
+        mbedtls_ssl_set_hostname(&(pTlsData->ssl), addr);
+    }
+#else
+    if (strcmp("iot-auth-pre.cn-shanghai.aliyuncs.com", addr)) {
+        mbedtls_ssl_set_hostname(&(pTlsData->ssl), addr);
+    }
+#endif /* #if defined(_PLATFORM_IS_LINUX_) */
+#endif
+    mbedtls_ssl_set_bio(&(pTlsData->ssl), &(pTlsData->fd), mbedtls_net_send, mbedtls_net_recv,
+                        nonblock ? NULL : mbedtls_net_recv_timeout);
+
+    /* setup sessoin if sessoin ticket enabled */
+#if defined(TLS_SAVE_TICKET)
+    HAL_Snprintf(pTlsData->session_key, sizeof(pTlsData->session_key) - 1, "%s:%s", addr, port);
+    memset(&(pTlsData->saved_session), 0, sizeof(mbedtls_ssl_session));
+    if (ssl_session_cache_get(pTlsData->session_key, &(pTlsData->saved_session)) == 0) {
+        pTlsData->has_saved_session = 1;
+        mbedtls_ssl_set_session(&(pTlsData->ssl), &(pTlsData->saved_session));
+        hal_info("use saved session of %s", pTlsData->session_key);
+    }
+    pTlsData->handshake_start = HAL_UptimeMs();
+#endif /* #if defined(TLS_SAVE_TICKET) */
+
+    mbedtls_ssl_conf_read_timeout(&(pTlsData->conf), 10000);
+
+    return 0;
+}
+
+#if defined(TLS_SAVE_TICKET)
+/* errors the server gives for a session it won't resume, transport errors say nothing about it */
+static int ssl_session_rejected(int ret)
+{
+    return (ret == MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE ||
+            ret == MBEDTLS_ERR_SSL_BAD_HS_SERVER_HELLO ||
+            ret == MBEDTLS_ERR_SSL_BAD_HS_FINISHED);
+}
+#endif
+
+static void _ssl_conn_handshake_failed(TLSDataParams_t *pTlsData, int ret)
+{
+    hal_err("failed  ! mbedtls_ssl_handshake returned -0x%04x", -ret);
+
+#if defined(TLS_SAVE_TICKET)
+    if (pTlsData->has_saved_session && ssl_session_rejected(ret)) {
+        /* don't offer it again if it is what the server refused */
+        ssl_session_cache_del(pTlsData->session_key);
+        mbedtls_ssl_session_free(&(pTlsData->saved_session));
+        pTlsData->has_saved_session = 0;
+    }
+#endif
+}
+
+static int _ssl_conn_established(TLSDataParams_t *pTlsData)
+{
+    int ret = -1;
+
+    hal_info(" ok");
+
+#if defined(TLS_SAVE_TICKET)
+    do {
+        mbedtls_ssl_session new_session;
+        int resumed;
+
+        memset(&new_session, 0, sizeof(new_session));
+        if (mbedtls_ssl_get_session(&(pTlsData->ssl), &new_session) != 0) {
+            mbedtls_ssl_session_free(&new_session);
+            break;
+        }
+
+        /* an abbreviated handshake keeps the master secret of the saved session */
+        resumed = pTlsData->has_saved_session && !memcmp(new_session.master, pTlsData->saved_session.master, 48);
+        if (resumed) {
+            g_tls_resumed_handshakes++;
+        } else {
+            g_tls_full_handshakes++;
+        }
+        hal_info("%s handshake with %s in %u ms, full %u, resumed %u",
+                 resumed ? "abbreviated" : "full", pTlsData->session_key,
+                 (uint32_t)(HAL_UptimeMs() - pTlsData->handshake_start),
+                 g_tls_full_handshakes, g_tls_resumed_handshakes);
+
+        ssl_session_cache_put(pTlsData->session_key, &new_session);
+        mbedtls_ssl_session_free(&new_session);
+    } while (0);
+    if (pTlsData->has_saved_session) {
+        mbedtls_ssl_session_free(&(pTlsData->saved_session));
+        pTlsData->has_saved_session = 0;
+    }
+#endif
+
+    /*
+     * 5. Verify the server certificate
+     */
+    hal_info("  . Verifying peer X.509 certificate..");
+    if (0 != (ret = _real_confirm(mbedtls_ssl_get_verify_result(&(pTlsData->ssl))))) {
+        hal_err(" failed  ! verify result not confirmed.");
+        return ret;
+    }
+    /* n->my_socket = (int)((n->tlsdataparams.fd).fd); */
+    /* WRITE_IOT_DEBUG_LOG("my_socket=%d", n->my_socket); */
+
+    return 0;
+}
+
+/**
  * @brief This function connects to the specific SSL server with TLS, and returns a value that indicates whether the connection is create successfully or not. Call #NewNetwork() to initialize network structure before calling this function.
  * @param[in] n is the the network structure pointer.
  * @param[in] addr is the Server Host name or IP address.
@@ -560,17 +1273,12 @@ static int _TLSConnectNetwork(TLSDataParams_t *pTlsData, const char *addr, const
                               const char *client_pwd, size_t client_pwd_len)
 {
     int ret = -1;
-#if defined(_PLATFORM_IS_LINUX_)
-    struct in_addr in;
-#endif /* #if defined(_PLATFORM_IS_LINUX_) */
+
     /*
      * 0. Init
      */
-    if (0 != (ret = _ssl_client_init(&(pTlsData->ssl), &(pTlsData->fd), &(pTlsData->conf),
-                                     &(pTlsData->cacertl), ca_crt, ca_crt_len,
-                                     &(pTlsData->clicert), client_crt, client_crt_len,
-                                     &(pTlsData->pkey), client_key, client_key_len, client_pwd, client_pwd_len))) {
-        hal_err(" failed ! ssl_client_init returned -0x%04x", -ret);
+    if (0 != (ret = _ssl_conn_init(pTlsData, ca_crt, ca_crt_len, client_crt, client_crt_len,
+                                   client_key, client_key_len, client_pwd, client_pwd_len))) {
         return ret;
     }
 
@@ -600,270 +1308,100 @@ static int _TLSConnectNetwork(TLSDataParams_t *pTlsData, const char *addr, const
     /*
      * 2. Setup stuff
      */
-    hal_info("  . Setting up the SSL/TLS structure...");
-    if ((ret = mbedtls_ssl_config_defaults(&(pTlsData->conf), MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
-                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
-        hal_err(" failed! mbedtls_ssl_config_defaults returned %d", ret);
+    if (0 != (ret = _ssl_conn_setup(pTlsData, addr, port, 0))) {
         return ret;
     }
 
-    mbedtls_ssl_conf_max_version(&pTlsData->conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
-    mbedtls_ssl_conf_min_version(&pTlsData->conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
-
-    hal_info(" ok");
+    /*
+      * 4. Handshake
+      */
+    hal_info("Performing the SSL/TLS handshake...");
 
-    /* OPTIONAL is not optimal for security, but makes interop easier in this simplified example */
-    if (ca_crt != NULL) {
-#if defined(FORCE_SSL_VERIFY)
-        mbedtls_ssl_conf_authmode(&(pTlsData->conf), MBEDTLS_SSL_VERIFY_REQUIRED);
-#else
-        mbedtls_ssl_conf_authmode(&(pTlsData->conf), MBEDTLS_SSL_VERIFY_OPTIONAL);
-#endif
-    } else {
-        mbedtls_ssl_conf_authmode(&(pTlsData->conf), MBEDTLS_SSL_VERIFY_NONE);
+    while ((ret = mbedtls_ssl_handshake(&(pTlsData->ssl))) != 0) {
+        if ((ret != MBEDTLS_ERR_SSL_WANT_READ) && (ret != MBEDTLS_ERR_SSL_WANT_WRITE)) {
+            _ssl_conn_handshake_failed(pTlsData, ret);
+            return ret;
+        }
     }
 
-#if (TLS_AUTH_MODE == TLS_AUTH_MODE_CA)
-    mbedtls_ssl_conf_ca_chain(&(pTlsData->conf), &(pTlsData->cacertl), NULL);
-
-    if ((ret = mbedtls_ssl_conf_own_cert(&(pTlsData->conf), &(pTlsData->clicert), &(pTlsData->pkey))) != 0) {
-        hal_err(" failed\n  ! mbedtls_ssl_conf_own_cert returned %d\n", ret);
-        return ret;
-    }
-#elif (TLS_AUTH_MODE == TLS_AUTH_MODE_PSK)
-    {
-        static const int ciphersuites[1] = {MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA};
-        char product_key[IOTX_PRODUCT_KEY_LEN + 1] = {0};
-        char device_name[IOTX_DEVICE_NAME_LEN + 1] = {0};
-        char device_secret[IOTX_DEVICE_SECRET_LEN + 1] = {0};
-        char *auth_type = "devicename";
-        char *sign_method = "hmacsha256";
-        char *timestamp = "2524608000000";
-        char *psk_identity = NULL, string_to_sign[IOTX_PRODUCT_KEY_LEN + IOTX_DEVICE_NAME_LEN + 33] = {0};
-        uint32_t psk_identity_len = 0;
-        uint8_t sign_hex[32] = {0};
-        char sign_string[65] = {0};
-        int i = 0;
-
-        HAL_GetProductKey(product_key);
-        HAL_GetDeviceName(device_name);
-        HAL_GetDeviceSecret(device_secret);
+    return _ssl_conn_established(pTlsData);
+}
 
-        /* psk identity length */
-        psk_identity_len = strlen(auth_type) + strlen(sign_method) + strlen(product_key) + strlen(device_name) + strlen(
-                                       timestamp) + 5;
-        psk_identity = HAL_Malloc(psk_identity_len);
-        if (psk_identity == NULL) {
-            printf("psk_identity malloc failed\n");
-            return -1;
-        }
-        memset(psk_identity, 0, psk_identity_len);
-        memcpy(psk_identity, auth_type, strlen(auth_type));
-        memcpy(psk_identity + strlen(psk_identity), "|", strlen("|"));
-        memcpy(psk_identity + strlen(psk_identity), sign_method, strlen(sign_method));
-        memcpy(psk_identity + strlen(psk_identity), "|", strlen("|"));
-        memcpy(psk_identity + strlen(psk_identity), product_key, strlen(product_key));
-        memcpy(psk_identity + strlen(psk_identity), "&", strlen("&"));
-        memcpy(psk_identity + strlen(psk_identity), device_name, strlen(device_name));
-        memcpy(psk_identity + strlen(psk_identity), "|", strlen("|"));
-        memcpy(psk_identity + strlen(psk_identity), timestamp, strlen(timestamp));
+/* start a non-blocking connect, only the name resolving blocks */
+static int _ssl_net_connect_nonblock(mbedtls_net_context *ctx, const char *host, const char *port)
+{
+#if defined(_PLATFORM_IS_LINUX_)
+    int ret = MBEDTLS_ERR_NET_UNKNOWN_HOST;
+    struct addrinfo hints, *addr_list, *cur;
 
-        /* string to sign */
-        memcpy(string_to_sign, "id", strlen("id"));
-        memcpy(string_to_sign + strlen(string_to_sign), product_key, strlen(product_key));
-        memcpy(string_to_sign + strlen(string_to_sign), "&", strlen("&"));
-        memcpy(string_to_sign + strlen(string_to_sign), device_name, strlen(device_name));
-        memcpy(string_to_sign + strlen(string_to_sign), "timestamp", strlen("timestamp"));
-        memcpy(string_to_sign + strlen(string_to_sign), timestamp, strlen(timestamp));
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
 
-        utils_hmac_sha256(string_to_sign, strlen(string_to_sign), sign_string, device_secret, strlen(device_secret));
+    if (getaddrinfo(host, port, &hints, &addr_list) != 0) {
+        return (MBEDTLS_ERR_NET_UNKNOWN_HOST);
+    }
 
-        for (i = 0; i < strlen(sign_string); i++) {
-            if (sign_string[i] >= 'a' && sign_string[i] <= 'z') {
-                sign_string[i] -= 'a' - 'A';
-            }
+    for (cur = addr_list; cur != NULL; cur = cur->ai_next) {
+        ctx->fd = (int)socket(cur->ai_family, cur->ai_socktype, cur->ai_protocol);
+        if (ctx->fd < 0) {
+            ret = MBEDTLS_ERR_NET_SOCKET_FAILED;
+            continue;
         }
-        /* printf("psk_identity: %s\n",psk_identity);
-        printf("psk         : %s\n",sign_string); */
 
-        mbedtls_ssl_conf_psk(&(pTlsData->conf), (const unsigned char *)sign_string, strlen(sign_string),
-                             (uint8_t *)psk_identity, strlen(psk_identity));
-        mbedtls_ssl_conf_ciphersuites(&(pTlsData->conf), ciphersuites);
-
-        HAL_Free(psk_identity);
+        if (mbedtls_net_set_nonblock(ctx) == 0 &&
+            (connect(ctx->fd, cur->ai_addr, cur->ai_addrlen) == 0 || errno == EINPROGRESS)) {
+            ret = 0;
+            break;
+        }
 
-        printf("mbedtls psk config finished\n");
+        close(ctx->fd);
+        ctx->fd = -1;
+        ret = MBEDTLS_ERR_NET_CONNECT_FAILED;
     }
-#endif /* #elif (TLS_AUTH_MODE == TLS_AUTH_MODE_PSK) */
 
-    mbedtls_ssl_conf_rng(&(pTlsData->conf), _ssl_random, NULL);
-    mbedtls_ssl_conf_dbg(&(pTlsData->conf), _ssl_debug, NULL);
-    mbedtls_ssl_conf_dbg(&(pTlsData->conf), _ssl_debug, stdout);
+    freeaddrinfo(addr_list);
 
-    if ((ret = mbedtls_ssl_setup(&(pTlsData->ssl), &(pTlsData->conf))) != 0) {
-        hal_err("failed! mbedtls_ssl_setup returned %d", ret);
-        return ret;
-    }
-#if (defined(ON_PRE) || defined(ON_DAILY))
-    hal_err("SKIPPING mbedtls_ssl_set_hostname() when ON_PRE or ON_DAILY defined!");
-#else
-#if defined(_PLATFORM_IS_LINUX_)
-    /* only set hostname when addr isn't ip string and hostname isn't preauth_shanghai */
-    if (inet_aton(addr, &in) == 0 && strcmp("iot-auth-pre.cn-shanghai.aliyuncs.com", addr)) {
-        mbedtls_ssl_set_hostname(&(pTlsData->ssl), addr);
-    }
+    return (ret);
 #else
-    if (strcmp("iot-auth-pre.cn-shanghai.aliyuncs.com", addr)) {
-        mbedtls_ssl_set_hostname(&(pTlsData->ssl), addr);
+    int ret;
+
+    /* no portable non-blocking connect, only the handshake is driven step by step */
+    if (0 != (ret = mbedtls_net_connect(ctx, host, port, MBEDTLS_NET_PROTO_TCP))) {
+        return ret;
     }
-#endif /* #if defined(_PLATFORM_IS_LINUX_) */
+    return mbedtls_net_set_nonblock(ctx);
 #endif
-    mbedtls_ssl_set_bio(&(pTlsData->ssl), &(pTlsData->fd), mbedtls_net_send, mbedtls_net_recv, mbedtls_net_recv_timeout);
-
-    /* setup sessoin if sessoin ticket enabled */
-#if defined(TLS_SAVE_TICKET)
-    if (NULL == saved_session) {
-        do {
-            int len = TLS_MAX_SESSION_BUF;
-            char key_buf[KEY_MAX_LEN] = {0};
-            unsigned char *save_buf = HAL_Malloc(TLS_MAX_SESSION_BUF);
-            if (save_buf ==  NULL) {
-                printf(" malloc failed\r\n");
-                break;
-            }
-
-            saved_session = HAL_Malloc(sizeof(mbedtls_ssl_session));
-
-            if (saved_session == NULL) {
-                printf(" malloc failed\r\n");
-                HAL_Free(save_buf);
-                save_buf =  NULL;
-                break;
-            }
-
-            memset(save_buf, 0x00, TLS_MAX_SESSION_BUF);
-            memset(saved_session, 0x00, sizeof(mbedtls_ssl_session));
+}
 
-            HAL_Snprintf(key_buf, KEY_MAX_LEN - 1, KV_SESSION_KEY_FMT, addr);
-            ret = HAL_Kv_Get(key_buf, save_buf, &len);
+static int _TLSConnectNetworkAsync(TLSDataParams_t *pTlsData, const char *addr, const char *port,
+                                   const char *ca_crt, size_t ca_crt_len)
+{
+    int ret = -1;
 
-            if (ret != 0 || len == 0) {
-                printf(" kv get failed len=%d,ret = %d\r\n", len, ret);
-                HAL_Free(saved_session);
-                HAL_Free(save_buf);
-                save_buf = NULL;
-                saved_session = NULL;
-                break;
-            }
-            ret = ssl_deserialize_session(saved_session, save_buf, len);
-            if (ret < 0) {
-                printf("ssl_deserialize_session err,ret = %d\r\n", ret);
-                HAL_Free(saved_session);
-                HAL_Free(save_buf);
-                save_buf = NULL;
-                saved_session = NULL;
-                break;
-            }
-            HAL_Free(save_buf);
-        } while (0);
+    if (0 != (ret = _ssl_conn_init(pTlsData, ca_crt, ca_crt_len, NULL, 0, NULL, 0, NULL, 0))) {
+        return ret;
     }
 
-    if (NULL != saved_session) {
-        mbedtls_ssl_set_session(&(pTlsData->ssl), saved_session);
-        printf("use saved session!!\r\n");
+    hal_info("Connecting to /%s/%s asynchronously...", addr, port);
+    if (0 != (ret = _ssl_net_connect_nonblock(&(pTlsData->fd), addr, port))) {
+        hal_err(" failed ! net_connect returned -0x%04x", -ret);
+        return ret;
     }
-#endif /* #if defined(TLS_SAVE_TICKET) */
 
-    /*
-      * 4. Handshake
-      */
-    mbedtls_ssl_conf_read_timeout(&(pTlsData->conf), 10000);
-    hal_info("Performing the SSL/TLS handshake...");
-
-    while ((ret = mbedtls_ssl_handshake(&(pTlsData->ssl))) != 0) {
-        if ((ret != MBEDTLS_ERR_SSL_WANT_READ) && (ret != MBEDTLS_ERR_SSL_WANT_WRITE)) {
-            hal_err("failed  ! mbedtls_ssl_handshake returned -0x%04x", -ret);
-
-#if defined(TLS_SAVE_TICKET)
-            if (saved_session != NULL) {
-                mbedtls_ssl_session_free(saved_session);
-                HAL_Free(saved_session);
-                saved_session = NULL;
-            }
-#endif
-            return ret;
-        }
+    if (0 != (ret = _ssl_conn_setup(pTlsData, addr, port, 1))) {
+        return ret;
     }
-    hal_info(" ok");
 
-#if defined(TLS_SAVE_TICKET)
-    do {
-        size_t real_session_len = 0;
-        mbedtls_ssl_session *new_session = NULL;
-
-        new_session = HAL_Malloc(sizeof(mbedtls_ssl_session));
-        if (NULL == new_session) {
-            break;
-        }
-
-        memset(new_session, 0x00, sizeof(mbedtls_ssl_session));
-
-        ret = mbedtls_ssl_get_session(&(pTlsData->ssl), new_session);
-        if (ret != 0) {
-            HAL_Free(new_session);
-            break;
-        }
-        if (saved_session == NULL) {
-            ret = 1;
-        } else if (new_session->ticket_len != saved_session->ticket_len) {
-            ret = 1;
-        } else {
-            ret = memcmp(new_session->ticket, saved_session->ticket, new_session->ticket_len);
-        }
-        if (ret != 0) {
-            unsigned char *save_buf = HAL_Malloc(TLS_MAX_SESSION_BUF);
-            if (save_buf ==  NULL) {
-                mbedtls_ssl_session_free(new_session);
-                HAL_Free(new_session);
-                new_session = NULL;
-                break;
-            }
-            memset(save_buf, 0x00, sizeof(TLS_MAX_SESSION_BUF));
-            ret = ssl_serialize_session(new_session, save_buf, TLS_MAX_SESSION_BUF, &real_session_len);
-            printf("mbedtls_ssl_get_session_session return 0x%04x real_len=%d\r\n", ret, (int)real_session_len);
-            if (ret == 0) {
-                char key_buf[KEY_MAX_LEN] = {0};
-                HAL_Snprintf(key_buf, KEY_MAX_LEN - 1, KV_SESSION_KEY_FMT, addr);
-                ret = HAL_Kv_Set(key_buf, (void *)save_buf, real_session_len, 1);
-                if (ret < 0) {
-                    printf("save ticket to kv failed ret =%d ,len = %d\r\n", ret, (int)real_session_len);
-                }
-            }
-            HAL_Free(save_buf);
-        }
-        mbedtls_ssl_session_free(new_session);
-        HAL_Free(new_session);
-    } while (0);
-    if (saved_session != NULL) {
-        mbedtls_ssl_session_free(saved_session);
-        HAL_Free(saved_session);
-        saved_session = NULL;
-    }
+#if defined(_PLATFORM_IS_LINUX_)
+    pTlsData->async_state = TLS_ASYNC_CONNECTING;
+#else
+    hal_info("Performing the SSL/TLS handshake...");
+    pTlsData->async_state = TLS_ASYNC_HANDSHAKE;
 #endif
 
-    /*
-     * 5. Verify the server certificate
-     */
-    hal_info("  . Verifying peer X.509 certificate..");
-    if (0 != (ret = _real_confirm(mbedtls_ssl_get_verify_result(&(pTlsData->ssl))))) {
-        hal_err(" failed  ! verify result not confirmed.");
-        return ret;
-    }
-    /* n->my_socket = (int)((n->tlsdataparams.fd).fd); */
-    /* WRITE_IOT_DEBUG_LOG("my_socket=%d", n->my_socket); */
-
     return 0;
-
 }
 
 static int _network_ssl_read(TLSDataParams_t *pTlsData, char *buffer, int len, int timeout_ms)
@@ -993,18 +1531,19 @@ static void _network_ssl_disconnect(TLSDataParams_t *pTlsData)
 {
     mbedtls_ssl_close_notify(&(pTlsData->ssl));
     mbedtls_net_free(&(pTlsData->fd));
-#if (TLS_AUTH_MODE == TLS_AUTH_MODE_CA)
-    mbedtls_x509_crt_free(&(pTlsData->cacertl));
-    if ((pTlsData->pkey).pk_info != NULL) {
-        hal_info("need release client crt&key");
-#if defined(MBEDTLS_CERTS_C)
-        mbedtls_x509_crt_free(&(pTlsData->clicert));
-        mbedtls_pk_free(&(pTlsData->pkey));
+    mbedtls_ssl_free(&(pTlsData->ssl));
+#if defined(TLS_SAVE_TICKET)
+    /* destroyed before an async handshake finished */
+    if (pTlsData->has_saved_session) {
+        mbedtls_ssl_session_free(&(pTlsData->saved_session));
+        pTlsData->has_saved_session = 0;
+    }
 #endif
+    /* pTlsData->conf is a copy, what it points to is freed with the shared one */
+    if (pTlsData->shared != NULL) {
+        _ssl_shared_conf_put(pTlsData->shared);
+        pTlsData->shared = NULL;
     }
-#endif /* #if (TLS_AUTH_MODE == TLS_AUTH_MODE_CA) */
-    mbedtls_ssl_free(&(pTlsData->ssl));
-    mbedtls_ssl_config_free(&(pTlsData->conf));
     hal_info("ssl_disconnect");
 }
 
@@ -1042,14 +1581,16 @@ int HAL_SSLHooks_set(ssl_hooks_t *hooks)
     return DTLS_SUCCESS;
 }
 
-uintptr_t HAL_SSL_Establish(const char *host,
-                            uint16_t port,
-                            const char *ca_crt,
-                            size_t ca_crt_len)
+static uintptr_t _ssl_establish(const char *host,
+                                uint16_t port,
+                                const char *ca_crt,
+                                size_t ca_crt_len,
+                                int async)
 {
     char                port_str[6];
     const char         *alter = host;
     TLSDataParams_pt    pTlsData;
+    int                 ret;
 
     if (host == NULL || ca_crt == NULL) {
         hal_err("input params are NULL, abort");
@@ -1078,7 +1619,12 @@ uintptr_t HAL_SSL_Establish(const char *host,
 
     mbedtls_platform_set_calloc_free(_SSLCalloc_wrapper, _SSLFree_wrapper);
 
-    if (0 != _TLSConnectNetwork(pTlsData, alter, port_str, ca_crt, ca_crt_len, NULL, 0, NULL, 0, NULL, 0)) {
+    if (async) {
+        ret = _TLSConnectNetworkAsync(pTlsData, alter, port_str, ca_crt, ca_crt_len);
+    } else {
+        ret = _TLSConnectNetwork(pTlsData, alter, port_str, ca_crt, ca_crt_len, NULL, 0, NULL, 0, NULL, 0);
+    }
+    if (0 != ret) {
         _network_ssl_disconnect(pTlsData);
         g_ssl_hooks.free((void *)pTlsData);
         return (uintptr_t)NULL;
@@ -1086,3 +1632,86 @@ uintptr_t HAL_SSL_Establish(const char *host,
 
     return (uintptr_t)pTlsData;
 }
+
+uintptr_t HAL_SSL_Establish(const char *host,
+                            uint16_t port,
+                            const char *ca_crt,
+                            size_t ca_crt_len)
+{
+    return _ssl_establish(host, port, ca_crt, ca_crt_len, 0);
+}
+
+uintptr_t HAL_SSL_Establish_Async(const char *host,
+                                  uint16_t port,
+                                  const char *ca_crt,
+                                  size_t ca_crt_len)
+{
+    return _ssl_establish(host, port, ca_crt, ca_crt_len, 1);
+}
+
+int HAL_SSL_Establish_Step(uintptr_t handle, int *fd)
+{
+    TLSDataParams_t *pTlsData = (TLSDataParams_t *)handle;
+    int ret = -1;
+
+    if (pTlsData == NULL) {
+        return DTLS_INVALID_PARAM;
+    }
+    if (fd != NULL) {
+        *fd = pTlsData->fd.fd;
+    }
+
+    switch (pTlsData->async_state) {
+        case TLS_ASYNC_NONE:
+            return 0;
+#if defined(_PLATFORM_IS_LINUX_)
+        case TLS_ASYNC_CONNECTING: {
+            fd_set write_fds;
+            struct timeval tv = {0, 0};
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+
+            FD_ZERO(&write_fds);
+            FD_SET(pTlsData->fd.fd, &write_fds);
+            ret = select(pTlsData->fd.fd + 1, NULL, &write_fds, NULL, &tv);
+            if (ret == 0 || (ret < 0 && errno == EINTR)) {
+                return HAL_SSL_WANT_WRITE;
+            }
+            if (ret < 0 || getsockopt(pTlsData->fd.fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err != 0) {
+                hal_err(" failed ! net_connect error %d", err);
+                pTlsData->async_state = TLS_ASYNC_FAILED;
+                return MBEDTLS_ERR_NET_CONNECT_FAILED;
+            }
+            hal_info("Performing the SSL/TLS handshake...");
+            pTlsData->async_state = TLS_ASYNC_HANDSHAKE;
+        }
+        /* fall through */
+#endif /* #if defined(_PLATFORM_IS_LINUX_) */
+        case TLS_ASYNC_HANDSHAKE:
+            while (pTlsData->ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+                ret = mbedtls_ssl_handshake_step(&(pTlsData->ssl));
+                if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+                    return HAL_SSL_WANT_READ;
+                } else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                    return HAL_SSL_WANT_WRITE;
+                } else if (ret != 0) {
+                    _ssl_conn_handshake_failed(pTlsData, ret);
+                    pTlsData->async_state = TLS_ASYNC_FAILED;
+                    return ret;
+                }
+            }
+
+            /* from now on it is read and written the same as a connection of HAL_SSL_Establish() */
+            mbedtls_net_set_block(&(pTlsData->fd));
+            mbedtls_ssl_set_bio(&(pTlsData->ssl), &(pTlsData->fd), mbedtls_net_send, mbedtls_net_recv,
+                                mbedtls_net_recv_timeout);
+            if (0 != (ret = _ssl_conn_established(pTlsData))) {
+                pTlsData->async_state = TLS_ASYNC_FAILED;
+                return ret;
+            }
+            pTlsData->async_state = TLS_ASYNC_NONE;
+            return 0;
+        default:
+            return -1;
+    }
+}
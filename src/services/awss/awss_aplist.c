@@ -9,6 +9,7 @@ extern "C" {
 #ifdef AWSS_SUPPORT_APLIST
 #include <stdio.h>
 #include <stdint.h>
+#include "os.h"
 #include "awss_log.h"
 #include "awss_adha.h"
 #include "awss_timer.h"
@@ -17,11 +18,22 @@ extern "C" {
 #include "zconfig_ieee80211.h"
 
 #define CLR_APLIST_MONITOR_TIMEOUT_MS    (24 * 60 *60 * 1000)
+/* buckets of the bssid and ssid hash tables */
+#define APLIST_HASH_NUM                  (64)
+/* ap not heard for so long is the first one replaced when aplist is full */
+#define APLIST_AGING_MS                  (60 * 1000)
 /* storage to store apinfo */
 struct ap_info *zconfig_aplist = NULL;
 /* aplist num, less than MAX_APLIST_NUM */
 uint8_t zconfig_aplist_num = 0;
 
+/*
+ * heads of the hash chains, holding zconfig_aplist[] index,
+ * [0] is never used by aplist so index 0 ends a chain
+ */
+static uint8_t aplist_bssid_hash[APLIST_HASH_NUM];
+static uint8_t aplist_ssid_hash[APLIST_HASH_NUM];
+
 static uint8_t clr_aplist = 0;
 static void *clr_aplist_timer = NULL;
 
@@ -39,6 +51,8 @@ int awss_is_ready_clr_aplist(void)
 int awss_clear_aplist(void)
 {
     memset(zconfig_aplist, 0, sizeof(struct ap_info) * MAX_APLIST_NUM);
+    memset(aplist_bssid_hash, 0, sizeof(aplist_bssid_hash));
+    memset(aplist_ssid_hash, 0, sizeof(aplist_ssid_hash));
 #if defined(AWSS_SUPPORT_ADHA) || defined(AWSS_SUPPORT_AHA)
     memset(adha_aplist, 0, sizeof(*adha_aplist));
 #endif
@@ -81,6 +95,8 @@ int awss_init_ieee80211_aplist(void)
     if (zconfig_aplist == NULL) {
         return -1;
     }
+    memset(aplist_bssid_hash, 0, sizeof(aplist_bssid_hash));
+    memset(aplist_ssid_hash, 0, sizeof(aplist_ssid_hash));
     zconfig_aplist_num = 0;
     return 0;
 }
@@ -92,15 +108,139 @@ int awss_deinit_ieee80211_aplist(void)
     }
     os_free(zconfig_aplist);
     zconfig_aplist = NULL;
+    memset(aplist_bssid_hash, 0, sizeof(aplist_bssid_hash));
+    memset(aplist_ssid_hash, 0, sizeof(aplist_ssid_hash));
     zconfig_aplist_num = 0;
     return 0;
 }
 
-struct ap_info *zconfig_get_apinfo(uint8_t *mac)
+/* hash on the last 3 bytes only, so it also serves lookup by 3 byte mac */
+static uint8_t aplist_bssid_hash_idx(const uint8_t *last_3_byte_mac)
 {
-    int i;
+    return (uint8_t)((last_3_byte_mac[0] ^ (last_3_byte_mac[1] << 1) ^ last_3_byte_mac[2]) % APLIST_HASH_NUM);
+}
+
+static uint8_t aplist_ssid_hash_idx(const char *ssid)
+{
+    uint32_t hash = 5381;
+
+    while (*ssid) {
+        hash = hash * 33 + (uint8_t)*ssid++;
+    }
+
+    return (uint8_t)(hash % APLIST_HASH_NUM);
+}
+
+static void aplist_hash_add_ssid(uint8_t i)
+{
+    struct ap_info *ap = &zconfig_aplist[i];
+    uint8_t *head = &aplist_ssid_hash[aplist_ssid_hash_idx(ap->ssid)];
+
+    ap->ssid_next = *head;
+    *head = i;
+}
+
+static void aplist_hash_add(uint8_t i)
+{
+    struct ap_info *ap = &zconfig_aplist[i];
+    uint8_t *head = &aplist_bssid_hash[aplist_bssid_hash_idx(ap->mac + 3)];
+
+    ap->bssid_next = *head;
+    *head = i;
+
+    aplist_hash_add_ssid(i);
+}
+
+static void aplist_hash_del_ssid(uint8_t i)
+{
+    uint8_t *pos = &aplist_ssid_hash[aplist_ssid_hash_idx(zconfig_aplist[i].ssid)];
+
+    while (*pos) {
+        if (*pos == i) {
+            *pos = zconfig_aplist[i].ssid_next;
+            break;
+        }
+        pos = &zconfig_aplist[*pos].ssid_next;
+    }
+    zconfig_aplist[i].ssid_next = 0;
+}
+
+static void aplist_hash_del(uint8_t i)
+{
+    uint8_t *pos = &aplist_bssid_hash[aplist_bssid_hash_idx(zconfig_aplist[i].mac + 3)];
+
+    while (*pos) {
+        if (*pos == i) {
+            *pos = zconfig_aplist[i].bssid_next;
+            break;
+        }
+        pos = &zconfig_aplist[*pos].bssid_next;
+    }
+    zconfig_aplist[i].bssid_next = 0;
+
+    aplist_hash_del_ssid(i);
+}
+
+/*
+ * adha/aha ap index is kept in adha_aplist, and zc_bssid is the ap
+ * channel is locked on, these entries are never replaced
+ */
+static int aplist_is_pinned(struct ap_info *ap)
+{
+#ifdef AWSS_SUPPORT_ADHA
+    if (!strcmp(ap->ssid, zc_adha_ssid)) {
+        return 1;
+    }
+#endif
+#ifdef AWSS_SUPPORT_AHA
+    if (!strcmp(ap->ssid, zc_default_ssid)) {
+        return 1;
+    }
+#endif
+    return !memcmp(ap->mac, zc_bssid, ETH_ALEN);
+}
+
+/*
+ * choose the entry to replace when aplist is full:
+ * the one heard least recently if it aged out, otherwise the weakest one
+ * if it is weaker than rssi (or force is set)
+ *
+ * Return:
+ *     index of zconfig_aplist[], 0 if nothing can be replaced
+ */
+static uint8_t aplist_get_victim(signed char rssi, int force)
+{
+    uint8_t i, oldest = 0, weakest = 0;
+    struct ap_info *ap;
 
     for (i = 1; i < zconfig_aplist_num; i++) {
+        ap = &zconfig_aplist[i];
+        if (aplist_is_pinned(ap)) {
+            continue;
+        }
+        if (!oldest || (int32_t)(zconfig_aplist[oldest].last_seen - ap->last_seen) > 0) {
+            oldest = i;
+        }
+        if (!weakest || ap->rssi < zconfig_aplist[weakest].rssi) {
+            weakest = i;
+        }
+    }
+
+    if (oldest && time_elapsed_ms_since(zconfig_aplist[oldest].last_seen) > APLIST_AGING_MS) {
+        return oldest;
+    }
+    if (weakest && (force || zconfig_aplist[weakest].rssi < rssi)) {
+        return weakest;
+    }
+
+    return 0;
+}
+
+struct ap_info *zconfig_get_apinfo(uint8_t *mac)
+{
+    uint8_t i;
+
+    for (i = aplist_bssid_hash[aplist_bssid_hash_idx(mac + 3)]; i; i = zconfig_aplist[i].bssid_next) {
         if (!memcmp(zconfig_aplist[i].mac, mac, ETH_ALEN)) {
             return &zconfig_aplist[i];
         }
@@ -111,10 +251,10 @@ struct ap_info *zconfig_get_apinfo(uint8_t *mac)
 
 struct ap_info *zconfig_get_apinfo_by_3_byte_mac(uint8_t *last_3_Byte_mac)
 {
-    int i;
+    uint8_t i;
     uint8_t *local_mac;
 
-    for (i = 1; i < zconfig_aplist_num; i++) {
+    for (i = aplist_bssid_hash[aplist_bssid_hash_idx(last_3_Byte_mac)]; i; i = zconfig_aplist[i].bssid_next) {
         local_mac = (uint8_t *)(zconfig_aplist[i].mac) + 3;
         if (!memcmp(local_mac, last_3_Byte_mac, ETH_ALEN - 3)) {
             return &zconfig_aplist[i];
@@ -124,17 +264,21 @@ struct ap_info *zconfig_get_apinfo_by_3_byte_mac(uint8_t *last_3_Byte_mac)
     return NULL;
 }
 
+/* several bss may share one ssid, return the strongest */
 struct ap_info *zconfig_get_apinfo_by_ssid(uint8_t *ssid)
 {
-    int i;
+    uint8_t i;
+    struct ap_info *best = NULL;
 
-    for (i = 1; i < zconfig_aplist_num; i ++) {
+    for (i = aplist_ssid_hash[aplist_ssid_hash_idx((char *)ssid)]; i; i = zconfig_aplist[i].ssid_next) {
         if (!strcmp((char *)zconfig_aplist[i].ssid, (char *)ssid)) {
-            return &zconfig_aplist[i];
+            if (best == NULL || zconfig_aplist[i].rssi > best->rssi) {
+                best = &zconfig_aplist[i];
+            }
         }
     }
 
-    return NULL;
+    return best;
 }
 
 /* 通过ssid前缀 */
@@ -199,10 +343,12 @@ struct ap_info *zconfig_get_apinfo_by_ssid_suffix(uint8_t *ssid_suffix)
  * @encry: [IN], ap encryption mode, i.e. NONE/WEP/TKIP/AES/TKIP-AES
  *
  * Note:
- *     1) if ap num exceed zconfig_aplist[], always save at [0]
- *         but why...I forgot...
- *     2) always update channel if channel != 0
- *     3) if chn is locked, save ssid to zc_ssid, because zc_ssid
+ *     1) one entry per bssid, a beacon of a known bss refreshes its
+ *         rssi and age, and renames it if the ssid is not hidden
+ *     2) if zconfig_aplist[] is full, replace an aged out or weaker ap,
+ *         otherwise drop the new one, see aplist_get_victim()
+ *     3) always update channel if channel != 0
+ *     4) if chn is locked, save ssid to zc_ssid, because zc_ssid
  *         can be used for ssid-auto-completion
  * Return:
  *     0/success, -1/invalid params(empty ssid/bssid)
@@ -212,6 +358,7 @@ int awss_save_apinfo(uint8_t *ssid, uint8_t *bssid, uint8_t channel, uint8_t aut
                      uint8_t pairwise_cipher, uint8_t group_cipher, signed char rssi)
 {
     int i;
+    struct ap_info *ap;
 
     /* ssid, bssid cannot empty, channel can be 0, auth/encry can be invalid */
     if (!(ssid && bssid)) {
@@ -242,48 +389,64 @@ int awss_save_apinfo(uint8_t *ssid, uint8_t *bssid, uint8_t channel, uint8_t aut
     }
 
     /*
-     * start from zconfig_aplist[1], leave [0] for temp use
-     * if zconfig_aplist[] is full, always replace [0]
+     * start from zconfig_aplist[1], [0] is left unused
+     * so that index 0 can end the hash chains
      */
     if (!zconfig_aplist_num) {
         zconfig_aplist_num = 1;
     }
 
-    for (i = 1; i < zconfig_aplist_num; i++) {
-        if (!strncmp(zconfig_aplist[i].ssid, (char *)ssid, ZC_MAX_SSID_LEN)
-            && !memcmp(zconfig_aplist[i].mac, bssid, ETH_ALEN)) {
-            //FIXME: useless?
-            /* found the same bss */
-            if (!zconfig_aplist[i].channel) {
-                zconfig_aplist[i].channel = channel;
-            }
-            if (zconfig_aplist[i].auth == ZC_AUTH_TYPE_INVALID) {
-                zconfig_aplist[i].auth = auth;
-            }
-            if (zconfig_aplist[i].encry[0] == ZC_ENC_TYPE_INVALID) {
-                zconfig_aplist[i].encry[0] = group_cipher;
-            }
-            if (zconfig_aplist[i].encry[1] == ZC_ENC_TYPE_INVALID) {
-                zconfig_aplist[i].encry[1] = pairwise_cipher;
-            }
+    ap = zconfig_get_apinfo(bssid);
+    if (ap) {
+        /* found the same bss */
+        ap->rssi = rssi;
+        ap->last_seen = os_get_time_ms();
+        if (channel) {
+            ap->channel = channel;
+        }
+        if (ap->auth == ZC_AUTH_TYPE_INVALID) {
+            ap->auth = auth;
+        }
+        if (ap->encry[0] == ZC_ENC_TYPE_INVALID) {
+            ap->encry[0] = group_cipher;
+        }
+        if (ap->encry[1] == ZC_ENC_TYPE_INVALID) {
+            ap->encry[1] = pairwise_cipher;
+        }
 
-            return 0;//duplicated ssid
+        if (ssid[0] == '\0' || !strncmp(ap->ssid, (char *)ssid, ZC_MAX_SSID_LEN - 1)) {
+            return 0;//duplicated bss
         }
-    }
 
-    if (i < MAX_APLIST_NUM) {
-        zconfig_aplist_num ++;
+        /* hidden ssid revealed by probe response, or ap renamed */
+        i = ap - zconfig_aplist;
+        aplist_hash_del_ssid(i);
+        memset(ap->ssid, 0, sizeof(ap->ssid));
+        strncpy(ap->ssid, (const char *)&ssid[0], ZC_MAX_SSID_LEN - 1);
+        aplist_hash_add_ssid(i);
     } else {
-        i = 0;    /* [0] for temp use, always replace [0] */
-    }
+        if (zconfig_aplist_num < MAX_APLIST_NUM) {
+            i = zconfig_aplist_num ++;
+        } else {
+            i = aplist_get_victim(rssi, !memcmp(zc_bssid, bssid, ETH_ALEN));
+            if (!i) {
+                return 0;    /* weaker than all of the aplist, drop it */
+            }
+            aplist_hash_del(i);
+        }
 
-    strncpy((char *)&zconfig_aplist[i].ssid, (const char *)&ssid[0], ZC_MAX_SSID_LEN - 1);
-    memcpy(&zconfig_aplist[i].mac, bssid, ETH_ALEN);
-    zconfig_aplist[i].auth = auth;
-    zconfig_aplist[i].rssi = rssi;
-    zconfig_aplist[i].channel = channel;
-    zconfig_aplist[i].encry[0] = group_cipher;
-    zconfig_aplist[i].encry[1] = pairwise_cipher;
+        ap = &zconfig_aplist[i];
+        memset(ap, 0, sizeof(*ap));
+        strncpy(ap->ssid, (const char *)&ssid[0], ZC_MAX_SSID_LEN - 1);
+        memcpy(ap->mac, bssid, ETH_ALEN);
+        ap->auth = auth;
+        ap->rssi = rssi;
+        ap->channel = channel;
+        ap->encry[0] = group_cipher;
+        ap->encry[1] = pairwise_cipher;
+        ap->last_seen = os_get_time_ms();
+        aplist_hash_add(i);
+    }
 
 #if defined(AWSS_SUPPORT_ADHA) || defined(AWSS_SUPPORT_AHA)
     do {
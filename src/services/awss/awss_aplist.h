@@ -21,6 +21,10 @@ struct ap_info {
 	uint8_t mac[ETH_ALEN];
 	char ssid[ZC_MAX_SSID_LEN];
 	signed char rssi;
+	/* kept by awss_aplist.c: when last heard, next entries in bssid/ssid hash chains */
+	uint32_t last_seen;
+	uint8_t bssid_next;
+	uint8_t ssid_next;
 };
 
 void aws_try_adjust_chan(void);
@@ -36,6 +36,19 @@ enum {
 };
 
 
+#ifdef AWSS_SUPPORT_5G_CHANNEL
+#define AWS_5G_CHN_NUMS              (9)
+#else
+#define AWS_5G_CHN_NUMS              (0)
+#endif
+
+/* traffic seen on a channel, decayed on each visit */
+struct aws_chn_stat {
+    uint8_t chn;
+    uint8_t hint;      /* awss frames recognized */
+    uint16_t data;     /* data frames per channelscan interval */
+};
+
 struct aws_info {
     uint8_t state;
 
@@ -44,13 +57,19 @@ struct aws_info {
 
     uint8_t locked_chn;
 
-#define AWS_MAX_CHN_NUMS             (2 * 13 + 5)    /* +5 for safety gap */
+#define AWS_MAX_CHN_NUMS             (2 * 13 + 5 + AWS_5G_CHN_NUMS)    /* +5 for safety gap */
     uint8_t chn_list[AWS_MAX_CHN_NUMS];
     uint8_t  stop;
 
     uint32_t chn_timestamp;/* channel start time */
     uint32_t start_timestamp;/* aws start time */
     uint32_t p2p_received_timestamp ;/* aws start time */
+
+#define AWS_CHN_STAT_NUM             (ZC_MAX_CHANNEL + AWS_5G_CHN_NUMS)
+    struct aws_chn_stat chn_stats[AWS_CHN_STAT_NUM];
+    uint8_t chn_dwell_times;/* channelscan intervals to stay on cur_chn */
+    uint16_t chn_hint;/* awss frames heard since cur_chn start */
+    uint16_t chn_data;/* data frames heard since cur_chn start */
 } *aws_info;
 
 #define aws_state                    (aws_info->state)
@@ -62,11 +81,29 @@ struct aws_info {
 #define aws_start_timestamp          (aws_info->start_timestamp)
 #define aws_stop                     (aws_info->stop)
 #define aws_p2p_received_timestamp   (aws_info->p2p_received_timestamp)
+#define aws_chn_stats                (aws_info->chn_stats)
+#define aws_chn_dwell_times          (aws_info->chn_dwell_times)
+#define aws_chn_hint                 (aws_info->chn_hint)
+#define aws_chn_data                 (aws_info->chn_data)
 
 #define aws_channel_lock_timeout_ms  (4 * 1000)
 
+/*
+ * channel dwell: one channelscan interval, plus one for each sign of a phone
+ * provisioning on the channel (awss frames heard lately, busy data traffic,
+ * crowded by aps), at most AWS_CHN_DWELL_MAX_TIMES intervals.
+ * every channel is still visited in turn, so a sweep over aws_chn_list takes
+ * at most AWS_CHN_DWELL_MAX_TIMES times of the fixed dwell one.
+ */
+#define AWS_CHN_DWELL_MAX_TIMES      (4)
+#define AWS_CHN_BUSY_DATA_FRAMES     (20)
+#define AWS_CHN_BUSY_AP_NUM          (3)
+
 static const uint8_t aws_fixed_scanning_channels[] = {
-    1, 6, 11, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13
+    1, 6, 11, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+#ifdef AWSS_SUPPORT_5G_CHANNEL
+    36, 40, 44, 48, 149, 153, 157, 161, 165
+#endif
 };
 
 #define RESCAN_MONITOR_TIMEOUT_MS     (5 * 60 * 1000)
@@ -144,6 +181,89 @@ void zconfig_got_ssid_passwd_callback(uint8_t *ssid, uint8_t *passwd,
     awss_event_post(AWSS_GOT_SSID_PASSWD);
 }
 
+static struct aws_chn_stat *aws_get_chn_stat(uint8_t channel)
+{
+    int i;
+
+    for (i = 0; i < AWS_CHN_STAT_NUM; i++) {
+        if (aws_chn_stats[i].chn == channel) {
+            return &aws_chn_stats[i];
+        }
+        if (aws_chn_stats[i].chn == 0) {
+            aws_chn_stats[i].chn = channel;
+            return &aws_chn_stats[i];
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef AWSS_SUPPORT_APLIST
+static int aws_get_chn_ap_num(uint8_t channel)
+{
+    int i, num = 0;
+
+    for (i = 1; i < zconfig_aplist_num; i++) {
+        if (zconfig_aplist[i].channel == channel) {
+            num++;
+        }
+    }
+
+    return num;
+}
+#endif
+
+/* fold traffic heard on cur_chn into its stat, the older part weighs half */
+static void aws_update_chn_stat(void)
+{
+    struct aws_chn_stat *stat;
+    uint32_t elapsed, data;
+
+    if (aws_cur_chn == 0) {
+        return;
+    }
+    stat = aws_get_chn_stat(aws_cur_chn);
+    if (stat == NULL) {
+        return;
+    }
+
+    elapsed = time_elapsed_ms_since(aws_chn_timestamp);
+    data = aws_chn_data * os_awss_get_channelscan_interval_ms() / (elapsed ? elapsed : 1);
+    stat->data = (stat->data + (data > 0xffff ? 0xffff : data)) / 2;
+    stat->hint = stat->hint / 2 + (aws_chn_hint > 0x7f ? 0x7f : aws_chn_hint);
+}
+
+static uint8_t aws_get_chn_dwell_times(uint8_t channel)
+{
+    struct aws_chn_stat *stat = aws_get_chn_stat(channel);
+    uint8_t times = 1;
+
+    if (stat) {
+        if (stat->hint) {
+            times += 2;
+        }
+        if (stat->data >= AWS_CHN_BUSY_DATA_FRAMES) {
+            times += 1;
+        }
+    }
+#ifdef AWSS_SUPPORT_APLIST
+    if (aws_get_chn_ap_num(channel) >= AWS_CHN_BUSY_AP_NUM) {
+        times += 1;
+    }
+#endif
+
+    return times > AWS_CHN_DWELL_MAX_TIMES ? AWS_CHN_DWELL_MAX_TIMES : times;
+}
+
+/* start counting traffic of a newly switched channel */
+static void aws_start_chn_dwell(uint8_t channel)
+{
+    aws_chn_dwell_times = aws_get_chn_dwell_times(channel);
+    aws_chn_hint = 0;
+    aws_chn_data = 0;
+    aws_chn_timestamp = os_get_time_ms();
+}
+
 uint8_t aws_next_channel(void)
 {
     /* aws_chn_index start from -1 */
@@ -181,10 +301,14 @@ void aws_switch_channel(void)
     }
 
     do {
-        int channel = aws_next_channel();
-        aws_chn_timestamp = os_get_time_ms();
+        int channel;
+
+        aws_update_chn_stat();
+        channel = aws_next_channel();
+        aws_start_chn_dwell(channel);
         os_awss_switch_channel(channel, 0, NULL);
-        awss_trace("chan %d\r\n", channel);
+        awss_trace("chan %d, dwell %d ms\r\n", channel,
+                   aws_chn_dwell_times * os_awss_get_channelscan_interval_ms());
     } while (0);
     os_mutex_unlock(zc_mutex);
 }
@@ -225,8 +349,9 @@ static void aws_switch_dst_chan(int channel)
 
     aws_chn_index = i;
     aws_locked_chn = channel;
+    aws_update_chn_stat();
     aws_cur_chn = channel;
-    aws_chn_timestamp = os_get_time_ms();
+    aws_start_chn_dwell(channel);
     if (aws_state == AWS_SCANNING) {
         aws_state = AWS_CHN_LOCKED;
     }
@@ -243,12 +368,19 @@ enum {
 
 int aws_is_chnscan_timeout(void)
 {
+    int dwell_times = aws_chn_dwell_times;
+
     if (aws_stop == AWS_STOPPING) {
         awss_debug("aws will stop...\r\n");
         return CHNSCAN_TIMEOUT;
     }
 
-    if (time_elapsed_ms_since(aws_chn_timestamp) > os_awss_get_channelscan_interval_ms()) {
+    /* heard awss frames on this visit, stay as long as allowed */
+    if (aws_chn_hint) {
+        dwell_times = AWS_CHN_DWELL_MAX_TIMES;
+    }
+
+    if (time_elapsed_ms_since(aws_chn_timestamp) > dwell_times * os_awss_get_channelscan_interval_ms()) {
         if ((0 != os_awss_get_timeout_interval_ms()) &&
             (time_elapsed_ms_since(aws_start_timestamp) > os_awss_get_timeout_interval_ms())) {
             return CHNSCAN_TIMEOUT;
@@ -553,7 +685,23 @@ int aws_80211_frame_handler(char *buf, int length, enum AWSS_LINK_TYPE link_type
 
     int ret = zconfig_recv_callback(buf, length, aws_cur_chn, link_type, with_fcs, rssi);
 
-    if (aws_state == AWS_CHN_LOCKED) {
+    if (aws_state == AWS_SCANNING) {
+        switch (ret) {
+            case PKG_BC_FRAME:
+            case PKG_START_FRAME:
+            case PKG_DATA_FRAME:
+            case PKG_GROUP_FRAME:
+            case PKG_MCAST_FRAME:
+                aws_chn_hint++;
+                break;
+            default:
+                break;
+        }
+        if (link_type == AWSS_LINK_TYPE_NONE && length >= 2 &&
+            ieee80211_is_data(((struct ieee80211_hdr *)buf)->frame_control)) {
+            aws_chn_data++;
+        }
+    } else if (aws_state == AWS_CHN_LOCKED) {
         switch (ret) {
             case PKG_START_FRAME:
             case PKG_DATA_FRAME:
@@ -584,6 +732,7 @@ void aws_start(char *pk, char *dn, char *ds, char *ps)
 
     /* start from -1 */
     aws_chn_index = 0xff;
+    aws_chn_dwell_times = 1;
     memcpy(aws_chn_list, aws_fixed_scanning_channels,
            sizeof(aws_fixed_scanning_channels));
 
@@ -36,15 +36,7 @@ static uint8_t g_notify_id;
 static uint16_t g_notify_msg_id;
 static char awss_notify_resp[AWSS_NOTIFY_TYPE_MAX] = {0};
 
-#ifdef WIFI_PROVISION_ENABLED
-static void *success_notify_timer = NULL;
-static void *devinfo_notify_timer = NULL;
-static void *success_notify_mutex = NULL;
-static void *devinfo_notify_mutex = NULL;
-#endif
-static void *dev_bind_notify_timer = NULL;
 static void *get_devinfo_timer  = NULL;
-static void *dev_bind_notify_mutex = NULL;
 
 extern char awss_report_token_suc;
 extern char awss_report_token_cnt;
@@ -234,6 +226,8 @@ static int awss_get_broadcast_addr(platform_netaddr_t *bcast_addr)
     return 0;
 }
 
+static int awss_notify_sched_start(int type, int budget, int sent);
+
 int awss_notify_dev_info(int type, int count)
 {
     char *buf = NULL;
@@ -276,15 +270,11 @@ int awss_notify_dev_info(int type, int count)
         utils_hex_to_str(aes_random, RANDOM_MAX_LEN, rand_str, sizeof(rand_str));
         iotx_state_event(ITE_STATE_DEV_BIND, STATE_BIND_NOTIFY_TOKEN_SENT, rand_str);
         awss_info("sending message to app:%s, %s\n", topic, buf);
-        for (i = 0; i < count; i ++) {
-            awss_cmp_coap_send(buf, strlen(buf), &notify_sa, topic, cb, &g_notify_msg_id);
-            if (count > 1) {
-                os_msleep(200 + 100 * i);
-            }
+        awss_cmp_coap_send(buf, strlen(buf), &notify_sa, topic, cb, &g_notify_msg_id);
 
-            if (awss_notify_resp[type]) {
-                break;
-            }
+        /* the rest are sent by notify scheduler, don't block the caller */
+        if (count > 1 && awss_notify_resp[type] == 0) {
+            awss_notify_sched_start(type, count, 1);
         }
     } while (0);
 
@@ -298,7 +288,6 @@ int awss_notify_dev_info(int type, int count)
     return awss_notify_resp[type];
 }
 
-#define AWSS_NOTIFY_CNT_MAX (30)
 
 static void *coap_session_ctx = NULL;
 
@@ -454,40 +443,118 @@ int online_ucast_get_device_info(void *ctx, void *resource, void *remote, void *
     return online_get_device_info(ctx, resource, remote, request, 0);
 }
 
-static int dev_bind_interval = 0;
-static char dev_bind_cnt = 0;
-static int __awss_dev_bind_notify()
+/*
+ * notify scheduler
+ *
+ * all notify types share one timer. a type is sent at most budget times, and
+ * stops once the app acks it (awss_notify_resp[type] set). the wait before the
+ * n-th resend is a random value in [0, min(CAP, BASE * 2^n)) ms (exponential
+ * backoff with full jitter), so devices powered on together spread out on the
+ * LAN instead of notifying in lockstep.
+ */
+#define AWSS_NOTIFY_CNT_MAX         (30)
+#define AWSS_NOTIFY_BACKOFF_BASE_MS (200)
+#define AWSS_NOTIFY_BACKOFF_CAP_MS  (3200)
+
+struct notify_sched_t {
+    uint8_t active;
+    uint8_t cnt;
+    uint8_t budget;
+    uint32_t due;
+};
+
+static struct notify_sched_t notify_sched[AWSS_NOTIFY_TYPE_MAX];
+static void *notify_sched_timer = NULL;
+static void *notify_sched_mutex = NULL;
+
+static void awss_notify_sched_run(void);
+
+static uint32_t awss_notify_backoff_ms(uint8_t cnt)
 {
-    /*
-     * wait for token is sent to cloud and rx reply from cloud
-     */
-    if (awss_report_token_suc == 0) {
-        if (dev_bind_notify_timer == NULL) {
-            dev_bind_notify_timer = HAL_Timer_Create("dev_bind", (void (*)(void *))__awss_dev_bind_notify, NULL);
+    uint32_t window = AWSS_NOTIFY_BACKOFF_BASE_MS;
+
+    while (cnt-- > 0 && window < AWSS_NOTIFY_BACKOFF_CAP_MS) {
+        window <<= 1;
+    }
+    if (window > AWSS_NOTIFY_BACKOFF_CAP_MS) {
+        window = AWSS_NOTIFY_BACKOFF_CAP_MS;
+    }
+
+    return 1 + HAL_Random(window);
+}
+
+static int awss_notify_sched_lock(void)
+{
+    if (notify_sched_mutex == NULL) {
+        notify_sched_mutex = HAL_MutexCreate();
+        if (notify_sched_mutex == NULL) {
+            return STATE_SYS_DEPEND_MUTEX_CREATE;
         }
-        HAL_Timer_Stop(dev_bind_notify_timer);
-        HAL_Timer_Start(dev_bind_notify_timer, AWSS_CHECK_RESP_TIME);
-        return 0;
     }
+    HAL_MutexLock(notify_sched_mutex);
+    return 0;
+}
+
+/* arm the timer for the earliest due type, delete it when none is active */
+static void awss_notify_sched_arm(void)
+{
+    uint8_t i;
+    int found = 0;
+    uint32_t wait = 0, left;
 
-    if (dev_bind_notify_mutex == NULL) {
-        dev_bind_notify_mutex = HAL_MutexCreate();
-        if (dev_bind_notify_mutex == NULL) {
-            return STATE_USER_INPUT_NULL_POINTER;
+    for (i = 0; i < AWSS_NOTIFY_TYPE_MAX; i ++) {
+        if (!notify_sched[i].active) {
+            continue;
+        }
+        left = (int32_t)(notify_sched[i].due - os_get_time_ms()) > 0 ?
+               notify_sched[i].due - os_get_time_ms() : 1;
+        if (!found || left < wait) {
+            wait = left;
         }
+        found = 1;
     }
 
-    if (dev_bind_cnt == 0) {
-        awss_event_post(AWSS_BIND_NOTIFY);
+    if (!found) {
+        if (notify_sched_timer) {
+            awss_stop_timer(notify_sched_timer);
+            notify_sched_timer = NULL;
+        }
+        return;
     }
 
-    HAL_MutexLock(dev_bind_notify_mutex);
+    if (notify_sched_timer == NULL) {
+        notify_sched_timer = HAL_Timer_Create("awss_notify", (void (*)(void *))awss_notify_sched_run, NULL);
+        if (notify_sched_timer == NULL) {
+            return;
+        }
+    }
+    HAL_Timer_Stop(notify_sched_timer);
+    HAL_Timer_Start(notify_sched_timer, wait);
+}
 
-    do {
+static void awss_notify_sched_finish(int type)
+{
+    notify_sched[type].active = 0;
+    notify_sched[type].cnt = 0;
+    awss_notify_resp[type] = 0;
+}
+
+/*
+ * called with notify_sched_mutex held, *event is set when the caller should
+ * post it once the mutex is released
+ * @return 0: sent or not ready yet, type keeps scheduled; 1: type is done
+ */
+static int awss_notify_sched_send(int type, int *event)
+{
+    struct notify_sched_t *sched = &notify_sched[type];
+
+    if (type == AWSS_NOTIFY_DEV_BIND_TOKEN) {
         uint8_t i = 0;
 
-        if (awss_notify_resp[AWSS_NOTIFY_DEV_BIND_TOKEN] != 0) {
-            break;
+        /* wait for token is sent to cloud and rx reply from cloud */
+        if (awss_report_token_suc == 0) {
+            sched->due = os_get_time_ms() + AWSS_CHECK_RESP_TIME;
+            return 0;
         }
 
         for (i = 0; i < RANDOM_MAX_LEN; i ++)
@@ -498,243 +565,143 @@ static int __awss_dev_bind_notify()
         if (i >= RANDOM_MAX_LEN) {
             produce_random(aes_random, sizeof(aes_random));
         }
+    }
 
-        awss_notify_dev_info(AWSS_NOTIFY_DEV_BIND_TOKEN, 1);
-#ifdef DEV_BIND_TEST
-        if (dev_bind_cnt > 3) {
-            os_reboot();
+    if (sched->cnt == 0) {
+        if (type == AWSS_NOTIFY_DEV_BIND_TOKEN) {
+            *event = AWSS_BIND_NOTIFY;
         }
-#endif
-
-        dev_bind_interval += 100;
-        if (dev_bind_cnt ++ < AWSS_NOTIFY_CNT_MAX &&
-            awss_notify_resp[AWSS_NOTIFY_DEV_BIND_TOKEN] == 0) {
-            if (dev_bind_notify_timer == NULL) {
-                dev_bind_notify_timer = HAL_Timer_Create("dev_bind", (void (*)(void *))awss_dev_bind_notify, NULL);
-            }
-            HAL_Timer_Stop(dev_bind_notify_timer);
-            HAL_Timer_Start(dev_bind_notify_timer, dev_bind_interval);
-            HAL_MutexUnlock(dev_bind_notify_mutex);
-            return 0;
+#ifdef WIFI_PROVISION_ENABLED
+        else if (type == AWSS_NOTIFY_SUCCESS) {
+            *event = AWSS_SUC_NOTIFY;
         }
-    } while (0);
-
-    awss_notify_resp[AWSS_NOTIFY_DEV_BIND_TOKEN] = 0;
-    dev_bind_interval = 0;
-    dev_bind_cnt = 0;
-    if (dev_bind_notify_timer) {
-        awss_stop_timer(dev_bind_notify_timer);
-        dev_bind_notify_timer = NULL;
+#endif
     }
 
-    HAL_MutexUnlock(dev_bind_notify_mutex);
-    return 1;
-}
-
-int awss_dev_bind_notify()
-{
-    dev_bind_cnt = 0;
-    dev_bind_interval = 0;
-    awss_notify_resp[AWSS_NOTIFY_DEV_BIND_TOKEN] = 0;
-
-    return __awss_dev_bind_notify();
-}
-
-int awss_dev_bind_notify_stop()
-{
-    if (dev_bind_notify_mutex) {
-        HAL_MutexLock(dev_bind_notify_mutex);
+    awss_notify_dev_info(type, 1);
+#ifdef DEV_BIND_TEST
+    if (type == AWSS_NOTIFY_DEV_BIND_TOKEN && sched->cnt > 3) {
+        os_reboot();
     }
+#endif
 
-    do {
-        awss_notify_resp[AWSS_NOTIFY_DEV_BIND_TOKEN] = 1;
-        dev_bind_cnt = AWSS_NOTIFY_CNT_MAX;
-        if (dev_bind_notify_timer == NULL) {
-            break;
-        }
-
-        awss_stop_timer(dev_bind_notify_timer);
-        dev_bind_notify_timer = NULL;
-    } while (0);
-
-    if (dev_bind_notify_mutex) {
-        HAL_MutexUnlock(dev_bind_notify_mutex);
-        HAL_MutexDestroy(dev_bind_notify_mutex);
-        dev_bind_notify_mutex = NULL;
+    if (++ sched->cnt >= sched->budget || awss_notify_resp[type] != 0) {
+        return 1;
     }
+
+    sched->due = os_get_time_ms() + awss_notify_backoff_ms(sched->cnt);
     return 0;
 }
 
-#ifdef WIFI_PROVISION_ENABLED
-static int suc_interval = 0;
-static char suc_cnt = 0;
-static int __awss_suc_notify()
+static void awss_notify_sched_run(void)
 {
-    awss_debug("resp:%d\r\n", awss_notify_resp[AWSS_NOTIFY_SUCCESS]);
-
-    if (success_notify_mutex == NULL) {
-        success_notify_mutex = HAL_MutexCreate();
-        if (success_notify_mutex == NULL) {
-            return STATE_SYS_DEPEND_MUTEX_CREATE;
-        }
-    }
+    uint8_t i;
+    uint8_t cnt = 0;
+    int events[AWSS_NOTIFY_TYPE_MAX];
 
-    if (suc_cnt == 0) {
-        awss_event_post(AWSS_SUC_NOTIFY);
+    if (awss_notify_sched_lock() != 0) {
+        return;
     }
 
-    HAL_MutexLock(success_notify_mutex);
-
-    do {
-        if (awss_notify_resp[AWSS_NOTIFY_SUCCESS] != 0) {
-            break;
+    for (i = 0; i < AWSS_NOTIFY_TYPE_MAX; i ++) {
+        if (!notify_sched[i].active) {
+            continue;
         }
-
-        awss_notify_dev_info(AWSS_NOTIFY_SUCCESS, 1);
-
-        suc_interval += 100;
-        if (suc_cnt ++ < AWSS_NOTIFY_CNT_MAX &&
-            awss_notify_resp[AWSS_NOTIFY_SUCCESS] == 0) {
-            if (success_notify_timer == NULL) {
-                success_notify_timer = HAL_Timer_Create("awss_suc", (void (*)(void *))__awss_suc_notify, NULL);
-            }
-            HAL_Timer_Stop(success_notify_timer);
-            HAL_Timer_Start(success_notify_timer, suc_interval);
-            HAL_MutexUnlock(success_notify_mutex);
-            return 0;
+        /* acked, cancel before it is due */
+        if (awss_notify_resp[i] != 0) {
+            awss_notify_sched_finish(i);
+            continue;
+        }
+        if ((int32_t)(notify_sched[i].due - os_get_time_ms()) > 0) {
+            continue;
+        }
+        events[cnt] = -1;
+        if (awss_notify_sched_send(i, &events[cnt])) {
+            awss_notify_sched_finish(i);
+        }
+        if (events[cnt] != -1) {
+            cnt ++;
         }
-    } while (0);
-
-    awss_notify_resp[AWSS_NOTIFY_SUCCESS] = 0;
-    suc_interval = 0;
-    suc_cnt = 0;
-    if (success_notify_timer) {
-        awss_stop_timer(success_notify_timer);
-        success_notify_timer = NULL;
     }
 
-    if (success_notify_mutex) {
-        HAL_MutexUnlock(success_notify_mutex);
-        HAL_MutexDestroy(success_notify_mutex);
-        success_notify_mutex = NULL;
+    awss_notify_sched_arm();
+    HAL_MutexUnlock(notify_sched_mutex);
+
+    /* event callback may start or stop a notify, which takes notify_sched_mutex */
+    for (i = 0; i < cnt; i ++) {
+        awss_event_post(events[i]);
     }
-    return 1;
 }
 
-int awss_suc_notify()
+/*
+ * schedule type to be sent budget times in all, sent of them are done
+ * by the caller already
+ */
+static int awss_notify_sched_start(int type, int budget, int sent)
 {
-    suc_cnt = 0;
-    suc_interval = 0;
-    awss_notify_resp[AWSS_NOTIFY_SUCCESS] = 0;
-    return __awss_suc_notify();
+    int ret = awss_notify_sched_lock();
+    if (ret != 0) {
+        return ret;
+    }
+
+    awss_notify_resp[type] = 0;
+    notify_sched[type].active = 1;
+    notify_sched[type].budget = budget > AWSS_NOTIFY_CNT_MAX ? AWSS_NOTIFY_CNT_MAX : budget;
+    notify_sched[type].cnt = sent;
+    notify_sched[type].due = os_get_time_ms() + (sent ? awss_notify_backoff_ms(sent) : 0);
+    awss_notify_sched_arm();
+
+    HAL_MutexUnlock(notify_sched_mutex);
+    return 0;
 }
 
-int awss_suc_notify_stop()
+static int awss_notify_sched_stop(int type)
 {
-    if (success_notify_mutex) {
-        HAL_MutexLock(success_notify_mutex);
+    int ret = awss_notify_sched_lock();
+    if (ret != 0) {
+        return ret;
     }
 
-    do {
-        awss_notify_resp[AWSS_NOTIFY_SUCCESS] = 1;
-        suc_cnt = AWSS_NOTIFY_CNT_MAX;
-        if (success_notify_timer == NULL) {
-            break;
-        }
+    notify_sched[type].active = 0;
+    notify_sched[type].cnt = 0;
+    awss_notify_resp[type] = 1;
+    awss_notify_sched_arm();
 
-        awss_stop_timer(success_notify_timer);
-        success_notify_timer = NULL;
-    } while (0);
-
-    if (success_notify_mutex) {
-        HAL_MutexUnlock(success_notify_mutex);
-        HAL_MutexDestroy(success_notify_mutex);
-        success_notify_mutex = NULL;
-    }
+    HAL_MutexUnlock(notify_sched_mutex);
     return 0;
 }
 
-
-static int devinfo_interval = 0;
-static char devinfo_cnt = 0;
-static int __awss_devinfo_notify()
+int awss_dev_bind_notify()
 {
-    if (devinfo_notify_mutex == NULL) {
-        devinfo_notify_mutex = HAL_MutexCreate();
-        if (devinfo_notify_mutex == NULL) {
-            return STATE_SYS_DEPEND_MUTEX_CREATE;
-        }
-    }
-    HAL_MutexLock(devinfo_notify_mutex);
-
-    do {
-        if (awss_notify_resp[AWSS_NOTIFY_DEV_RAND_SIGN] != 0) {
-            break;
-        }
+    return awss_notify_sched_start(AWSS_NOTIFY_DEV_BIND_TOKEN, AWSS_NOTIFY_CNT_MAX, 0);
+}
 
-        awss_notify_dev_info(AWSS_NOTIFY_DEV_RAND_SIGN, 1);
+int awss_dev_bind_notify_stop()
+{
+    return awss_notify_sched_stop(AWSS_NOTIFY_DEV_BIND_TOKEN);
+}
 
-        devinfo_interval += 100;
-        if (devinfo_cnt ++ < AWSS_NOTIFY_CNT_MAX &&
-            awss_notify_resp[AWSS_NOTIFY_DEV_RAND_SIGN] == 0) {
-            if (devinfo_notify_timer == NULL) {
-                devinfo_notify_timer = HAL_Timer_Create("devinfo", (void (*)(void *))__awss_devinfo_notify, NULL);
-            }
-            HAL_Timer_Stop(devinfo_notify_timer);
-            HAL_Timer_Start(devinfo_notify_timer, devinfo_interval);
-            HAL_MutexUnlock(devinfo_notify_mutex);
-            return 0;
-        }
-    } while (0);
+#ifdef WIFI_PROVISION_ENABLED
+int awss_suc_notify()
+{
+    awss_debug("resp:%d\r\n", awss_notify_resp[AWSS_NOTIFY_SUCCESS]);
+    return awss_notify_sched_start(AWSS_NOTIFY_SUCCESS, AWSS_NOTIFY_CNT_MAX, 0);
+}
 
-    awss_notify_resp[AWSS_NOTIFY_DEV_RAND_SIGN] = 0;
-    devinfo_interval = 0;
-    devinfo_cnt = 0;
-    if (devinfo_notify_timer) {
-        awss_stop_timer(devinfo_notify_timer);
-        devinfo_notify_timer = NULL;
-    }
-    if (devinfo_notify_mutex) {
-        HAL_MutexUnlock(devinfo_notify_mutex);
-        HAL_MutexDestroy(devinfo_notify_mutex);
-        devinfo_notify_mutex = NULL;
-    }
-    return 1;
+int awss_suc_notify_stop()
+{
+    return awss_notify_sched_stop(AWSS_NOTIFY_SUCCESS);
 }
 
 int awss_devinfo_notify()
 {
-    devinfo_cnt = 0;
-    devinfo_interval = 0;
-    awss_notify_resp[AWSS_NOTIFY_DEV_RAND_SIGN] = 0;
-    return __awss_devinfo_notify();
+    return awss_notify_sched_start(AWSS_NOTIFY_DEV_RAND_SIGN, AWSS_NOTIFY_CNT_MAX, 0);
 }
 
 int awss_devinfo_notify_stop()
 {
-    if (devinfo_notify_mutex) {
-        HAL_MutexLock(devinfo_notify_mutex);
-    }
-
-    do {
-        awss_notify_resp[AWSS_NOTIFY_DEV_RAND_SIGN] = 1;
-        devinfo_cnt = AWSS_NOTIFY_CNT_MAX;
-        if (devinfo_notify_timer == NULL) {
-            break;
-        }
-
-        awss_stop_timer(devinfo_notify_timer);
-        devinfo_notify_timer = NULL;
-    } while (0);
-
-    if (devinfo_notify_mutex) {
-        HAL_MutexUnlock(devinfo_notify_mutex);
-        HAL_MutexDestroy(devinfo_notify_mutex);
-        devinfo_notify_mutex = NULL;
-    }
-    return 0;
+    return awss_notify_sched_stop(AWSS_NOTIFY_DEV_RAND_SIGN);
 }
-
 #endif
 
 #if defined(__cplusplus) /* If this is a C++ compiler, use C linkage */
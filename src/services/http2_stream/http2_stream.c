@@ -19,6 +19,13 @@
 
 #define URL_MAX_LEN                     (100)
 
+#ifndef HTTP2_STREAM_TABLE_INIT_SIZE
+    #define HTTP2_STREAM_TABLE_INIT_SIZE    (16)    /* slots of stream id table, power of 2 */
+#endif
+#ifndef HTTP2_STREAM_CHANNEL_BUCKETS
+    #define HTTP2_STREAM_CHANNEL_BUCKETS    (16)    /* buckets of channel id index, power of 2 */
+#endif
+
 #define h2stream_err(...)               log_err("h2stream", __VA_ARGS__)
 #define h2stream_warning(...)           log_warning("h2stream", __VA_ARGS__)
 #define h2stream_info(...)              log_info("h2stream", __VA_ARGS__)
@@ -43,32 +50,45 @@ typedef struct _device_info_struct_ {
     int         port;
 } device_info;
 
+typedef struct _http2_stream_node_ http2_stream_node_t;
+
+/* open addressing table of stream nodes keyed by stream id, linear probing */
+typedef struct {
+    http2_stream_node_t  **slots;
+    uint32_t             size;            /* number of slots, power of 2 */
+    uint32_t             used;            /* slots holding a node or a tombstone */
+} http2_stream_table_t;
+
 typedef struct {
     http2_connection_t   *http2_connect;
     void                 *mutex;
     void                 *semaphore;
+    void                 *io_wakeup;       /* posted when there is work for io thread */
     void                 *rw_thread;
     http2_list_t         stream_list;
+    http2_stream_table_t stream_table;    /* stream id -> node of stream_list */
+    http2_list_t         channel_index[HTTP2_STREAM_CHANNEL_BUCKETS];  /* nodes which got a channel id */
     int                  init_state;
     http2_stream_cb_t    *cbs;
 #ifdef FS_ENABLED
-    http2_list_t         file_list;
-    void                 *file_thread;
+    http2_list_t         file_list;       /* uploads queued or in progress, driven by io thread */
 #endif
     uint8_t              connect_state;
     uint8_t              retry_cnt;
 } stream_handle_t;
 
-typedef struct {
+struct _http2_stream_node_ {
     unsigned int stream_id;         /* http2 protocol stream id */
     char *channel_id;               /* string return by server to identify a specific stream channel, different from stream identifier which is a field in http2 frame */
     stream_type_t stream_type;      /* check @stream_type_t */
     void *semaphore;                /* semaphore for http2 response sync */
     char status_code[5];            /* http2 response status code */
     uint8_t  rcv_hd_cnt;            /* the number of concerned heads received*/
+    uint8_t  closed;                /* stream closed by nghttp2 */
     void     *user_data;            /* data passed to the stream callback function */
     http2_list_t list;              /* list_head */
-} http2_stream_node_t;
+    http2_list_t channel_list;      /* bucket of channel_index, self linked when no channel id */
+};
 
 static device_info g_device_info;
 
@@ -168,25 +188,174 @@ static void file_upload_gen_string(char *str, int type, char *para1, int para2)
     }
 }
 
+/* slot of a removed node, keeps probe sequences of other nodes intact */
+static char g_stream_slot_deleted;
+#define HTTP2_STREAM_SLOT_DELETED ((http2_stream_node_t *)&g_stream_slot_deleted)
+
+static uint32_t http2_stream_id_hash(unsigned int stream_id)
+{
+    /* client streams are odd, drop the constant bit before mixing */
+    return (uint32_t)(stream_id >> 1) * 2654435761u;
+}
+
+static uint32_t http2_stream_channel_hash(const char *channel_id)
+{
+    uint32_t hash = 5381;
+
+    while (*channel_id) {
+        hash = (hash << 5) + hash + (uint8_t)(*channel_id++);
+    }
+    return hash & (HTTP2_STREAM_CHANNEL_BUCKETS - 1);
+}
+
+static http2_stream_node_t **http2_stream_table_slot(http2_stream_table_t *table, unsigned int stream_id)
+{
+    uint32_t mask = table->size - 1;
+    uint32_t i = http2_stream_id_hash(stream_id) & mask;
+
+    if (table->slots == NULL) {
+        return NULL;
+    }
+    while (table->slots[i] != NULL) {
+        if (table->slots[i] != HTTP2_STREAM_SLOT_DELETED && table->slots[i]->stream_id == stream_id) {
+            return &table->slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+/* rebuild into 'size' slots, dropping tombstones */
+static int http2_stream_table_resize(http2_stream_table_t *table, uint32_t size)
+{
+    uint32_t i, j;
+    http2_stream_node_t **slots = NULL;
+
+    slots = (http2_stream_node_t **)HTTP2_STREAM_MALLOC(size * sizeof(http2_stream_node_t *));
+    if (slots == NULL) {
+        return FAIL_RETURN;
+    }
+    memset(slots, 0, size * sizeof(http2_stream_node_t *));
+
+    table->used = 0;
+    for (i = 0; table->slots != NULL && i < table->size; i++) {
+        if (table->slots[i] == NULL || table->slots[i] == HTTP2_STREAM_SLOT_DELETED) {
+            continue;
+        }
+        j = http2_stream_id_hash(table->slots[i]->stream_id) & (size - 1);
+        while (slots[j] != NULL) {
+            j = (j + 1) & (size - 1);
+        }
+        slots[j] = table->slots[i];
+        table->used++;
+    }
+
+    HTTP2_STREAM_FREE(table->slots);
+    table->slots = slots;
+    table->size = size;
+    return SUCCESS_RETURN;
+}
+
+static int http2_stream_table_add(http2_stream_table_t *table, http2_stream_node_t *node)
+{
+    uint32_t mask, i;
+    http2_stream_node_t **slot = http2_stream_table_slot(table, node->stream_id);
+
+    if (slot != NULL) {
+        /* id reused by a new session while the stale node is still owned, newest wins */
+        *slot = node;
+        return SUCCESS_RETURN;
+    }
+
+    /* keep load factor including tombstones under 3/4 */
+    if (table->slots == NULL || (table->used + 1) * 4 > table->size * 3) {
+        uint32_t size = (table->slots == NULL) ? HTTP2_STREAM_TABLE_INIT_SIZE : table->size;
+        uint32_t live = 0;
+
+        for (i = 0; table->slots != NULL && i < table->size; i++) {
+            if (table->slots[i] != NULL && table->slots[i] != HTTP2_STREAM_SLOT_DELETED) {
+                live++;
+            }
+        }
+        while ((live + 1) * 2 > size) {
+            size <<= 1;
+        }
+        if (http2_stream_table_resize(table, size) != SUCCESS_RETURN) {
+            return FAIL_RETURN;
+        }
+    }
+
+    mask = table->size - 1;
+    i = http2_stream_id_hash(node->stream_id) & mask;
+    while (table->slots[i] != NULL && table->slots[i] != HTTP2_STREAM_SLOT_DELETED) {
+        i = (i + 1) & mask;
+    }
+    if (table->slots[i] == NULL) {
+        table->used++;
+    }
+    table->slots[i] = node;
+    return SUCCESS_RETURN;
+}
+
+static void http2_stream_table_del(http2_stream_table_t *table, http2_stream_node_t *node)
+{
+    http2_stream_node_t **slot = http2_stream_table_slot(table, node->stream_id);
+
+    /* a stale node may have been replaced by the newer one with same id */
+    if (slot != NULL && *slot == node) {
+        *slot = HTTP2_STREAM_SLOT_DELETED;
+    }
+}
+
+static void http2_stream_table_destroy(http2_stream_table_t *table)
+{
+    HTTP2_STREAM_FREE(table->slots);
+    memset(table, 0, sizeof(http2_stream_table_t));
+}
+
 static int http2_stream_node_search(stream_handle_t *handle, unsigned int stream_id, http2_stream_node_t **p_node)
 {
-    *p_node = NULL;
+    http2_stream_node_t **slot = NULL;
 
-    POINTER_SANITY_CHECK(handle, NULL_VALUE_ERROR);
     POINTER_SANITY_CHECK(p_node, NULL_VALUE_ERROR);
+    *p_node = NULL;
+    POINTER_SANITY_CHECK(handle, NULL_VALUE_ERROR);
 
-    http2_stream_node_t *search_node = NULL;
-    list_for_each_entry(search_node, &handle->stream_list, list, http2_stream_node_t) {
-        if (search_node->stream_id == stream_id) {
-            *p_node = search_node;
-            return SUCCESS_RETURN;
-        }
+    slot = http2_stream_table_slot(&handle->stream_table, stream_id);
+    if (slot != NULL) {
+        *p_node = *slot;
+        return SUCCESS_RETURN;
     }
 
     h2stream_debug("stream node not exist, stream_id = %d", stream_id);
     return FAIL_RETURN;
 }
 
+/* give node a channel id, or take it away when channel_id is NULL; old one is freed */
+static void http2_stream_node_set_channel(stream_handle_t *handle, http2_stream_node_t *node, char *channel_id)
+{
+    if (node->channel_id != NULL) {
+        list_del((list_head_t *)&node->channel_list);
+        INIT_LIST_HEAD((list_head_t *)&node->channel_list);
+        HTTP2_STREAM_FREE(node->channel_id);
+    }
+    node->channel_id = channel_id;
+    if (channel_id != NULL) {
+        list_add((list_head_t *)&node->channel_list,
+                 (list_head_t *)&handle->channel_index[http2_stream_channel_hash(channel_id)]);
+    }
+}
+
+/* unlink node from list and indexes and free it */
+static void http2_stream_node_release(stream_handle_t *handle, http2_stream_node_t *node)
+{
+    http2_stream_table_del(&handle->stream_table, node);
+    http2_stream_node_set_channel(handle, node, NULL);
+    list_del((list_head_t *)&node->list);
+    HAL_SemaphoreDestroy(node->semaphore);
+    HTTP2_STREAM_FREE(node);
+}
+
 static void on_stream_header(int32_t stream_id, int cat, const uint8_t *name, uint32_t namelen,
                              const uint8_t *value, uint32_t valuelen, uint8_t flags)
 {
@@ -203,12 +372,13 @@ static void on_stream_header(int32_t stream_id, int cat, const uint8_t *name, ui
     switch (cat) {
     case 0x01:
         if (strncmp((char *)name, "x-data-stream-id", (int)namelen) == 0) {
-            node->channel_id = HTTP2_STREAM_MALLOC(valuelen + 1);
-            if (node->channel_id == NULL) {
+            char *channel_id = HTTP2_STREAM_MALLOC(valuelen + 1);
+            if (channel_id == NULL) {
                 return;
             }
-            memset(node->channel_id, 0, (int)valuelen + 1);
-            memcpy(node->channel_id, (char *)value, (int)valuelen);
+            memset(channel_id, 0, (int)valuelen + 1);
+            memcpy(channel_id, (char *)value, (int)valuelen);
+            http2_stream_node_set_channel(g_stream_handle, node, channel_id);
             if (++node->rcv_hd_cnt == 2) {
                 HAL_SemaphorePost(node->semaphore);
             }
@@ -252,6 +422,7 @@ static void on_stream_close(int32_t stream_id, uint32_t error_code)
     if (node == NULL) {
         return;
     }
+    node->closed = 1;
     if (g_stream_handle->cbs && g_stream_handle->cbs->on_stream_close_cb) {
         g_stream_handle->cbs->on_stream_close_cb(node->stream_id, node->channel_id, error_code,node->user_data);
     }
@@ -312,18 +483,47 @@ static int  reconnect(stream_handle_t *handle)
     return 0;
 }
 
+#ifdef FS_ENABLED
+static void http2_upload_schedule(stream_handle_t *handle, http2_list_t *done_list);
+static void http2_upload_abort(stream_handle_t *handle, http2_list_t *done_list, int all);
+static void http2_upload_notify(http2_list_t *done_list);
+#endif
+
+static void http2_io_wakeup(stream_handle_t *handle)
+{
+    HAL_SemaphorePost(handle->io_wakeup);
+}
+
 static void *http2_io(void *user_data)
 {
     stream_handle_t *handle = (stream_handle_t *)user_data;
     int rv = 0;
+    int busy;
+    uint32_t idle_wait;
     POINTER_SANITY_CHECK(handle, NULL);
     iotx_time_t timer;
     iotx_time_init(&timer);
+#ifdef FS_ENABLED
+    http2_list_t done_list;
+    INIT_LIST_HEAD((list_head_t *)&done_list);
+#endif
     while (handle->init_state) {
+        busy = 0;
         if (handle->connect_state) {
+            /* network read blocks until socket readable or its timeout, queued frames are flushed */
             HAL_MutexLock(handle->mutex);
             rv = iotx_http2_exec_io(handle->http2_connect);
+#ifdef FS_ENABLED
+            if (rv >= 0) {
+                http2_upload_schedule(handle, &done_list);
+            }
+            busy = !list_empty((list_head_t *) & (handle->file_list));
+#endif
+            busy = busy || !list_empty((list_head_t *) & (handle->stream_list));
             HAL_MutexUnlock(handle->mutex);
+#ifdef FS_ENABLED
+            http2_upload_notify(&done_list);
+#endif
         }
         if (utils_time_is_expired(&timer) && handle->connect_state) {
             HAL_MutexLock(handle->mutex);
@@ -342,10 +542,18 @@ static void *http2_io(void *user_data)
                     }
                 }
                 rv = reconnect(handle);
+#ifdef FS_ENABLED
+                /* streams of uploads in progress went away with the old session */
+                HAL_MutexLock(handle->mutex);
+                http2_upload_abort(handle, &done_list, 0);
+                HAL_MutexUnlock(handle->mutex);
+                http2_upload_notify(&done_list);
+#endif
                 continue;
             } else {
                 handle->retry_cnt++;
             }
+            HAL_SleepMs(100);
         } else {
             if (handle->connect_state == 0) {
                 handle->connect_state = 1;
@@ -354,9 +562,26 @@ static void *http2_io(void *user_data)
                     handle->cbs->on_reconnect_cb();
                 }
             }
+
+            if (busy) {
+                /* let stream APIs take the mutex between two reads */
+                HAL_SleepMs(1);
+            } else {
+                /* nothing in flight, block until a stream API has work for us or it's time to ping */
+                idle_wait = iotx_time_left(&timer);
+                if (idle_wait > IOT_HTTP2_IO_IDLE_WAIT_MS) {
+                    idle_wait = IOT_HTTP2_IO_IDLE_WAIT_MS;
+                }
+                HAL_SemaphoreWait(handle->io_wakeup, idle_wait);
+            }
         }
-        HAL_SleepMs(100);
     }
+#ifdef FS_ENABLED
+    HAL_MutexLock(handle->mutex);
+    http2_upload_abort(handle, &done_list, 1);
+    HAL_MutexUnlock(handle->mutex);
+    http2_upload_notify(&done_list);
+#endif
     HAL_SemaphorePost(handle->semaphore);
 
     return NULL;
@@ -390,6 +615,12 @@ static int http2_stream_node_insert(stream_handle_t *handle, unsigned int id, vo
     }
     node->semaphore = semaphore;
 
+    if (http2_stream_table_add(&handle->stream_table, node) != SUCCESS_RETURN) {
+        HAL_SemaphoreDestroy(semaphore);
+        HTTP2_STREAM_FREE(node);
+        return FAIL_RETURN;
+    }
+    INIT_LIST_HEAD((list_head_t *)&node->channel_list);
     INIT_LIST_HEAD((list_head_t *)&node->list);
     list_add((list_head_t *)&node->list, (list_head_t *)&handle->stream_list);
 
@@ -402,23 +633,18 @@ static int http2_stream_node_insert(stream_handle_t *handle, unsigned int id, vo
 
 static int http2_stream_node_remove(stream_handle_t *handle, unsigned int id)
 {
-    http2_stream_node_t *search_node;
+    http2_stream_node_t *search_node = NULL;
 
     POINTER_SANITY_CHECK(handle, NULL_VALUE_ERROR);
     ARGUMENT_SANITY_CHECK(id != 0, FAIL_RETURN);
 
-    list_for_each_entry(search_node, &handle->stream_list, list, http2_stream_node_t) {
-        if (id == search_node->stream_id) {
-            h2stream_info("stream_node found, delete\n");
-
-            list_del((list_head_t *)&search_node->list);
-            HTTP2_STREAM_FREE(search_node->channel_id);
-            HAL_SemaphoreDestroy(search_node->semaphore);
-            HTTP2_STREAM_FREE(search_node);
-            return SUCCESS_RETURN;
-        }
+    http2_stream_node_search(handle, id, &search_node);
+    if (search_node == NULL) {
+        return FAIL_RETURN;
     }
-    return FAIL_RETURN;
+    h2stream_info("stream_node found, delete\n");
+    http2_stream_node_release(handle, search_node);
+    return SUCCESS_RETURN;
 }
 
 static int get_version_int()
@@ -435,6 +661,108 @@ static int get_version_int()
     return v_int;
 }
 
+/* strings referenced by request headers, live as long as the headers */
+typedef struct {
+    char path[128];
+    char client_id[64 + 1];
+    char sign[41 + 1];
+    char version[33];
+    char data_len[33];
+} http2_header_str_t;
+
+static http2_header *http2_stream_header_new(const http2_header *static_header, int static_num,
+        header_ext_info_t *header, int *header_count)
+{
+    int header_num = static_num;
+    http2_header *nva = NULL;
+
+    if (header != NULL) {
+        header_num += header->num;
+    }
+    nva = (http2_header *)HTTP2_STREAM_MALLOC(sizeof(http2_header) * header_num);
+    if (nva == NULL) {
+        h2stream_err("nva malloc failed\n");
+        return NULL;
+    }
+
+    /* add external header if it's not NULL */
+    *header_count = http2_nv_copy(nva, 0, (http2_header *)static_header, static_num);
+    if (header != NULL) {
+        *header_count = http2_nv_copy(nva, *header_count, (http2_header *)header->nva, header->num);
+    }
+    return nva;
+}
+
+static http2_header *http2_stream_open_header(http2_header_str_t *str, const char *identify,
+        header_ext_info_t *header, int *header_count)
+{
+    char sign_str[256 + 1] = {0};
+
+    HAL_Snprintf(str->path, sizeof(str->path), "/stream/open/%s", identify);
+    file_upload_gen_string(str->client_id, CID_STRING_ENUM, NULL, 0);
+    file_upload_gen_string(sign_str, ORI_SIGN_STR_ENUM, str->client_id, 0);
+    file_upload_gen_string(str->sign, REAL_SIGN_STR_ENUM, sign_str, 0);
+    HAL_Snprintf(str->version, sizeof(str->version), "%d", get_version_int());
+
+    const http2_header static_header[] = { MAKE_HEADER(":method", "POST"),
+                                           MAKE_HEADER_CS(":path", str->path),
+                                           MAKE_HEADER(":scheme", "https"),
+                                           MAKE_HEADER("x-auth-name", "devicename"),
+                                           MAKE_HEADER_CS("x-auth-param-client-id", str->client_id),
+                                           MAKE_HEADER("x-auth-param-signmethod", "hmacsha1"),
+                                           MAKE_HEADER_CS("x-auth-param-product-key", g_device_info.product_key),
+                                           MAKE_HEADER_CS("x-auth-param-device-name", g_device_info.device_name),
+                                           MAKE_HEADER_CS("x-auth-param-sign", str->sign),
+                                           MAKE_HEADER_CS("x-sdk-version", str->version),
+                                           MAKE_HEADER_CS("x-sdk-version-name", LINKKIT_VERSION),
+                                           MAKE_HEADER("x-sdk-platform", "c"),
+                                           MAKE_HEADER("content-length", "0"),
+                                         };
+
+    return http2_stream_header_new(static_header, sizeof(static_header) / sizeof(static_header[0]), header,
+                                   header_count);
+}
+
+static http2_header *http2_stream_send_header(http2_header_str_t *str, const char *identify, const char *channel_id,
+        uint32_t stream_len, header_ext_info_t *header, int *header_count)
+{
+    HAL_Snprintf(str->data_len, sizeof(str->data_len), "%d", stream_len);
+    HAL_Snprintf(str->path, sizeof(str->path), "/stream/send/%s", identify);
+    HAL_Snprintf(str->version, sizeof(str->version), "%d", get_version_int());
+
+    const http2_header static_header[] = { MAKE_HEADER(":method", "POST"),
+                                           MAKE_HEADER_CS(":path", str->path),
+                                           MAKE_HEADER(":scheme", "https"),
+                                           MAKE_HEADER_CS("content-length", str->data_len),
+                                           MAKE_HEADER_CS("x-data-stream-id", channel_id),
+                                           MAKE_HEADER_CS("x-sdk-version", str->version),
+                                           MAKE_HEADER_CS("x-sdk-version-name", LINKKIT_VERSION),
+                                           MAKE_HEADER("x-sdk-platform", "c"),
+                                         };
+
+    return http2_stream_header_new(static_header, sizeof(static_header) / sizeof(static_header[0]), header,
+                                   header_count);
+}
+
+static http2_header *http2_stream_close_header(http2_header_str_t *str, const char *identify, const char *channel_id,
+        int *header_count)
+{
+    HAL_Snprintf(str->path, sizeof(str->path), "/stream/close/%s", identify);
+    HAL_Snprintf(str->version, sizeof(str->version), "%d", get_version_int());
+
+    const http2_header static_header[] = { MAKE_HEADER(":method", "POST"),
+                                           MAKE_HEADER_CS(":path", str->path),
+                                           MAKE_HEADER(":scheme", "https"),
+                                           MAKE_HEADER_CS("x-data-stream-id", channel_id),
+                                           MAKE_HEADER_CS("x-sdk-version", str->version),
+                                           MAKE_HEADER_CS("x-sdk-version-name", LINKKIT_VERSION),
+                                           MAKE_HEADER("x-sdk-platform", "c"),
+                                         };
+
+    return http2_stream_header_new(static_header, sizeof(static_header) / sizeof(static_header[0]), NULL,
+                                   header_count);
+}
+
 void *IOT_HTTP2_Connect(device_conn_info_t *conn_info, http2_stream_cb_t *user_cb)
 {
     stream_handle_t *stream_handle = NULL;
@@ -469,8 +797,20 @@ void *IOT_HTTP2_Connect(device_conn_info_t *conn_info, http2_stream_cb_t *user_c
         HTTP2_STREAM_FREE(stream_handle);
         return NULL;
     }
+    stream_handle->io_wakeup = HAL_SemaphoreCreate();
+    if (stream_handle->io_wakeup == NULL) {
+        h2stream_err("semaphore create error\n");
+        HAL_MutexDestroy(stream_handle->mutex);
+        HAL_SemaphoreDestroy(stream_handle->semaphore);
+        HTTP2_STREAM_FREE(stream_handle);
+        return NULL;
+    }
 
     INIT_LIST_HEAD((list_head_t *) & (stream_handle->stream_list));
+    for (ret = 0; ret < HTTP2_STREAM_CHANNEL_BUCKETS; ret++) {
+        INIT_LIST_HEAD((list_head_t *) & (stream_handle->channel_index[ret]));
+    }
+    ret = 0;
 #ifdef FS_ENABLED
     INIT_LIST_HEAD((list_head_t *) & (stream_handle->file_list));
 #endif
@@ -484,6 +824,7 @@ void *IOT_HTTP2_Connect(device_conn_info_t *conn_info, http2_stream_cb_t *user_c
     if (conn == NULL) {
         HAL_MutexDestroy(stream_handle->mutex);
         HAL_SemaphoreDestroy(stream_handle->semaphore);
+        HAL_SemaphoreDestroy(stream_handle->io_wakeup);
         HTTP2_STREAM_FREE(stream_handle);
         return NULL;
     }
@@ -505,14 +846,10 @@ void *IOT_HTTP2_Connect(device_conn_info_t *conn_info, http2_stream_cb_t *user_c
 
 int IOT_HTTP2_Stream_Open(void *hd, stream_data_info_t *info, header_ext_info_t *header)
 {
-    char client_id[64 + 1] = {0};
-    char sign_str[256 + 1] = {0};
-    char sign[41 + 1] = {0};
-    char path[128] = {0};
     int header_count = 0;
-    int header_num;
     int rv = 0;
     http2_data h2_data;
+    http2_header_str_t header_str;
     http2_stream_node_t *node = NULL;
     stream_handle_t *handle = (stream_handle_t *)hd;
     http2_header *nva = NULL;
@@ -524,45 +861,11 @@ int IOT_HTTP2_Stream_Open(void *hd, stream_data_info_t *info, header_ext_info_t
 
     memset(&h2_data, 0, sizeof(http2_data));
 
-    HAL_Snprintf(path, sizeof(path), "/stream/open/%s", info->identify);
-
-    file_upload_gen_string(client_id, CID_STRING_ENUM, NULL, 0);
-    file_upload_gen_string(sign_str, ORI_SIGN_STR_ENUM, client_id, 0);
-    file_upload_gen_string(sign, REAL_SIGN_STR_ENUM, sign_str, 0);
-
-    char version[33] = {0};
-    HAL_Snprintf(version, sizeof(version), "%d", get_version_int());
-    const http2_header static_header[] = { MAKE_HEADER(":method", "POST"),
-                                           MAKE_HEADER_CS(":path", path),
-                                           MAKE_HEADER(":scheme", "https"),
-                                           MAKE_HEADER("x-auth-name", "devicename"),
-                                           MAKE_HEADER_CS("x-auth-param-client-id", client_id),
-                                           MAKE_HEADER("x-auth-param-signmethod", "hmacsha1"),
-                                           MAKE_HEADER_CS("x-auth-param-product-key", g_device_info.product_key),
-                                           MAKE_HEADER_CS("x-auth-param-device-name", g_device_info.device_name),
-                                           MAKE_HEADER_CS("x-auth-param-sign", sign),
-                                           MAKE_HEADER_CS("x-sdk-version", version),
-                                           MAKE_HEADER_CS("x-sdk-version-name", LINKKIT_VERSION),
-                                           MAKE_HEADER("x-sdk-platform", "c"),
-                                           MAKE_HEADER("content-length", "0"),
-                                         };
-    header_num = sizeof(static_header) / sizeof(static_header[0]);
-    if (header != NULL) {
-        header_num += header->num;
-    }
-    nva = (http2_header *)HTTP2_STREAM_MALLOC(sizeof(http2_header) * header_num);
+    nva = http2_stream_open_header(&header_str, info->identify, header, &header_count);
     if (nva == NULL) {
-        h2stream_err("nva malloc failed\n");
         return FAIL_RETURN;
     }
 
-
-    /* add external header if it's not NULL */
-    header_count = http2_nv_copy(nva, 0, (http2_header *)static_header, sizeof(static_header) / sizeof(static_header[0]));
-    if (header != NULL) {
-        header_count = http2_nv_copy(nva, header_count, (http2_header *)header->nva, header->num);
-    }
-
     h2_data.header = (http2_header *)nva;
     h2_data.header_count = header_count;
     h2_data.data = NULL;
@@ -574,6 +877,7 @@ int IOT_HTTP2_Stream_Open(void *hd, stream_data_info_t *info, header_ext_info_t
     rv = iotx_http2_client_send((void *)handle->http2_connect, &h2_data);
     http2_stream_node_insert(handle, h2_data.stream_id, info->user_data, &node);
     HAL_MutexUnlock(handle->mutex);
+    http2_io_wakeup(handle);
     HTTP2_STREAM_FREE(nva);
 
     if (rv < 0) {
@@ -613,8 +917,7 @@ int IOT_HTTP2_Stream_Send(void *hd, stream_data_info_t *info, header_ext_info_t
 {
     int rv = 0;
     http2_data h2_data;
-    char path[128] = {0};
-    char data_len_str[33] = {0};
+    http2_header_str_t header_str;
     int windows_size;
     int count = 0;
     http2_stream_node_t *node = NULL;
@@ -638,37 +941,14 @@ int IOT_HTTP2_Stream_Send(void *hd, stream_data_info_t *info, header_ext_info_t
         windows_size = iotx_http2_get_available_window_size(handle->http2_connect);
     }
 
-    HAL_Snprintf(data_len_str, sizeof(data_len_str), "%d", info->stream_len);
-    HAL_Snprintf(path, sizeof(path), "/stream/send/%s", info->identify);
     if (info->send_len == 0) { //first send,need header
-        int header_count, header_num;
-        char version[33] = {0};
-        HAL_Snprintf(version, sizeof(version), "%d", get_version_int());
-        const http2_header static_header[] = { MAKE_HEADER(":method", "POST"),
-                                               MAKE_HEADER_CS(":path", path),
-                                               MAKE_HEADER(":scheme", "https"),
-                                               MAKE_HEADER_CS("content-length", data_len_str),
-                                               MAKE_HEADER_CS("x-data-stream-id", info->channel_id),
-                                               MAKE_HEADER_CS("x-sdk-version", version),
-                                               MAKE_HEADER_CS("x-sdk-version-name", LINKKIT_VERSION),
-                                               MAKE_HEADER("x-sdk-platform", "c"),
-                                             };
-
-        header_num = sizeof(static_header) / sizeof(static_header[0]);
-        if (header != NULL) {
-            header_num += header->num;
-        }
-        nva = (http2_header *)HTTP2_STREAM_MALLOC(sizeof(http2_header) * header_num);
+        int header_count;
+
+        nva = http2_stream_send_header(&header_str, info->identify, info->channel_id, info->stream_len, header,
+                                       &header_count);
         if (nva == NULL) {
-            h2stream_err("nva malloc failed\n");
             return FAIL_RETURN;
         }
-
-        /* add external header if it's not NULL */
-        header_count = http2_nv_copy(nva, 0, (http2_header *)static_header, sizeof(static_header) / sizeof(static_header[0]));
-        if (header != NULL) {
-            header_count = http2_nv_copy(nva, header_count, (http2_header *)header->nva, header->num);
-        }
         memset(&h2_data, 0, sizeof(h2_data));
         h2_data.header = (http2_header *)nva;
         h2_data.header_count = header_count;
@@ -685,6 +965,7 @@ int IOT_HTTP2_Stream_Send(void *hd, stream_data_info_t *info, header_ext_info_t
         rv = iotx_http2_client_send((void *)handle->http2_connect, &h2_data);
         http2_stream_node_insert(handle, h2_data.stream_id, info->user_data, &node);
         HAL_MutexUnlock(handle->mutex);
+        http2_io_wakeup(handle);
         HTTP2_STREAM_FREE(nva);
 
         if (rv < 0) {
@@ -796,6 +1077,7 @@ int IOT_HTTP2_Stream_Query(void *hd, stream_data_info_t *info, header_ext_info_t
     rv = iotx_http2_client_send((void *)handle->http2_connect, &h2_data);
     http2_stream_node_insert(handle, h2_data.stream_id, info->user_data, &node);
     HAL_MutexUnlock(handle->mutex);
+    http2_io_wakeup(handle);
     HTTP2_STREAM_FREE(nva);
 
     if (rv < 0) {
@@ -824,27 +1106,21 @@ int IOT_HTTP2_Stream_Query(void *hd, stream_data_info_t *info, header_ext_info_t
 int IOT_HTTP2_Stream_Close(void *hd, stream_data_info_t *info)
 {
     int rv = 0;
+    int header_count;
     http2_data h2_data;
-    char path[128] = {0};
+    http2_header_str_t header_str;
+    http2_header *nva = NULL;
     stream_handle_t *handle = (stream_handle_t *)hd;
 
     POINTER_SANITY_CHECK(info, NULL_VALUE_ERROR);
     POINTER_SANITY_CHECK(handle, NULL_VALUE_ERROR);
     POINTER_SANITY_CHECK(info->channel_id, NULL_VALUE_ERROR);
-    char version[33] = {0};
-    HAL_Snprintf(version, sizeof(version), "%d", get_version_int());
-    HAL_Snprintf(path, sizeof(path), "/stream/close/%s", info->identify);
-    const http2_header static_header[] = { MAKE_HEADER(":method", "POST"),
-                                           MAKE_HEADER_CS(":path", path),
-                                           MAKE_HEADER(":scheme", "https"),
-                                           MAKE_HEADER_CS("x-data-stream-id", info->channel_id),
-                                           MAKE_HEADER_CS("x-sdk-version", version),
-                                           MAKE_HEADER_CS("x-sdk-version-name", LINKKIT_VERSION),
-                                           MAKE_HEADER("x-sdk-platform", "c"),
-                                         };
 
-    int header_count = sizeof(static_header) / sizeof(static_header[0]);
-    h2_data.header = (http2_header *)static_header;
+    nva = http2_stream_close_header(&header_str, info->identify, info->channel_id, &header_count);
+    if (nva == NULL) {
+        return FAIL_RETURN;
+    }
+    h2_data.header = nva;
     h2_data.header_count = header_count;
     h2_data.data = NULL;
     h2_data.len = 0;
@@ -854,31 +1130,27 @@ int IOT_HTTP2_Stream_Close(void *hd, stream_data_info_t *info)
     HAL_MutexLock(handle->mutex);
     rv = iotx_http2_client_send((void *)handle->http2_connect, &h2_data);
     HAL_MutexUnlock(handle->mutex);
+    HTTP2_STREAM_FREE(nva);
 
     if (rv < 0) {
         h2stream_warning("client send error\n");
     }
 
-    /* just delete stream node */
+    /* just delete stream nodes of this channel */
     char *stream_id = info->channel_id;
-    int len = strlen(stream_id);
-    http2_stream_node_t *node, *next;
+    http2_stream_node_t *node = NULL, *next;
     HAL_MutexLock(handle->mutex);
-    list_for_each_entry_safe(node, next, &handle->stream_list, list, http2_stream_node_t) {
-        if (info->h2_stream_id == node->stream_id) {
-            h2stream_info("stream_node found:stream_id= %d, Delete It", node->stream_id);
-            list_del((list_head_t *)&node->list);
-            HTTP2_STREAM_FREE(node->channel_id);
-            HAL_SemaphoreDestroy(node->semaphore);
-            HTTP2_STREAM_FREE(node);
-            continue;
-        }
-        if ((node->channel_id != NULL) && (stream_id != NULL) &&
-                (len == strlen(node->channel_id) && !strncmp(node->channel_id, stream_id, len))) {
-            list_del((list_head_t *)&node->list);
-            HTTP2_STREAM_FREE(node->channel_id);
-            HAL_SemaphoreDestroy(node->semaphore);
-            HTTP2_STREAM_FREE(node);
+    if (info->h2_stream_id != 0) {
+        http2_stream_node_search(handle, info->h2_stream_id, &node);
+    }
+    if (node != NULL) {
+        h2stream_info("stream_node found:stream_id= %d, Delete It", node->stream_id);
+        http2_stream_node_release(handle, node);
+    }
+    list_for_each_entry_safe(node, next, &handle->channel_index[http2_stream_channel_hash(stream_id)], channel_list,
+                             http2_stream_node_t) {
+        if (!strcmp(node->channel_id, stream_id)) {
+            http2_stream_node_release(handle, node);
         }
     }
     HTTP2_STREAM_FREE(info->channel_id);
@@ -894,6 +1166,7 @@ int IOT_HTTP2_Disconnect(void *hd)
 
     POINTER_SANITY_CHECK(handle, NULL_VALUE_ERROR);
     handle->init_state = 0;
+    http2_io_wakeup(handle);
 
     ret = HAL_SemaphoreWait(handle->semaphore, PLATFORM_WAIT_INFINITE);
     if (ret < 0) {
@@ -904,15 +1177,14 @@ int IOT_HTTP2_Disconnect(void *hd)
     http2_stream_node_t *node, *next;
     HAL_MutexLock(handle->mutex);
     list_for_each_entry_safe(node, next, &handle->stream_list, list, http2_stream_node_t) {
-        list_del((list_head_t *)&node->list);
-        HTTP2_STREAM_FREE(node->channel_id);
-        HAL_SemaphoreDestroy(node->semaphore);
-        HTTP2_STREAM_FREE(node);
+        http2_stream_node_release(handle, node);
     }
+    http2_stream_table_destroy(&handle->stream_table);
     HAL_MutexUnlock(handle->mutex);
     g_stream_handle = NULL;
     HAL_MutexDestroy(handle->mutex);
     HAL_SemaphoreDestroy(handle->semaphore);
+    HAL_SemaphoreDestroy(handle->io_wakeup);
 
     ret = iotx_http2_client_disconnect(handle->http2_connect);
     HTTP2_STREAM_FREE(handle);
@@ -920,9 +1192,22 @@ int IOT_HTTP2_Disconnect(void *hd)
 }
 
 #ifdef FS_ENABLED
-#define PACKET_LEN 16384
+typedef enum {
+    UPLOAD_STATE_QUEUED,            /* waiting for a free slot */
+    UPLOAD_STATE_OPENING,           /* stream open request sent, waiting for channel id */
+    UPLOAD_STATE_SENDING,           /* file streamed by nghttp2, waiting for response */
+    UPLOAD_STATE_DONE
+} http2_upload_state_t;
+
+/* file being uploaded, opened once and read sequentially */
+typedef struct {
+    void *fp;
+    int   size;
+    int   offset;
+} http2_file_source_t;
 
 typedef struct {
+    http2_data_source_t source;     /* body of upload request, read by nghttp2 */
     stream_handle_t *handle;
     const char *path;
     const char *identify;
@@ -930,170 +1215,300 @@ typedef struct {
     header_ext_info_t *header;
     void *data;
     http2_list_t list;
+    http2_upload_state_t state;
+    int result;
+    http2_file_source_t file;
+    unsigned int stream_id;         /* stream of current state */
+    char *channel_id;
+    iotx_time_t timer;              /* expires when no progress for IOT_HTTP2_RES_OVERTIME_MS */
 } http2_stream_file_t;
 
-static int http2_stream_get_file_size(const char *file_name)
+static int http2_file_source_open(http2_file_source_t *src, const char *file_name)
 {
-    void *fp = NULL;
-    int size = 0;
-    if ((fp = HAL_Fopen(file_name, "r")) == NULL) {
+    memset(src, 0, sizeof(http2_file_source_t));
+    if ((src->fp = HAL_Fopen(file_name, "r")) == NULL) {
         h2stream_err("The file %s can not be opened.\n", file_name);
         return -1;
     }
-    HAL_Fseek(fp, 0L, HAL_SEEK_END);
-    size = HAL_Ftell(fp);
-    HAL_Fclose(fp);
-    return size;
+    if (HAL_Fseek(src->fp, 0L, HAL_SEEK_END) != 0) {
+        goto do_exit;
+    }
+    src->size = HAL_Ftell(src->fp);
+    if (src->size < 0 || HAL_Fseek(src->fp, 0L, HAL_SEEK_SET) != 0) {
+        goto do_exit;
+    }
+    return 0;
+
+do_exit:
+    h2stream_err("The file %s can not move offset.\n", file_name);
+    HAL_Fclose(src->fp);
+    src->fp = NULL;
+    return -1;
 }
 
-static int http2_stream_get_file_data(const char *file_name, char *data, int len, int offset)
+/* read next piece of file, return length read, 0 at end of file */
+static int http2_file_source_read(http2_file_source_t *src, char *data, int len)
 {
-    void *fp = NULL;
-    int ret = 0;
-    if ((fp = HAL_Fopen(file_name, "r")) == NULL) {
-        h2stream_err("The file %s can not be opened.\n", file_name);
-        return -1;
+    int ret;
+
+    if (src->size - src->offset < len) {
+        len = src->size - src->offset;
     }
-    ret = HAL_Fseek(fp, offset, HAL_SEEK_SET);
-    if (ret != 0) {
-        HAL_Fclose(fp);
-        h2stream_err("The file %s can not move offset.\n", file_name);
-        return -1;
+    if (len <= 0) {
+        return 0;
     }
-    ret = HAL_Fread(data, len, 1, fp);
-    HAL_Fclose(fp);
-    return len;
+    ret = HAL_Fread(data, 1, len, src->fp);
+    src->offset += ret;
+    return ret;
 }
 
-static void *http_upload_one(void *user)
+static void http2_file_source_close(http2_file_source_t *src)
 {
+    if (src->fp != NULL) {
+        HAL_Fclose(src->fp);
+        src->fp = NULL;
+    }
+}
 
-    stream_data_info_t info;
+/* called by nghttp2 when flow control of the upload stream allows more DATA */
+static int http2_upload_read(http2_data_source_t *source, char *buf, int len, int *eof)
+{
+    http2_stream_file_t *file_data = list_entry(source, http2_stream_file_t, source);
     int ret;
-    if (user == NULL) {
-        return NULL;
+
+    ret = http2_file_source_read(&file_data->file, buf, len);
+    if (ret <= 0 && file_data->file.offset < file_data->file.size) {
+        h2stream_err("read file err %d\n", ret);
+        file_data->result = UPLOAD_FILE_READ_FAILED;
+        return -1;
     }
+    *eof = (file_data->file.offset == file_data->file.size);
+    utils_time_countdown_ms(&file_data->timer, IOT_HTTP2_RES_OVERTIME_MS);
+    return ret;
+}
 
-    http2_stream_file_t *user_data = (http2_stream_file_t *)user;
-    stream_handle_t *handle = (stream_handle_t *)user_data->handle;
+static void http2_upload_finish(http2_stream_file_t *file_data, int result)
+{
+    http2_data h2_data;
+    http2_header_str_t header_str;
+    http2_stream_node_t *node = NULL;
+    stream_handle_t *handle = file_data->handle;
 
-    int file_size = http2_stream_get_file_size(user_data->path);
+    if (file_data->stream_id != 0) {
+        http2_stream_node_search(handle, file_data->stream_id, &node);
+        /* nghttp2 must stop reading the file before it is closed, RST_STREAM goes out ahead of DATA */
+        if (file_data->state == UPLOAD_STATE_SENDING && (node == NULL || !node->closed)) {
+            iotx_http2_reset_stream(handle->http2_connect, file_data->stream_id);
+        }
+        http2_stream_node_remove(handle, file_data->stream_id);
+        file_data->stream_id = 0;
+    }
 
-    if (file_size <= 0) {
-        if (user_data->cb) {
-            user_data->cb(user_data->path, UPLOAD_FILE_NOT_EXIST, user_data->data);
+    /* release channel, response is not waited for */
+    if (file_data->channel_id != NULL) {
+        memset(&h2_data, 0, sizeof(http2_data));
+        h2_data.header = http2_stream_close_header(&header_str, file_data->identify, file_data->channel_id,
+                         &h2_data.header_count);
+        if (h2_data.header != NULL) {
+            h2_data.flag = 1;
+            if (iotx_http2_client_send((void *)handle->http2_connect, &h2_data) < 0) {
+                h2stream_warning("client send error\n");
+            }
+            HTTP2_STREAM_FREE(h2_data.header);
         }
-        HTTP2_STREAM_FREE(user_data);
-        return NULL;
     }
 
-    h2stream_info("file_size=%d", file_size);
+    if (file_data->result == UPLOAD_SUCCESS) {
+        file_data->result = result;
+    }
+    file_data->state = UPLOAD_STATE_DONE;
+}
 
-    char *data_buffer = HTTP2_STREAM_MALLOC(PACKET_LEN);
-    if (data_buffer == NULL) {
-        user_data->cb(user_data->path, UPLOAD_MALLOC_FAILED, user_data->data);
-        HTTP2_STREAM_FREE(user_data);
-        return NULL;
+static void http2_upload_start(http2_stream_file_t *file_data)
+{
+    int rv;
+    http2_data h2_data;
+    http2_header_str_t header_str;
+    http2_stream_node_t *node = NULL;
+    stream_handle_t *handle = file_data->handle;
+
+    if (http2_file_source_open(&file_data->file, file_data->path) < 0 || file_data->file.size <= 0) {
+        http2_upload_finish(file_data, UPLOAD_FILE_NOT_EXIST);
+        return;
     }
+    h2stream_info("file_size=%d", file_data->file.size);
 
-    memset(&info, 0, sizeof(stream_data_info_t));
-    info.stream = data_buffer;
-    info.stream_len = file_size;
-    info.packet_len = PACKET_LEN;
-    //info.identify = "com/aliyun/iotx/vision/picture/device/upstream";
-    info.identify = user_data->identify;
+    memset(&h2_data, 0, sizeof(http2_data));
+    h2_data.header = http2_stream_open_header(&header_str, file_data->identify, file_data->header,
+                     &h2_data.header_count);
+    if (h2_data.header == NULL) {
+        http2_upload_finish(file_data, UPLOAD_MALLOC_FAILED);
+        return;
+    }
+    h2_data.flag = 1;
 
-    ret = IOT_HTTP2_Stream_Open(user_data->handle, &info, user_data->header);
-    if (ret < 0) {
-        h2stream_err("IOT_HTTP2_Stream_Open failed %d\n", ret);
-        if (user_data->cb) {
-            user_data->cb(user_data->path, UPLOAD_STREAM_OPEN_FAILED, user_data->data);
-        }
-        HTTP2_STREAM_FREE(user_data);
-        HTTP2_STREAM_FREE(data_buffer);
-        return NULL;
+    rv = iotx_http2_client_send((void *)handle->http2_connect, &h2_data);
+    HTTP2_STREAM_FREE(h2_data.header);
+    if (rv < 0 || http2_stream_node_insert(handle, h2_data.stream_id, file_data->data, &node) != SUCCESS_RETURN) {
+        h2stream_err("IOT_HTTP2_Stream_Open failed %d\n", rv);
+        http2_upload_finish(file_data, UPLOAD_STREAM_OPEN_FAILED);
+        return;
     }
 
-    while (info.send_len < info.stream_len) {
+    node->stream_type = STREAM_TYPE_AUXILIARY;
+    file_data->stream_id = h2_data.stream_id;
+    file_data->state = UPLOAD_STATE_OPENING;
+    utils_time_countdown_ms(&file_data->timer, IOT_HTTP2_RES_OVERTIME_MS);
+}
 
-        if (!handle->init_state) {
-            ret = -1;
-            break;
-        }
-        ret = http2_stream_get_file_data(user_data->path, data_buffer, PACKET_LEN, info.send_len);
-        if (ret <= 0) {
-            ret = -1;
-            h2stream_err("read file err %d\n", ret);
-            break;
-        }
-        info.packet_len = ret;
+static void http2_upload_opened(http2_stream_file_t *file_data, http2_stream_node_t *node)
+{
+    int rv;
+    http2_data h2_data;
+    http2_header_str_t header_str;
+    stream_handle_t *handle = file_data->handle;
 
-        if (info.stream_len - info.send_len < info.packet_len) {
-            info.packet_len = info.stream_len - info.send_len;
-        }
+    if (memcmp(node->status_code, "200", 3) || node->channel_id == NULL) {
+        h2stream_err("stream open status code error\n");
+        http2_upload_finish(file_data, UPLOAD_STREAM_OPEN_FAILED);
+        return;
+    }
 
-        ret = IOT_HTTP2_Stream_Send(user_data->handle, &info, user_data->header);
-        if (ret < 0) {
-            h2stream_err("send err %d\n", ret);
-            break;
-        }
-        h2stream_debug("send len =%d\n", info.send_len);
+    /* take over channel id, aux stream is done */
+    file_data->channel_id = node->channel_id;
+    list_del((list_head_t *)&node->channel_list);
+    INIT_LIST_HEAD((list_head_t *)&node->channel_list);
+    node->channel_id = NULL;
+    http2_stream_node_remove(handle, file_data->stream_id);
+    file_data->stream_id = 0;
+
+    memset(&h2_data, 0, sizeof(http2_data));
+    h2_data.header = http2_stream_send_header(&header_str, file_data->identify, file_data->channel_id,
+                     file_data->file.size, file_data->header, &h2_data.header_count);
+    if (h2_data.header == NULL) {
+        http2_upload_finish(file_data, UPLOAD_MALLOC_FAILED);
+        return;
     }
 
-    if (user_data->cb) {
+    file_data->source.read = http2_upload_read;
+    rv = iotx_http2_client_send_source(handle->http2_connect, &h2_data, &file_data->source, IOT_HTTP2_UPLOAD_WEIGHT);
+    HTTP2_STREAM_FREE(h2_data.header);
+    if (h2_data.stream_id > 0) {
+        /* stream is submitted, nghttp2 may read the file from now on */
+        file_data->stream_id = h2_data.stream_id;
+        file_data->state = UPLOAD_STATE_SENDING;
+    }
+    if (rv < 0 || http2_stream_node_insert(handle, h2_data.stream_id, file_data->data, &node) != SUCCESS_RETURN) {
+        h2stream_err("send failed!");
+        http2_upload_finish(file_data, UPLOAD_STREAM_SEND_FAILED);
+        return;
+    }
 
-        if (ret < 0) {
-            ret = UPLOAD_STREAM_SEND_FAILED;
-        } else {
-            ret = UPLOAD_SUCCESS;
+    node->stream_type = STREAM_TYPE_UPLOAD;
+    utils_time_countdown_ms(&file_data->timer, IOT_HTTP2_RES_OVERTIME_MS);
+}
+
+static void http2_upload_step(http2_stream_file_t *file_data)
+{
+    http2_stream_node_t *node = NULL;
+
+    http2_stream_node_search(file_data->handle, file_data->stream_id, &node);
+    if (node == NULL) {
+        http2_upload_finish(file_data, (file_data->state == UPLOAD_STATE_OPENING) ?
+                            UPLOAD_STREAM_OPEN_FAILED : UPLOAD_STREAM_SEND_FAILED);
+        return;
+    }
+
+    if (node->rcv_hd_cnt < 2 && !node->closed) {
+        if (utils_time_is_expired(&file_data->timer)) {
+            h2stream_err("response overtime, stream_id %d\n", file_data->stream_id);
+            http2_upload_finish(file_data, (file_data->state == UPLOAD_STATE_OPENING) ?
+                                UPLOAD_STREAM_OPEN_FAILED : UPLOAD_STREAM_SEND_FAILED);
         }
-        user_data->cb(user_data->path, ret, user_data->data);
+        return;
+    }
+
+    if (file_data->state == UPLOAD_STATE_OPENING) {
+        http2_upload_opened(file_data, node);
+    } else if (memcmp(node->status_code, "200", 3) || file_data->file.offset != file_data->file.size) {
+        h2stream_err("status code error, stream_id %d\n", file_data->stream_id);
+        http2_upload_finish(file_data, UPLOAD_STREAM_SEND_FAILED);
+    } else {
+        http2_upload_finish(file_data, UPLOAD_SUCCESS);
     }
-    IOT_HTTP2_Stream_Close(user_data->handle, &info);
-    HTTP2_STREAM_FREE(data_buffer);
-    HTTP2_STREAM_FREE(user_data);
-    return NULL;
 }
 
+static void http2_upload_notify(http2_list_t *done_list)
+{
+    http2_stream_file_t *node, *next;
 
-static void *http_upload_file_func(void *user)
+    list_for_each_entry_safe(node, next, done_list, list, http2_stream_file_t) {
+        list_del((list_head_t *)&node->list);
+        http2_file_source_close(&node->file);
+        if (node->cb) {
+            node->cb(node->path, node->result, node->data);
+        }
+        HTTP2_STREAM_FREE(node->channel_id);
+        HTTP2_STREAM_FREE(node);
+    }
+}
+
+/* drive queued uploads as concurrent streams, called by io thread with handle->mutex held */
+static void http2_upload_schedule(stream_handle_t *handle, http2_list_t *done_list)
 {
-    if (user == NULL) {
-        return NULL;
+    int active = 0;
+    int max_active = IOT_HTTP2_UPLOAD_MAX_CONCURRENT;
+    int server_max = iotx_http2_get_max_concurrent_streams(handle->http2_connect);
+    http2_stream_file_t *node, *next;
+
+    if (server_max < max_active) {
+        max_active = server_max;
     }
-    stream_handle_t *handle = (stream_handle_t *)user;
-    while (handle->init_state) {
-        http2_stream_file_t *node, *next;
-        HAL_MutexLock(handle->mutex);
-        list_for_each_entry_safe(node, next, &handle->file_list, list, http2_stream_file_t) {
-            list_del((list_head_t *)&node->list);
-            HAL_MutexUnlock(handle->mutex);
-            http_upload_one((void *)node);
-            HAL_MutexLock(handle->mutex);
-            break;
+
+    list_for_each_entry_safe(node, next, &handle->file_list, list, http2_stream_file_t) {
+        if (node->state == UPLOAD_STATE_QUEUED) {
+            if (active >= max_active) {
+                continue;
+            }
+            http2_upload_start(node);
+        } else {
+            http2_upload_step(node);
         }
 
-        if (list_empty((list_head_t *)&handle->file_list)) {
-            h2stream_debug("no file left,file upload thread exit\n");
-            handle->file_thread = NULL;
-            HAL_MutexUnlock(handle->mutex);
-            break;
+        if (node->state == UPLOAD_STATE_DONE) {
+            list_del((list_head_t *)&node->list);
+            list_add_tail((list_head_t *)&node->list, (list_head_t *)done_list);
+        } else {
+            active++;
         }
-        HAL_MutexUnlock(handle->mutex);
     }
-
-    return NULL;
 }
 
+/* fail uploads in progress, or all of them, when their session is gone or going */
+/* called by io thread with handle->mutex held */
+static void http2_upload_abort(stream_handle_t *handle, http2_list_t *done_list, int all)
+{
+    http2_stream_file_t *node, *next;
+
+    list_for_each_entry_safe(node, next, &handle->file_list, list, http2_stream_file_t) {
+        if (node->state == UPLOAD_STATE_QUEUED && !all) {
+            continue;
+        }
+        if (node->stream_id != 0) {
+            http2_stream_node_remove(handle, node->stream_id);
+            node->stream_id = 0;
+        }
+        node->result = UPLOAD_STREAM_SEND_FAILED;
+        node->state = UPLOAD_STATE_DONE;
+        list_del((list_head_t *)&node->list);
+        list_add_tail((list_head_t *)&node->list, (list_head_t *)done_list);
+    }
+}
 
-//void *file_thread = NULL;
 int IOT_HTTP2_Stream_UploadFile(void *hd, const char *file_path, const char *identify,
                                 header_ext_info_t *header,
                                 upload_file_result_cb cb, void *user_data)
 {
-
-    int ret;
-    hal_os_thread_param_t thread_parms = {0};
     stream_handle_t *handle = (stream_handle_t *)hd;
 
     POINTER_SANITY_CHECK(handle, NULL_VALUE_ERROR);
@@ -1105,30 +1520,22 @@ int IOT_HTTP2_Stream_UploadFile(void *hd, const char *file_path, const char *ide
         return -1;
     }
 
+    memset(file_data, 0, sizeof(http2_stream_file_t));
     file_data->handle = handle;
     file_data->path =  file_path;
     file_data->identify = identify;
     file_data->cb = cb;
     file_data->data = user_data;
     file_data->header = header;
-
-    thread_parms.stack_size = 6144;
-    thread_parms.name = "file_upload";
+    file_data->state = UPLOAD_STATE_QUEUED;
+    file_data->result = UPLOAD_SUCCESS;
+    iotx_time_init(&file_data->timer);
 
     INIT_LIST_HEAD((list_head_t *)&file_data->list);
     HAL_MutexLock(handle->mutex);
     list_add_tail((list_head_t *)&file_data->list, (list_head_t *)&handle->file_list);
-    if (handle->file_thread == NULL) {
-        ret = HAL_ThreadCreate(&handle->file_thread, http_upload_file_func, handle, &thread_parms, NULL);
-        if (ret != 0) {
-            h2stream_err("thread create error\n");
-            HTTP2_STREAM_FREE(file_data);
-            HAL_MutexUnlock(handle->mutex);
-            return -1;
-        }
-        HAL_ThreadDetach(handle->file_thread);
-    }
     HAL_MutexUnlock(handle->mutex);
+    http2_io_wakeup(handle);
     return 0;
 }
 #endif
@@ -99,6 +99,7 @@ ERROR:
 int dm_cota_perform_sync(_OU_ char *output, _IN_ int output_len)
 {
     int res = 0, file_download = 0;
+    uint32_t persist_on_fetch = 1;
     uint64_t file_size = 0, file_downloaded = 0;
     uint32_t percent_pre = 0, percent_now = 0;
     unsigned long long report_pre = 0, report_now = 0;
@@ -130,6 +131,9 @@ int dm_cota_perform_sync(_OU_ char *output, _IN_ int output_len)
     /* Prepare Write Data To Storage */
     HAL_Firmware_Persistence_Start();
 
+    /* let OTA module hash and write each fetched buffer in one pass */
+    IOT_OTA_Ioctl(ota_handle, IOT_OTAG_PERSIST_ON_FETCH, &persist_on_fetch, 4);
+
     while (1) {
         file_download = IOT_OTA_FetchYield(ota_handle, output, output_len, 1);
         if (file_download < 0) {
@@ -139,9 +143,6 @@ int dm_cota_perform_sync(_OU_ char *output, _IN_ int output_len)
             return FAIL_RETURN;
         }
 
-        /* Write Config File Into Stroage */
-        HAL_Firmware_Persistence_Write(output, file_download);
-
         /* Get OTA information */
         IOT_OTA_Ioctl(ota_handle, IOT_OTAG_FETCHED_SIZE, &file_downloaded, 4);
         IOT_OTA_Ioctl(ota_handle, IOT_OTAG_FILE_SIZE, &file_size, 4);
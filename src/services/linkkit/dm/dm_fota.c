@@ -63,6 +63,7 @@ static int _dm_fota_send_new_config_to_user(void *ota_handle)
 int dm_fota_perform_sync(_OU_ char *output, _IN_ int output_len)
 {
     int res = 0, file_download = 0;
+    uint32_t persist_on_fetch = 1;
     uint64_t file_size = 0, file_downloaded = 0;
     uint32_t percent_pre = 0, percent_now = 0;
     unsigned long long report_pre = 0, report_now = 0;
@@ -89,24 +90,32 @@ int dm_fota_perform_sync(_OU_ char *output, _IN_ int output_len)
         return FAIL_RETURN;
     }
 
-    /* reset the size_fetched in ota_handle to be 0 */
-    IOT_OTA_Ioctl(ota_handle, IOT_OTAG_RESET_FETCHED_SIZE, ota_handle, 4);
-    /* Prepare Write Data To Storage */
-    HAL_Firmware_Persistence_Start();
+#if defined(OTA_FETCH_CHECKPOINT)
+    /* continue writing after the bytes restored from checkpoint */
+    IOT_OTA_Ioctl(ota_handle, IOT_OTAG_FETCHED_SIZE, &file_downloaded, 4);
+    if (file_downloaded > 0 && 0 == HAL_Firmware_Persistence_Resume((uint32_t)file_downloaded)) {
+        dm_log_info("Fota resume from %d bytes", (int)file_downloaded);
+    } else
+#endif
+    {
+        /* reset the size_fetched in ota_handle to be 0 */
+        IOT_OTA_Ioctl(ota_handle, IOT_OTAG_RESET_FETCHED_SIZE, ota_handle, 4);
+        /* Prepare Write Data To Storage */
+        HAL_Firmware_Persistence_Start();
+    }
+
+    /* let OTA module hash and write each fetched buffer in one pass */
+    IOT_OTA_Ioctl(ota_handle, IOT_OTAG_PERSIST_ON_FETCH, &persist_on_fetch, 4);
     while (1) {
         file_download = IOT_OTA_FetchYield(ota_handle, output, output_len, 1);
-        if (file_download < 0) {
-            IOT_OTA_ReportProgress(ota_handle, IOT_OTAP_FETCH_FAILED, NULL);
+        if (file_download == IOT_OTAE_BURN_FAILED) {
+            IOT_OTA_ReportProgress(ota_handle, IOT_OTAP_BURN_FAILED, NULL);
+            dm_log_err("Fota write firmware failed");
             HAL_Firmware_Persistence_Stop();
             ctx->is_report_new_config = 0;
             return FAIL_RETURN;
-        }
-
-        /* Write Config File Into Stroage */
-        res = HAL_Firmware_Persistence_Write(output, file_download);
-        if (res < 0) {
-            IOT_OTA_ReportProgress(ota_handle, IOT_OTAP_BURN_FAILED, NULL);
-            dm_log_err("Fota write firmware failed");
+        } else if (file_download < 0) {
+            IOT_OTA_ReportProgress(ota_handle, IOT_OTAP_FETCH_FAILED, NULL);
             HAL_Firmware_Persistence_Stop();
             ctx->is_report_new_config = 0;
             return FAIL_RETURN;
@@ -24,10 +24,15 @@ typedef enum {
 recv_cb g_recv_cb;
 
 int at_ica_mqtt_atsend(char *at_cmd, int timeout_ms);
+int at_ica_mqtt_atsend_req(char *at_cmd, const char *data, int data_len,
+                           at_mqtt_send_type_t type, int qos, int timeout_ms,
+                           unsigned int *packet_id, int *status);
 int at_ica_mqtt_client_deinit(void);
 int at_ica_mqtt_client_init(void);
 int at_ica_mqtt_client_state(void);
+int at_ica_mqtt_client_wait_state(int state, int timeout_ms);
 int at_ica_mqtt_client_publish(const char *topic, int qos, const char *message);
+int at_ica_mqtt_client_publish_raw(const char *topic, int qos, const char *payload, int len);
 int at_ica_mqtt_client_unsubscribe(const char *topic,
                                    unsigned int *mqtt_packet_id,
                                    int *mqtt_status);
@@ -98,6 +103,14 @@ int HAL_MDAL_MAL_Publish(const char *topic, int qos, const char *message)
     return -1;
 }
 
+int HAL_MDAL_MAL_PublishRaw(const char *topic, int qos, const char *payload, int len)
+{
+#ifdef MAL_ICA_ENABLED
+    return at_ica_mqtt_client_publish_raw(topic, qos, payload, len);
+#endif
+    return -1;
+}
+
 
 int HAL_MDAL_MAL_State(void)
 {
@@ -107,6 +120,14 @@ int HAL_MDAL_MAL_State(void)
     return -1;
 }
 
+int HAL_MDAL_MAL_WaitState(int state, int timeout_ms)
+{
+#ifdef MAL_ICA_ENABLED
+    return at_ica_mqtt_client_wait_state(state, timeout_ms);
+#endif
+    return -1;
+}
+
 void HAL_MDAL_MAL_RegRecvCb(recv_cb cb)
 {
     g_recv_cb = cb;    
@@ -134,218 +155,172 @@ int HAL_MDAL_MAL_Connectwifi(char *at_conn_wifi)
     return -1;
 }
 
+/* completion token of an AT command waiting for its response */
+typedef struct {
+    at_mqtt_send_type_t type;       /* AT_MQTT_IDLE when slot is free */
+    uint32_t            seq;        /* send order, responses come back in it */
+    int                 qos;
+    int                 final;      /* OK or +CME ERROR of the command received */
+    int                 urc_done;   /* +IMQTTxxx response received, commands other than simple ones have one */
+    int                 urc_result;
+    int                 done;
+    int                 result;
+    int                 packet_id;
+    int                 status;
+    void               *sem;
+} at_mqtt_req_t;
+
 static char              *g_ica_rsp_buff = NULL;
 static volatile int       g_mqtt_connect_state = 0;
-static volatile at_mqtt_send_type_t   g_ica_at_response = AT_MQTT_IDLE;
-static volatile int       g_at_response_result = 0;
-static void*              g_sem_response;
-static volatile int       g_response_msg_number = 0;
-static int                g_response_packetid = 0;
-static int                g_response_status = 0;
-static int                g_public_qos = 0;
-
-int at_ica_mqtt_atsend(char *at_cmd, int timeout_ms);
-
-static void at_err_callback(char* at_rsp)
+static void              *g_sem_state;          /* posted on every state change urc */
+static void              *g_req_mutex;          /* protects g_req_slot */
+static void              *g_send_mutex;         /* keeps g_req_slot order same as order on the wire */
+static at_mqtt_req_t      g_req_slot[AT_MQTT_MAX_PENDING];
+static uint32_t           g_req_seq = 0;
+
+/* oldest request of type still waiting for its +IMQTTxxx response, called with g_req_mutex held */
+static at_mqtt_req_t *at_req_oldest(at_mqtt_send_type_t type)
 {
-    char * temp;
-    int    data;
+    int i;
+    at_mqtt_req_t *req = NULL;
 
-    temp            = strtok(at_rsp, ":");
-    temp            = strtok(NULL, ":");
-    if((data = strtol(temp, NULL, 0)) == 3)
-    {
-         g_at_response_result = 0;
-    }
-    else
-    {
-         g_at_response_result = -1;
+    for (i = 0; i < AT_MQTT_MAX_PENDING; i++) {
+        if (g_req_slot[i].type != type || g_req_slot[i].done || g_req_slot[i].urc_done) {
+            continue;
+        }
+        if (req == NULL || (int32_t)(g_req_slot[i].seq - req->seq) < 0) {
+            req = &g_req_slot[i];
+        }
     }
-
-    // notify the sender error;
-    HAL_SemaphorePost(g_sem_response);
-
-    return;
+    return req;
 }
 
-static void at_succ_callback(void)
+/* oldest request of any type still waiting for its final result code, called with g_req_mutex held */
+static at_mqtt_req_t *at_req_oldest_unfinal(void)
 {
-    g_at_response_result = 0;
-    // notify the sender ok;
-    HAL_SemaphorePost(g_sem_response);
+    int i;
+    at_mqtt_req_t *req = NULL;
 
-    return;
+    for (i = 0; i < AT_MQTT_MAX_PENDING; i++) {
+        if (g_req_slot[i].type == AT_MQTT_IDLE || g_req_slot[i].final) {
+            continue;
+        }
+        if (req == NULL || (int32_t)(g_req_slot[i].seq - req->seq) < 0) {
+            req = &g_req_slot[i];
+        }
+    }
+    return req;
 }
 
-static void sub_callback(char *at_rsp)
+/* called with g_req_mutex held */
+static void at_req_complete(at_mqtt_req_t *req, int result)
 {
-    char  *temp;
-
-    if (strstr(at_rsp, AT_MQTT_CMD_ERROR_RSP)) {
-        g_at_response_result = -1;
+    req->result = result;
+    req->done = 1;
+    // notify the sender
+    HAL_SemaphorePost(req->sem);
+}
 
-        // notify the sender fail;
-        HAL_SemaphorePost(g_sem_response);
+/* OK answers the oldest command without final result code, others also wait for their response, called with g_req_mutex held */
+static void at_req_ok(void)
+{
+    at_mqtt_req_t *req = at_req_oldest_unfinal();
 
+    if (req == NULL) {
         return;
-    } else if (NULL != strstr(at_rsp, AT_ICA_MQTT_MQTTSUBRSP)) {
-        // get status/packet_id
-        if (NULL != strstr(at_rsp, ",")) {
-            g_at_response_result = 0;
-
-            temp            = strtok(at_rsp, ":");
-
-            if (temp != NULL) {
-                temp            = strtok(NULL, ",");
-            } else {
-                mdal_err("subscribe rsp param invalid 1");
-                g_at_response_result = -1;
-
-                HAL_SemaphorePost(g_sem_response);
-                return;
-            }
-
-            if (temp != NULL) {
-                g_response_packetid = strtol(temp, NULL, 0);
-
-                temp            = strtok(NULL, "\r\n");
-            } else {
-                mdal_err("subscribe rsp param invalid 2");
-                g_at_response_result = -1;
-
-                HAL_SemaphorePost(g_sem_response);
-                return;
-            }
-
-            if (temp != NULL) {
-                g_response_status = strtol(temp, NULL, 0);
-            } else {
-                mdal_err("subscribe rsp param invalid 3");
-                g_at_response_result = -1;
-
-                HAL_SemaphorePost(g_sem_response);
-                return;
-            }
-
-            // notify the sender ok;
-            HAL_SemaphorePost(g_sem_response);
-        }
     }
 
-    return;
+    req->final = 1;
+    if (req->type == AT_MQTT_SEND_TYPE_SIMPLE) {
+        at_req_complete(req, 0);
+    } else if (req->urc_done) {
+        at_req_complete(req, req->urc_result);
+    }
 }
 
-static void unsub_callback(char *at_rsp)
+/* +IMQTTxxx response of req, it may come before or after the final result code, called with g_req_mutex held */
+static void at_req_urc(at_mqtt_req_t *req, int result)
 {
-    char  *temp;
-    if (strstr(at_rsp, AT_MQTT_CMD_ERROR_RSP)) {
-        g_at_response_result = -1;
-
-        // notify the sender fail;
-        HAL_SemaphorePost(g_sem_response);
-
-        return;
-    } else if (NULL != strstr(at_rsp, AT_ICA_MQTT_MQTTUNSUBRSP)) {
-        // get status/packet_id
-        if (NULL != strstr(at_rsp, ",")) {
-            g_at_response_result = 0;
-
-            temp            = strtok(at_rsp, ":");
-
-            if (temp != NULL) {
-                temp            = strtok(NULL, ",");
-            } else {
-                mdal_err("subscribe rsp param invalid 1");
-
-                return;
-            }
-
-            if (temp != NULL) {
-                g_response_packetid = strtol(temp, NULL, 0);
-
-                temp            = strtok(NULL, "\r\n");
-            } else {
-                mdal_err("subscribe rsp param invalid 2");
-
-                return;
-            }
-
-            if (temp != NULL) {
-                g_response_status = strtol(temp, NULL, 0);
-            } else {
-                mdal_err("subscribe rsp param invalid 3");
-
-                return;
-            }
+    req->urc_done = 1;
+    req->urc_result = result;
+    if (req->final) {
+        at_req_complete(req, result);
+    }
+}
 
-            mdal_err("unsub: %s", g_ica_rsp_buff);
-            mdal_err("unsub packetid: %d, sta: %d", g_response_packetid, g_response_status);
+static void at_err_callback(char *at_rsp)
+{
+    char *temp;
+    int   result = -1;
+    at_mqtt_req_t *req;
 
-            // notify the sender ok;
-            HAL_SemaphorePost(g_sem_response);
-        }
+    temp            = strtok(at_rsp, ":");
+    temp            = strtok(NULL, ":");
+    if (temp != NULL && strtol(temp, NULL, 0) == 3) {
+        result = 0;
     }
 
-    return;
+    // error is the final result code of the oldest command without one, no response follows it
+    HAL_MutexLock(g_req_mutex);
+    if ((req = at_req_oldest_unfinal()) != NULL) {
+        req->final = 1;
+        at_req_complete(req, result);
+    }
+    HAL_MutexUnlock(g_req_mutex);
 }
 
-static void pub_callback(char *at_rsp)
+/* parse "+IMQTTxxx:<packet_id>[,<status>]" into oldest request of type waiting for it */
+static void at_id_rsp_callback(char *at_rsp, at_mqtt_send_type_t type)
 {
-    char  *temp;
-    if (strstr(at_rsp, AT_MQTT_CMD_ERROR_RSP)) {
-        g_at_response_result = -1;
-
-        // notify the sender fail;
-        HAL_SemaphorePost(g_sem_response);
+    char *temp;
+    int   has_status;
+    at_mqtt_req_t *req;
 
+    HAL_MutexLock(g_req_mutex);
+    if ((req = at_req_oldest(type)) == NULL) {
+        HAL_MutexUnlock(g_req_mutex);
+        mdal_err("no request waits for %s", at_rsp);
         return;
-    } else if (NULL != strstr(at_rsp, AT_ICA_MQTT_MQTTPUBRSP)) {
-        // get status/packet_id
-        if ((NULL != strstr(at_rsp, ","))
-          ||(0 == g_public_qos)) {
-
-            temp            = strtok(at_rsp, ":");
-
-            if (temp != NULL) {
-                if (0 == g_public_qos) {
-                    temp    = strtok(NULL, "\r\n");
-                } else {
-                    temp    = strtok(NULL, ",");
-                }
-            } else {
-                mdal_err("public get packetid error");
-
-                return;
-            }
-
-            if (temp != NULL) {
-                g_response_packetid = strtol(temp, NULL, 0);
-            } else {
-                mdal_err("public parse packetid error");
-
-                return;
-            }
-
-            if (0 != g_public_qos) {
-                temp            = strtok(NULL, "\r\n");
+    }
 
-                if (temp != NULL) {
-                    g_response_status = strtol(temp, NULL, 0);
-                } else {
-                    mdal_err("public parse status error");
+    if (strstr(at_rsp, AT_MQTT_CMD_ERROR_RSP)) {
+        at_req_urc(req, -1);
+        HAL_MutexUnlock(g_req_mutex);
+        return;
+    }
 
-                    return;
-                }
-            }
+    // get status/packet_id, qos 0 publish has no status
+    has_status = (type != AT_MQTT_PUB || 0 != req->qos);
+    if (has_status && NULL == strstr(at_rsp, ",")) {
+        HAL_MutexUnlock(g_req_mutex);
+        return;
+    }
 
-            g_at_response_result = 0;
+    temp = strtok(at_rsp, ":");
+    if (temp != NULL) {
+        temp = strtok(NULL, has_status ? "," : "\r\n");
+    }
+    if (temp == NULL) {
+        mdal_err("rsp packet id invalid");
+        at_req_urc(req, -1);
+        HAL_MutexUnlock(g_req_mutex);
+        return;
+    }
+    req->packet_id = strtol(temp, NULL, 0);
 
-            // notify the sender ok;
-            HAL_SemaphorePost(g_sem_response);
+    if (has_status) {
+        temp = strtok(NULL, "\r\n");
+        if (temp == NULL) {
+            mdal_err("rsp status invalid");
+            at_req_urc(req, -1);
+            HAL_MutexUnlock(g_req_mutex);
+            return;
         }
+        req->status = strtol(temp, NULL, 0);
     }
-    
-    return;
+
+    at_req_urc(req, 0);
+    HAL_MutexUnlock(g_req_mutex);
 }
 
 static void state_change_callback(char *at_rsp)
@@ -363,6 +338,7 @@ static void state_change_callback(char *at_rsp)
 
         if (temp != NULL) {
             g_mqtt_connect_state = strtol(temp, NULL, 0);
+            HAL_SemaphorePost(g_sem_state);
         }
     }
     return;
@@ -424,7 +400,7 @@ static void recv_data_callback(char *at_rsp)
 
         msg_ptr[msg_len] = '\0';
 
-        g_recv_cb(topic_ptr, msg_ptr);
+        g_recv_cb(topic_ptr, msg_ptr, msg_len);
 
         return;
     } else {
@@ -435,6 +411,86 @@ static void recv_data_callback(char *at_rsp)
 
 }
 
+/* "+IMQTTRCVPUBIN:<packet_id>,"<topic>",<len>," followed by len bytes of payload */
+/* payload may hold any byte, so it is read by length from at channel instead of up to a postfix */
+static void at_ica_mqtt_client_rcvpubin_callback(void *arg, char *rspinfo, int rsplen)
+{
+    char  c;
+    int   pos = 0;
+    int   commas = 0;
+    int   quoted = 0;
+    int   msg_len;
+    int   room;
+    char *topic_ptr;
+    char *temp;
+    char *msg;
+
+    if (NULL == g_ica_rsp_buff) {
+        mdal_err("g_ica_rsp_buff rsp is NULL");
+        return;
+    }
+
+    // read header up to the comma before payload
+    while (commas < 3) {
+        if (1 != HAL_MDAL_MAL_ICA_Read(&c, 1) || pos >= AT_MQTT_MAX_TOPIC_LEN + 32) {
+            mdal_err("rcvpubin header invalid");
+            return;
+        }
+        if ('\"' == c) {
+            quoted = !quoted;
+        } else if (',' == c && !quoted) {
+            commas++;
+        }
+        g_ica_rsp_buff[pos++] = c;
+    }
+    g_ica_rsp_buff[pos] = '\0';
+
+    topic_ptr = strchr(g_ica_rsp_buff, '\"');
+    temp = strrchr(g_ica_rsp_buff, '\"');
+    if (NULL == topic_ptr || temp == topic_ptr) {
+        mdal_err("publish topic not found");
+        return;
+    }
+    *temp = '\0';
+    topic_ptr++;
+    msg_len = strtol(temp + 2, NULL, 0);
+
+    // payload gets a buffer of its own length, header stays in g_ica_rsp_buff
+    msg = NULL;
+    if (msg_len >= 0 && msg_len <= AT_MQTT_PUBIN_MAX_LEN) {
+        msg = MDAL_ICA_MALLOC(msg_len + 1);
+    }
+    if (NULL == msg) {
+        mdal_err("rcvpubin len(%d) exceed max len or no memory", msg_len);
+        // drain payload so at channel stays in sync
+        room = AT_MQTT_RSP_MAX_LEN - pos - 1;
+        while (msg_len > 0) {
+            int n = HAL_MDAL_MAL_ICA_Read(g_ica_rsp_buff + pos, msg_len < room ? msg_len : room);
+            if (n <= 0) {
+                break;
+            }
+            msg_len -= n;
+        }
+        return;
+    }
+
+    for (pos = 0; pos < msg_len;) {
+        int n = HAL_MDAL_MAL_ICA_Read(msg + pos, msg_len - pos);
+        if (n <= 0) {
+            mdal_err("rcvpubin payload truncated");
+            MDAL_ICA_FREE(msg);
+            return;
+        }
+        pos += n;
+    }
+    msg[msg_len] = '\0';
+
+    if (g_recv_cb != NULL) {
+        g_recv_cb(topic_ptr, msg, msg_len);
+    }
+    MDAL_ICA_FREE(msg);
+}
+
 static void at_ica_mqtt_client_rsp_callback(void *arg, char *rspinfo, int rsplen)
 {
     if (NULL == rspinfo || rsplen == 0) {
@@ -469,56 +525,39 @@ static void at_ica_mqtt_client_rsp_callback(void *arg, char *rspinfo, int rsplen
                            strlen(AT_ICA_MQTT_MQTTSTATERSP))) {  // Receive Mqtt Status Change
 
         state_change_callback(g_ica_rsp_buff);
-    } else {
-        switch (g_ica_at_response) {  // nothing to process
-
-            case AT_MQTT_IDLE:
-
-                break;
-
-            case AT_MQTT_SEND_TYPE_SIMPLE:
-
-                if (0 == memcmp(g_ica_rsp_buff,
-                                AT_MQTT_CMD_SUCCESS_RSP,
-                                strlen(AT_MQTT_CMD_SUCCESS_RSP))) {
-
-                    at_succ_callback();
-                } else {
-
-                    mdal_err("invalid success type %s", g_ica_rsp_buff);
-                }
-
-                break;
-
-            case AT_MQTT_AUTH:
-
-                if (0 == memcmp(g_ica_rsp_buff,
-                                AT_ICA_MQTT_MQTTAUTHRSP,
-                                strlen(AT_ICA_MQTT_MQTTAUTHRSP))) {
-
-                    if (NULL != strstr(g_ica_rsp_buff, AT_MQTT_CMD_SUCCESS_RSP)) {
-                        at_succ_callback();
-                    }
-                }
+    } else if (0 == memcmp(g_ica_rsp_buff,
+                           AT_ICA_MQTT_MQTTAUTHRSP,
+                           strlen(AT_ICA_MQTT_MQTTAUTHRSP))) {
 
-                break;
+        at_mqtt_req_t *req;
 
-            case AT_MQTT_SUB:
-                sub_callback(g_ica_rsp_buff);
-                break;
+        HAL_MutexLock(g_req_mutex);
+        if (NULL != (req = at_req_oldest(AT_MQTT_AUTH))) {
+            at_req_urc(req, NULL != strstr(g_ica_rsp_buff, AT_MQTT_CMD_SUCCESS_RSP) ? 0 : -1);
+        }
+        HAL_MutexUnlock(g_req_mutex);
+    } else if (0 == memcmp(g_ica_rsp_buff,
+                           AT_ICA_MQTT_MQTTUNSUBRSP,
+                           strlen(AT_ICA_MQTT_MQTTUNSUBRSP))) {
 
-            case AT_MQTT_UNSUB:
-                unsub_callback(g_ica_rsp_buff);
-                break;
+        at_id_rsp_callback(g_ica_rsp_buff, AT_MQTT_UNSUB);
+    } else if (0 == memcmp(g_ica_rsp_buff,
+                           AT_ICA_MQTT_MQTTSUBRSP,
+                           strlen(AT_ICA_MQTT_MQTTSUBRSP))) {
 
-            case AT_MQTT_PUB:
-                pub_callback(g_ica_rsp_buff);
-                break;
+        at_id_rsp_callback(g_ica_rsp_buff, AT_MQTT_SUB);
+    } else if (0 == memcmp(g_ica_rsp_buff,
+                           AT_ICA_MQTT_MQTTPUBRSP,
+                           strlen(AT_ICA_MQTT_MQTTPUBRSP))) {
 
-            default:
-                break;
+        at_id_rsp_callback(g_ica_rsp_buff, AT_MQTT_PUB);
+    } else if (0 == memcmp(g_ica_rsp_buff,
+                           AT_MQTT_CMD_SUCCESS_RSP,
+                           strlen(AT_MQTT_CMD_SUCCESS_RSP))) {
 
-        }
+        HAL_MutexLock(g_req_mutex);
+        at_req_ok();
+        HAL_MutexUnlock(g_req_mutex);
     }
 
     return;
@@ -656,7 +695,7 @@ int at_ica_mqtt_client_subscribe(const char *topic,
              topic,
              qos);
 
-    if (0 != at_ica_mqtt_atsend(at_cmd, timeout_ms)) {
+    if (0 != at_ica_mqtt_atsend_req(at_cmd, NULL, 0, AT_MQTT_SUB, qos, timeout_ms, mqtt_packet_id, mqtt_status)) {
         mdal_err("sub at command fail");
 
         return -1;
@@ -685,7 +724,8 @@ int at_ica_mqtt_client_unsubscribe(const char *topic,
              AT_ICA_MQTT_MQTTUNSUB,
              topic);
 
-    if (0 != at_ica_mqtt_atsend(at_cmd, AT_MQTT_WAIT_TIMEOUT)) {
+    if (0 != at_ica_mqtt_atsend_req(at_cmd, NULL, 0, AT_MQTT_UNSUB, 0, AT_MQTT_WAIT_TIMEOUT,
+                                    mqtt_packet_id, mqtt_status)) {
 
         mdal_err("unsub at command fail");
 
@@ -726,8 +766,7 @@ int at_ica_mqtt_client_publish(const char *topic, int qos, const char *message)
              qos,
              msg_convert);
 
-    g_public_qos = qos;
-    if (0 != at_ica_mqtt_atsend(at_cmd, AT_MQTT_WAIT_TIMEOUT)) {
+    if (0 != at_ica_mqtt_atsend_req(at_cmd, NULL, 0, AT_MQTT_PUB, qos, AT_MQTT_WAIT_TIMEOUT, NULL, NULL)) {
 
         mdal_err("pub at command fail");
 
@@ -736,26 +775,100 @@ int at_ica_mqtt_client_publish(const char *topic, int qos, const char *message)
     return 0;
 }
 
+/* publish payload as is, only its length goes into the command and the bytes follow the '>' prompt */
+int at_ica_mqtt_client_publish_raw(const char *topic, int qos, const char *payload, int len)
+{
+    char    at_cmd[AT_MQTT_CMD_MAX_LEN] = {0};
+    int     ret;
+
+    if ((topic == NULL)||(payload == NULL && len > 0)||(len < 0)) {
+
+        mdal_err("publish param should not be NULL");
+
+        return -1;
+    }
+
+    ret = snprintf(at_cmd,
+                   AT_MQTT_CMD_MAX_LEN,
+                   "%s=\"%s\",%d,%d",
+                   AT_ICA_MQTT_MQTTPUBIN,
+                   topic,
+                   qos,
+                   len);
+    if (ret < 0 || ret >= AT_MQTT_CMD_MAX_LEN) {
+
+        mdal_err("pub topic too long");
+
+        return -1;
+    }
+
+    if (0 != at_ica_mqtt_atsend_req(at_cmd, payload, len, AT_MQTT_PUB, qos, AT_MQTT_WAIT_TIMEOUT, NULL, NULL)) {
+
+        mdal_err("pubin at command fail");
+
+        return -1;
+    }
+    return 0;
+}
+
 
 int at_ica_mqtt_client_state(void)
 {
     return (int)g_mqtt_connect_state;
 }
 
+static void at_ica_mqtt_client_release(void)
+{
+    int i;
+
+    for (i = 0; i < AT_MQTT_MAX_PENDING; i++) {
+        if (NULL != g_req_slot[i].sem) {
+            HAL_SemaphoreDestroy(g_req_slot[i].sem);
+        }
+    }
+    memset(g_req_slot, 0, sizeof(g_req_slot));
+
+    if (NULL != g_sem_state) {
+        HAL_SemaphoreDestroy(g_sem_state);
+        g_sem_state = NULL;
+    }
+    if (NULL != g_req_mutex) {
+        HAL_MutexDestroy(g_req_mutex);
+        g_req_mutex = NULL;
+    }
+    if (NULL != g_send_mutex) {
+        HAL_MutexDestroy(g_send_mutex);
+        g_send_mutex = NULL;
+    }
+    if (NULL != g_ica_rsp_buff) {
+        MDAL_ICA_FREE(g_ica_rsp_buff);
+        g_ica_rsp_buff = NULL;
+    }
+}
+
 int at_ica_mqtt_client_init(void)
 {
+    int i;
+
+    memset(g_req_slot, 0, sizeof(g_req_slot));
+
     g_ica_rsp_buff = MDAL_ICA_MALLOC(AT_MQTT_RSP_MAX_LEN);
     if (NULL == g_ica_rsp_buff) {
         mdal_err("at ica mqtt client malloc buff failed");
         return -1;
     }
 
-    if (NULL == (g_sem_response = HAL_SemaphoreCreate())) {
-        if (NULL != g_ica_rsp_buff) {
-            MDAL_ICA_FREE(g_ica_rsp_buff);
-
-            g_ica_rsp_buff = NULL;
+    g_sem_state = HAL_SemaphoreCreate();
+    g_req_mutex = HAL_MutexCreate();
+    g_send_mutex = HAL_MutexCreate();
+    for (i = 0; i < AT_MQTT_MAX_PENDING; i++) {
+        if (NULL == (g_req_slot[i].sem = HAL_SemaphoreCreate())) {
+            break;
         }
+    }
+
+    if (NULL == g_sem_state || NULL == g_req_mutex || NULL == g_send_mutex || i < AT_MQTT_MAX_PENDING) {
+        at_ica_mqtt_client_release();
         mdal_err("at ica mqtt client create sem failed");
 
         return -1;
@@ -765,6 +878,13 @@ int at_ica_mqtt_client_init(void)
 
     HAL_MDAL_MAL_ICA_Init();
 
+    /* ahead of AT_ICA_MQTT_MQTTRCV which is its prefix */
+    HAL_MDAL_MAL_ICA_InputCb(AT_ICA_MQTT_MQTTRCVPUBIN,
+           NULL,
+           0,
+           at_ica_mqtt_client_rcvpubin_callback,
+           NULL);
+
     HAL_MDAL_MAL_ICA_InputCb(AT_ICA_MQTT_MQTTRCV,
            AT_ICA_MQTT_POSTFIX,
            AT_MQTT_CMD_MAX_LEN,
@@ -788,59 +908,122 @@ int at_ica_mqtt_client_init(void)
 
 int at_ica_mqtt_client_deinit(void)
 {
-    if (NULL != g_ica_rsp_buff) {
-        MDAL_ICA_FREE(g_ica_rsp_buff);
-        g_ica_rsp_buff = NULL;
-    }
-
-    HAL_SemaphoreDestroy(g_sem_response);
+    at_ica_mqtt_client_release();
 
     g_mqtt_connect_state = 0;
 
     return 0;
 }
 
-int at_ica_mqtt_atsend(char *at_cmd, int timeout_ms)
+/* wait until modem reports mqtt state, woken by state change urc */
+int at_ica_mqtt_client_wait_state(int state, int timeout_ms)
 {
-    if (at_cmd == NULL) {
-        return -1;
+    iotx_time_t timer;
+
+    iotx_time_init(&timer);
+    utils_time_countdown_ms(&timer, timeout_ms);
+
+    while (g_mqtt_connect_state != state) {
+        if (utils_time_is_expired(&timer)) {
+            return -1;
+        }
+        HAL_SemaphoreWait(g_sem_state, iotx_time_left(&timer));
     }
-    // state error
-    if (g_ica_at_response != AT_MQTT_IDLE) {
 
-        mdal_err("at send state is not idle (%d)", g_ica_at_response);
+    return 0;
+}
+
+/* send at_cmd and wait for its own response, other commands may be in flight meanwhile */
+/* if data is not NULL, it is written after the '>' prompt which at_cmd leads to */
+int at_ica_mqtt_atsend_req(char *at_cmd, const char *data, int data_len,
+                           at_mqtt_send_type_t type, int qos, int timeout_ms,
+                           unsigned int *packet_id, int *status)
+{
+    int i;
+    int ret;
+    at_mqtt_req_t *req = NULL;
 
+    if (at_cmd == NULL) {
         return -1;
     }
 
     mdal_err("send: %s", at_cmd);
 
-    if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTAUTH)) {
-        g_ica_at_response = AT_MQTT_AUTH;
-    } else if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTSUB)) {
-        g_ica_at_response = AT_MQTT_SUB;
-    } else if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTUNSUB)) {
-        g_ica_at_response = AT_MQTT_UNSUB;
-    } else if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTPUB)) {
-        g_ica_at_response = AT_MQTT_PUB;
-    } else {
-        g_ica_at_response = AT_MQTT_SEND_TYPE_SIMPLE;
+    HAL_MutexLock(g_send_mutex);
+    HAL_MutexLock(g_req_mutex);
+    for (i = 0; i < AT_MQTT_MAX_PENDING; i++) {
+        if (g_req_slot[i].type == AT_MQTT_IDLE) {
+            req = &g_req_slot[i];
+            break;
+        }
     }
+    if (req == NULL) {
+        HAL_MutexUnlock(g_req_mutex);
+        HAL_MutexUnlock(g_send_mutex);
+        mdal_err("too many at commands in flight");
 
-    if (0 != HAL_MDAL_MAL_ICA_Write(at_cmd)) {
+        return -1;
+    }
+    /* drop a post left by a response which came after its sender gave up */
+    while (0 == HAL_SemaphoreWait(req->sem, 0));
+    req->type = type;
+    req->seq = g_req_seq++;
+    req->qos = qos;
+    req->final = 0;
+    req->urc_done = 0;
+    req->urc_result = -1;
+    req->done = 0;
+    req->result = -1;
+    req->packet_id = 0;
+    req->status = 0;
+    HAL_MutexUnlock(g_req_mutex);
+
+    if (data != NULL) {
+        ret = HAL_MDAL_MAL_ICA_WriteData(at_cmd, data, data_len);
+    } else {
+        ret = HAL_MDAL_MAL_ICA_Write(at_cmd);
+    }
+    HAL_MutexUnlock(g_send_mutex);
 
+    if (0 != ret) {
         mdal_err("at send raw api fail");
+    } else {
+        HAL_SemaphoreWait(req->sem, timeout_ms);
+    }
 
-        g_ica_at_response = AT_MQTT_IDLE;
-
-        return -1;
+    HAL_MutexLock(g_req_mutex);
+    ret = req->done ? req->result : -1;
+    if (0 == ret && packet_id != NULL) {
+        *packet_id = req->packet_id;
     }
-    HAL_SemaphoreWait(g_sem_response, timeout_ms);
-    g_ica_at_response = AT_MQTT_IDLE;
+    if (0 == ret && status != NULL) {
+        *status = req->status;
+    }
+    req->type = AT_MQTT_IDLE;
+    HAL_MutexUnlock(g_req_mutex);
 
-    return g_at_response_result;
+    return ret;
 }
 
+int at_ica_mqtt_atsend(char *at_cmd, int timeout_ms)
+{
+    at_mqtt_send_type_t type;
 
+    if (at_cmd == NULL) {
+        return -1;
+    }
 
+    if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTAUTH)) {
+        type = AT_MQTT_AUTH;
+    } else if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTSUB)) {
+        type = AT_MQTT_SUB;
+    } else if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTUNSUB)) {
+        type = AT_MQTT_UNSUB;
+    } else if (NULL != strstr(at_cmd, AT_ICA_MQTT_MQTTPUB)) {
+        type = AT_MQTT_PUB;
+    } else {
+        type = AT_MQTT_SEND_TYPE_SIMPLE;
+    }
 
+    return at_ica_mqtt_atsend_req(at_cmd, NULL, 0, type, 0, timeout_ms, NULL, NULL);
+}
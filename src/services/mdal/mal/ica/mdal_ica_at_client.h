@@ -49,6 +49,13 @@ extern "C"
 
 #define AT_MQTT_WAIT_TIMEOUT            10*1000
 
+#ifndef AT_MQTT_MAX_PENDING
+    #define AT_MQTT_MAX_PENDING         4       /* at commands waiting for response at the same time */
+#endif
+#ifndef AT_MQTT_PUBIN_MAX_LEN
+    #define AT_MQTT_PUBIN_MAX_LEN       4096    /* largest payload taken from +IMQTTRCVPUBIN */
+#endif
+
 #define mdal_err(...)               log_err("MAL", __VA_ARGS__)
 
 
@@ -42,3 +42,15 @@ int HAL_MDAL_MAL_ICA_Write(const char* at_cmd)
 {
     return at.send_raw_no_rsp(at_cmd);
 }
+
+int HAL_MDAL_MAL_ICA_WriteData(const char *at_cmd, const char *data, int len)
+{
+    char rsp[64] = {0};
+
+    return at.send_data_2stage(at_cmd, data, len, rsp, sizeof(rsp));
+}
+
+int HAL_MDAL_MAL_ICA_Read(char *buf, int len)
+{
+    return at.read(buf, len);
+}
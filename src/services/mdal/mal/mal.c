@@ -19,10 +19,11 @@
 #define MAL_TIMEOUT_FOREVER -1
 #define MAL_MC_PACKET_ID_MAX (65535)
 #define MAL_MC_TOPIC_NAME_MAX_LEN (128)
-#define MAL_MC_DEFAULT_BUFFER_NUM  1
-#define MAL_MC_MAX_BUFFER_NUM  14
 #define MAL_MC_MAX_TOPIC_LEN   128
-#define MAL_MC_MAX_MSG_LEN     512
+#ifndef MAL_MC_RECV_BUF_SIZE
+    #define MAL_MC_RECV_BUF_SIZE   (14 * 512)   /* bytes of receive ring, room for 14 messages of 512 bytes */
+#endif
+#define MAL_MC_RECORD_HEAD_LEN (4)      /* topic length and message length, 2 bytes each */
 
 #define MAL_MC_DEAFULT_TIMEOUT   (8000)
 #define GUIDER_SIGN_LEN             (66)
@@ -38,25 +39,28 @@
 #define mal_malloc(...)            LITE_malloc(__VA_ARGS__, MEM_MAGIC, "mal")
 #define mal_free                   LITE_free
 
+/* byte ring of received messages, each record is head + topic + message */
 typedef struct at_mqtt_msg_buff_s{
-    uint8_t  write_index;
-    uint8_t  read_index;
-    uint8_t  last_write_index;
-    uint8_t  valid_flag[MAL_MC_MAX_BUFFER_NUM];
-    uint8_t  buffer_num;
-    char*    topic[MAL_MC_MAX_BUFFER_NUM];
-    char*    msg_data[MAL_MC_MAX_BUFFER_NUM];
+    char*    buf;
+    uint32_t size;
+    uint32_t read_pos;
+    uint32_t used;
+    uint32_t high_watermark;        /* 0 disables watermark callback */
+    uint32_t low_watermark;
+    uint8_t  above_high;
+    iotx_mal_recv_watermark_fpt watermark_cb;
+    void*    watermark_ctx;
+    uint32_t dropped_full;          /* messages dropped because ring had no room */
+    uint32_t dropped_oversize;      /* messages dropped because larger than ring */
     void*    buffer_mutex;
 } at_mqtt_msg_buff_t;
 static at_mqtt_msg_buff_t    g_at_mqtt_buff_mgr;
-static char g_at_mqtt_topic[MAL_MC_DEFAULT_BUFFER_NUM][MAL_MC_TOPIC_NAME_MAX_LEN];
-static char g_at_mqtt_msg_data[MAL_MC_DEFAULT_BUFFER_NUM][MAL_MC_MAX_MSG_LEN];
 
 static int mal_mc_check_state_normal(iotx_mc_client_t *c);
 static int mal_mc_release(iotx_mc_client_t *c);
 static iotx_mc_state_t mal_mc_get_client_state(iotx_mc_client_t *pClient);
 static void mal_mc_set_client_state(iotx_mc_client_t *pClient, iotx_mc_state_t newState);
-int mal_mc_data_copy_from_buf(char *topic, char *message);
+int mal_mc_data_copy_from_buf(char **topic, char **message, int *message_len);
 
 static void *g_mqtt_client = NULL;
 
@@ -208,7 +212,8 @@ int MALMQTTPublish(iotx_mc_client_t *c, const char *topicName, iotx_mqtt_topic_i
         return FAIL_RETURN;
     }
 
-    if (0 != HAL_MDAL_MAL_Publish(topicName, topic_msg->qos, topic_msg->payload)) {
+    /* payload goes out by length, it may hold quotes or NULs and is not NUL-terminated */
+    if (0 != HAL_MDAL_MAL_PublishRaw(topicName, topic_msg->qos, topic_msg->payload, topic_msg->payload_len)) {
         mal_err("MALMQTTPublish publish failed\n");
         return FAIL_RETURN;
     }
@@ -340,7 +345,7 @@ static int mal_mc_get_next_packetid(iotx_mc_client_t *c)
 }
 
 /* handle PUBLISH packet received from remote MQTT broker */
-static int iotx_mc_handle_recv_PUBLISH(iotx_mc_client_t *c, char *topic, char *msg)
+static int iotx_mc_handle_recv_PUBLISH(iotx_mc_client_t *c, char *topic, char *msg, int msg_len)
 {
     iotx_mqtt_topic_info_t topic_msg = {0};
     int flag_matched = 0;
@@ -355,7 +360,7 @@ static int iotx_mc_handle_recv_PUBLISH(iotx_mc_client_t *c, char *topic, char *m
     char *filterStr = "{\"method\":\"thing.service.property.set\"";
     int filterLen = strlen(filterStr);
 
-    if (0 == memcmp(msg, filterStr, filterLen)) {
+    if (msg_len >= filterLen && 0 == memcmp(msg, filterStr, filterLen)) {
         //mal_debug("iotx_mc_handle_recv_PUBLISH match filterstring");
         time_curr = HAL_UptimeMs();
         if (time_curr < time_prev) {
@@ -384,7 +389,7 @@ static int iotx_mc_handle_recv_PUBLISH(iotx_mc_client_t *c, char *topic, char *m
             if (NULL != msg_handle->handle.h_fp) {
                 iotx_mqtt_event_msg_t event_msg = {0};
                 topic_msg.payload = msg;
-                topic_msg.payload_len = strlen(msg);
+                topic_msg.payload_len = msg_len;
                 topic_msg.ptopic = topic;
                 topic_msg.topic_len = strlen(topic);
                 event_msg.event_type = IOTX_MQTT_EVENT_PUBLISH_RECEIVED;
@@ -406,7 +411,7 @@ static int iotx_mc_handle_recv_PUBLISH(iotx_mc_client_t *c, char *topic, char *m
             iotx_mqtt_event_msg_t event_msg = {0};
 
             topic_msg.payload = msg;
-            topic_msg.payload_len = strlen(msg);
+            topic_msg.payload_len = msg_len;
             topic_msg.ptopic = topic;
             topic_msg.topic_len = strlen(topic);
             event_msg.event_type = IOTX_MQTT_EVENT_PUBLISH_RECEIVED;
@@ -423,8 +428,9 @@ static int iotx_mc_handle_recv_PUBLISH(iotx_mc_client_t *c, char *topic, char *m
 static int mal_mc_cycle(iotx_mc_client_t *c, iotx_time_t *timer)
 {
     int rc = SUCCESS_RETURN;
-    char msg[MAL_MC_MAX_MSG_LEN] = {0};
-    char topic[MAL_MC_MAX_MSG_LEN] = {0};
+    char *msg = NULL;
+    char *topic = NULL;
+    int msg_len = 0;
 
     if (!c) {
         return FAIL_RETURN;
@@ -446,13 +452,14 @@ static int mal_mc_cycle(iotx_mc_client_t *c, iotx_time_t *timer)
     }
 
     /* read the buf, see what work is due */
-    rc = mal_mc_data_copy_from_buf(topic, msg);
+    rc = mal_mc_data_copy_from_buf(&topic, &msg, &msg_len);
     if (rc != SUCCESS_RETURN) {
         /* mal_debug("wait data timeout"); */
         return rc;
     }
 
-    rc = iotx_mc_handle_recv_PUBLISH(c, topic, msg);
+    rc = iotx_mc_handle_recv_PUBLISH(c, topic, msg, msg_len);
+    mal_free(topic);
     if (SUCCESS_RETURN != rc) {
         mal_err("recvPublishProc error,result = %d", rc);
     }
@@ -617,31 +624,20 @@ static void mal_mc_set_client_state(iotx_mc_client_t *pClient, iotx_mc_state_t n
 }
 
 
-int mal_mc_recv_buf_init()
+int mal_mc_recv_buf_init(void)
 {
-    g_at_mqtt_buff_mgr.read_index  = 0;
-    g_at_mqtt_buff_mgr.write_index = 0;
-    g_at_mqtt_buff_mgr.last_write_index = 0;
-    g_at_mqtt_buff_mgr.buffer_num = MAL_MC_DEFAULT_BUFFER_NUM;
-
-    for (int i = 0; i < MAL_MC_MAX_BUFFER_NUM; i++) {
-        g_at_mqtt_buff_mgr.valid_flag[i] = 0;
-        if(i < MAL_MC_DEFAULT_BUFFER_NUM)
-        {
-            g_at_mqtt_buff_mgr.topic[i] = g_at_mqtt_topic[i];
-            g_at_mqtt_buff_mgr.msg_data[i] = g_at_mqtt_msg_data[i];
-        memset(g_at_mqtt_buff_mgr.topic[i], 0, MAL_MC_MAX_TOPIC_LEN);
-        memset(g_at_mqtt_buff_mgr.msg_data[i], 0, MAL_MC_MAX_MSG_LEN);
-        }
-        else
-        {
-           g_at_mqtt_buff_mgr.topic[i] = NULL;
-           g_at_mqtt_buff_mgr.msg_data[i] = NULL;
-        }
+    memset(&g_at_mqtt_buff_mgr, 0, sizeof(at_mqtt_msg_buff_t));
+
+    g_at_mqtt_buff_mgr.size = MAL_MC_RECV_BUF_SIZE;
+    if (NULL == (g_at_mqtt_buff_mgr.buf = mal_malloc(g_at_mqtt_buff_mgr.size))) {
+        mal_err("malloc receive buffer error");
+        return -1;
     }
 
     if (NULL == (g_at_mqtt_buff_mgr.buffer_mutex = HAL_MutexCreate())) {
         mal_err("create buffer mutex error");
+        mal_free(g_at_mqtt_buff_mgr.buf);
+        g_at_mqtt_buff_mgr.buf = NULL;
         return -1;
     }
 
@@ -650,61 +646,48 @@ int mal_mc_recv_buf_init()
 
 void mal_mc_recv_buf_deinit()
 {
-    g_at_mqtt_buff_mgr.read_index  = 0;
-    g_at_mqtt_buff_mgr.write_index = 0;
-    g_at_mqtt_buff_mgr.last_write_index = 0;
-
-    for (int i = 0; i < MAL_MC_MAX_BUFFER_NUM; i++) {
-        g_at_mqtt_buff_mgr.valid_flag[i] = 0;
-        if(i < MAL_MC_DEFAULT_BUFFER_NUM)
-        {
-        memset(g_at_mqtt_buff_mgr.topic[i], 0, MAL_MC_MAX_TOPIC_LEN);
-        memset(g_at_mqtt_buff_mgr.msg_data[i], 0, MAL_MC_MAX_MSG_LEN);
-        }
-        else
-        {
-           if(i < g_at_mqtt_buff_mgr.buffer_num)
-           {
-               if(g_at_mqtt_buff_mgr.topic[i] != NULL)
-               {
-                   mal_free(g_at_mqtt_buff_mgr.topic[i]);
-               }
-               if(g_at_mqtt_buff_mgr.msg_data[i] != NULL)
-               {
-                   mal_free(g_at_mqtt_buff_mgr.msg_data[i]);
-               }
-           }
-        }
+    if (g_at_mqtt_buff_mgr.buffer_mutex != NULL) {
+        HAL_MutexDestroy(g_at_mqtt_buff_mgr.buffer_mutex);
+    }
+    if (g_at_mqtt_buff_mgr.buf != NULL) {
+        mal_free(g_at_mqtt_buff_mgr.buf);
     }
+    memset(&g_at_mqtt_buff_mgr, 0, sizeof(at_mqtt_msg_buff_t));
+}
+
+/* append len bytes at end of ring, caller checks room */
+static void mal_mc_ring_write(const char *data, uint32_t len)
+{
+    uint32_t pos = (g_at_mqtt_buff_mgr.read_pos + g_at_mqtt_buff_mgr.used) % g_at_mqtt_buff_mgr.size;
+    uint32_t first = g_at_mqtt_buff_mgr.size - pos;
 
-    HAL_MutexDestroy(g_at_mqtt_buff_mgr.buffer_mutex);
+    if (first > len) {
+        first = len;
+    }
+    memcpy(g_at_mqtt_buff_mgr.buf + pos, data, first);
+    memcpy(g_at_mqtt_buff_mgr.buf, data + first, len - first);
+    g_at_mqtt_buff_mgr.used += len;
 }
 
-int mal_mc_wait_for_result()
+/* copy len bytes at offset from start of ring, nothing is consumed */
+static void mal_mc_ring_read(uint32_t offset, char *data, uint32_t len)
 {
-    iotx_time_t         time;
-    int state = 0;
-    int timeout_ms = MAL_MC_DEAFULT_TIMEOUT;
-    iotx_time_init(&time);
-    utils_time_countdown_ms(&time, timeout_ms);
-    do {
-        unsigned int left_t;
-        left_t = iotx_time_left(&time);
-        if (left_t < 100) {
-            HAL_SleepMs(left_t);
-        } else {
-            HAL_SleepMs(100);
-        }
+    uint32_t pos = (g_at_mqtt_buff_mgr.read_pos + offset) % g_at_mqtt_buff_mgr.size;
+    uint32_t first = g_at_mqtt_buff_mgr.size - pos;
 
-        state = HAL_MDAL_MAL_State();
-    }while (!utils_time_is_expired(&time) &&  (state != IOTX_MC_STATE_CONNECTED));
+    if (first > len) {
+        first = len;
+    }
+    memcpy(data, g_at_mqtt_buff_mgr.buf + pos, first);
+    memcpy(data + first, g_at_mqtt_buff_mgr.buf, len - first);
+}
 
-    if(state == IOTX_MC_STATE_CONNECTED)
-    {
+int mal_mc_wait_for_result()
+{
+    /* woken by state change report of modem instead of polling it */
+    if (0 == HAL_MDAL_MAL_WaitState(IOTX_MC_STATE_CONNECTED, MAL_MC_DEAFULT_TIMEOUT)) {
         return SUCCESS_RETURN;
-    }
-    else
-    {
+    } else {
         return FAIL_RETURN;
     }
 }
@@ -875,123 +858,123 @@ int iotx_mdal_get_auth_username_passwd(char* username, char* password)
 #endif /* MAL_ICA_ENABLED */
 }
 
-int mal_mc_data_copy_to_buf(char *topic, char *message)
+int mal_mc_data_copy_to_buf(char *topic, char *message, int message_len)
 {
-    uint8_t       write_index;
-    char         *copy_ptr;
+    uint8_t       head[MAL_MC_RECORD_HEAD_LEN];
+    uint32_t      topic_len;
+    uint32_t      record_len;
+    int           notify = 0;
+    iotx_mal_recv_watermark_fpt cb;
+    void         *ctx;
 
     if ((topic == NULL)||(message == NULL)) {
         mal_err("write buffer is NULL");
         return -1;
     }
 
-    if ((strlen(topic) >= MAL_MC_MAX_TOPIC_LEN)||
-        (strlen(message) >= MAL_MC_MAX_MSG_LEN)) {
-        mal_err("topic(%d) or message(%d) too large", strlen(topic), strlen(message));
+    topic_len = strlen(topic);
+    if ((topic_len >= MAL_MC_MAX_TOPIC_LEN)||(message_len < 0)||(message_len > 0xFFFF)) {
+        mal_err("topic(%d) or message(%d) too large", topic_len, message_len);
         return -1;
     }
+    record_len = MAL_MC_RECORD_HEAD_LEN + topic_len + message_len;
 
     HAL_MutexLock(g_at_mqtt_buff_mgr.buffer_mutex);
-    write_index     = g_at_mqtt_buff_mgr.write_index;
-
-    if ((g_at_mqtt_buff_mgr.valid_flag[write_index]) 
-         && (g_at_mqtt_buff_mgr.buffer_num == MAL_MC_MAX_BUFFER_NUM)) {
-        mal_err("buffer is full");
-
+    if (record_len > g_at_mqtt_buff_mgr.size) {
+        g_at_mqtt_buff_mgr.dropped_oversize++;
         HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
+        mal_err("message(%d) larger than buffer, drop it", message_len);
         return -1;
     }
-    if(g_at_mqtt_buff_mgr.valid_flag[write_index])
-    {
-        int last_write_index = write_index;
-        g_at_mqtt_buff_mgr.last_write_index = last_write_index;
-        write_index = g_at_mqtt_buff_mgr.buffer_num;
-        mal_err("increase buffer to %d", g_at_mqtt_buff_mgr.buffer_num);
-        g_at_mqtt_buff_mgr.topic[write_index] = mal_malloc(MAL_MC_MAX_TOPIC_LEN);
-        if(g_at_mqtt_buff_mgr.topic[write_index] == NULL)
-        {
-            mal_err("increase buffer failed, drop it");
-            return -1;
-        }
-        g_at_mqtt_buff_mgr.msg_data[write_index] = mal_malloc(MAL_MC_MAX_MSG_LEN);
-        if(g_at_mqtt_buff_mgr.msg_data[write_index] == NULL)
-        {
-            mal_err("increase buffer failed, drop it");
-            mal_free(g_at_mqtt_buff_mgr.topic[write_index]);
-            return -1;
-        }
-        g_at_mqtt_buff_mgr.buffer_num ++;
-    }
-    else
-    {
-        g_at_mqtt_buff_mgr.last_write_index = 0;
+    if (record_len > g_at_mqtt_buff_mgr.size - g_at_mqtt_buff_mgr.used) {
+        g_at_mqtt_buff_mgr.dropped_full++;
+        HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
+        mal_err("buffer is full, drop it");
+        return -1;
     }
 
-    copy_ptr = g_at_mqtt_buff_mgr.topic[write_index];
-    memcpy(copy_ptr, topic, strlen(topic));
-    copy_ptr = g_at_mqtt_buff_mgr.msg_data[write_index];
-    memcpy(copy_ptr, message, strlen(message));
-
-    g_at_mqtt_buff_mgr.valid_flag[write_index] = 1;
-    write_index++;
+    head[0] = (uint8_t)(topic_len >> 8);
+    head[1] = (uint8_t)topic_len;
+    head[2] = (uint8_t)(message_len >> 8);
+    head[3] = (uint8_t)message_len;
+    mal_mc_ring_write((char *)head, MAL_MC_RECORD_HEAD_LEN);
+    mal_mc_ring_write(topic, topic_len);
+    mal_mc_ring_write(message, message_len);
 
-    if (write_index >= g_at_mqtt_buff_mgr.buffer_num) {
-        write_index = 0;
+    if (g_at_mqtt_buff_mgr.high_watermark && !g_at_mqtt_buff_mgr.above_high &&
+        g_at_mqtt_buff_mgr.used >= g_at_mqtt_buff_mgr.high_watermark) {
+        g_at_mqtt_buff_mgr.above_high = 1;
+        notify = 1;
     }
+    cb = g_at_mqtt_buff_mgr.watermark_cb;
+    ctx = g_at_mqtt_buff_mgr.watermark_ctx;
+    HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
 
-    if(g_at_mqtt_buff_mgr.last_write_index != 0)
-    {
-        g_at_mqtt_buff_mgr.write_index = g_at_mqtt_buff_mgr.last_write_index;
+    if (notify && cb != NULL) {
+        cb(ctx, 1);
     }
-    else
-    {
-    g_at_mqtt_buff_mgr.write_index  = write_index;
-    }
-    HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
 
     return 0;
 }
 
-int mal_mc_data_copy_from_buf(char *topic, char *message)
+/* take oldest message, *topic and *message share one block which caller frees by *topic */
+int mal_mc_data_copy_from_buf(char **topic, char **message, int *message_len)
 {
-    uint8_t         read_index;
-    char           *copy_ptr;
-
-    if ((topic == NULL)||(message == NULL)) {
+    uint8_t       head[MAL_MC_RECORD_HEAD_LEN];
+    uint32_t      topic_len;
+    uint32_t      msg_len;
+    char         *block;
+    int           notify = 0;
+    iotx_mal_recv_watermark_fpt cb;
+    void         *ctx;
+
+    if ((topic == NULL)||(message == NULL)||(message_len == NULL)) {
         mal_err("read buffer is NULL");
         return -1;
     }
 
     HAL_MutexLock(g_at_mqtt_buff_mgr.buffer_mutex);
-    read_index = g_at_mqtt_buff_mgr.read_index;
-
-    if (g_at_mqtt_buff_mgr.valid_flag[read_index] == 0) {
+    if (g_at_mqtt_buff_mgr.used == 0) {
         HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
         return -1;
     }
 
-    copy_ptr = g_at_mqtt_buff_mgr.topic[read_index];
-    memcpy(topic, copy_ptr, strlen(copy_ptr));
-    copy_ptr = g_at_mqtt_buff_mgr.msg_data[read_index];
-    memcpy(message, copy_ptr, strlen(copy_ptr));
-
-    memset(g_at_mqtt_buff_mgr.topic[read_index], 0, MAL_MC_MAX_TOPIC_LEN);
-    memset(g_at_mqtt_buff_mgr.msg_data[read_index], 0, MAL_MC_MAX_MSG_LEN);
-    g_at_mqtt_buff_mgr.valid_flag[read_index] = 0;
-    read_index++;
-
-    if (read_index >= g_at_mqtt_buff_mgr.buffer_num) {
-
-        read_index = 0;
+    mal_mc_ring_read(0, (char *)head, MAL_MC_RECORD_HEAD_LEN);
+    topic_len = ((uint32_t)head[0] << 8) | head[1];
+    msg_len = ((uint32_t)head[2] << 8) | head[3];
 
+    /* NUL after topic and after message */
+    block = mal_malloc(topic_len + msg_len + 2);
+    if (block == NULL) {
+        HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
+        mal_err("malloc message error");
+        return -1;
     }
+    mal_mc_ring_read(MAL_MC_RECORD_HEAD_LEN, block, topic_len);
+    block[topic_len] = '\0';
+    mal_mc_ring_read(MAL_MC_RECORD_HEAD_LEN + topic_len, block + topic_len + 1, msg_len);
+    block[topic_len + 1 + msg_len] = '\0';
 
-    g_at_mqtt_buff_mgr.read_index = read_index;
+    g_at_mqtt_buff_mgr.read_pos = (g_at_mqtt_buff_mgr.read_pos + MAL_MC_RECORD_HEAD_LEN + topic_len + msg_len)
+                                  % g_at_mqtt_buff_mgr.size;
+    g_at_mqtt_buff_mgr.used -= MAL_MC_RECORD_HEAD_LEN + topic_len + msg_len;
 
+    if (g_at_mqtt_buff_mgr.above_high && g_at_mqtt_buff_mgr.used <= g_at_mqtt_buff_mgr.low_watermark) {
+        g_at_mqtt_buff_mgr.above_high = 0;
+        notify = 1;
+    }
+    cb = g_at_mqtt_buff_mgr.watermark_cb;
+    ctx = g_at_mqtt_buff_mgr.watermark_ctx;
     HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
 
-    return 0;
+    if (notify && cb != NULL) {
+        cb(ctx, 0);
+    }
 
+    *topic = block;
+    *message = block + topic_len + 1;
+    *message_len = msg_len;
+    return 0;
 }
 
 static struct list_head g_mqtt_sub_list = LIST_HEAD_INIT(g_mqtt_sub_list);
@@ -1032,7 +1015,10 @@ void *MAL_MQTT_Construct(iotx_mqtt_param_t *pInitParams)
         pclient->handle_event.pcontext = pInitParams->handle_event.pcontext;
     }
 
-    mal_mc_recv_buf_init();
+    if (0 != mal_mc_recv_buf_init()) {
+        mal_free(pclient);
+        return NULL;
+    }
     HAL_MDAL_MAL_RegRecvCb(mal_mc_data_copy_to_buf);
 
     mal_mc_set_client_state(pclient, IOTX_MC_STATE_INITIALIZED);
@@ -1130,6 +1116,45 @@ int MAL_MQTT_Yield(void *handle, int timeout_ms)
     return 0;
 }
 
+int MAL_MQTT_SetRecvWatermark(void *handle, uint32_t high, uint32_t low,
+                              iotx_mal_recv_watermark_fpt watermark_cb, void *pcontext)
+{
+    iotx_mc_client_t *pClient = (iotx_mc_client_t *)(handle ? handle : g_mqtt_client);
+
+    POINTER_SANITY_CHECK(pClient, NULL_VALUE_ERROR);
+    if (low > high || high > g_at_mqtt_buff_mgr.size) {
+        mal_err("Invalid argument, high = %d, low = %d", high, low);
+        return FAIL_RETURN;
+    }
+
+    HAL_MutexLock(g_at_mqtt_buff_mgr.buffer_mutex);
+    g_at_mqtt_buff_mgr.high_watermark = high;
+    g_at_mqtt_buff_mgr.low_watermark = low;
+    g_at_mqtt_buff_mgr.watermark_cb = watermark_cb;
+    g_at_mqtt_buff_mgr.watermark_ctx = pcontext;
+    HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
+
+    return SUCCESS_RETURN;
+}
+
+int MAL_MQTT_GetRecvDropped(void *handle, uint32_t *dropped_full, uint32_t *dropped_oversize)
+{
+    iotx_mc_client_t *pClient = (iotx_mc_client_t *)(handle ? handle : g_mqtt_client);
+
+    POINTER_SANITY_CHECK(pClient, NULL_VALUE_ERROR);
+
+    HAL_MutexLock(g_at_mqtt_buff_mgr.buffer_mutex);
+    if (dropped_full != NULL) {
+        *dropped_full = g_at_mqtt_buff_mgr.dropped_full;
+    }
+    if (dropped_oversize != NULL) {
+        *dropped_oversize = g_at_mqtt_buff_mgr.dropped_oversize;
+    }
+    HAL_MutexUnlock(g_at_mqtt_buff_mgr.buffer_mutex);
+
+    return SUCCESS_RETURN;
+}
+
 /* check whether MQTT connection is established or not */
 int MAL_MQTT_CheckStateNormal(void *handle)
 {
@@ -10,14 +10,17 @@ extern "C"
 {
 #endif
 
-typedef int (*recv_cb)(char* topic, char* message);
+/* message is message_len bytes, may hold any byte, a NUL is appended after them */
+typedef int (*recv_cb)(char* topic, char* message, int message_len);
 
 int HAL_MDAL_MAL_Connect(char *proKey, char *devName, char *devSecret);
 int HAL_MDAL_MAL_Disconnect(void);
 int HAL_MDAL_MAL_Subscribe(const char *topic, int qos, unsigned int *mqtt_packet_id, int *mqtt_status, int timeout_ms);
 int HAL_MDAL_MAL_Unsubscribe(const char *topic, unsigned int *mqtt_packet_id, int *mqtt_status);
 int HAL_MDAL_MAL_Publish(const char *topic, int qos, const char *message);
+int HAL_MDAL_MAL_PublishRaw(const char *topic, int qos, const char *payload, int len);
 int HAL_MDAL_MAL_State(void);
+int HAL_MDAL_MAL_WaitState(int state, int timeout_ms);
 
 void HAL_MDAL_MAL_RegRecvCb(recv_cb);
 
@@ -28,6 +31,10 @@ int HAL_MDAL_MAL_ICA_Init();
 int HAL_MDAL_MAL_ICA_InputCb(const char *prefix, const char *postfix, int maxlen,
                   mal_ica_cb cb, void *arg);
 int HAL_MDAL_MAL_ICA_Write(const char* at_cmd);
+/* send at_cmd without line ending, wait for '>' prompt of modem, then write len bytes of data */
+int HAL_MDAL_MAL_ICA_WriteData(const char *at_cmd, const char *data, int len);
+/* read len bytes from at channel, for use in a callback registered with NULL postfix, return length read */
+int HAL_MDAL_MAL_ICA_Read(char *buf, int len);
 #endif
 
 #ifdef __cplusplus
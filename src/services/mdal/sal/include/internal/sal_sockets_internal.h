@@ -59,9 +59,6 @@ extern "C" {
 /* Helpers to process several netconn_types by the same code */
 #define NETCONNTYPE_GROUP(t)         ((t)&0xF0)
 
-#define SELECT_SEM_T        sal_sem_t
-#define SELECT_SEM_PTR(sem) (&(sem))
-
 #define NUM_SOCKETS MEMP_NUM_NETCONN
 #define NUM_EVENTS  MEMP_NUM_NETCONN
 
@@ -69,8 +66,27 @@ extern "C" {
 
 #define SAL_EVENT_OFFSET (NUM_SOCKETS + SAL_SOCKET_OFFSET)
 
-#ifndef SELWAIT_T
-#define SELWAIT_T uint8_t
+/* epoll instances for sal_epoll_create, sal_select uses its own on stack */
+#ifndef SAL_EPOLL_NUM
+#define SAL_EPOLL_NUM       4
+#endif
+
+/* fds registered over all sal_epoll_create instances */
+#ifndef SAL_EPOLL_ITEM_NUM
+#define SAL_EPOLL_ITEM_NUM  ((NUM_SOCKETS + NUM_EVENTS) * 2)
+#endif
+
+#define SAL_EPOLL_OFFSET (SAL_EVENT_OFFSET + NUM_EVENTS)
+
+/* output buffers kept for the xmit task, more are malloc'ed when all in use */
+#ifndef SAL_OUTPUTBUF_NUM
+#define SAL_OUTPUTBUF_NUM       8
+#endif
+
+/* payload held in an output buffer itself, consecutive small TCP sends to
+   the same socket are merged up to this size */
+#ifndef SAL_OUTPUTBUF_DATA_SIZE
+#define SAL_OUTPUTBUF_DATA_SIZE 128
 #endif
 
 /* Flags for struct netconn.flags (u8_t) */
@@ -96,31 +112,21 @@ typedef struct sal_netbuf {
     u16_t     port;
 } sal_netbuf_t;
 
+/** A packet waiting in the send queue of the xmit task */
 typedef struct sal_outputbuf {
+    /** next packet in the send queue, of any socket */
+    struct sal_outputbuf *next;
+    /** points to data when the packet fits in it */
     void *payload;
+    int   fd;
     u16_t len;
     u16_t remote_port;
     char  remote_ip[16];
+    /** 1 when taken from the static pool */
+    u8_t  pooled;
+    u8_t  data[SAL_OUTPUTBUF_DATA_SIZE];
 } sal_outputbuf_t;
 
-/** Description for a task waiting in select */
-struct sal_select_cb {
-    /** Pointer to the next waiting task */
-    struct sal_select_cb *next;
-    /** Pointer to the previous waiting task */
-    struct sal_select_cb *prev;
-    /** readset passed to select */
-    fd_set *readset;
-    /** writeset passed to select */
-    fd_set *writeset;
-    /** unimplemented: exceptset passed to select */
-    fd_set *exceptset;
-    /** don't signal the same semaphore twice: set to 1 when signalled */
-    int sem_signalled;
-    /** semaphore to wake up a task waiting for select */
-    SELECT_SEM_T sem;
-};
-
 /** Current state of the netconn. Non-TCP netconns are always
  * in state NETCONN_NONE! */
 enum netconn_state {
@@ -171,10 +177,6 @@ typedef struct sal_netconn {
         by the neconn application thread. */
     sal_mbox_t recvmbox;
 
-#if SAL_PACKET_SEND_MODE_ASYNC
-    sal_mbox_t sendmbox;
-#endif
-
     /** flags holding more netconn-internal state, see NETCONN_FLAG_* defines */
     u8_t flags;
     /** timeout to wait for sending data (which means enqueueing data for sending
@@ -6,6 +6,7 @@
 #define _SAL_SOCKET_H_
 
 #include <stddef.h> /* for size_t */
+#include <stdint.h>
 #include <sys/time.h>
 
 #ifdef __cplusplus
@@ -193,9 +194,39 @@ typedef struct ip_mreq {
 #define SO_CONTIMEO    0x1009 /* Unimplemented: connect timeout */
 #define SO_NO_CHECK    0x100a /* don't create UDP checksum */
 
+/*
+ * Events and operations of sal_epoll_*, values match the Linux ones.
+ * Waiting is level triggered, SAL_EPOLLERR is only reported when asked for.
+ */
+#define SAL_EPOLLIN        0x001 /* data to read, or eventfd counter set */
+#define SAL_EPOLLOUT       0x004 /* room to write */
+#define SAL_EPOLLERR       0x008 /* error happened on the socket */
+
+#define SAL_EPOLL_CTL_ADD  1
+#define SAL_EPOLL_CTL_DEL  2
+#define SAL_EPOLL_CTL_MOD  3
+
+typedef union sal_epoll_data {
+    void     *ptr;
+    int       fd;
+    uint32_t  u32;
+    uint64_t  u64;
+} sal_epoll_data_t;
+
+struct sal_epoll_event {
+    uint32_t         events;
+    sal_epoll_data_t data;
+};
+
 int sal_select(int maxfdp1, fd_set *readset, fd_set *writeset,
                fd_set *exceptset, struct timeval *timeout);
 
+int sal_epoll_create(int size);
+
+int sal_epoll_ctl(int epfd, int op, int fd, struct sal_epoll_event *event);
+
+int sal_epoll_wait(int epfd, struct sal_epoll_event *events, int maxevents, int timeout);
+
 int sal_socket(int domain, int type, int protocol);
 
 int sal_write(int s, const void *data, size_t size);
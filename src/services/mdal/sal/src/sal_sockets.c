@@ -4,10 +4,6 @@
 
 #include "internal/sal_sockets_internal.h"
 
-static int  sal_selscan(int maxfdp1, fd_set *readset_in, fd_set *writeset_in,
-                        fd_set *exceptset_in, fd_set *readset_out,
-                        fd_set *writeset_out, fd_set *exceptset_out);
-
 static struct sal_sock *tryget_socket(int s);
 
 static struct sal_event *tryget_event(int s);
@@ -20,13 +16,15 @@ static int alloc_socket(sal_netconn_t *newconn, int accepted);
 
 static void free_socket(struct sal_sock *sock);
 
+struct sal_epoll_item;
+
 struct sal_event {
     uint64_t counts;
     int used;
     int reads;
     int writes;
-    /** semaphore to wake up a task waiting for select */
-    sal_sem_t *psem;
+    /** epoll registrations of this eventfd */
+    struct sal_epoll_item *epoll_items;
 };
 
 /** Contains all internal pointers and states used for a socket */
@@ -50,8 +48,43 @@ struct sal_sock {
     /** last error that occurred on this socket (in fact,
         all our errnos fit into an uint8_t) */
     uint8_t err;
-    /** counter of how many threads are waiting for this socket using select */
-    SELWAIT_T select_waiting;
+    /** epoll registrations of this socket, walked by sal_deal_event() */
+    struct sal_epoll_item *epoll_items;
+#if SAL_PACKET_SEND_MODE_ASYNC
+    /** packets of this socket in the send queue or being sent */
+    uint16_t sendqueued;
+#endif
+};
+
+/** An fd registered with an epoll instance */
+struct sal_epoll_item {
+    struct sal_epoll *ep;
+    int fd;
+    /** events asked for */
+    uint32_t events;
+    sal_epoll_data_t data;
+    /** next item registered for the same fd */
+    struct sal_epoll_item *next_watch;
+    /** next item in the ready list of ep */
+    struct sal_epoll_item *next_ready;
+    uint8_t used;
+    /** 1 when linked in the ready list of ep */
+    uint8_t ready;
+};
+
+/** An epoll instance, its ready list is filled as events come in so that
+    waiting never scans all the registered fds */
+struct sal_epoll {
+    uint8_t used;
+    /** a task is blocked on sem in sal_epoll_wait */
+    uint8_t waiting;
+    /** fail the wait when a registered fd gets closed, set by sal_select */
+    uint8_t notify_close;
+    /** a registered fd got closed */
+    uint8_t fd_closed;
+    struct sal_epoll_item *ready_head;
+    struct sal_epoll_item *ready_tail;
+    sal_sem_t sem;
 };
 
 /** A struct sockaddr replacement that has the same alignment as sockaddr_in/
@@ -80,11 +113,21 @@ union sockaddr_aligned {
 static struct sal_sock sockets[NUM_SOCKETS];
 /** The global array of available events */
 static struct sal_event events[NUM_EVENTS];
-/** The global list of tasks waiting for select */
-static struct sal_select_cb *select_cb_list;
-/** This counter is increased from sal_select when the list is changed
-    and checked in event_callback to see if it has changed. */
-static volatile int select_cb_ctr;
+/** The global array of available epoll instances */
+static struct sal_epoll epolls[SAL_EPOLL_NUM];
+/** The global array of registrations for epoll instances */
+static struct sal_epoll_item epoll_items[SAL_EPOLL_ITEM_NUM];
+
+#if SAL_PACKET_SEND_MODE_ASYNC
+/** Output buffers not in use */
+static sal_outputbuf_t *sal_outputbuf_free;
+static sal_outputbuf_t sal_outputbufs[SAL_OUTPUTBUF_NUM];
+/** The send queue shared by all sockets, drained by the xmit task */
+static sal_outputbuf_t *sal_output_head;
+static sal_outputbuf_t *sal_output_tail;
+/** signaled when the send queue gets its first packet */
+static sal_sem_t sal_output_sem;
+#endif
 
 /* From http://www.iana.org/assignments/port-numbers:
    "The Dynamic and/or Private Ports are those from 49152 through 65535" */
@@ -328,7 +371,7 @@ int sal_eventfd(unsigned int initval, int flags)
             events[i].counts = 0;
             events[i].reads = 0;
             events[i].writes = 0;
-            events[i].psem = NULL;
+            events[i].epoll_items = NULL;
             SAL_ARCH_UNPROTECT(lev);
             return i + SAL_EVENT_OFFSET;
         }
@@ -427,6 +470,143 @@ static int salpcb_new(sal_netconn_t *conn)
     return ERR_OK;
 }
 
+#if SAL_PACKET_SEND_MODE_ASYNC
+static void sal_outputbuf_release(sal_outputbuf_t *buf)
+{
+    SAL_ARCH_DECL_PROTECT(lev);
+
+    if (buf->payload != buf->data) {
+        sal_free(buf->payload);
+    }
+    if (!buf->pooled) {
+        sal_free(buf);
+        return;
+    }
+
+    SAL_ARCH_PROTECT(lev);
+    buf->next = sal_outputbuf_free;
+    sal_outputbuf_free = buf;
+    SAL_ARCH_UNPROTECT(lev);
+}
+
+/**
+ * Queue a packet of socket s for the xmit task. A small TCP packet is merged
+ * into the packet at the queue tail when that one is for the same socket and
+ * has room, so bursts of small writes take one buffer and one HAL_SAL_Send.
+ */
+static err_t sal_output_post(struct sal_sock *sock, int s, const void *data, size_t size)
+{
+    sal_outputbuf_t *buf;
+    sal_outputbuf_t *tail;
+    int was_empty;
+
+    SAL_ARCH_DECL_PROTECT(lev);
+
+    SAL_ARCH_PROTECT(lev);
+    tail = sal_output_tail;
+    if (NETCONNTYPE_GROUP(sock->conn->type) == NETCONN_TCP &&
+        tail != NULL && tail->fd == s && tail->payload == tail->data &&
+        tail->len + size <= SAL_OUTPUTBUF_DATA_SIZE) {
+        memcpy(tail->data + tail->len, data, size);
+        tail->len += size;
+        SAL_ARCH_UNPROTECT(lev);
+        return ERR_OK;
+    }
+
+    if (sock->sendevent == 0) {
+        /* already SAL_DEFAULT_OUTPUTMBOX_SIZE packets queued for s */
+        SAL_ARCH_UNPROTECT(lev);
+        return ERR_WOULDBLOCK;
+    }
+    /* take the slot now, nothing gets ready by that so no one to notify */
+    sock->sendevent--;
+
+    buf = sal_outputbuf_free;
+    if (buf != NULL) {
+        sal_outputbuf_free = buf->next;
+    }
+    SAL_ARCH_UNPROTECT(lev);
+
+    if (buf != NULL) {
+        buf->pooled = 1;
+    } else {
+        buf = (sal_outputbuf_t *)sal_malloc(sizeof(sal_outputbuf_t));
+        if (NULL == buf) {
+            SAL_ERROR("memory is not enough, malloc size %d fail\n", sizeof(sal_outputbuf_t));
+            sal_deal_event(s, NETCONN_EVT_SENDPLUS);
+            return ERR_MEM;
+        }
+        buf->pooled = 0;
+    }
+
+    if (size <= SAL_OUTPUTBUF_DATA_SIZE) {
+        buf->payload = buf->data;
+    } else {
+        buf->payload = sal_malloc(size);
+        if (NULL == buf->payload) {
+            SAL_ERROR("memory is no enough, malloc size %d fail\n", size);
+            buf->payload = buf->data;
+            sal_outputbuf_release(buf);
+            sal_deal_event(s, NETCONN_EVT_SENDPLUS);
+            return ERR_MEM;
+        }
+    }
+    memcpy(buf->payload, data, size);
+    buf->len = size;
+    buf->fd = s;
+    buf->next = NULL;
+
+    SAL_ARCH_PROTECT(lev);
+    was_empty = (sal_output_head == NULL);
+    if (was_empty) {
+        sal_output_head = buf;
+    } else {
+        sal_output_tail->next = buf;
+    }
+    sal_output_tail = buf;
+    sock->sendqueued++;
+    SAL_ARCH_UNPROTECT(lev);
+
+    /* the xmit task takes the whole queue on each wake up */
+    if (was_empty) {
+        sal_sem_signal(&sal_output_sem);
+    }
+
+    return ERR_OK;
+}
+
+/* drop what is still queued for socket s */
+static void sal_output_drop(int s)
+{
+    sal_outputbuf_t **pbuf;
+    sal_outputbuf_t *buf;
+    sal_outputbuf_t *dropped = NULL;
+
+    SAL_ARCH_DECL_PROTECT(lev);
+
+    SAL_ARCH_PROTECT(lev);
+    pbuf = &sal_output_head;
+    sal_output_tail = NULL;
+    while ((buf = *pbuf) != NULL) {
+        if (buf->fd == s) {
+            *pbuf = buf->next;
+            buf->next = dropped;
+            dropped = buf;
+        } else {
+            sal_output_tail = buf;
+            pbuf = &buf->next;
+        }
+    }
+    SAL_ARCH_UNPROTECT(lev);
+
+    while (dropped != NULL) {
+        buf = dropped;
+        dropped = buf->next;
+        sal_outputbuf_release(buf);
+    }
+}
+#endif
+
 static void salnetconn_drain(sal_netconn_t *conn)
 {
     sal_netbuf_t *mem;
@@ -447,27 +627,7 @@ static void salnetconn_drain(sal_netconn_t *conn)
     }
 
 #if SAL_PACKET_SEND_MODE_ASYNC
-    if (sal_mbox_valid(&conn->sendmbox)) {
-        int s;
-        struct sal_sock *sock;
-
-        s = conn->socket;
-        sock = get_socket(s);
-
-        if (sock->sendevent > 0) {
-            while (sal_mbox_tryfetch(&conn->sendmbox, (void **)(&mem)) != SAL_MBOX_EMPTY) {
-                if (mem != NULL) {
-                    if (mem->payload) {
-                        sal_free(mem->payload);
-                        mem->payload = NULL;
-                    }
-                    sal_free(mem);
-                }
-            }
-            sal_mbox_free(&conn->sendmbox);
-            sal_mbox_set_invalid(&conn->sendmbox);
-        }
-    }
+    sal_output_drop(conn->socket);
 #endif
 
     return;
@@ -491,12 +651,6 @@ static sal_netconn_t *salnetconn_new(enum netconn_type t)
         SAL_ERROR("fai to new conn input mail box, size is %d \n", SAL_DEFAULT_INPUTMBOX_SIZE);
         goto err;
     }
-#if SAL_PACKET_SEND_MODE_ASYNC
-    if (sal_mbox_new(&conn->sendmbox, SAL_DEFAULT_OUTPUTMBOX_SIZE) != ERR_OK) {
-        SAL_ERROR("fai to new conn input mail box, size is %d \n", SAL_DEFAULT_INPUTMBOX_SIZE);
-        goto err;
-    }
-#endif
 
     err = salpcb_new(conn);
     if (ERR_OK != err) {
@@ -510,12 +664,6 @@ err:
         sal_mbox_free(&conn->recvmbox);
     }
 
-#if SAL_PACKET_SEND_MODE_ASYNC
-    if (sal_mbox_valid(&conn->sendmbox)) {
-        sal_mbox_free(&conn->sendmbox);
-    }
-#endif
-
     sal_free(conn);
 
     return NULL;
@@ -715,272 +863,569 @@ static err_t salnetconn_recv_data(sal_netconn_t *conn, sal_netbuf_t **new_buf)
 
 }
 
-int sal_select(int maxfdp1, fd_set *readset, fd_set *writeset,
-               fd_set *exceptset, struct timeval *timeout)
+static struct sal_epoll *tryget_epoll(int s)
 {
-    uint32_t waitres = 0;
-    int nready;
-    fd_set lreadset, lwriteset, lexceptset;
-    uint32_t msectimeout;
-    struct sal_select_cb select_cb;
-    int i;
-    int maxfdp2;
+    s -= SAL_EPOLL_OFFSET;
+    if ((s < 0) || (s >= SAL_EPOLL_NUM)) {
+        return NULL;
+    }
+    if (!epolls[s].used) {
+        return NULL;
+    }
+    return &epolls[s];
+}
 
-    SAL_ARCH_DECL_PROTECT(lev);
+/* head of the registrations of a socket or eventfd, call with SAL_ARCH protected */
+static struct sal_epoll_item **sal_epoll_watchers(int s)
+{
+    struct sal_sock *sock = tryget_socket(s);
+    struct sal_event *event;
 
-    SAL_DEBUG("sal_select(%d, %p, %p, %p, tvsec=%d tvusec=%d)",
-              maxfdp1, (void *)readset,
-              (void *) writeset, (void *) exceptset,
-              timeout ? (int32_t)timeout->tv_sec : (int32_t) - 1,
-              timeout ? (int32_t)timeout->tv_usec : (int32_t) - 1);
+    if (sock != NULL) {
+        return &sock->epoll_items;
+    }
+    event = tryget_event(s);
+    if (event != NULL) {
+        return &event->epoll_items;
+    }
+    return NULL;
+}
 
-    /* Go through each socket in each list to count number of sockets which
-       currently match */
-    nready = sal_selscan(maxfdp1, readset, writeset, exceptset,
-                         &lreadset, &lwriteset, &lexceptset);
-
-    /* If we don't have any current events, then suspend
-       if we are supposed to */
-    if (!nready) {
-        if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0) {
-            SAL_DEBUG("sal_select: no timeout, returning 0");
-            /* This is OK as the local fdsets are empty and nready is zero,
-               or we would have returned earlier. */
-            goto return_copy_fdsets;
-        }
+/* current readiness of a socket or eventfd, call with SAL_ARCH protected */
+static uint32_t sal_fd_ready_events(int s)
+{
+    struct sal_sock *sock = tryget_socket(s);
+    struct sal_event *event;
+    uint32_t revents = 0;
 
-        /* None ready: add our semaphore to list:
-           We don't actually need any dynamic memory. Our entry on the
-           list is only valid while we are in this function, so it's ok
-           to use local variables. */
-
-        select_cb.next = NULL;
-        select_cb.prev = NULL;
-        select_cb.readset = readset;
-        select_cb.writeset = writeset;
-        select_cb.exceptset = exceptset;
-        select_cb.sem_signalled = 0;
-
-       if (sal_sem_new(&select_cb.sem, 0) != ERR_OK) {
-            /* failed to create semaphore */
-            set_errno(ENOMEM);
-            return -1;
+    if (sock != NULL) {
+        if ((sock->lastdata != NULL) || (sock->rcvevent > 0)) {
+            revents |= SAL_EPOLLIN;
+        }
+        if (sock->sendevent != 0) {
+            revents |= SAL_EPOLLOUT;
         }
+        if (sock->errevent != 0) {
+            revents |= SAL_EPOLLERR;
+        }
+    } else {
+        event = tryget_event(s);
+        if (event != NULL) {
+            if (event->reads > 0) {
+                revents |= SAL_EPOLLIN;
+            }
+            if (event->writes != 0) {
+                revents |= SAL_EPOLLOUT;
+            }
+        }
+    }
+    return revents;
+}
 
-        /* Protect the select_cb_list */
-        SAL_ARCH_PROTECT(lev);
+/* wake up the task waiting on ep, call with SAL_ARCH protected */
+static void sal_epoll_wake(struct sal_epoll *ep)
+{
+    if (ep->waiting) {
+        ep->waiting = 0;
+        /* Don't call SAL_ARCH_UNPROTECT() before signaling the semaphore,
+           the waiter may return and free it right after. */
+        sal_sem_signal(&ep->sem);
+    }
+}
+
+/* put item on the ready list of its epoll, call with SAL_ARCH protected */
+static void sal_epoll_item_ready(struct sal_epoll_item *item)
+{
+    struct sal_epoll *ep = item->ep;
 
-        /* Put this select_cb on top of list */
-        select_cb.next = select_cb_list;
-        if (select_cb_list != NULL) {
-            select_cb_list->prev = &select_cb;
+    if (!item->ready) {
+        item->ready = 1;
+        item->next_ready = NULL;
+        if (ep->ready_tail != NULL) {
+            ep->ready_tail->next_ready = item;
+        } else {
+            ep->ready_head = item;
         }
-        select_cb_list = &select_cb;
-        /* Increasing this counter tells event_callback
-           that the list has changed. */
-        select_cb_ctr++;
+        ep->ready_tail = item;
+    }
+    sal_epoll_wake(ep);
+}
 
-        /* Now we can safely unprotect */
-        SAL_ARCH_UNPROTECT(lev);
+/* take item off the ready list of its epoll, call with SAL_ARCH protected */
+static void sal_epoll_item_unready(struct sal_epoll_item *item)
+{
+    struct sal_epoll *ep = item->ep;
+    struct sal_epoll_item *prev = NULL;
+    struct sal_epoll_item *cur;
 
-        /* Increase select_waiting for each socket we are interested in */
-        maxfdp2 = maxfdp1;
-        for (i = SAL_SOCKET_OFFSET; i < maxfdp1; i++) {
-            if ((readset && FD_ISSET(i, readset)) ||
-                (writeset && FD_ISSET(i, writeset)) ||
-                (exceptset && FD_ISSET(i, exceptset))) {
-                struct sal_sock *sock;
-                struct sal_event *event;
-                SAL_ARCH_PROTECT(lev);
-                sock = tryget_socket(i);
-                event = tryget_event(i);
-                if (sock != NULL) {
-                    sock->select_waiting++;
-                    SAL_ASSERT("sock->select_waiting > 0",
-                               sock->select_waiting > 0);
-                } else if (event != NULL) {
-                    event->psem = SELECT_SEM_PTR(select_cb.sem);
-                } else {
-                    /* Not a valid socket */
-                    nready = -1;
-                    maxfdp2 = i;
-                    SAL_ARCH_UNPROTECT(lev);
-                    break;
-                }
-                SAL_ARCH_UNPROTECT(lev);
+    if (!item->ready) {
+        return;
+    }
+    for (cur = ep->ready_head; cur != NULL; prev = cur, cur = cur->next_ready) {
+        if (cur == item) {
+            if (prev != NULL) {
+                prev->next_ready = item->next_ready;
+            } else {
+                ep->ready_head = item->next_ready;
+            }
+            if (ep->ready_tail == item) {
+                ep->ready_tail = prev;
             }
+            break;
         }
+    }
+    item->ready = 0;
+    item->next_ready = NULL;
+}
 
-        if (nready >= 0) {
-            /* Call sal_selscan again: there could have been events between
-               the last scan (without us on the list) and putting us on the list! */
-            nready = sal_selscan(maxfdp1, readset, writeset, exceptset,
-                                 &lreadset, &lwriteset, &lexceptset);
-            if (!nready) {
-                /* Still none ready, just wait to be woken */
-                if (timeout == 0) {
-                    /* Wait forever */
-                    msectimeout = 0;
-                } else {
-                    msectimeout =  ((timeout->tv_sec * 1000) + \
-                                    ((timeout->tv_usec + 500) / 1000));
-                    if (msectimeout == 0) {
-                        /* Wait 1ms at least (0 means wait forever) */
-                        msectimeout = 1;
-                    }
-                }
+/* events of an fd changed, queue the registrations now ready; call with SAL_ARCH protected */
+static void sal_epoll_notify(struct sal_epoll_item *watchers, uint32_t revents)
+{
+    struct sal_epoll_item *item;
 
-                waitres = sal_arch_sem_wait(SELECT_SEM_PTR(select_cb.sem),
-                                            msectimeout);
-            }
+    for (item = watchers; item != NULL; item = item->next_watch) {
+        if (item->events & revents) {
+            sal_epoll_item_ready(item);
         }
+    }
+}
 
-        /* Decrease select_waiting for each socket we are interested in */
-        for (i = SAL_SOCKET_OFFSET; i < maxfdp2; i++) {
-            if ((readset && FD_ISSET(i, readset)) ||
-                (writeset && FD_ISSET(i, writeset)) ||
-                (exceptset && FD_ISSET(i, exceptset))) {
-                struct sal_sock *sock;
-                struct sal_event *event;
-                SAL_ARCH_PROTECT(lev);
-                sock = tryget_socket(i);
-                event = tryget_event(i);
-                if (sock != NULL) {
-                    /* @todo: what if this is a new socket (reallocated?)
-                       in this case, select_waiting-- would be wrong
-                       (a global 'sockalloc' counter, stored per socket
-                       could help) */
-                    SAL_ASSERT("sock->select_waiting > 0",
-                               sock->select_waiting > 0);
-                    if (sock->select_waiting > 0) {
-                        sock->select_waiting--;
-                    }
-                } else if (event != NULL) {
-                    event->psem = NULL;
-                } else {
-                    /* Not a valid socket */
-                    nready = -1;
-                }
-                SAL_ARCH_UNPROTECT(lev);
-            }
+/* register fd to ep with item, call with SAL_ARCH protected */
+static void sal_epoll_item_attach(struct sal_epoll *ep, struct sal_epoll_item *item,
+                                  struct sal_epoll_item **watchers, int fd,
+                                  const struct sal_epoll_event *event)
+{
+    item->ep = ep;
+    item->fd = fd;
+    item->events = event->events;
+    item->data = event->data;
+    item->ready = 0;
+    item->next_ready = NULL;
+    item->used = 1;
+    item->next_watch = *watchers;
+    *watchers = item;
+
+    /* events that came before registering are not missed */
+    if (sal_fd_ready_events(fd) & item->events) {
+        sal_epoll_item_ready(item);
+    }
+}
+
+/* unregister item from its fd and epoll, call with SAL_ARCH protected */
+static void sal_epoll_item_detach(struct sal_epoll_item *item)
+{
+    struct sal_epoll_item **watchers = sal_epoll_watchers(item->fd);
+
+    while (watchers != NULL && *watchers != NULL) {
+        if (*watchers == item) {
+            *watchers = item->next_watch;
+            break;
         }
-        /* Take us off the list */
-        SAL_ARCH_PROTECT(lev);
-        if (select_cb.next != NULL) {
-            select_cb.next->prev = select_cb.prev;
+        watchers = &(*watchers)->next_watch;
+    }
+    sal_epoll_item_unready(item);
+    item->next_watch = NULL;
+    item->used = 0;
+}
+
+/* fd is being closed, drop all its registrations; call with SAL_ARCH protected */
+static void sal_epoll_fd_closed(struct sal_epoll_item **watchers)
+{
+    struct sal_epoll_item *item;
+
+    while ((item = *watchers) != NULL) {
+        *watchers = item->next_watch;
+        sal_epoll_item_unready(item);
+        item->next_watch = NULL;
+        item->used = 0;
+        if (item->ep->notify_close) {
+            item->ep->fd_closed = 1;
+            sal_epoll_wake(item->ep);
         }
-        if (select_cb_list == &select_cb) {
-            SAL_ASSERT("select_cb.prev == NULL", select_cb.prev == NULL);
-            select_cb_list = select_cb.next;
+    }
+}
+
+static struct sal_epoll_item *sal_epoll_find(struct sal_epoll *ep, struct sal_epoll_item *watchers)
+{
+    struct sal_epoll_item *item;
+
+    for (item = watchers; item != NULL; item = item->next_watch) {
+        if (item->ep == ep) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Report ready items of ep into events, level triggered: an item stays on the
+ * ready list as long as its fd is ready, and leaves it on the first look that
+ * finds it is not. Call with SAL_ARCH protected.
+ */
+static int sal_epoll_collect(struct sal_epoll *ep, struct sal_epoll_event *events, int maxevents)
+{
+    struct sal_epoll_item *item = ep->ready_head;
+    struct sal_epoll_item *prev = NULL;
+    struct sal_epoll_item *next;
+    uint32_t revents;
+    int nready = 0;
+
+    while (item != NULL && nready < maxevents) {
+        next = item->next_ready;
+        revents = sal_fd_ready_events(item->fd) & item->events;
+        if (revents == 0) {
+            if (prev != NULL) {
+                prev->next_ready = next;
+            } else {
+                ep->ready_head = next;
+            }
+            if (ep->ready_tail == item) {
+                ep->ready_tail = prev;
+            }
+            item->ready = 0;
+            item->next_ready = NULL;
         } else {
-            SAL_ASSERT("select_cb.prev != NULL", select_cb.prev != NULL);
-            select_cb.prev->next = select_cb.next;
+            events[nready].events = revents;
+            events[nready].data = item->data;
+            nready++;
+            prev = item;
         }
-        /* Increasing this counter tells event_callback
-           that the list has changed. */
-        select_cb_ctr++;
-        SAL_ARCH_UNPROTECT(lev);
+        item = next;
+    }
+
+    /* events got full, move the reported ones behind the others for fairness */
+    if (item != NULL && prev != NULL) {
+        ep->ready_tail->next_ready = ep->ready_head;
+        ep->ready_head = item;
+        prev->next_ready = NULL;
+        ep->ready_tail = prev;
+    }
+
+    return nready;
+}
+
+/* timeout_ms < 0 waits forever, 0 returns at once */
+static int sal_epoll_wait_ep(struct sal_epoll *ep, struct sal_epoll_event *events,
+                             int maxevents, int timeout_ms)
+{
+    uint32_t begin_ms = sal_now();
+    uint32_t elapsed_ms;
+    uint32_t wait_ms = 0;
+    int nready;
 
-        sal_sem_free(&select_cb.sem);
+    SAL_ARCH_DECL_PROTECT(lev);
 
-        if (nready < 0) {
-            /* This happens when a socket got closed while waiting */
+    while (1) {
+        SAL_ARCH_PROTECT(lev);
+        if (ep->fd_closed) {
+            SAL_ARCH_UNPROTECT(lev);
             set_errno(EBADF);
             return -1;
         }
+        nready = sal_epoll_collect(ep, events, maxevents);
+        if (nready > 0 || timeout_ms == 0) {
+            SAL_ARCH_UNPROTECT(lev);
+            return nready;
+        }
+        if (timeout_ms > 0) {
+            elapsed_ms = sal_now() - begin_ms;
+            if (elapsed_ms >= (uint32_t)timeout_ms) {
+                SAL_ARCH_UNPROTECT(lev);
+                return 0;
+            }
+            wait_ms = (uint32_t)timeout_ms - elapsed_ms;
+        }
+        ep->waiting = 1;
+        SAL_ARCH_UNPROTECT(lev);
+
+        /* a wake up may be stale or already consumed, the ready list is
+           looked at again anyway */
+        if (sal_arch_sem_wait(&ep->sem, wait_ms) == SAL_ARCH_TIMEOUT) {
+            SAL_ARCH_PROTECT(lev);
+            ep->waiting = 0;
+            SAL_ARCH_UNPROTECT(lev);
+        }
+    }
+}
+
+int sal_epoll_create(int size)
+{
+    int i;
+    SAL_ARCH_DECL_PROTECT(lev);
 
-        if (waitres == SAL_ARCH_TIMEOUT) {
-            /* Timeout */
-            SAL_DEBUG("sal_select: timeout expired");
-            /* This is OK as the local fdsets are empty and nready is zero,
-               or we would have returned earlier. */
-            goto return_copy_fdsets;
+    if (size <= 0) {
+        set_errno(EINVAL);
+        return -1;
+    }
+
+    for (i = 0; i < SAL_EPOLL_NUM; ++i) {
+        SAL_ARCH_PROTECT(lev);
+        if (!epolls[i].used) {
+            epolls[i].used = 1;
+            SAL_ARCH_UNPROTECT(lev);
+            epolls[i].waiting = 0;
+            epolls[i].notify_close = 0;
+            epolls[i].fd_closed = 0;
+            epolls[i].ready_head = NULL;
+            epolls[i].ready_tail = NULL;
+            if (sal_sem_new(&epolls[i].sem, 0) != ERR_OK) {
+                SAL_ARCH_SET(epolls[i].used, 0);
+                set_errno(ENOMEM);
+                return -1;
+            }
+            return i + SAL_EPOLL_OFFSET;
         }
+        SAL_ARCH_UNPROTECT(lev);
+    }
 
-        /* See what's set */
-        nready = sal_selscan(maxfdp1, readset, writeset, exceptset,
-                             &lreadset, &lwriteset, &lexceptset);
+    set_errno(EMFILE);
+    return -1;
+}
+
+static int sal_epoll_close(int epfd)
+{
+    struct sal_epoll *ep = tryget_epoll(epfd);
+    int i;
+    SAL_ARCH_DECL_PROTECT(lev);
+
+    if (ep == NULL) {
+        set_errno(EBADF);
+        return -1;
     }
 
-    SAL_DEBUG("sal_select: nready=%d", nready);
-return_copy_fdsets:
-    set_errno(0);
-    if (readset) {
-        *readset = lreadset;
+    SAL_ARCH_PROTECT(lev);
+    for (i = 0; i < SAL_EPOLL_ITEM_NUM; ++i) {
+        if (epoll_items[i].used && epoll_items[i].ep == ep) {
+            sal_epoll_item_detach(&epoll_items[i]);
+        }
     }
-    if (writeset) {
-        *writeset = lwriteset;
+    SAL_ARCH_UNPROTECT(lev);
+
+    sal_sem_free(&ep->sem);
+    SAL_ARCH_SET(ep->used, 0);
+    return 0;
+}
+
+int sal_epoll_ctl(int epfd, int op, int fd, struct sal_epoll_event *event)
+{
+    struct sal_epoll *ep;
+    struct sal_epoll_item **watchers;
+    struct sal_epoll_item *item;
+    int i, err = 0;
+    SAL_ARCH_DECL_PROTECT(lev);
+
+    if (op != SAL_EPOLL_CTL_DEL && event == NULL) {
+        set_errno(EINVAL);
+        return -1;
     }
-    if (exceptset) {
-        *exceptset = lexceptset;
+
+    SAL_ARCH_PROTECT(lev);
+    ep = tryget_epoll(epfd);
+    watchers = sal_epoll_watchers(fd);
+    if (ep == NULL || watchers == NULL) {
+        err = EBADF;
+        goto do_exit;
+    }
+    item = sal_epoll_find(ep, *watchers);
+
+    switch (op) {
+        case SAL_EPOLL_CTL_ADD:
+            if (item != NULL) {
+                err = EEXIST;
+                break;
+            }
+            for (i = 0; i < SAL_EPOLL_ITEM_NUM; ++i) {
+                if (!epoll_items[i].used) {
+                    item = &epoll_items[i];
+                    break;
+                }
+            }
+            if (item == NULL) {
+                err = ENOMEM;
+                break;
+            }
+            sal_epoll_item_attach(ep, item, watchers, fd, event);
+            break;
+        case SAL_EPOLL_CTL_MOD:
+            if (item == NULL) {
+                err = ENOENT;
+                break;
+            }
+            item->events = event->events;
+            item->data = event->data;
+            /* a stale ready entry is dropped by the next wait */
+            if (sal_fd_ready_events(fd) & item->events) {
+                sal_epoll_item_ready(item);
+            }
+            break;
+        case SAL_EPOLL_CTL_DEL:
+            if (item == NULL) {
+                err = ENOENT;
+                break;
+            }
+            sal_epoll_item_detach(item);
+            break;
+        default:
+            err = EINVAL;
+            break;
     }
-    return nready;
+
+do_exit:
+    SAL_ARCH_UNPROTECT(lev);
+    if (err != 0) {
+        set_errno(err);
+        return -1;
+    }
+    return 0;
 }
 
-//把有事件的标出来
-static int sal_selscan(int maxfdp1, fd_set *readset_in, fd_set *writeset_in,
-                       fd_set *exceptset_in, fd_set *readset_out,
-                       fd_set *writeset_out, fd_set *exceptset_out)
+int sal_epoll_wait(int epfd, struct sal_epoll_event *events, int maxevents, int timeout)
 {
-    int i, nready = 0;
+    struct sal_epoll *ep = tryget_epoll(epfd);
+
+    if (ep == NULL) {
+        set_errno(EBADF);
+        return -1;
+    }
+    if (events == NULL || maxevents <= 0) {
+        set_errno(EINVAL);
+        return -1;
+    }
+
+    return sal_epoll_wait_ep(ep, events, maxevents, timeout);
+}
+
+/**
+ * select on top of an epoll instance living on the stack: the fds in the sets
+ * are registered once, then the wait only looks at what sal_deal_event()
+ * queued as ready instead of rescanning every fd after each wake up.
+ */
+int sal_select(int maxfdp1, fd_set *readset, fd_set *writeset,
+               fd_set *exceptset, struct timeval *timeout)
+{
+    struct sal_epoll ep;
+    struct sal_epoll_item items[NUM_SOCKETS + NUM_EVENTS];
+    struct sal_epoll_event revents[NUM_SOCKETS + NUM_EVENTS];
+    struct sal_epoll_event event;
+    struct sal_epoll_item **watchers;
     fd_set lreadset, lwriteset, lexceptset;
-    struct sal_sock *sock;
-    struct sal_event *event;
+    int msectimeout;
+    int nitems = 0;
+    int nready = 0;
+    int n = 0;
+    int i;
+
     SAL_ARCH_DECL_PROTECT(lev);
 
-    FD_ZERO(&lreadset);
-    FD_ZERO(&lwriteset);
-    FD_ZERO(&lexceptset);
+    SAL_DEBUG("sal_select(%d, %p, %p, %p, tvsec=%d tvusec=%d)",
+              maxfdp1, (void *)readset,
+              (void *) writeset, (void *) exceptset,
+              timeout ? (int32_t)timeout->tv_sec : (int32_t) - 1,
+              timeout ? (int32_t)timeout->tv_usec : (int32_t) - 1);
+
+    if (timeout == NULL) {
+        /* Wait forever */
+        msectimeout = -1;
+    } else {
+        msectimeout = ((timeout->tv_sec * 1000) + \
+                       ((timeout->tv_usec + 500) / 1000));
+        if (msectimeout == 0 && (timeout->tv_sec != 0 || timeout->tv_usec != 0)) {
+            /* Wait 1ms at least (0 means poll) */
+            msectimeout = 1;
+        }
+    }
+
+    memset(&ep, 0, sizeof(ep));
+    ep.used = 1;
+    ep.notify_close = 1;
+    if (msectimeout != 0 && sal_sem_new(&ep.sem, 0) != ERR_OK) {
+        /* failed to create semaphore */
+        set_errno(ENOMEM);
+        return -1;
+    }
 
-    /* Go through each socket in each list to count number of sockets which
-       currently match */
     for (i = SAL_SOCKET_OFFSET; i < maxfdp1; i++) {
-        /* if this FD is not in the set, continue */
-        if (!(readset_in && FD_ISSET(i, readset_in)) &&
-            !(writeset_in && FD_ISSET(i, writeset_in)) &&
-            !(exceptset_in && FD_ISSET(i, exceptset_in))) {
+        event.events = 0;
+        if (readset && FD_ISSET(i, readset)) {
+            event.events |= SAL_EPOLLIN;
+        }
+        if (writeset && FD_ISSET(i, writeset)) {
+            event.events |= SAL_EPOLLOUT;
+        }
+        if (exceptset && FD_ISSET(i, exceptset)) {
+            event.events |= SAL_EPOLLERR;
+        }
+        if (event.events == 0) {
             continue;
         }
-        /* First get the socket's status (protected)... */
+        event.data.fd = i;
+
         SAL_ARCH_PROTECT(lev);
-        sock = tryget_socket(i);
-        event = tryget_event(i);
-        if (sock != NULL || event != NULL) {
-            void *lastdata = sock ? sock->lastdata : NULL;
-            int16_t rcvevent = sock ? sock->rcvevent : event->reads;
-            uint16_t sendevent = sock ? sock->sendevent : event->writes;
-            uint16_t errevent = sock ? sock->errevent : 0;
+        watchers = sal_epoll_watchers(i);
+        if (watchers == NULL) {
+            /* Not a valid socket */
             SAL_ARCH_UNPROTECT(lev);
-            /* See if netconn of this socket is ready for read */
-            if (readset_in && FD_ISSET(i, readset_in) && \
-                ((lastdata != NULL) || (rcvevent > 0))) {
-                FD_SET(i, &lreadset);
-                SAL_DEBUG("sal_selscan: fd=%d ready for reading", i);
-                nready++;
-            }
-            /* See if netconn of this socket is ready for write */
-            if (writeset_in && FD_ISSET(i, writeset_in) && (sendevent != 0)) {
-                FD_SET(i, &lwriteset);
-                SAL_DEBUG("sal_selscan: fd=%d ready for writing", i);
-                nready++;
-            }
-            /* See if netconn of this socket had an error */
-            if (exceptset_in && FD_ISSET(i, exceptset_in) && (errevent != 0)) {
-                FD_SET(i, &lexceptset);
-                SAL_DEBUG("sal_selscan: fd=%d ready for exception", i);
-                nready++;
-            }
-        } else {
-            SAL_ARCH_UNPROTECT(lev);
-            /* continue on to next FD in list */
+            nready = -1;
+            break;
+        }
+        sal_epoll_item_attach(&ep, &items[nitems++], watchers, i, &event);
+        SAL_ARCH_UNPROTECT(lev);
+    }
+
+    if (nready == 0) {
+        n = sal_epoll_wait_ep(&ep, revents, nitems, msectimeout);
+    }
+
+    /* Take us off the sockets which are still open */
+    for (i = 0; i < nitems; i++) {
+        SAL_ARCH_PROTECT(lev);
+        if (items[i].used) {
+            sal_epoll_item_detach(&items[i]);
+        }
+        SAL_ARCH_UNPROTECT(lev);
+    }
+    if (msectimeout != 0) {
+        sal_sem_free(&ep.sem);
+    }
+
+    if (nready < 0 || n < 0) {
+        /* This happens when a socket got closed while waiting */
+        set_errno(EBADF);
+        return -1;
+    }
+
+    FD_ZERO(&lreadset);
+    FD_ZERO(&lwriteset);
+    FD_ZERO(&lexceptset);
+    for (i = 0; i < n; i++) {
+        if (revents[i].events & SAL_EPOLLIN) {
+            FD_SET(revents[i].data.fd, &lreadset);
+            SAL_DEBUG("sal_select: fd=%d ready for reading", revents[i].data.fd);
+            nready++;
+        }
+        if (revents[i].events & SAL_EPOLLOUT) {
+            FD_SET(revents[i].data.fd, &lwriteset);
+            SAL_DEBUG("sal_select: fd=%d ready for writing", revents[i].data.fd);
+            nready++;
+        }
+        if (revents[i].events & SAL_EPOLLERR) {
+            FD_SET(revents[i].data.fd, &lexceptset);
+            SAL_DEBUG("sal_select: fd=%d ready for exception", revents[i].data.fd);
+            nready++;
         }
     }
-    /* copy local sets to the ones provided as arguments */
-    *readset_out = lreadset;
-    *writeset_out = lwriteset;
-    *exceptset_out = lexceptset;
 
-    SAL_ASSERT("nready >= 0", nready >= 0);
+    SAL_DEBUG("sal_select: nready=%d", nready);
+    set_errno(0);
+    if (readset) {
+        *readset = lreadset;
+    }
+    if (writeset) {
+        *writeset = lwriteset;
+    }
+    if (exceptset) {
+        *exceptset = lexceptset;
+    }
     return nready;
 }
 
@@ -1112,9 +1557,6 @@ int sal_sendto(int s, const void *data, size_t size, int flags,
                const struct sockaddr *to, socklen_t tolen)
 {
     struct sal_sock *pstsalsock = NULL;
-#if SAL_PACKET_SEND_MODE_ASYNC
-    sal_outputbuf_t *buf = NULL;
-#endif
 #if SAL_UDP_CLIENT_ENABLED
     err_t           err = ERR_OK;
     ip_addr_t       remote_addr;
@@ -1171,30 +1613,10 @@ int sal_sendto(int s, const void *data, size_t size, int flags,
 #endif
 
 #if SAL_PACKET_SEND_MODE_ASYNC
-    buf = (sal_outputbuf_t *)sal_malloc(sizeof(sal_outputbuf_t));
-    if (NULL == buf) {
-        SAL_ERROR("memory is not enough, malloc size %d fail\n", sizeof(sal_outputbuf_t));
-        return -1;
-    }
-
-    memset(buf, 0, sizeof(sal_outputbuf_t));
-    buf->payload = sal_malloc(size);
-    if (NULL == buf->payload) {
-        sal_free(buf);
-        SAL_ERROR("memory is no enough, malloc size %d fail\n", size);
-        return -1;
-    }
-    buf->len = size;
-    memcpy(buf->payload, data, size);
-
-    if (sal_mbox_trypost(&pstsalsock->conn->sendmbox, buf) != ERR_OK) {
-        sal_free(buf->payload);
-        sal_free(buf);
+    if (sal_output_post(pstsalsock, s, data, size) != ERR_OK) {
         sock_set_errno(pstsalsock, EAGAIN);
         SAL_ERROR("%s try post output packet fail \n", __FUNCTION__);
         //return -1;
-    } else {
-        sal_deal_event(s, NETCONN_EVT_SENDMINUS);
     }
 #else
     sal_deal_event(s, NETCONN_EVT_SENDMINUS);
@@ -1229,9 +1651,7 @@ int sal_write(int s, const void *data, size_t size)
         event->counts += *(uint64_t *)data;
         if (event->counts) {
             event->reads = event->counts;
-            if (event->psem) {
-                sal_sem_signal(event->psem);
-            }
+            sal_epoll_notify(event->epoll_items, sal_fd_ready_events(s));
         }
         SAL_ARCH_UNPROTECT(lev);
         return size;
@@ -1314,8 +1734,6 @@ int sal_packet_input(int s, void *data, size_t len, char remote_ip[16], uint16_t
 
 void sal_deal_event(int s, enum netconn_evt evt)
 {
-    struct sal_select_cb *scb;
-    int last_select_cb_ctr;
     struct sal_sock *sock = tryget_socket(s);
     if (!sock) {
         return;
@@ -1344,60 +1762,9 @@ void sal_deal_event(int s, enum netconn_evt evt)
             break;
     }
 
-    if (sock->select_waiting == 0) {
-        /* noone is waiting for this socket, no need to check select_cb_list */
-        SAL_ARCH_UNPROTECT(lev);
-        return;
-    }
-
-    /* Now decide if anyone is waiting for this socket */
-    /* NOTE: This code goes through the select_cb_list list multiple times
-       ONLY IF a select was actually waiting. We go through the list the number
-       of waiting select calls + 1. This list is expected to be small. */
-
-    /* At this point, SAL_ARCH is still protected! */
-again:
-    for (scb = select_cb_list; scb != NULL; scb = scb->next) {
-        /* remember the state of select_cb_list to detect changes */
-        last_select_cb_ctr = select_cb_ctr;
-        if (scb->sem_signalled == 0) {
-            /* semaphore not signalled yet */
-            int do_signal = 0;
-            /* Test this select call for our socket */
-            if (sock->rcvevent > 0) {
-                if (scb->readset && FD_ISSET(s, scb->readset)) {
-                    do_signal = 1;
-                }
-            }
-            if (sock->sendevent != 0) {
-                if (!do_signal && scb->writeset && \
-                    FD_ISSET(s, scb->writeset)) {
-                    do_signal = 1;
-                }
-            }
-            if (sock->errevent != 0) {
-                if (!do_signal && scb->exceptset && \
-                    FD_ISSET(s, scb->exceptset)) {
-                    do_signal = 1;
-                }
-            }
-            if (do_signal) {
-                scb->sem_signalled = 1;
-                /* Don't call SAL_ARCH_UNPROTECT() before signaling the
-                   semaphore, as this might lead to the select thread taking
-                   itself off the list, invalidating the semaphore. */
-                sal_sem_signal(SELECT_SEM_PTR(scb->sem));
-            }
-        }
-        /* unlock interrupts with each step */
-        SAL_ARCH_UNPROTECT(lev);
-        /* this makes sure interrupt protection time is short */
-        SAL_ARCH_PROTECT(lev);
-        if (last_select_cb_ctr != select_cb_ctr) {
-            /* someone has changed select_cb_list, restart at the beginning */
-            goto again;
-        }
-    }
+    /* Only the epoll instances registered for this socket are looked at,
+       SAL_ARCH is still protected so none of them can go away meanwhile */
+    sal_epoll_notify(sock->epoll_items, sal_fd_ready_events(s));
     SAL_ARCH_UNPROTECT(lev);
 
 }
@@ -1433,7 +1800,10 @@ static int alloc_socket(sal_netconn_t *newconn, int accepted)
                                      NETCONN_TCP ? (accepted != 0) : 1);
             sockets[i].errevent   = 0;
             sockets[i].err        = 0;
-            sockets[i].select_waiting = 0;
+            sockets[i].epoll_items = NULL;
+#if SAL_PACKET_SEND_MODE_ASYNC
+            sockets[i].sendqueued = 0;
+#endif
             return i + SAL_SOCKET_OFFSET;
         }
         SAL_ARCH_UNPROTECT(lev);
@@ -1484,38 +1854,42 @@ int sal_socket(int domain, int type, int protocol)
 }
 
 #if SAL_PACKET_SEND_MODE_ASYNC
-#define SAL_ASYNC_TASK_SLEEP_TIME_PER_SOCKET   5
 static void *sal_packet_output(void *arg)
 {
-    int fd = 0;
     sal_outputbuf_t *outputmem = NULL;
+    sal_outputbuf_t *next = NULL;
     struct sal_sock *pstsalsock = NULL;
+    int fd;
+
+    SAL_ARCH_DECL_PROTECT(lev);
 
     while (1) {
-        for (fd = 0; fd < MEMP_NUM_NETCONN; fd++) {
-            pstsalsock = get_socket(fd);
-            if (NULL == pstsalsock || NULL == pstsalsock->conn || !sal_mbox_valid(&pstsalsock->conn->sendmbox)) {
-                sal_msleep(SAL_ASYNC_TASK_SLEEP_TIME_PER_SOCKET);
-                continue;
-            }
+        /* sleep until sal_output_post() queues to an empty queue */
+        sal_arch_sem_wait(&sal_output_sem, 0);
 
-            /* TODO : here need to do some protection to against conn_drain */
-            if (sal_arch_mbox_fetch(&pstsalsock->conn->sendmbox, (void **)&outputmem,
-                                    SAL_ASYNC_TASK_SLEEP_TIME_PER_SOCKET) != SAL_ARCH_TIMEOUT) {
-                if (outputmem == NULL) {
-                    continue;
-                }
+        SAL_ARCH_PROTECT(lev);
+        outputmem = sal_output_head;
+        sal_output_head = NULL;
+        sal_output_tail = NULL;
+        SAL_ARCH_UNPROTECT(lev);
 
-                sal_deal_event(fd, NETCONN_EVT_SENDPLUS);
-                /* HAL_SAL_Send need timeout to support send timeout */
-                if (HAL_SAL_Send(fd, outputmem->payload, outputmem->len, NULL, -1, 0)) {
-                    SAL_ERROR("socket %d fail to send packet, do nothing for now \r\n", fd);
-                }
+        for (; outputmem != NULL; outputmem = next) {
+            next = outputmem->next;
+            fd = outputmem->fd;
 
-                sal_free(outputmem->payload);
-                sal_free(outputmem);
-                outputmem = NULL;
+            sal_deal_event(fd, NETCONN_EVT_SENDPLUS);
+            /* HAL_SAL_Send need timeout to support send timeout */
+            if (HAL_SAL_Send(fd, outputmem->payload, outputmem->len, NULL, -1, 0)) {
+                SAL_ERROR("socket %d fail to send packet, do nothing for now \r\n", fd);
             }
+            sal_outputbuf_release(outputmem);
+
+            SAL_ARCH_PROTECT(lev);
+            pstsalsock = tryget_socket(fd);
+            if (pstsalsock != NULL && pstsalsock->sendqueued > 0) {
+                pstsalsock->sendqueued--;
+            }
+            SAL_ARCH_UNPROTECT(lev);
         }
     }
 
@@ -1529,6 +1903,7 @@ int sal_init(void)
     static int sal_init_done = 0;
 #if SAL_PACKET_SEND_MODE_ASYNC
     sal_task_t  task;
+    int         i;
 #endif
 
     if (sal_init_done) {
@@ -1545,9 +1920,22 @@ int sal_init(void)
     }
 
 #if SAL_PACKET_SEND_MODE_ASYNC
+    for (i = 0; i < SAL_OUTPUTBUF_NUM; i++) {
+        sal_outputbufs[i].next = sal_outputbuf_free;
+        sal_outputbuf_free = &sal_outputbufs[i];
+    }
+
+    if (sal_sem_new(&sal_output_sem, 0) != ERR_OK) {
+        sal_mutex_arch_free();
+        sal_mutex_free(&lock_sal_core);
+        SAL_ERROR("fail to creat sal xmit sem \r\n");
+        return -1;
+    }
+
     if (sal_task_new_ext(&task, "sal_xmit", sal_packet_output, NULL, 2048, 3)) {
         sal_mutex_arch_free();
         sal_mutex_free(&lock_sal_core);
+        sal_sem_free(&sal_output_sem);
         SAL_ERROR("fail to creat sal xmit task \r\n");
         return -1;
     }
@@ -1692,12 +2080,20 @@ int sal_close(int s)
     int wait_send_timeout = 0;
 #endif
     err_t err;
+    SAL_ARCH_DECL_PROTECT(lev);
 
     SAL_DEBUG("sal_close(%d)\r\n", s);
 
+    if (tryget_epoll(s) != NULL) {
+        return sal_epoll_close(s);
+    }
+
     event = tryget_event(s);
     if (event) {
+        SAL_ARCH_PROTECT(lev);
+        sal_epoll_fd_closed(&event->epoll_items);
         event->used = 0;
+        SAL_ARCH_UNPROTECT(lev);
         return 0;
     }
 
@@ -1710,15 +2106,14 @@ int sal_close(int s)
     }
 
 #if SAL_PACKET_SEND_MODE_ASYNC
-    if (sal_mbox_valid(&sock->conn->sendmbox)) {
-        while (wait_send_timeout < SAL_DRAIN_SENDMBOX_WAIT_TIME) {
-            if (sock->sendevent == 0) {
-                break;
-            }
-
-            sal_msleep(10);
-            wait_send_timeout++;
+    /* let the xmit task send what is queued for this socket */
+    while (wait_send_timeout < SAL_DRAIN_SENDMBOX_WAIT_TIME) {
+        if (sock->sendqueued == 0) {
+            break;
         }
+
+        sal_msleep(10);
+        wait_send_timeout++;
     }
 #endif
 
@@ -1739,6 +2134,10 @@ int sal_close(int s)
         return -1;
     }
 
+    SAL_ARCH_PROTECT(lev);
+    sal_epoll_fd_closed(&sock->epoll_items);
+    SAL_ARCH_UNPROTECT(lev);
+
     free_socket(sock);
     set_errno(0);
     return 0;
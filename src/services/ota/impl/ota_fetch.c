@@ -6,11 +6,16 @@
 
 /* ofc, OTA fetch channel */
 
+#define OFC_HEADER_ACCEPT   "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+#define OFC_HEADER_LEN      (sizeof(OFC_HEADER_ACCEPT) + 48)
+
 typedef struct {
 
     const char *url;
     httpclient_t http;              /* http client */
     httpclient_data_t http_data;    /* http client data */
+    uint32_t offset;                /* offset of the first byte requested by current connection */
+    char header[OFC_HEADER_LEN];    /* http request-header, with 'Range' when resuming */
 
 } otahttp_Struct_t, *otahttp_Struct_pt;
 
@@ -25,6 +30,18 @@ extern int httpclient_common(httpclient_t *client,
 extern const char *iotx_ca_get(void);
 
 
+static void ofc_build_header(otahttp_Struct_pt h_odc)
+{
+    if (0 == h_odc->offset) {
+        OTA_SNPRINTF(h_odc->header, sizeof(h_odc->header), "%s", OFC_HEADER_ACCEPT);
+    } else {
+        OTA_SNPRINTF(h_odc->header, sizeof(h_odc->header), "%sRange: bytes=%u-\r\n",
+                     OFC_HEADER_ACCEPT, (unsigned int)h_odc->offset);
+    }
+    h_odc->http.header = h_odc->header;
+}
+
+
 void *ofc_Init(char *url)
 {
     otahttp_Struct_pt h_odc;
@@ -37,7 +54,7 @@ void *ofc_Init(char *url)
     memset(h_odc, 0, sizeof(otahttp_Struct_t));
 
     /* set http request-header parameter */
-    h_odc->http.header = "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
+    ofc_build_header(h_odc);
 
 #if defined(SUPPORT_ITLS)
     char *s_ptr = strstr(url, "://");
@@ -52,6 +69,26 @@ void *ofc_Init(char *url)
 }
 
 
+int ofc_Seek(void *handle, uint32_t offset)
+{
+    otahttp_Struct_pt h_odc = (otahttp_Struct_pt)handle;
+
+    if (NULL == h_odc) {
+        return -1;
+    }
+
+    /* drop current connection, next ofc_Fetch() reconnects and asks for the remaining bytes only */
+    httpclient_close(&h_odc->http);
+    memset(&h_odc->http_data, 0, sizeof(httpclient_data_t));
+    h_odc->http.response_code = 0;
+    h_odc->offset = offset;
+    ofc_build_header(h_odc);
+
+    OTA_LOG_INFO("fetch channel seek to offset %u", (unsigned int)offset);
+    return 0;
+}
+
+
 int32_t ofc_Fetch(void *handle, char *buf, uint32_t buf_len, uint32_t timeout_s)
 {
     int diff;
@@ -63,7 +100,16 @@ int32_t ofc_Fetch(void *handle, char *buf, uint32_t buf_len, uint32_t timeout_s)
     if (0 != httpclient_common(&h_odc->http, h_odc->url, 443, iotx_ca_get(), HTTPCLIENT_GET, timeout_s * 1000,
                                &h_odc->http_data)) {
         OTA_LOG_ERROR("fetch firmware failed");
-        return -1;
+        return OFC_FETCH_ERR_CONN;
+    }
+
+    /* a server ignoring 'Range' answers '200' with the whole file, a '206' may start elsewhere than asked */
+    if (0 != h_odc->offset
+        && (206 != h_odc->http.response_code || h_odc->http.range_start != (int)h_odc->offset)) {
+        OTA_LOG_ERROR("range request from %u not honored, response code %d, range from %d",
+                      (unsigned int)h_odc->offset, h_odc->http.response_code, h_odc->http.range_start);
+        ofc_Seek(h_odc, 0);
+        return OFC_FETCH_ERR_RANGE;
     }
 
     return h_odc->http_data.response_content_len - h_odc->http_data.retrieve_len - diff;
@@ -72,8 +118,11 @@ int32_t ofc_Fetch(void *handle, char *buf, uint32_t buf_len, uint32_t timeout_s)
 
 int ofc_Deinit(void *handle)
 {
-    if (NULL != handle) {
-        OTA_FREE(handle);
+    otahttp_Struct_pt h_odc = (otahttp_Struct_pt)handle;
+
+    if (NULL != h_odc) {
+        httpclient_close(&h_odc->http);
+        OTA_FREE(h_odc);
     }
 
     return 0;
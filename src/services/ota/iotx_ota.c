@@ -15,6 +15,13 @@
 #define OTA_API_MALLOC(size) LITE_malloc(size, MEM_MAGIC, "ota.api")
 #define OTA_API_FREE(ptr)    LITE_free(ptr)
 
+/* the only digest to be verified when fetch finished */
+typedef enum {
+    OTA_DIGEST_NONE,
+    OTA_DIGEST_MD5,
+    OTA_DIGEST_SHA256
+} ota_digest_method_t;
+
 typedef struct  {
     const char *product_key;    /* point to product key */
     const char *device_name;    /* point to device name */
@@ -25,12 +32,18 @@ typedef struct  {
     uint32_t size_last_fetched; /* size of last downloaded */
     uint32_t size_fetched;      /* size of already downloaded */
     uint32_t size_file;         /* size of file */
+    uint32_t retry_cnt;         /* count of consecutive resumptions without progress */
+#if defined(OTA_FETCH_CHECKPOINT)
+    uint32_t size_checkpoint;   /* size of already downloaded when last checkpoint saved */
+#endif
     char *purl;                 /* point to URL */
     char *version;              /* point to string */
     char md5sum[33];            /* MD5 string */
 
     void *md5;                  /* MD5 handle */
     void *sha256;               /* Sha256 handle */
+    ota_digest_method_t digest_method;  /* which of MD5 and Sha256 is computed on fetched data */
+    int persist_on_fetch;       /* 1, IOT_OTA_FetchYield() saves fetched data itself */
     void *ch_signal;            /* channel handle of signal exchanged with OTA server */
     void *ch_fetch;             /* channel handle of download */
 
@@ -90,6 +103,129 @@ int iotx_ota_set_cota_fetch_callback(void *pt, cota_fetch_cb_fpt fetch_cb, void
 }
 
 
+#if defined(OTA_FETCH_CHECKPOINT)
+
+#define OTA_CHECKPOINT_MAGIC    (0x4F434B31)    /* "OCK1" */
+
+/* download progress of FOTA, as well as the digest state of bytes before 'size_fetched' */
+typedef struct {
+    uint32_t magic;
+    uint32_t length;            /* sizeof(ota_checkpoint_t), reject checkpoint written by other build */
+    uint32_t size_file;
+    uint32_t size_fetched;
+    char md5sum[33];
+    iot_md5_context md5;
+    iot_sha256_context sha256;
+} ota_checkpoint_t;
+
+static void ota_checkpoint_save(OTA_Struct_pt h_ota)
+{
+    ota_checkpoint_t ckpt;
+
+    memset(&ckpt, 0, sizeof(ota_checkpoint_t));
+    ckpt.magic = OTA_CHECKPOINT_MAGIC;
+    ckpt.length = sizeof(ota_checkpoint_t);
+    ckpt.size_file = h_ota->size_file;
+    ckpt.size_fetched = h_ota->size_fetched;
+    memcpy(ckpt.md5sum, h_ota->md5sum, sizeof(ckpt.md5sum));
+    memcpy(&ckpt.md5, h_ota->md5, sizeof(iot_md5_context));
+    memcpy(&ckpt.sha256, h_ota->sha256, sizeof(iot_sha256_context));
+
+    /* checkpoint must not claim bytes that a power loss can still take away */
+    if (0 != HAL_Firmware_Persistence_Sync()) {
+        OTA_LOG_WRN("sync firmware data failed, skip checkpoint");
+        return;
+    }
+    if (0 != HAL_Kv_Set(OTA_CHECKPOINT_KV_KEY, &ckpt, sizeof(ota_checkpoint_t), 1)) {
+        OTA_LOG_WRN("save checkpoint failed");
+        return;
+    }
+    h_ota->size_checkpoint = h_ota->size_fetched;
+}
+
+/* restore progress of the same firmware, identified by its md5 and size */
+static int ota_checkpoint_load(OTA_Struct_pt h_ota)
+{
+    ota_checkpoint_t ckpt;
+    int len = sizeof(ota_checkpoint_t);
+
+    memset(&ckpt, 0, sizeof(ota_checkpoint_t));
+    if (0 != HAL_Kv_Get(OTA_CHECKPOINT_KV_KEY, &ckpt, &len)) {
+        return -1;
+    }
+
+    if (len != sizeof(ota_checkpoint_t)
+        || ckpt.magic != OTA_CHECKPOINT_MAGIC
+        || ckpt.length != sizeof(ota_checkpoint_t)
+        || ckpt.size_file != h_ota->size_file
+        || ckpt.size_fetched >= ckpt.size_file
+        || 0 != strncmp(ckpt.md5sum, h_ota->md5sum, sizeof(ckpt.md5sum))) {
+        OTA_LOG_INFO("checkpoint does not match current firmware, drop it");
+        HAL_Kv_Del(OTA_CHECKPOINT_KV_KEY);
+        return -1;
+    }
+
+    memcpy(h_ota->md5, &ckpt.md5, sizeof(iot_md5_context));
+    memcpy(h_ota->sha256, &ckpt.sha256, sizeof(iot_sha256_context));
+    h_ota->size_fetched = ckpt.size_fetched;
+    h_ota->size_checkpoint = ckpt.size_fetched;
+
+    OTA_LOG_INFO("resume firmware download from checkpoint %u/%u",
+                 (unsigned int)h_ota->size_fetched, (unsigned int)h_ota->size_file);
+    return 0;
+}
+
+static void ota_checkpoint_clear(OTA_Struct_pt h_ota)
+{
+    h_ota->size_checkpoint = 0;
+    HAL_Kv_Del(OTA_CHECKPOINT_KV_KEY);
+}
+
+#endif  /* #if defined(OTA_FETCH_CHECKPOINT) */
+
+
+static ota_digest_method_t ota_digest_method_of(const char *sign_method)
+{
+    if (NULL == sign_method) {
+        return OTA_DIGEST_NONE;
+    } else if (0 == strcmp(sign_method, "Md5")) {
+        return OTA_DIGEST_MD5;
+    } else if (0 == strcmp(sign_method, "Sha256")) {
+        return OTA_DIGEST_SHA256;
+    }
+
+    OTA_LOG_ERROR("unsupported sign method: %s", sign_method);
+    return OTA_DIGEST_NONE;
+}
+
+
+/* update the digest to be verified, and save data when persist_on_fetch, in one pass over 'buf' */
+static int ota_digest_and_persist(OTA_Struct_pt h_ota, char *buf, uint32_t buf_len)
+{
+    uint32_t offset, slice_len;
+
+    for (offset = 0; offset < buf_len; offset += slice_len) {
+        slice_len = buf_len - offset;
+        if (h_ota->persist_on_fetch && slice_len > OTA_PERSIST_SLICE_LEN) {
+            slice_len = OTA_PERSIST_SLICE_LEN;
+        }
+
+        if (OTA_DIGEST_MD5 == h_ota->digest_method) {
+            otalib_MD5Update(h_ota->md5, buf + offset, slice_len);
+        } else if (OTA_DIGEST_SHA256 == h_ota->digest_method) {
+            otalib_Sha256Update(h_ota->sha256, buf + offset, slice_len);
+        }
+
+        if (h_ota->persist_on_fetch && 0 != HAL_Firmware_Persistence_Write(buf + offset, slice_len)) {
+            OTA_LOG_ERROR("persist fetched data failed");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 static int ota_callback(void *pcontext, const char *msg, uint32_t msg_len, iotx_ota_topic_types_t type)
 {
     const char *pvalue;
@@ -133,6 +269,15 @@ static int ota_callback(void *pcontext, const char *msg, uint32_t msg_len, iotx_
                 OTA_LOG_ERROR("Initialize fetch module failed");
                 return -1;
             }
+            h_ota->retry_cnt = 0;
+            h_ota->digest_method = OTA_DIGEST_MD5;
+            h_ota->persist_on_fetch = 0;
+
+#if defined(OTA_FETCH_CHECKPOINT)
+            if (NULL != h_ota->md5 && NULL != h_ota->sha256 && 0 == ota_checkpoint_load(h_ota)) {
+                ofc_Seek(h_ota->ch_fetch, h_ota->size_fetched);
+            }
+#endif
 
             h_ota->type = IOT_OTAT_FOTA;
             h_ota->state = IOT_OTAS_FETCHING;
@@ -185,6 +330,9 @@ static int ota_callback(void *pcontext, const char *msg, uint32_t msg_len, iotx_
                 OTA_LOG_ERROR("Initialize fetch module failed");
                 return -1;
             }
+            h_ota->retry_cnt = 0;
+            h_ota->digest_method = ota_digest_method_of(h_ota->signMethod);
+            h_ota->persist_on_fetch = 0;
 
             h_ota->type = IOT_OTAT_COTA;
             h_ota->state = IOT_OTAS_FETCHING;
@@ -226,6 +374,9 @@ static int ota_callback(void *pcontext, const char *msg, uint32_t msg_len, iotx_
                 OTA_LOG_ERROR("Initialize fetch module failed");
                 return -1;
             }
+            h_ota->retry_cnt = 0;
+            h_ota->digest_method = ota_digest_method_of(h_ota->signMethod);
+            h_ota->persist_on_fetch = 0;
 
             h_ota->type = IOT_OTAT_COTA;
             h_ota->state = IOT_OTAS_FETCHING;
@@ -680,6 +831,27 @@ int IOT_OTA_IsFetchFinish(void *handle)
 }
 
 
+/* leave fetching state on error, and notify the stop of fetching */
+static void ota_fetch_abort(OTA_Struct_pt h_ota, int err)
+{
+    h_ota->state = IOT_OTAS_FETCHED;
+    h_ota->type = IOT_OTAT_NONE;
+    h_ota->err = err;
+
+    if (h_ota->fetch_cb && h_ota->purl) {
+        h_ota->fetch_cb(h_ota->user_data, 1, h_ota->size_file, h_ota->purl, h_ota->version);
+        /* remove */
+        h_ota->purl = NULL;
+    } else if (h_ota->fetch_cota_cb && h_ota->cota_url) {
+        h_ota->fetch_cota_cb(h_ota->user_data, 1, h_ota->configId, h_ota->configSize, h_ota->sign, h_ota->signMethod,
+                             h_ota->cota_url, h_ota->getType);
+        /* remove */
+        h_ota->cota_url = NULL;
+    }
+    h_ota->size_fetched = 0;
+}
+
+
 int IOT_OTA_FetchYield(void *handle, char *buf, uint32_t buf_len, uint32_t timeout_s)
 {
     int ret;
@@ -695,24 +867,46 @@ int IOT_OTA_FetchYield(void *handle, char *buf, uint32_t buf_len, uint32_t timeo
         return IOT_OTAE_INVALID_STATE;
     }
 
+#if defined(OTA_FETCH_CHECKPOINT)
+    /* bytes returned by previous call have been persisted by caller when it asks for more */
+    if (IOT_OTAT_FOTA == h_ota->type
+        && h_ota->size_fetched - h_ota->size_checkpoint >= OTA_CHECKPOINT_INTERVAL) {
+        ota_checkpoint_save(h_ota);
+    }
+#endif
+
     ret = ofc_Fetch(h_ota->ch_fetch, buf, buf_len, timeout_s);
+    if (OFC_FETCH_ERR_CONN == ret && h_ota->retry_cnt < OTA_FETCH_RETRY_MAX) {
+        /* keep what has been fetched, reconnect and request the rest by 'Range' */
+        h_ota->retry_cnt++;
+        OTA_LOG_WRN("fetch interrupted at %u/%u, resume it (%u/%d)", (unsigned int)h_ota->size_fetched,
+                    (unsigned int)h_ota->size_file, (unsigned int)h_ota->retry_cnt, OTA_FETCH_RETRY_MAX);
+        HAL_SleepMs(OTA_FETCH_RETRY_INTERVAL_MS * h_ota->retry_cnt);
+        ofc_Seek(h_ota->ch_fetch, h_ota->size_fetched);
+        h_ota->size_last_fetched = 0;
+        return 0;
+    }
+
+    if (OFC_FETCH_ERR_RANGE == ret && h_ota->persist_on_fetch) {
+        /* data is written by this module, so it can start the image over from the beginning */
+        OTA_LOG_WRN("server can not resume at %u, fetch again from 0", (unsigned int)h_ota->size_fetched);
+#if defined(OTA_FETCH_CHECKPOINT)
+        ota_checkpoint_clear(h_ota);
+#endif
+        HAL_Firmware_Persistence_Start();
+        h_ota->size_fetched = 0;
+        h_ota->size_last_fetched = 0;
+        return 0;
+    }
+
     if (ret < 0) {
         OTA_LOG_ERROR("Fetch firmware failed");
-        h_ota->state = IOT_OTAS_FETCHED;
-        h_ota->type = IOT_OTAT_NONE;
-        h_ota->err = IOT_OTAE_FETCH_FAILED;
-
-        if (h_ota->fetch_cb && h_ota->purl) {
-            h_ota->fetch_cb(h_ota->user_data, 1, h_ota->size_file, h_ota->purl, h_ota->version);
-            /* remove */
-            h_ota->purl = NULL;
-        } else if (h_ota->fetch_cota_cb && h_ota->cota_url) {
-            h_ota->fetch_cota_cb(h_ota->user_data, 1, h_ota->configId, h_ota->configSize, h_ota->sign, h_ota->signMethod,
-                                 h_ota->cota_url, h_ota->getType);
-            /* remove */
-            h_ota->cota_url = NULL;
+#if defined(OTA_FETCH_CHECKPOINT)
+        if (OFC_FETCH_ERR_RANGE == ret) {
+            ota_checkpoint_clear(h_ota);
         }
-        h_ota->size_fetched = 0;
+#endif
+        ota_fetch_abort(h_ota, IOT_OTAE_FETCH_FAILED);
         return -1;
     } else if (0 == h_ota->size_fetched) {
         /* force report status in the first */
@@ -733,12 +927,23 @@ int IOT_OTA_FetchYield(void *handle, char *buf, uint32_t buf_len, uint32_t timeo
         IOT_OTA_ReportProgress(h_ota, IOT_OTAP_FETCH_PERCENTAGE_MIN, "Enter in downloading state");
     }
 
-    otalib_MD5Update(h_ota->md5, buf, ret);
-    otalib_Sha256Update(h_ota->sha256, buf, ret);
+    if (ret > 0) {
+        h_ota->retry_cnt = 0;
+    }
+
+    if (0 != ota_digest_and_persist(h_ota, buf, ret)) {
+        ota_fetch_abort(h_ota, IOT_OTAE_BURN_FAILED);
+        return IOT_OTAE_BURN_FAILED;
+    }
     h_ota->size_last_fetched = ret;
     h_ota->size_fetched += ret;
 
     if (h_ota->size_fetched >= h_ota->size_file) {
+#if defined(OTA_FETCH_CHECKPOINT)
+        if (IOT_OTAT_FOTA == h_ota->type) {
+            ota_checkpoint_clear(h_ota);
+        }
+#endif
         h_ota->type = IOT_OTAT_NONE;
         h_ota->state = IOT_OTAS_FETCHED;
         if (h_ota->fetch_cb && h_ota->purl) {
@@ -924,6 +1129,10 @@ int IOT_OTA_Ioctl(void *handle, IOT_OTA_CmdType_t type, void *buf, size_t buf_le
                 h_ota->err = IOT_OTAE_INVALID_STATE;
                 OTA_LOG_ERROR("Firmware can be checked in IOT_OTAS_FETCHED state only");
                 return -1;
+            } else if (OTA_DIGEST_MD5 != h_ota->digest_method) {
+                OTA_LOG_ERROR("md5 of firmware is not computed");
+                *((uint32_t *)buf) = 0;
+                return 0;
             } else {
                 char md5_str[33];
                 otalib_MD5Finalize(h_ota->md5, md5_str);
@@ -945,7 +1154,8 @@ int IOT_OTA_Ioctl(void *handle, IOT_OTA_CmdType_t type, void *buf, size_t buf_le
                 OTA_LOG_ERROR("Config can be checked in IOT_OTAS_FETCHED state only");
                 return -1;
             } else {
-                if (0 == strncmp(h_ota->signMethod, "Md5", strlen(h_ota->signMethod))) {
+                *((uint32_t *)buf) = 0;
+                if (OTA_DIGEST_MD5 == h_ota->digest_method) {
                     char md5_str[33];
                     otalib_MD5Finalize(h_ota->md5, md5_str);
                     OTA_LOG_DEBUG("origin=%s, now=%s", h_ota->sign, md5_str);
@@ -955,7 +1165,7 @@ int IOT_OTA_Ioctl(void *handle, IOT_OTA_CmdType_t type, void *buf, size_t buf_le
                         *((uint32_t *)buf) = 0;
                     }
                 }
-                if (0 == strncmp(h_ota->signMethod, "Sha256", strlen(h_ota->signMethod))) {
+                if (OTA_DIGEST_SHA256 == h_ota->digest_method) {
                     char sha256_str[65];
                     otalib_Sha256Finalize(h_ota->sha256, sha256_str);
                     OTA_LOG_DEBUG("origin=%s, now=%s", h_ota->sign, sha256_str);
@@ -968,9 +1178,24 @@ int IOT_OTA_Ioctl(void *handle, IOT_OTA_CmdType_t type, void *buf, size_t buf_le
                 return 0;
             }
         case IOT_OTAG_RESET_FETCHED_SIZE: {
+            if (0 != h_ota->size_fetched && NULL != h_ota->ch_fetch) {
+                ofc_Seek(h_ota->ch_fetch, 0);
+            }
             h_ota->size_fetched = 0;
+#if defined(OTA_FETCH_CHECKPOINT)
+            h_ota->size_checkpoint = 0;
+#endif
             return 0;
         }
+        case IOT_OTAG_PERSIST_ON_FETCH:
+            if ((4 != buf_len) || (0 != ((unsigned long)buf & 0x3))) {
+                OTA_LOG_ERROR("Invalid parameter");
+                h_ota->err = IOT_OTAE_INVALID_PARAM;
+                return -1;
+            } else {
+                h_ota->persist_on_fetch = (0 != *((uint32_t *)buf));
+                return 0;
+            }
         default:
             OTA_LOG_ERROR("invalid cmd type");
             h_ota->err = IOT_OTAE_INVALID_PARAM;
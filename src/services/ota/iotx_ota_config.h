@@ -9,4 +9,27 @@
     #define OTA_SIGNAL_CHANNEL      (1)
 #endif
 
+/* times of reconnecting and resuming by HTTP 'Range' before a download is reported as failed */
+#ifndef OTA_FETCH_RETRY_MAX
+    #define OTA_FETCH_RETRY_MAX     (5)
+#endif
+
+/* base interval between two reconnections, multiplied by the retry count */
+#ifndef OTA_FETCH_RETRY_INTERVAL_MS
+    #define OTA_FETCH_RETRY_INTERVAL_MS     (1000)
+#endif
+
+/* fetched data is hashed and saved slice by slice, so each slice is still in cache when written */
+#ifndef OTA_PERSIST_SLICE_LEN
+    #define OTA_PERSIST_SLICE_LEN   (4 * 1024)
+#endif
+
+/* define OTA_FETCH_CHECKPOINT to persist download progress via HAL_Kv_Set() and resume it after reboot */
+#if defined(OTA_FETCH_CHECKPOINT)
+    #ifndef OTA_CHECKPOINT_INTERVAL
+        #define OTA_CHECKPOINT_INTERVAL     (64 * 1024)
+    #endif
+    #define OTA_CHECKPOINT_KV_KEY           "ota_ckpt"
+#endif
+
 #endif  /* __IOTX_OTA_CONFIG_H__ */
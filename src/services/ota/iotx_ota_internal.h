@@ -70,7 +70,12 @@ int otalib_GetConfigParams(const char *json_doc, uint32_t json_len, char **confi
 int otalib_GenInfoMsg(char *buf, size_t buf_len, uint32_t id, const char *version);
 int otalib_GenReportMsg(char *buf, size_t buf_len, uint32_t id, int progress, const char *msg_detail);
 
+/* error codes of ofc_Fetch() */
+#define OFC_FETCH_ERR_CONN      (-1)    /* connection broken, retry from current offset is possible */
+#define OFC_FETCH_ERR_RANGE     (-2)    /* server did not resume at the offset asked, channel is back at offset 0 */
+
 void *ofc_Init(char *url);
+int ofc_Seek(void *handle, uint32_t offset);
 int32_t ofc_Fetch(void *handle, char *buf, uint32_t buf_len, uint32_t timeout_s);
 int ofc_Deinit(void *handle);
 
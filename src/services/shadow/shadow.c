@@ -420,6 +420,8 @@ iotx_err_t IOT_Shadow_Destroy(void *handle)
         list_destroy(pshadow->inner_data.attr_list);
     }
 
+    iotx_ds_common_release_attr_hash(pshadow);
+
     if (NULL != pshadow->mutex) {
         HAL_MutexDestroy(pshadow->mutex);
     }
@@ -212,11 +212,12 @@ iotx_err_t iotx_ds_common_convert_string2data(
     }
 
     if (type == IOTX_SHADOW_INT32) {
-        if (0 == strcmp(pdata, "true")) {
+        /* buf may point into a JSON document, not NULL-terminated */
+        if (buf_len == strlen("true") && 0 == strncmp(buf, "true", buf_len)) {
             *((int32_t *)pdata) = 1;
-        } else if (0 == strcmp(pdata, "false")) {
+        } else if (buf_len == strlen("false") && 0 == strncmp(buf, "false", buf_len)) {
             *((int32_t *)pdata) = 0;
-        } else if (0 == strcmp(pdata, "null")) {
+        } else if (buf_len == strlen("null") && 0 == strncmp(buf, "null", buf_len)) {
             *((int32_t *)pdata) = 0;
         } else {
             *((int32_t *)pdata) = atoi(buf);
@@ -257,24 +258,90 @@ int iotx_ds_common_check_attr_existence(
 }
 
 
+static uint32_t iotx_ds_common_attr_hash(const char *name, size_t name_len)
+{
+    uint32_t hash = 5381;
+
+    while (name_len--) {
+        hash = ((hash << 5) + hash) + (uint8_t)(*name++);
+    }
+
+    return hash % IOTX_DS_ATTR_HASH_SIZE;
+}
+
+
 /* register attribute to list */
 iotx_err_t iotx_ds_common_register_attr(
             iotx_shadow_pt pshadow,
             iotx_shadow_attr_pt pattr)
 {
-    list_node_t *node = list_node_new(pattr);
+    list_t **pbucket;
+    list_node_t *node, *hash_node;
+
+    node = list_node_new(pattr);
     if (NULL == node) {
         return ERROR_NO_MEM;
     }
 
+    hash_node = list_node_new(pattr);
+    if (NULL == hash_node) {
+        LITE_free(node);
+        return ERROR_NO_MEM;
+    }
+
     HAL_MutexLock(pshadow->mutex);
+    pbucket = &pshadow->inner_data.attr_hash[iotx_ds_common_attr_hash(pattr->pattr_name, strlen(pattr->pattr_name))];
+    if (NULL == *pbucket) {
+        *pbucket = list_new();
+        if (NULL == *pbucket) {
+            HAL_MutexUnlock(pshadow->mutex);
+            LITE_free(node);
+            LITE_free(hash_node);
+            return ERROR_NO_MEM;
+        }
+    }
     list_lpush(pshadow->inner_data.attr_list, node);
+    list_rpush(*pbucket, hash_node);
     HAL_MutexUnlock(pshadow->mutex);
 
     return SUCCESS_RETURN;
 }
 
 
+iotx_shadow_attr_pt iotx_ds_common_find_attr(iotx_shadow_pt pshadow, const char *name, size_t name_len)
+{
+    list_t *bucket = pshadow->inner_data.attr_hash[iotx_ds_common_attr_hash(name, name_len)];
+    list_node_t *node;
+    iotx_shadow_attr_pt pattr;
+
+    if (NULL == bucket) {
+        return NULL;
+    }
+
+    for (node = bucket->head; NULL != node; node = node->next) {
+        pattr = (iotx_shadow_attr_pt)node->val;
+        if (0 == strncmp(pattr->pattr_name, name, name_len) && '\0' == pattr->pattr_name[name_len]) {
+            return pattr;
+        }
+    }
+
+    return NULL;
+}
+
+
+void iotx_ds_common_release_attr_hash(iotx_shadow_pt pshadow)
+{
+    int i;
+
+    for (i = 0; i < IOTX_DS_ATTR_HASH_SIZE; ++i) {
+        if (NULL != pshadow->inner_data.attr_hash[i]) {
+            list_destroy(pshadow->inner_data.attr_hash[i]);
+            pshadow->inner_data.attr_hash[i] = NULL;
+        }
+    }
+}
+
+
 /* remove attribute to list */
 iotx_err_t iotx_ds_common_remove_attr(
             iotx_shadow_pt pshadow,
@@ -289,7 +356,14 @@ iotx_err_t iotx_ds_common_remove_attr(
         rc = ERROR_SHADOW_NO_ATTRIBUTE;
         shadow_err("Try to remove a non-existent attribute.");
     } else {
+        list_t *bucket = pshadow->inner_data.attr_hash[iotx_ds_common_attr_hash(pattr->pattr_name,
+                         strlen(pattr->pattr_name))];
+
         list_remove(pshadow->inner_data.attr_list, node);
+        node = (NULL == bucket) ? NULL : list_find(bucket, pattr);
+        if (NULL != node) {
+            list_remove(bucket, node);
+        }
     }
     HAL_MutexUnlock(pshadow->mutex);
 
@@ -31,6 +31,7 @@ typedef struct iotx_inner_data_st {
     iotx_shadow_time_t time;
     iotx_update_ack_wait_list_t update_ack_wait_list[IOTX_DS_UPDATE_WAIT_ACK_LIST_NUM];
     list_t *attr_list;
+    list_t *attr_hash[IOTX_DS_ATTR_HASH_SIZE]; /* same attributes as attr_list, bucketed by name */
     char *ptopic_update;
     char *ptopic_get;
     int32_t sync_status;
@@ -82,6 +83,11 @@ iotx_err_t iotx_ds_common_remove_attr(
             iotx_shadow_pt pshadow,
             iotx_shadow_attr_pt pattr);
 
+/* find registered attribute by name, name need not be NULL-terminated. Call with pshadow->mutex held. */
+iotx_shadow_attr_pt iotx_ds_common_find_attr(iotx_shadow_pt pshadow, const char *name, size_t name_len);
+
+void iotx_ds_common_release_attr_hash(iotx_shadow_pt pshadow);
+
 char *iotx_ds_common_generate_topic_name(iotx_shadow_pt pshadow, const char *topic);
 
 int iotx_ds_common_publish2update(iotx_shadow_pt pshadow, char *data, uint32_t data_len);
@@ -14,4 +14,8 @@
 
 #define IOTX_DS_UPDATE_WAIT_ACK_LIST_NUM        (5)   /**< indicate the maximum element of UPDATE ACK list. */
 
+#ifndef IOTX_DS_ATTR_HASH_SIZE
+    #define IOTX_DS_ATTR_HASH_SIZE              (16)  /**< indicate the number of buckets to look up attribute by name. */
+#endif
+
 #endif /* _IOTX_SHADOW_CONFIG_H_ */
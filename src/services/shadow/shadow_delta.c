@@ -11,6 +11,7 @@
 #include "shadow_debug.h"
 #include "iotx_utils.h"
 #include "utils_list.h"
+#include "json_parser.h"
 #include "shadow_delta.h"
 
 static int iotx_shadow_delta_response(iotx_shadow_pt pshadow)
@@ -39,21 +40,14 @@ static int iotx_shadow_delta_response(iotx_shadow_pt pshadow)
 
 
 
-static uint32_t iotx_shadow_get_timestamp(const char *pmetadata_desired,
-        size_t len_metadata_desired,
-        const char *pname)
+static uint32_t iotx_shadow_get_timestamp(const char *pmetadata_attr, int len_metadata_attr)
 {
+    int len;
     const char *pdata;
 
-    /* attribute be matched, and then get timestamp */
-
-    pdata = LITE_json_value_of((char *)pname, (char *)pmetadata_desired);
-
+    pdata = json_get_value_by_name((char *)pmetadata_attr, len_metadata_attr, "timestamp", &len, NULL);
     if (NULL != pdata) {
-        pdata = LITE_json_value_of((char *)"timestamp", (char *)pdata);
-        if (NULL != pdata) {
-            return atoi(pdata);
-        }
+        return atoi(pdata);
     }
 
     shadow_err("NOT timestamp in JSON doc");
@@ -76,50 +70,63 @@ static void iotx_shadow_delta_update_attr(iotx_shadow_pt pshadow,
         const char *json_doc_metadata,
         uint32_t json_doc_metadata_len)
 {
-    const char *pvalue;
+    char *pos, *key, *val;
+    int klen, vlen, vtype;
+    int i, matched_num = 0, matched_max;
     iotx_shadow_attr_pt pattr;
-    list_iterator_t *iter;
-    list_node_t *node;
+    iotx_shadow_attr_pt *pmatched;
 
-    /* Iterate the list and check JSON document according to list_node.val.pattr_name */
-    /* If the attribute be found, call the function registered by calling iotx_shadow_delta_register_attr() */
+    /* Walk the JSON document once and look each key up among registered attributes, */
+    /* then call the functions registered by calling iotx_shadow_delta_register_attr() in a batch. */
 
     HAL_MutexLock(pshadow->mutex);
-    iter = list_iterator_new(pshadow->inner_data.attr_list, LIST_TAIL);
-    if (NULL == iter) {
+    matched_max = pshadow->inner_data.attr_list->len;
+    if (0 == matched_max) {
+        HAL_MutexUnlock(pshadow->mutex);
+        return;
+    }
+
+    pmatched = LITE_malloc(matched_max * sizeof(iotx_shadow_attr_pt));
+    if (NULL == pmatched) {
         HAL_MutexUnlock(pshadow->mutex);
         shadow_warning("Allocate memory failed");
         return ;
     }
 
-    while (node = list_iterator_next(iter), NULL != node) {
-        pattr = (iotx_shadow_attr_pt)node->val;
-        pvalue = LITE_json_value_of((char *)pattr->pattr_name, (char *)json_doc_attr);
-
-        /* check if match attribute or not be matched */
-        if (NULL != pvalue) { /* attribute be matched */
-            /* get timestamp */
-            pattr->timestamp = iotx_shadow_get_timestamp(
-                                           json_doc_metadata,
-                                           json_doc_metadata_len,
-                                           pattr->pattr_name);
-
-            /* convert string of JSON value according to destination data type. */
-            if (SUCCESS_RETURN != iotx_shadow_delta_update_attr_value(pattr, pvalue, strlen(pvalue))) {
-                shadow_warning("Update attribute value failed.");
-            }
-
-            if (NULL != pattr->callback) {
-                HAL_MutexUnlock(pshadow->mutex);
-                /* call related callback function */
-                pattr->callback(pattr);
-                HAL_MutexLock(pshadow->mutex);
-            }
+    json_object_for_each_kv((char *)json_doc_attr, json_doc_attr_len, pos, key, klen, val, vlen, vtype) {
+        pattr = iotx_ds_common_find_attr(pshadow, key, klen);
+        if (NULL == pattr) {
+            continue;
+        }
+
+        /* convert string of JSON value according to destination data type. */
+        if (SUCCESS_RETURN != iotx_shadow_delta_update_attr_value(pattr, val, vlen)) {
+            shadow_warning("Update attribute value failed.");
+        }
+        pattr->timestamp = 0;
+        pmatched[matched_num++] = pattr;
+        if (matched_num == matched_max) {
+            break;
         }
     }
 
-    list_iterator_destroy(iter);
+    /* get timestamp, metadata carries the same attributes as state */
+    json_object_for_each_kv((char *)json_doc_metadata, json_doc_metadata_len, pos, key, klen, val, vlen, vtype) {
+        pattr = iotx_ds_common_find_attr(pshadow, key, klen);
+        if (NULL != pattr && JOBJECT == vtype) {
+            pattr->timestamp = iotx_shadow_get_timestamp(val, vlen);
+        }
+    }
     HAL_MutexUnlock(pshadow->mutex);
+
+    /* call related callback functions */
+    for (i = 0; i < matched_num; ++i) {
+        if (NULL != pmatched[i]->callback) {
+            pmatched[i]->callback(pmatched[i]);
+        }
+    }
+
+    LITE_free(pmatched);
 }
 
 /* handle response ACK of UPDATE */